@@ -0,0 +1,270 @@
+/********************************************************************************/
+/*										*/
+/*		     Checked and Presized Marshal Benchmark			*/
+/*										*/
+/********************************************************************************/
+
+/* pemtpmmarshalbench times the checked TSS_*_Marshal() functions against the presized
+   PEMTPM_Marshal_*() functions on the structures that pemtpm marshals for every key:
+
+   tpm2b_public		an RSA-2048 and an ECC P-256 TPM2B_PUBLIC
+   tpmt_sensitive	an RSA-2048 and an ECC P-256 TPMT_SENSITIVE
+   tpm2b_private	an RSA-2048 TPM2B_PRIVATE holding a marshaled TPM2B_SENSITIVE
+
+   Each structure is first marshaled both ways and the bytes compared.  The structures are filled
+   with pseudo random bytes, since marshaling does not depend on the key values.  The results are
+   written to stdout as one JSON object.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <tss2/tss.h>
+#include <tss2/tssutils.h>
+#include <tss2/tssmarshal.h>
+#include <tss2/pemtpm.h>
+
+#include "../src/pemtpmmarshal.h"
+
+/* large enough for any of the structures */
+#define BENCH_BUFFER_MAX	(PEMTPM_PUBLIC_BUFFER_MAX + PEMTPM_PRIVATE_BUFFER_MAX)
+
+/* one structure, with its checked and presized marshal functions */
+
+typedef struct {
+    const char		*name;
+    const void		*structure;
+    MarshalFunction_t	checkedFunction;
+    MarshalFunction_t	fastFunction;
+} BENCH_CASE;
+
+static void printUsage(void);
+
+/* getNanoseconds() returns a monotonic time stamp */
+
+static uint64_t getNanoseconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* fillBytes() fills 'buffer' from a fixed seed linear congruential generator */
+
+static void fillBytes(uint8_t *buffer, size_t length)
+{
+    static uint32_t state = 0x2545f491;
+    size_t i;
+
+    for (i = 0 ; i < length ; i++) {
+	state = state * 1103515245 + 12345;
+	buffer[i] = (uint8_t)(state >> 16);
+    }
+    return;
+}
+
+/* fillPublic() fills an RSA-2048 or ECC P-256 public area as pemtpm creates it */
+
+static void fillPublic(TPM2B_PUBLIC *objectPublic, TPMI_ALG_PUBLIC type)
+{
+    TPMT_PUBLIC *publicArea = &objectPublic->publicArea;
+
+    memset(objectPublic, 0, sizeof(TPM2B_PUBLIC));
+    publicArea->type = type;
+    publicArea->nameAlg = TPM_ALG_SHA256;
+    publicArea->objectAttributes.val =
+	TPMA_OBJECT_NODA | TPMA_OBJECT_USERWITHAUTH | TPMA_OBJECT_SIGN;
+    if (type == TPM_ALG_RSA) {
+	publicArea->parameters.rsaDetail.symmetric.algorithm = TPM_ALG_NULL;
+	publicArea->parameters.rsaDetail.scheme.scheme = TPM_ALG_RSASSA;
+	publicArea->parameters.rsaDetail.scheme.details.rsassa.hashAlg = TPM_ALG_SHA256;
+	publicArea->parameters.rsaDetail.keyBits = 2048;
+	publicArea->unique.rsa.t.size = 256;
+	fillBytes(publicArea->unique.rsa.t.buffer, 256);
+    }
+    else {
+	publicArea->parameters.eccDetail.symmetric.algorithm = TPM_ALG_NULL;
+	publicArea->parameters.eccDetail.scheme.scheme = TPM_ALG_ECDSA;
+	publicArea->parameters.eccDetail.scheme.details.ecdsa.hashAlg = TPM_ALG_SHA256;
+	publicArea->parameters.eccDetail.curveID = TPM_ECC_NIST_P256;
+	publicArea->parameters.eccDetail.kdf.scheme = TPM_ALG_NULL;
+	publicArea->unique.ecc.x.t.size = 32;
+	fillBytes(publicArea->unique.ecc.x.t.buffer, 32);
+	publicArea->unique.ecc.y.t.size = 32;
+	fillBytes(publicArea->unique.ecc.y.t.buffer, 32);
+    }
+    return;
+}
+
+/* fillSensitive() fills an RSA-2048 or ECC P-256 sensitive area with a password */
+
+static void fillSensitive(TPMT_SENSITIVE *tSensitive, TPMI_ALG_PUBLIC type)
+{
+    memset(tSensitive, 0, sizeof(TPMT_SENSITIVE));
+    tSensitive->sensitiveType = type;
+    tSensitive->authValue.t.size = 4;
+    memcpy(tSensitive->authValue.t.buffer, "rrrr", 4);
+    if (type == TPM_ALG_RSA) {
+	tSensitive->sensitive.rsa.t.size = 128;
+	fillBytes(tSensitive->sensitive.rsa.t.buffer, 128);
+    }
+    else {
+	tSensitive->sensitive.ecc.t.size = 32;
+	fillBytes(tSensitive->sensitive.ecc.t.buffer, 32);
+    }
+    return;
+}
+
+/* runCase() checks that both functions marshal the same bytes, then times 'iterations' calls of
+   each and prints the results */
+
+static TPM_RC runCase(const BENCH_CASE *benchCase, unsigned int iterations, int last)
+{
+    TPM_RC 		rc = 0;
+    uint8_t		checkedBuffer[BENCH_BUFFER_MAX];
+    uint16_t		checkedSize = 0;
+    uint8_t		fastBuffer[BENCH_BUFFER_MAX];
+    uint16_t		fastSize = 0;
+    uint64_t		checkedTime = 0;
+    uint64_t		fastTime = 0;
+    uint64_t		start;
+    unsigned int 	i;
+
+    if (rc == 0) {
+	rc = TSS_Structure_MarshalBuffer(checkedBuffer, &checkedSize, sizeof(checkedBuffer),
+					 (void *)benchCase->structure,
+					 benchCase->checkedFunction);
+    }
+    if (rc == 0) {
+	rc = TSS_Structure_MarshalBuffer(fastBuffer, &fastSize, sizeof(fastBuffer),
+					 (void *)benchCase->structure,
+					 benchCase->fastFunction);
+    }
+    if (rc == 0) {
+	if ((checkedSize != fastSize) || (memcmp(checkedBuffer, fastBuffer, fastSize) != 0)) {
+	    fprintf(stderr, "pemtpmmarshalbench: %s marshals differently\n", benchCase->name);
+	    rc = EXIT_FAILURE;
+	}
+    }
+    if (rc == 0) {
+	start = getNanoseconds();
+	for (i = 0 ; (rc == 0) && (i < iterations) ; i++) {
+	    rc = TSS_Structure_MarshalBuffer(checkedBuffer, &checkedSize, sizeof(checkedBuffer),
+					     (void *)benchCase->structure,
+					     benchCase->checkedFunction);
+	}
+	checkedTime = getNanoseconds() - start;
+    }
+    if (rc == 0) {
+	start = getNanoseconds();
+	for (i = 0 ; (rc == 0) && (i < iterations) ; i++) {
+	    rc = TSS_Structure_MarshalBuffer(fastBuffer, &fastSize, sizeof(fastBuffer),
+					     (void *)benchCase->structure,
+					     benchCase->fastFunction);
+	}
+	fastTime = getNanoseconds() - start;
+    }
+    if (rc == 0) {
+	printf("    {\"structure\": \"%s\", \"bytes\": %u, "
+	       "\"checked_ns\": %.1f, \"fast_ns\": %.1f, \"speedup\": %.2f}%s\n",
+	       benchCase->name, fastSize,
+	       (double)checkedTime / iterations,
+	       (double)fastTime / iterations,
+	       (fastTime != 0) ? (double)checkedTime / fastTime : 0.0,
+	       last ? "" : ",");
+    }
+    else {
+	fprintf(stderr, "pemtpmmarshalbench: %s failed, rc %08x\n", benchCase->name, rc);
+    }
+    return rc;
+}
+
+int main(int argc, char *argv[])
+{
+    TPM_RC			rc = 0;
+    int				i;    /* argc iterator */
+    unsigned int		iterations = 1000000;
+    TPM2B_PUBLIC		rsaPublic;
+    TPM2B_PUBLIC		eccPublic;
+    TPMT_SENSITIVE		rsaSensitive;
+    TPMT_SENSITIVE		eccSensitive;
+    TPM2B_PRIVATE		rsaPrivate;
+    size_t			c;
+
+    for (i=1 ; (i<argc) && (rc == 0) ; i++) {
+	if (strcmp(argv[i],"-n") == 0) {
+	    i++;
+	    if (i < argc) {
+		iterations = atoi(argv[i]);
+	    }
+	    if ((i == argc) || (iterations < 1)) {
+		printf("Bad parameter for -n\n");
+		printUsage();
+	    }
+	}
+	else {
+	    printf("\n%s is not a valid option\n", argv[i]);
+	    printUsage();
+	}
+    }
+    fillPublic(&rsaPublic, TPM_ALG_RSA);
+    fillPublic(&eccPublic, TPM_ALG_ECC);
+    fillSensitive(&rsaSensitive, TPM_ALG_RSA);
+    fillSensitive(&eccSensitive, TPM_ALG_ECC);
+    /* the TPM2B_PRIVATE of an unwrapped key is a TPM2B_SENSITIVE, as pemtpm marshals it */
+    {
+	uint8_t *buffer = rsaPrivate.t.buffer + sizeof(UINT16);
+	INT32 size = sizeof(rsaPrivate.t.buffer) - sizeof(UINT16);
+	uint16_t written = 0;
+	rc = TSS_TPMT_SENSITIVE_Marshal(&rsaSensitive, &written, &buffer, &size);
+	rsaPrivate.t.buffer[0] = (uint8_t)(written >> 8);
+	rsaPrivate.t.buffer[1] = (uint8_t)(written >> 0);
+	rsaPrivate.t.size = written + sizeof(UINT16);
+    }
+    {
+	const BENCH_CASE benchCases[] = {
+	    {"tpm2b_public_rsa2048", &rsaPublic,
+	     (MarshalFunction_t)TSS_TPM2B_PUBLIC_Marshal,
+	     (MarshalFunction_t)PEMTPM_Marshal_TPM2B_PUBLIC},
+	    {"tpm2b_public_ecc_p256", &eccPublic,
+	     (MarshalFunction_t)TSS_TPM2B_PUBLIC_Marshal,
+	     (MarshalFunction_t)PEMTPM_Marshal_TPM2B_PUBLIC},
+	    {"tpmt_sensitive_rsa2048", &rsaSensitive,
+	     (MarshalFunction_t)TSS_TPMT_SENSITIVE_Marshal,
+	     (MarshalFunction_t)PEMTPM_Marshal_TPMT_SENSITIVE},
+	    {"tpmt_sensitive_ecc_p256", &eccSensitive,
+	     (MarshalFunction_t)TSS_TPMT_SENSITIVE_Marshal,
+	     (MarshalFunction_t)PEMTPM_Marshal_TPMT_SENSITIVE},
+	    {"tpm2b_private_rsa2048", &rsaPrivate,
+	     (MarshalFunction_t)TSS_TPM2B_PRIVATE_Marshal,
+	     (MarshalFunction_t)PEMTPM_Marshal_TPM2B_PRIVATE},
+	};
+	size_t cases = sizeof(benchCases) / sizeof(benchCases[0]);
+
+	printf("{\n");
+	printf("  \"bench\": \"marshal\",\n");
+	printf("  \"iterations\": %u,\n", iterations);
+	printf("  \"structures\": [\n");
+	for (c = 0 ; (rc == 0) && (c < cases) ; c++) {
+	    rc = runCase(&benchCases[c], iterations, c == (cases - 1));
+	}
+	printf("  ]\n");
+	printf("}\n");
+    }
+    return (rc == 0) ? 0 : EXIT_FAILURE;
+}
+
+static void printUsage(void)
+{
+    printf("\n");
+    printf("pemtpmmarshalbench\n");
+    printf("\n");
+    printf("Times the checked TSS marshal functions against the presized pemtpm ones\n");
+    printf("and prints the time per call as JSON\n");
+    printf("\n");
+    printf("\t[-n\tcalls per structure (default 1000000)]\n");
+    exit(1);
+}
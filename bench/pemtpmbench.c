@@ -0,0 +1,527 @@
+/********************************************************************************/
+/*										*/
+/*		     Conversion and Marshal Stage Benchmark			*/
+/*										*/
+/********************************************************************************/
+
+/* pemtpmbench times each stage of a PEM to TPM2B_PUBLIC / TPM2B_PRIVATE conversion separately, so
+   that a slowdown can be attributed to OpenSSL or to pemtpm:
+
+   pem_read		PEM_read_bio_PrivateKey(), including decryption
+   get_key		EVP_PKEY_get1_RSA() or EVP_PKEY_get1_EC_KEY()
+   bn_extract		BN_bn2bin() of the public and private key parts
+   sensitive_marshal	PEMTPM_Marshal_TPMT_SENSITIVE(), as the library marshals it
+   public_marshal	PEMTPM_MarshalPublic(), from its template after the first key of a set
+   file_write		TSS_File_WriteBinaryFile() of both output files
+
+   It also times the whole library call, PEMTPM_ConvertPem(), on the same keys.
+
+   The key sets are synthetic, generated at startup and held in memory as PEM.  The results are
+   written to stdout as one JSON object.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <tss2/tss.h>
+#include <tss2/tssutils.h>
+#include <tss2/tssmarshal.h>
+#include <tss2/tssfile.h>
+#include <tss2/pemtpm.h>
+#include <openssl/opensslv.h>
+#include <openssl/pem.h>
+#include <openssl/evp.h>
+#include <openssl/rsa.h>
+#include <openssl/ec.h>
+
+#include "../src/pemtpmmarshal.h"
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000
+#error "pemtpmbench requires OpenSSL 1.1.0 or later"
+#endif
+
+#define BENCH_PASSWORD		"rrrr"
+
+enum {
+    STAGE_PEM_READ,
+    STAGE_GET_KEY,
+    STAGE_BN_EXTRACT,
+    STAGE_SENSITIVE_MARSHAL,
+    STAGE_PUBLIC_MARSHAL,
+    STAGE_FILE_WRITE,
+    STAGE_CONVERT,
+    STAGE_COUNT
+};
+
+static const char *stageNames[STAGE_COUNT] = {
+    "pem_read",
+    "get_key",
+    "bn_extract",
+    "sensitive_marshal",
+    "public_marshal",
+    "file_write",
+    "convert"
+};
+
+/* a synthetic key set */
+
+typedef struct {
+    const char		*name;
+    int			keyId;		/* EVP_PKEY_RSA or EVP_PKEY_EC */
+    int			bits;		/* RSA modulus bits or EC curve NID */
+    int			encrypted;
+} BENCH_SET;
+
+static const BENCH_SET benchSets[] = {
+    {"rsa1024",		EVP_PKEY_RSA,	1024,			0},
+    {"rsa1024-aes256",	EVP_PKEY_RSA,	1024,			1},
+    {"rsa2048",		EVP_PKEY_RSA,	2048,			0},
+    {"rsa2048-aes256",	EVP_PKEY_RSA,	2048,			1},
+    {"ecc-p256",	EVP_PKEY_EC,	NID_X9_62_prime256v1,	0},
+    {"ecc-p256-aes256",	EVP_PKEY_EC,	NID_X9_62_prime256v1,	1},
+    {"ecc-p384",	EVP_PKEY_EC,	NID_secp384r1,		0},
+    {"ecc-p384-aes256",	EVP_PKEY_EC,	NID_secp384r1,		1},
+};
+
+/* one generated key, as PEM in memory */
+
+typedef struct {
+    char		*pemData;
+    long		pemLength;
+} BENCH_KEY;
+
+static void printUsage(void);
+
+/* getNanoseconds() returns a monotonic time stamp */
+
+static uint64_t getNanoseconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int compareUint64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* generateKey() generates one key of the set and writes it to memory as PEM, encrypted if the set
+   asks for it */
+
+static TPM_RC generateKey(BENCH_KEY *benchKey, const BENCH_SET *benchSet)
+{
+    TPM_RC 		rc = 0;
+    EVP_PKEY_CTX 	*ctx = NULL;		/* freed @1 */
+    EVP_PKEY 		*evpPkey = NULL;	/* freed @2 */
+    BIO 		*bio = NULL;		/* freed @3 */
+    char		*data;
+
+    if (rc == 0) {
+	ctx = EVP_PKEY_CTX_new_id(benchSet->keyId, NULL);
+	if ((ctx == NULL) || (EVP_PKEY_keygen_init(ctx) != 1)) {
+	    rc = EXIT_FAILURE;
+	}
+    }
+    if (rc == 0) {
+	if (benchSet->keyId == EVP_PKEY_RSA) {
+	    if (EVP_PKEY_CTX_set_rsa_keygen_bits(ctx, benchSet->bits) != 1) {
+		rc = EXIT_FAILURE;
+	    }
+	}
+	else {
+	    if (EVP_PKEY_CTX_set_ec_paramgen_curve_nid(ctx, benchSet->bits) != 1) {
+		rc = EXIT_FAILURE;
+	    }
+	}
+    }
+    if (rc == 0) {
+	if (EVP_PKEY_keygen(ctx, &evpPkey) != 1) {
+	    rc = EXIT_FAILURE;
+	}
+    }
+    if (rc == 0) {
+	bio = BIO_new(BIO_s_mem());
+	if (bio == NULL) {
+	    rc = TSS_RC_OUT_OF_MEMORY;
+	}
+    }
+    if (rc == 0) {
+	if (PEM_write_bio_PrivateKey(bio, evpPkey,
+				     benchSet->encrypted ? EVP_aes_256_cbc() : NULL,
+				     NULL, 0, NULL,
+				     benchSet->encrypted ? BENCH_PASSWORD : NULL) != 1) {
+	    rc = EXIT_FAILURE;
+	}
+    }
+    if (rc == 0) {
+	benchKey->pemLength = BIO_get_mem_data(bio, &data);
+	rc = TSS_Malloc((unsigned char **)&benchKey->pemData, benchKey->pemLength);
+    }
+    if (rc == 0) {
+	memcpy(benchKey->pemData, data, benchKey->pemLength);
+    }
+    if (rc != 0) {
+	printf("generateKey: Error generating %s key\n", benchSet->name);
+    }
+    EVP_PKEY_CTX_free(ctx);		/* @1 */
+    EVP_PKEY_free(evpPkey);		/* @2 */
+    BIO_free(bio);			/* @3 */
+    return rc;
+}
+
+/* runStages() converts one key, timing each stage into 'stageTimes' */
+
+static TPM_RC runStages(uint64_t 		stageTimes[STAGE_COUNT],
+			const BENCH_KEY 	*benchKey,
+			const BENCH_SET 	*benchSet,
+			const char 		*outPublicFilename,
+			const char 		*outPrivateFilename)
+{
+    TPM_RC 		rc = 0;
+    const char		*password = benchSet->encrypted ? BENCH_PASSWORD : "";
+    BIO 		*bio = NULL;		/* freed @1 */
+    EVP_PKEY 		*evpPkey = NULL;	/* freed @2 */
+    RSA 		*rsaKey = NULL;		/* freed @3 */
+    EC_KEY 		*ecKey = NULL;		/* freed @4 */
+    TPMT_SENSITIVE	tSensitive;
+    TPM2B_PUBLIC	objectPublic;
+    uint8_t		publicBuffer[PEMTPM_PUBLIC_BUFFER_MAX];
+    uint16_t		publicSize = 0;
+    uint8_t		privateBuffer[PEMTPM_PRIVATE_BUFFER_MAX];
+    uint16_t		privateSize = 0;
+    uint64_t		start;
+
+    memset(&tSensitive, 0, sizeof(tSensitive));
+    memset(&objectPublic, 0, sizeof(objectPublic));
+
+    start = getNanoseconds();
+    if (rc == 0) {
+	bio = BIO_new_mem_buf(benchKey->pemData, (int)benchKey->pemLength);
+	if (bio == NULL) {
+	    rc = TSS_RC_OUT_OF_MEMORY;
+	}
+    }
+    if (rc == 0) {
+	evpPkey = PEM_read_bio_PrivateKey(bio, NULL, NULL, (void *)password);
+	if (evpPkey == NULL) {
+	    rc = EXIT_FAILURE;
+	}
+    }
+    stageTimes[STAGE_PEM_READ] = getNanoseconds() - start;
+
+    start = getNanoseconds();
+    if (rc == 0) {
+	if (benchSet->keyId == EVP_PKEY_RSA) {
+	    rsaKey = EVP_PKEY_get1_RSA(evpPkey);
+	}
+	else {
+	    ecKey = EVP_PKEY_get1_EC_KEY(evpPkey);
+	}
+	if ((rsaKey == NULL) && (ecKey == NULL)) {
+	    rc = EXIT_FAILURE;
+	}
+    }
+    stageTimes[STAGE_GET_KEY] = getNanoseconds() - start;
+
+    /* the structures are filled in as the library does, without the argument checks */
+    start = getNanoseconds();
+    if (rc == 0) {
+	objectPublic.publicArea.type = (rsaKey != NULL) ? TPM_ALG_RSA : TPM_ALG_ECC;
+	objectPublic.publicArea.nameAlg = TPM_ALG_SHA256;
+	objectPublic.publicArea.objectAttributes.val =
+	    TPMA_OBJECT_NODA | TPMA_OBJECT_USERWITHAUTH | TPMA_OBJECT_SIGN;
+	tSensitive.sensitiveType = objectPublic.publicArea.type;
+	rc = TSS_TPM2B_StringCopy(&tSensitive.authValue.b, password, sizeof(TPMU_HA));
+    }
+    if ((rc == 0) && (rsaKey != NULL)) {
+	const BIGNUM *n, *p;
+	RSA_get0_key(rsaKey, &n, NULL, NULL);
+	RSA_get0_factors(rsaKey, &p, NULL);
+	objectPublic.publicArea.parameters.rsaDetail.symmetric.algorithm = TPM_ALG_NULL;
+	objectPublic.publicArea.parameters.rsaDetail.scheme.scheme = TPM_ALG_RSASSA;
+	objectPublic.publicArea.parameters.rsaDetail.scheme.details.rsassa.hashAlg = TPM_ALG_SHA256;
+	objectPublic.publicArea.parameters.rsaDetail.keyBits = BN_num_bits(n);
+	objectPublic.publicArea.unique.rsa.t.size =
+	    BN_bn2bin(n, objectPublic.publicArea.unique.rsa.t.buffer);
+	tSensitive.sensitive.rsa.t.size = BN_bn2bin(p, tSensitive.sensitive.rsa.t.buffer);
+    }
+    if ((rc == 0) && (ecKey != NULL)) {
+	const EC_GROUP *group = EC_KEY_get0_group(ecKey);
+	int bytes = (EC_GROUP_get_degree(group) + 7) / 8;
+	BIGNUM *x = BN_new();
+	BIGNUM *y = BN_new();
+	if ((x == NULL) || (y == NULL) ||
+	    (EC_POINT_get_affine_coordinates(group, EC_KEY_get0_public_key(ecKey),
+					     x, y, NULL) != 1)) {
+	    rc = EXIT_FAILURE;
+	}
+	if (rc == 0) {
+	    objectPublic.publicArea.parameters.eccDetail.symmetric.algorithm = TPM_ALG_NULL;
+	    objectPublic.publicArea.parameters.eccDetail.scheme.scheme = TPM_ALG_ECDSA;
+	    objectPublic.publicArea.parameters.eccDetail.scheme.details.ecdsa.hashAlg =
+		TPM_ALG_SHA256;
+	    objectPublic.publicArea.parameters.eccDetail.curveID =
+		(bytes == 32) ? TPM_ECC_NIST_P256 : TPM_ECC_NIST_P384;
+	    objectPublic.publicArea.parameters.eccDetail.kdf.scheme = TPM_ALG_NULL;
+	    objectPublic.publicArea.unique.ecc.x.t.size = bytes;
+	    BN_bn2binpad(x, objectPublic.publicArea.unique.ecc.x.t.buffer, bytes);
+	    objectPublic.publicArea.unique.ecc.y.t.size = bytes;
+	    BN_bn2binpad(y, objectPublic.publicArea.unique.ecc.y.t.buffer, bytes);
+	    tSensitive.sensitive.ecc.t.size = bytes;
+	    BN_bn2binpad(EC_KEY_get0_private_key(ecKey), tSensitive.sensitive.ecc.t.buffer, bytes);
+	}
+	BN_free(x);
+	BN_free(y);
+    }
+    stageTimes[STAGE_BN_EXTRACT] = getNanoseconds() - start;
+
+    /* the TPM2B_PRIVATE is a TPM2B_SENSITIVE, the TPMT_SENSITIVE marshaled after two size
+       bytes each */
+    start = getNanoseconds();
+    if (rc == 0) {
+	UINT16 written = 0;
+	INT32 size = sizeof(privateBuffer) - 4;
+	uint8_t *buffer = privateBuffer + 4;
+	rc = PEMTPM_Marshal_TPMT_SENSITIVE(&tSensitive, &written, &buffer, &size);
+	if (rc == 0) {
+	    privateSize = written + 4;
+	    privateBuffer[0] = (uint8_t)((written + 2) >> 8);
+	    privateBuffer[1] = (uint8_t)((written + 2) >> 0);
+	    privateBuffer[2] = (uint8_t)(written >> 8);
+	    privateBuffer[3] = (uint8_t)(written >> 0);
+	}
+    }
+    stageTimes[STAGE_SENSITIVE_MARSHAL] = getNanoseconds() - start;
+
+    start = getNanoseconds();
+    if (rc == 0) {
+	rc = PEMTPM_MarshalPublic(publicBuffer, &publicSize, sizeof(publicBuffer),
+				  NULL, &objectPublic);
+    }
+    stageTimes[STAGE_PUBLIC_MARSHAL] = getNanoseconds() - start;
+
+    start = getNanoseconds();
+    if (rc == 0) {
+	rc = TSS_File_WriteBinaryFile(publicBuffer, publicSize, outPublicFilename);
+    }
+    if (rc == 0) {
+	rc = TSS_File_WriteBinaryFile(privateBuffer, privateSize, outPrivateFilename);
+    }
+    stageTimes[STAGE_FILE_WRITE] = getNanoseconds() - start;
+
+    /* the whole library call, for comparison with the sum of the stages */
+    start = getNanoseconds();
+    if (rc == 0) {
+	rc = PEMTPM_ConvertPem(publicBuffer, &publicSize, sizeof(publicBuffer),
+			       privateBuffer, &privateSize, sizeof(privateBuffer),
+			       objectPublic.publicArea.type, TYPE_SI,
+			       TPM_ALG_SHA256, TPM_ALG_SHA256,
+			       (const unsigned char *)benchKey->pemData, benchKey->pemLength,
+			       password);
+    }
+    stageTimes[STAGE_CONVERT] = getNanoseconds() - start;
+
+    memset(&tSensitive, 0, sizeof(tSensitive));
+    memset(privateBuffer, 0, sizeof(privateBuffer));
+    BIO_free(bio);		/* @1 */
+    EVP_PKEY_free(evpPkey);	/* @2 */
+    RSA_free(rsaKey);		/* @3 */
+    EC_KEY_free(ecKey);		/* @4 */
+    return rc;
+}
+
+/* printStage() prints the latency percentiles of one stage in microseconds.  'samples' is sorted
+   in place. */
+
+static void printStage(const char *name, uint64_t *samples, unsigned int count, int last)
+{
+    qsort(samples, count, sizeof(uint64_t), compareUint64);
+    printf("        \"%s\": {\"p50_us\": %.2f, \"p90_us\": %.2f, \"p99_us\": %.2f, "
+	   "\"max_us\": %.2f}%s\n",
+	   name,
+	   samples[(count * 50) / 100] / 1000.0,
+	   samples[(count * 90) / 100] / 1000.0,
+	   samples[(count * 99) / 100] / 1000.0,
+	   samples[count - 1] / 1000.0,
+	   last ? "" : ",");
+}
+
+/* runSet() generates the keys of one set, converts each of them 'iterations' times round robin,
+   and prints the set results */
+
+static TPM_RC runSet(const BENCH_SET 	*benchSet,
+		     unsigned int 	keys,
+		     unsigned int 	iterations,
+		     const char 	*outPublicFilename,
+		     const char 	*outPrivateFilename,
+		     int		last)
+{
+    TPM_RC 		rc = 0;
+    BENCH_KEY		*benchKeys = NULL;	/* freed @1 */
+    uint64_t		*samples = NULL;	/* freed @2 */
+    uint64_t		stageTimes[STAGE_COUNT];
+    uint64_t		stagesTotal = 0;
+    uint64_t		convertTotal = 0;
+    unsigned int 	i;
+    unsigned int 	s;
+
+    if (rc == 0) {
+	rc = TSS_Malloc((unsigned char **)&benchKeys, keys * sizeof(BENCH_KEY));
+    }
+    if (rc == 0) {
+	memset(benchKeys, 0, keys * sizeof(BENCH_KEY));
+	rc = TSS_Malloc((unsigned char **)&samples,
+			STAGE_COUNT * iterations * sizeof(uint64_t));
+    }
+    for (i = 0 ; (rc == 0) && (i < keys) ; i++) {
+	rc = generateKey(&benchKeys[i], benchSet);
+    }
+    for (i = 0 ; (rc == 0) && (i < iterations) ; i++) {
+	rc = runStages(stageTimes, &benchKeys[i % keys], benchSet,
+		       outPublicFilename, outPrivateFilename);
+	for (s = 0 ; (rc == 0) && (s < STAGE_COUNT) ; s++) {
+	    samples[(s * iterations) + i] = stageTimes[s];
+	    if (s == STAGE_CONVERT) {
+		convertTotal += stageTimes[s];
+	    }
+	    else {
+		stagesTotal += stageTimes[s];
+	    }
+	}
+    }
+    if (rc == 0) {
+	printf("    {\n");
+	printf("      \"set\": \"%s\",\n", benchSet->name);
+	printf("      \"keys\": %u,\n", keys);
+	printf("      \"iterations\": %u,\n", iterations);
+	printf("      \"keys_per_sec\": %.1f,\n", iterations / (stagesTotal / 1e9));
+	printf("      \"convert_keys_per_sec\": %.1f,\n", iterations / (convertTotal / 1e9));
+	printf("      \"stages\": {\n");
+	for (s = 0 ; s < STAGE_COUNT ; s++) {
+	    printStage(stageNames[s], samples + (s * iterations), iterations,
+		       s == (STAGE_COUNT - 1));
+	}
+	printf("      }\n");
+	printf("    }%s\n", last ? "" : ",");
+    }
+    else {
+	fprintf(stderr, "pemtpmbench: set %s failed, rc %08x\n", benchSet->name, rc);
+    }
+    for (i = 0 ; (benchKeys != NULL) && (i < keys) ; i++) {
+	free(benchKeys[i].pemData);
+    }
+    free(benchKeys);		/* @1 */
+    free(samples);		/* @2 */
+    return rc;
+}
+
+int main(int argc, char *argv[])
+{
+    TPM_RC			rc = 0;
+    int				i;    /* argc iterator */
+    unsigned int		keys = 4;
+    unsigned int		iterations = 200;
+    const char			*setName = NULL;
+    char			directory[] = "/tmp/pemtpmbenchXXXXXX";
+    char			outPublicFilename[sizeof(directory) + 16];
+    char			outPrivateFilename[sizeof(directory) + 16];
+    size_t			set;
+    size_t			sets = sizeof(benchSets) / sizeof(benchSets[0]);
+    size_t			lastSet = sets - 1;
+
+    for (i=1 ; (i<argc) && (rc == 0) ; i++) {
+	if (strcmp(argv[i],"-k") == 0) {
+	    i++;
+	    if (i < argc) {
+		keys = atoi(argv[i]);
+	    }
+	    if ((i == argc) || (keys < 1)) {
+		printf("Bad parameter for -k\n");
+		printUsage();
+	    }
+	}
+	else if (strcmp(argv[i],"-n") == 0) {
+	    i++;
+	    if (i < argc) {
+		iterations = atoi(argv[i]);
+	    }
+	    if ((i == argc) || (iterations < 1)) {
+		printf("Bad parameter for -n\n");
+		printUsage();
+	    }
+	}
+	else if (strcmp(argv[i],"-set") == 0) {
+	    i++;
+	    if (i < argc) {
+		setName = argv[i];
+	    }
+	    else {
+		printf("-set option needs a value\n");
+		printUsage();
+	    }
+	}
+	else {
+	    printf("\n%s is not a valid option\n", argv[i]);
+	    printUsage();
+	}
+    }
+    if (setName != NULL) {
+	for (set = 0 ; set < sets ; set++) {
+	    if (strcmp(setName, benchSets[set].name) == 0) {
+		lastSet = set;
+		break;
+	    }
+	}
+	if (set == sets) {
+	    printf("Unknown set %s\n", setName);
+	    printUsage();
+	}
+    }
+    /* library errors go to stdout, which is the JSON */
+    tssVerbose = FALSE;
+    if (mkdtemp(directory) == NULL) {
+	printf("pemtpmbench: cannot create %s\n", directory);
+	exit(1);
+    }
+    snprintf(outPublicFilename, sizeof(outPublicFilename), "%s/key.pub", directory);
+    snprintf(outPrivateFilename, sizeof(outPrivateFilename), "%s/key.priv", directory);
+
+    printf("{\n");
+    printf("  \"bench\": \"pemtpm\",\n");
+    printf("  \"openssl\": \"%s\",\n", OPENSSL_VERSION_TEXT);
+    printf("  \"sets\": [\n");
+    for (set = 0 ; (rc == 0) && (set < sets) ; set++) {
+	if ((setName == NULL) || (set == lastSet)) {
+	    rc = runSet(&benchSets[set], keys, iterations,
+			outPublicFilename, outPrivateFilename, set == lastSet);
+	}
+    }
+    printf("  ]\n");
+    printf("}\n");
+
+    unlink(outPublicFilename);
+    unlink(outPrivateFilename);
+    rmdir(directory);
+    return (rc == 0) ? 0 : EXIT_FAILURE;
+}
+
+static void printUsage(void)
+{
+    printf("\n");
+    printf("pemtpmbench\n");
+    printf("\n");
+    printf("Times each stage of the PEM to TPM conversion over synthetic key sets and\n");
+    printf("prints keys/sec and per-stage latency percentiles as JSON\n");
+    printf("\n");
+    printf("\t[-n\titerations per key set (default 200)]\n");
+    printf("\t[-k\tdistinct keys per key set (default 4)]\n");
+    printf("\t[-set\tone key set, e.g. rsa2048-aes256 (default all)]\n");
+    exit(1);
+}
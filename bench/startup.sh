@@ -0,0 +1,62 @@
+#!/bin/sh
+#
+# startup.sh measures the size of a pemtpm binary, whether libcrypto is linked into it, and the
+# mean wall time of a complete run converting one unencrypted RSA key, which is startup dominated.
+# The results are written to stdout as one JSON object.
+#
+#	startup.sh pemtpm [-k key.pem] [-n runs]
+#
+# Without -k, an RSA-2048 key is generated with the openssl command.
+
+usage()
+{
+    echo "usage: $0 pemtpm [-k unencrypted RSA PEM key] [-n runs, default 200]" >&2
+    exit 1
+}
+
+[ $# -ge 1 ] || usage
+pemtpm=$1
+shift
+key=
+runs=200
+while [ $# -gt 0 ]; do
+    case $1 in
+	-k) [ $# -ge 2 ] || usage; key=$2; shift 2 ;;
+	-n) [ $# -ge 2 ] || usage; runs=$2; shift 2 ;;
+	*) usage ;;
+    esac
+done
+
+work=$(mktemp -d) || exit 1
+trap 'rm -rf "$work"' EXIT
+if [ -z "$key" ]; then
+    key=$work/key.pem
+    openssl genrsa -out "$key" 2048 2>/dev/null || { echo "$0: cannot generate a key" >&2; exit 1; }
+fi
+
+# the first run checks the key and warms the page cache
+"$pemtpm" -ipem "$key" -rsa -opu "$work/key.pub" -opr "$work/key.priv" >/dev/null ||
+    { echo "$0: $pemtpm cannot convert $key" >&2; exit 1; }
+
+bytes=$(wc -c < "$pemtpm")
+if ldd "$pemtpm" 2>/dev/null | grep -q libcrypto; then
+    linked=true
+else
+    linked=false
+fi
+
+start=$(date +%s%N)
+i=0
+while [ $i -lt "$runs" ]; do
+    "$pemtpm" -ipem "$key" -rsa -opu "$work/key.pub" -opr "$work/key.priv" >/dev/null
+    i=$((i + 1))
+done
+end=$(date +%s%N)
+
+echo "{"
+echo "  \"bench\": \"startup\","
+echo "  \"binary_bytes\": $bytes,"
+echo "  \"libcrypto_linked\": $linked,"
+echo "  \"runs\": $runs,"
+echo "  \"mean_us\": $(( (end - start) / runs / 1000 ))"
+echo "}"
@@ -48,385 +48,2642 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
 
 
 #include <tss2/tss.h>
 #include <tss2/tssutils.h>
 #include <tss2/tssmarshal.h>
-#include <openssl/pem.h>
+#include <tss2/pemtpm.h>
+#include <openssl/opensslv.h>
+#include <openssl/crypto.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/sha.h>
 
-#define TYPE_SI            5
+#include "pemtpmcache.h"
+#include "pemtpmcontainerwriter.h"
+#include "pemtpmlibcrypto.h"
+#include "pemtpmmarshal.h"
+#include "pemtpmqueue.h"
+#include "pemtpmstats.h"
+#include "pemtpmwriter.h"
 
-int tssVerbose = TRUE;
+static int verbose = TRUE;	/* per-key progress messages */
+static PEMTPM_CACHE *cache = NULL;	/* -cache, set before any thread starts */
 
-static TPM_RC convertPemToEvpPrivKey(EVP_PKEY **evpPkey,		/* freed by caller */
-			      const char *pemKeyFilename,
-			      const char *password)
+/* getHashAlgorithm() maps a command line hash algorithm name to a TPMI_ALG_HASH */
+
+static TPM_RC getHashAlgorithm(TPMI_ALG_HASH 	*halg,
+			       const char 	*string)
+{
+    TPM_RC 	rc = 0;
+
+    if (strcmp(string,"sha1") == 0) {
+	*halg = TPM_ALG_SHA1;
+    }
+    else if (strcmp(string,"sha256") == 0) {
+	*halg = TPM_ALG_SHA256;
+    }
+    else if (strcmp(string,"sha384") == 0) {
+	*halg = TPM_ALG_SHA384;
+    }
+    else {
+	rc = EXIT_FAILURE;
+    }
+    return rc;
+}
+
+/* convertPem() is PEMTPM_ConvertPemToKeyPair() through the -cache result cache, if there is one.
+   The cache holds the unwrapped duplicate, so wrapping is still done per key. */
+
+static TPM_RC convertPem(TPM2B_PUBLIC 		*objectPublic,
+			 TPM2B_PRIVATE 		*duplicate,
+			 TPMI_ALG_PUBLIC 	algPublic,
+			 int			keyType,
+			 TPMI_ALG_HASH 		nalg,
+			 TPMI_ALG_HASH		halg,
+			 const unsigned char 	*pemData,
+			 size_t 		pemLength,
+			 const char 		*pemKeyPassword)
+{
+    TPM_RC	rc = 0;
+    uint8_t	key[PEMTPM_CACHE_KEY_SIZE];
+    int		hit = FALSE;
+
+    if ((rc == 0) && (cache != NULL)) {
+	rc = PEMTPM_Cache_Key(key, algPublic, keyType, nalg, halg,
+			      pemData, pemLength, pemKeyPassword);
+	if (rc == 0) {
+	    hit = PEMTPM_Cache_Get(cache, key, objectPublic, duplicate);
+	}
+    }
+    if ((rc == 0) && !hit) {
+	rc = PEMTPM_ConvertPemToKeyPair(objectPublic, duplicate, algPublic, keyType,
+					nalg, halg, pemData, pemLength, pemKeyPassword);
+	if ((rc == 0) && (cache != NULL)) {
+	    PEMTPM_Cache_Put(cache, key, objectPublic, duplicate);
+	}
+    }
+    return rc;
+}
+
+/* WRAPPING is the optional protection of the duplicates, shared read only by every key of a run */
+
+typedef struct WRAPPING {
+    PEMTPM_PARENT 	*parent;		/* -ipp outer wrapper, NULL for none */
+    TPM2B_DATA 		encryptionKey;		/* -iek or -oek inner wrapper, size 0 for none */
+    uint8_t 		parentDigest[SHA256_DIGEST_LENGTH];	/* of -ipp, for -stamps and -ocf */
+} WRAPPING;
+
+/* isWrapped() returns TRUE if the duplicates are wrapped, which needs the object Name */
+
+static int isWrapped(const WRAPPING *wrapping)
+{
+    return ((wrapping->parent != NULL) || (wrapping->encryptionKey.t.size != 0));
+}
+
+/* wrapDuplicate() applies the inner wrapper and then the outer wrapper, each if it is configured.
+   'cipher' is the caller's inner wrapper context, reused across keys. */
+
+static TPM_RC wrapDuplicate(TPM2B_PRIVATE 		*duplicate,
+			    TPM2B_ENCRYPTED_SECRET 	*inSymSeed,
+			    const TPM2B_NAME 		*name,
+			    const WRAPPING 		*wrapping,
+			    PEMTPM_CIPHER 		*cipher)
+{
+    TPM_RC	rc = 0;
+
+    if ((rc == 0) && (wrapping->encryptionKey.t.size != 0)) {
+	rc = PEMTPM_WrapInner(duplicate, &wrapping->encryptionKey, name, cipher);
+    }
+    if ((rc == 0) && (wrapping->parent != NULL)) {
+	rc = PEMTPM_WrapDuplicate(duplicate, inSymSeed, wrapping->parent, name);
+    }
+    return rc;
+}
+
+/* IMPORT_COMMANDS is the -oic output.  Each converted key appends one complete TPM2_Import command
+   to one file, so a sender needs no marshaling code. */
+
+typedef struct IMPORT_COMMANDS {
+    FILE 		*commandFile;		/* NULL for none */
+    TPMI_DH_OBJECT 	parentHandle;		/* -hp */
+    TPM2B_AUTH 		parentAuth;		/* -pwdp, for the password session */
+} IMPORT_COMMANDS;
+
+/* marshalImportCommand() marshals the TPM2_Import command for one converted key.  'inSymSeed' is
+   used only with a parent. */
+
+static TPM_RC marshalImportCommand(uint8_t 			*commandBuffer,
+				   uint32_t 			*commandSize,
+				   uint32_t 			commandBufferSize,
+				   const TPM2B_PUBLIC 		*objectPublic,
+				   const TPM2B_PRIVATE 		*duplicate,
+				   const TPM2B_ENCRYPTED_SECRET *inSymSeed,
+				   const WRAPPING 		*wrapping,
+				   const IMPORT_COMMANDS 	*importCommands)
+{
+    return PEMTPM_MarshalImport(commandBuffer,
+				commandSize,
+				commandBufferSize,
+				importCommands->parentHandle,
+				&importCommands->parentAuth,
+				objectPublic,
+				duplicate,
+				(wrapping->parent != NULL) ? inSymSeed : NULL,
+				&wrapping->encryptionKey);
+}
+
+/* writeImportCommand() appends one marshaled TPM2_Import command to the -oic file */
+
+static TPM_RC writeImportCommand(const IMPORT_COMMANDS 	*importCommands,
+				 const uint8_t 		*commandBuffer,
+				 uint32_t 		commandSize)
+{
+    TPM_RC	rc = 0;
+
+    if (fwrite(commandBuffer, 1, commandSize, importCommands->commandFile) != commandSize) {
+	printf("writeImportCommand: Error writing the command file\n");
+	rc = TSS_RC_FILE_WRITE;
+    }
+    PEMTPM_STATS_COUNT(PEMTPM_STAT_BYTES_WRITTEN, commandSize);
+    return rc;
+}
+
+/* writeOutputFiles() writes the output files of one key with 'writer', as the batch does: each
+   file is written to "<name>.tmp", and the files are renamed over their names once all of them are
+   written.  It waits for the renames. */
+
+static TPM_RC writeOutputFiles(PEMTPM_WRITER 		*writer,
+			       PEMTPM_WRITER_FILE 	*files,
+			       size_t 			count)
+{
+    TPM_RC	rc = 0;
+    char	*tempFilenames = NULL;
+    char	*tempFilename;
+    size_t	length = 0;
+    size_t	f;
+
+    for (f = 0 ; f < count ; f++) {
+	length += strlen(files[f].filename) + sizeof(".tmp");
+    }
+    if (rc == 0) {
+	rc = TSS_Malloc((unsigned char **)&tempFilenames, length);	/* freed @1 */
+    }
+    if (rc == 0) {
+	tempFilename = tempFilenames;
+	for (f = 0 ; f < count ; f++) {
+	    files[f].tempFilename = tempFilename;
+	    tempFilename += sprintf(tempFilename, "%s.tmp", files[f].filename) + 1;
+	}
+	PEMTPM_Writer_Submit(writer, files, count, files);
+	PEMTPM_Writer_Complete(writer, &rc, TRUE);
+    }
+    free(tempFilenames);	/* @1 */
+    return rc;
+}
+
+/* convertPemDataToFiles() converts one PEM key held in memory and writes the TPM2B_PUBLIC and
+   TPM2B_PRIVATE to outPublicFilename and outPrivateFilename, and, if outNameFilename is not NULL,
+   the object Name.
+
+   The TPM2B_PRIVATE is wrapped as 'wrapping' configures.  With a parent, the inSymSeed is written
+   to outSeedFilename.  With -oic, the TPM2_Import command is also appended to the command file.
+
+   The files are written with writeOutputFiles(), so an interrupted conversion leaves the old
+   outputs of the key, not a partial or mismatched set.
+*/
+
+static TPM_RC convertPemDataToFiles(TPMI_ALG_PUBLIC 		algPublic,
+				    int				keyType,
+				    TPMI_ALG_HASH 		nalg,
+				    TPMI_ALG_HASH		halg,
+				    const unsigned char 	*pemData,
+				    size_t 			pemLength,
+				    const char 			*pemKeyPassword,
+				    const char 			*outPublicFilename,
+				    const char 			*outPrivateFilename,
+				    const char 			*outNameFilename,
+				    const WRAPPING 		*wrapping,
+				    PEMTPM_CIPHER 		*cipher,
+				    const char 			*outSeedFilename,
+				    const IMPORT_COMMANDS 	*importCommands,
+				    PEMTPM_WRITER 		*writer)
+{
+    TPM_RC			rc = 0;
+    TPM2B_PUBLIC		objectPublic;
+    TPM2B_PRIVATE		duplicate;
+    TPM2B_ENCRYPTED_SECRET	inSymSeed;
+    uint8_t			publicBuffer[PEMTPM_PUBLIC_BUFFER_MAX];
+    uint16_t			publicSize;
+    uint8_t			privateBuffer[PEMTPM_PRIVATE_BUFFER_MAX];
+    uint16_t			privateSize;
+    PEMTPM_WRITER_FILE		files[PEMTPM_WRITER_FILES_MAX];
+    size_t			count = 0;
+    uint8_t			commandBuffer[PEMTPM_IMPORT_COMMAND_MAX];
+    uint32_t			commandSize;
+    TPM2B_NAME			name;
+    uint64_t			start = 0;
+
+    if (pemtpmStats) start = PEMTPM_Stats_Now();
+    if (rc == 0) {
+	rc = convertPem(&objectPublic,
+			&duplicate,
+			algPublic,
+			keyType,
+			nalg,
+			halg,
+			pemData,
+			pemLength,
+			pemKeyPassword);
+    }
+    if (pemtpmStats) {
+	PEMTPM_Stats_Time(PEMTPM_STAGE_CONVERT, PEMTPM_Stats_Now() - start);
+	start = PEMTPM_Stats_Now();
+    }
+    /* the Name is hashed from the marshaled public area, not from a second marshal */
+    if (rc == 0) {
+	if (verbose) printf("importpem: success\n");
+	rc = PEMTPM_MarshalPublic(publicBuffer,
+				  &publicSize,
+				  sizeof(publicBuffer),
+				  ((outNameFilename != NULL) || isWrapped(wrapping)) ? &name : NULL,
+				  &objectPublic);
+    }
+    if ((rc == 0) && isWrapped(wrapping)) {
+	rc = wrapDuplicate(&duplicate, &inSymSeed, &name, wrapping, cipher);
+    }
+    if ((rc == 0) && (importCommands->commandFile != NULL)) {
+	rc = marshalImportCommand(commandBuffer, &commandSize, sizeof(commandBuffer),
+				  &objectPublic, &duplicate, &inSymSeed, wrapping, importCommands);
+    }
+    if (pemtpmStats) {
+	PEMTPM_Stats_Time(PEMTPM_STAGE_MARSHAL, PEMTPM_Stats_Now() - start);
+	start = PEMTPM_Stats_Now();
+    }
+    if (rc == 0) {
+	rc = TSS_Structure_MarshalBuffer(privateBuffer,
+					 &privateSize,
+					 sizeof(privateBuffer),
+					 &duplicate,
+					 (MarshalFunction_t)PEMTPM_Marshal_TPM2B_PRIVATE);
+    }
+    if (rc == 0) {
+	files[count].filename = outPublicFilename;
+	files[count].data = publicBuffer;
+	files[count].length = publicSize;
+	count++;
+	files[count].filename = outPrivateFilename;
+	files[count].data = privateBuffer;
+	files[count].length = privateSize;
+	count++;
+	if (outNameFilename != NULL) {
+	    files[count].filename = outNameFilename;
+	    files[count].data = name.t.name;
+	    files[count].length = name.t.size;
+	    count++;
+	}
+	if (wrapping->parent != NULL) {
+	    files[count].filename = outSeedFilename;
+	    files[count].data = inSymSeed.t.secret;
+	    files[count].length = inSymSeed.t.size;
+	    count++;
+	}
+	rc = writeOutputFiles(writer, files, count);
+    }
+    if ((rc == 0) && verbose) {
+	printf("pemtpm: write to %s OK\n", outPublicFilename);
+	printf("pemtpm: write to %s OK duplicate.t.size=%d\n",
+	       outPrivateFilename, duplicate.t.size);
+	if (outNameFilename != NULL) printf("pemtpm: write to %s OK\n", outNameFilename);
+	if (wrapping->parent != NULL) printf("pemtpm: write to %s OK\n", outSeedFilename);
+    }
+    if ((rc == 0) && (importCommands->commandFile != NULL)) {
+	rc = writeImportCommand(importCommands, commandBuffer, commandSize);
+	if ((rc == 0) && verbose) printf("pemtpm: TPM2_Import command size %u OK\n", commandSize);
+    }
+    if (pemtpmStats) {
+	PEMTPM_Stats_Time(PEMTPM_STAGE_WRITE, PEMTPM_Stats_Now() - start);
+    }
+    PEMTPM_STATS_COUNT((rc == 0) ? PEMTPM_STAT_KEYS_CONVERTED : PEMTPM_STAT_KEYS_FAILED, 1);
+    /* the duplicate is the unencrypted private key */
+    memset(&duplicate, 0, sizeof(duplicate));
+    memset(privateBuffer, 0, sizeof(privateBuffer));
+    if (importCommands->commandFile != NULL) {
+	memset(commandBuffer, 0, sizeof(commandBuffer));
+    }
+    return rc;
+}
+
+/* convertPemToFiles() is convertPemDataToFiles() for a PEM key file.  With 'sync', the outputs
+   are synced before they are renamed, and the renames are synced. */
+
+static TPM_RC convertPemToFiles(TPMI_ALG_PUBLIC 	algPublic,
+				int			keyType,
+				TPMI_ALG_HASH 		nalg,
+				TPMI_ALG_HASH		halg,
+				const char 		*pemKeyFilename,
+				const char 		*pemKeyPassword,
+				const char 		*outPublicFilename,
+				const char 		*outPrivateFilename,
+				const char 		*outNameFilename,
+				const WRAPPING 		*wrapping,
+				const char 		*outSeedFilename,
+				const IMPORT_COMMANDS 	*importCommands,
+				int			sync)
+{
+    TPM_RC			rc = 0;
+    unsigned char 		*pemData = NULL;
+    size_t 			pemLength;
+    PEMTPM_WRITER 		*writer = NULL;		/* freed @2 */
+    uint64_t			start = 0;
+
+    if (rc == 0) {
+	rc = PEMTPM_Writer_Create(&writer, 1, sync ? 1 : 0);
+    }
+    if (pemtpmStats) start = PEMTPM_Stats_Now();
+    if (rc == 0) {
+	rc = TSS_File_ReadBinaryFile(&pemData,		/* freed @1 */
+				     &pemLength,
+				     pemKeyFilename);
+    }
+    if (pemtpmStats) {
+	PEMTPM_Stats_Time(PEMTPM_STAGE_READ, PEMTPM_Stats_Now() - start);
+    }
+    if (rc == 0) {
+	rc = convertPemDataToFiles(algPublic,
+				   keyType,
+				   nalg,
+				   halg,
+				   pemData,
+				   pemLength,
+				   pemKeyPassword,
+				   outPublicFilename,
+				   outPrivateFilename,
+				   outNameFilename,
+				   wrapping,
+				   NULL,
+				   outSeedFilename,
+				   importCommands,
+				   writer);
+	if (rc == 0) {
+	    rc = PEMTPM_Writer_Sync(writer);
+	}
+    }
+    else {
+	PEMTPM_STATS_COUNT(PEMTPM_STAT_KEYS_FAILED, 1);
+    }
+    free(pemData);		/* @1 */
+    PEMTPM_Writer_Delete(writer);	/* @2 */
+    return rc;
+}
+
+/* verifyFiles() reads back a TPM2B_PUBLIC and TPM2B_PRIVATE written by pemtpm and validates
+   them */
+
+static TPM_RC verifyFiles(const char 		*inPublicFilename,
+			  const char 		*inPrivateFilename)
+{
+    TPM_RC			rc = 0;
+    uint8_t			publicBuffer[PEMTPM_PUBLIC_BUFFER_MAX];
+    size_t			publicLength;
+    uint8_t			privateBuffer[PEMTPM_PRIVATE_BUFFER_MAX];
+    size_t			privateLength;
+    TPM2B_PUBLIC		objectPublic;
+    TPMT_SENSITIVE		objectSensitive;
+
+    if (rc == 0) {
+	rc = TSS_File_ReadBinaryFileBuffer(publicBuffer, &publicLength,
+					   sizeof(publicBuffer), inPublicFilename);
+    }
+    if (rc == 0) {
+	rc = TSS_File_ReadBinaryFileBuffer(privateBuffer, &privateLength,
+					   sizeof(privateBuffer), inPrivateFilename);
+    }
+    if (rc == 0) {
+	rc = PEMTPM_ReadKeyPair(&objectPublic,
+				&objectSensitive,
+				publicBuffer,
+				publicLength,
+				privateBuffer,
+				privateLength);
+    }
+    if (rc == 0) {
+	printf("pemtpm: %s %s OK type %04x nameAlg %04x\n",
+	       inPublicFilename, inPrivateFilename,
+	       objectPublic.publicArea.type, objectPublic.publicArea.nameAlg);
+    }
+    else {
+	printf("pemtpm: %s %s invalid, rc %08x\n", inPublicFilename, inPrivateFilename, rc);
+    }
+    memset(&objectSensitive, 0, sizeof(objectSensitive));
+    memset(privateBuffer, 0, sizeof(privateBuffer));
+    return rc;
+}
+
+/* extractContainerKey() finds the key with the hex 'keyIdString' in a -ocf container and writes
+   its TPM2B_PUBLIC and TPM2B_PRIVATE to outPublicFilename and outPrivateFilename, and, if they are
+   not NULL, its inSymSeed and Name.  The container is mapped, so only the pages of the index
+   entries visited and of the record are read. */
+
+static TPM_RC extractContainerKey(const char 	*containerFilename,
+				  const char 	*keyIdString,
+				  const char 	*outPublicFilename,
+				  const char 	*outPrivateFilename,
+				  const char 	*outSeedFilename,
+				  const char 	*outNameFilename)
+{
+    TPM_RC			rc = 0;
+    const unsigned char		*container = NULL;
+    size_t			containerLength = 0;
+    uint8_t			keyId[PEMTPM_CONTAINER_KEY_ID_SIZE];
+    PEMTPM_CONTAINER_RECORD	record;
+    size_t			i;
+
+    if (rc == 0) {
+	if ((strlen(keyIdString) != 2 * sizeof(keyId)) ||
+	    (strspn(keyIdString, "0123456789abcdefABCDEF") != 2 * sizeof(keyId))) {
+	    printf("pemtpm: -kid must be %lu hex digits\n", (unsigned long)(2 * sizeof(keyId)));
+	    rc = TSS_RC_BAD_PROPERTY_VALUE;
+	}
+    }
+    for (i = 0 ; (rc == 0) && (i < sizeof(keyId)) ; i++) {
+	sscanf(keyIdString + 2 * i, "%2hhx", &keyId[i]);
+    }
+    if (rc == 0) {
+	rc = TSS_File_MapFile(&container, &containerLength,	/* unmapped @1 */
+			      containerFilename);
+    }
+    if (rc == 0) {
+	rc = PEMTPM_ContainerFind(&record, container, containerLength, keyId);
+	if (rc == TPM_RC_NO_RESULT) {
+	    printf("pemtpm: key %s is not in %s\n", keyIdString, containerFilename);
+	}
+    }
+    if (rc == 0) {
+	if ((record.inSymSeedSize != 0) && (outSeedFilename == NULL)) {
+	    printf("pemtpm: key %s is wrapped for a parent, -oss is needed\n", keyIdString);
+	    rc = TSS_RC_NULL_PARAMETER;
+	}
+	else if ((record.inSymSeedSize == 0) && (outSeedFilename != NULL)) {
+	    printf("pemtpm: key %s has no inSymSeed for -oss\n", keyIdString);
+	    rc = TSS_RC_BAD_PROPERTY_VALUE;
+	}
+    }
+    if (rc == 0) {
+	rc = TSS_File_WriteBinaryFile(record.objectPublic, record.objectPublicSize,
+				      outPublicFilename);
+    }
+    if (rc == 0) {
+	rc = TSS_File_WriteBinaryFile(record.duplicate, record.duplicateSize,
+				      outPrivateFilename);
+    }
+    if ((rc == 0) && (outSeedFilename != NULL)) {
+	rc = TSS_File_WriteBinaryFile(record.inSymSeed, record.inSymSeedSize, outSeedFilename);
+    }
+    if ((rc == 0) && (outNameFilename != NULL)) {
+	rc = TSS_File_WriteBinaryFile(record.name, record.nameSize, outNameFilename);
+    }
+    if (rc == 0) {
+	printf("pemtpm: %s key %s from %.*s OK\n", containerFilename, keyIdString,
+	       (int)record.sourceIdSize, (const char *)record.sourceId);
+    }
+    if (container != NULL) {
+	TSS_File_UnmapFile(container, containerLength);	/* @1 */
+    }
+    return rc;
+}
+
+/* A batch manifest has one key per line:
+
+   pemfile password opu opr [nalg [halg]]
+
+   Fields are separated by white space.  A password of "-" is the empty password.  nalg and halg
+   default to the command line values.  Blank lines and lines starting with # are ignored.
+
+   With -iek or -oek, each duplicate gets the inner wrapper, and each job keeps its cipher context
+   across keys.  With -ipp, each duplicate is wrapped for the parent, which is parsed once for the
+   whole batch, and a line also names the inSymSeed output:
+
+   pemfile password opu opr oss [nalg [halg]]
+
+   With -oic, each converted key also appends its TPM2_Import command to one file, in manifest
+   order.  With more than one job, the write stage holds a job that finishes early until the jobs
+   before it are written.
+
+   With -ocf, the outputs of every key are appended, in manifest order, to one container file
+   instead, see PEMTPM_CONTAINER, and a line has no output fields:
+
+   pemfile password [nalg [halg]]
+
+   Each key becomes a BATCH_JOB that passes through four stages: read the PEM file, parse and
+   decrypt it to TPM structures, marshal them, and write the output files.  With one job the stages
+   run inline.  Otherwise each stage runs on its own threads (the parse stage, which does the
+   decryption, on 'jobs' threads) and the stages are joined by bounded queues.
+
+   The write stage hands the output files to a PEMTPM_WRITER, which writes the files of many keys
+   at once, with io_uring or on a writer thread.  Each file is written to "<name>.tmp" and renamed
+   over its name once every file of the key is written, so an interrupted batch leaves each output
+   either old or whole.  A job is reported and recycled when its files are renamed, in the order
+   the jobs were handed over.  When the write stage runs out of jobs, it waits for the writer to
+   finish before it waits for more.
+
+   With -sync N, the renames also survive a crash.  The writer holds the written keys until there
+   are N, syncs their file systems once, and renames them, so the cost of a sync is shared by N
+   keys.  The write stage then does not wait for the writer when it runs out of jobs, and the job
+   pool is enlarged by the keys the writer holds.  The last renames are synced at the end of the
+   batch, and the stamps file is synced before it replaces the old one.
+
+   With -stats, each stage is timed, and the write stage prints one JSON line per key to stderr.
+   The write time runs from handing the files to the writer until they are written.
+
+   With -stamps, a key whose outputs are up to date is not converted again, see BATCH_STAMP.
+
+   Jobs are allocated once, before the first key, and are recycled through a free list, so the
+   steady state of a batch does not allocate.
+
+   The worker threads share only tssVerbose and stdout.  tssVerbose is set before any thread starts
+   and is read only afterwards, and every message is a single printf() call, which stdio
+   serializes, so lines from different keys never interleave.
+*/
+
+#define BATCH_LINE_MAX		4096
+#define BATCH_FIELDS_MAX	7
+#define BATCH_QUEUE_DEPTH	4	/* queue entries per parse thread */
+#define BATCH_PEM_MAX		16384	/* largest PEM key file */
+#define BATCH_SYNC_MAX		4096	/* most keys per -sync, each holds a job */
+
+/* A -stamps file records, for each key converted by a batch, the identity of its input and
+   parameters:
+
+   pemfile opu opr oss size mtime sha256 params opustat oprstat ossstat
+
+   oss is "-" without -ipp.  size, mtime and sha256 are those of the PEM file, and params is the
+   SHA-256 of the salt, algPublic, the key type, nalg, halg, the wrapping and the password, which
+   becomes the authValue.  The first line of the file is
+
+   # salt hex
+
+   with a random salt, kept from one batch to the next, so that the params of a password cannot be
+   looked up.  The stat fields are the size and mtime of each output, as size:mtime, and "-" for
+   no oss.
+
+   A later batch with the same stamps file does not convert a key again if the stamp for its opr
+   has the same file names and params, the outputs have the same size and mtime, and the PEM file
+   has the same size and mtime.  If the PEM size or mtime differ, the file is read and hashed, and
+   the key is still up to date if the content is unchanged.
+
+   The old stamps are read once, sorted by opr, and are read only while the batch runs.  The write
+   stage writes a new stamp for each converted or up to date key to a temporary file, which
+   replaces the stamps file when the batch completes.  A key that fails has no stamp, so it is
+   retried.
+*/
+
+enum {
+    STAMP_PEM,
+    STAMP_OPU,
+    STAMP_OPR,
+    STAMP_OSS,
+    STAMP_SIZE,
+    STAMP_MTIME,
+    STAMP_DIGEST,
+    STAMP_PARAMS,
+    STAMP_OPU_STAT,
+    STAMP_OPR_STAT,
+    STAMP_OSS_STAT,
+    STAMP_FIELDS
+};
+
+#define STAMP_HEX_SIZE		(2 * SHA256_DIGEST_LENGTH + 1)
+#define STAMP_SALT_SIZE		16
+#define STAMP_STAT_SIZE		64	/* size:mtime */
+
+typedef struct BATCH_STAMP {
+    char		*line;			/* the fields point into it */
+    char		*fields[STAMP_FIELDS];
+} BATCH_STAMP;
+
+typedef struct BATCH_STAMPS {
+    BATCH_STAMP		*stamps;		/* sorted by opr */
+    size_t		count;
+    uint8_t		salt[STAMP_SALT_SIZE];	/* of the params */
+    int			salted;			/* the salt was read */
+} BATCH_STAMPS;
+
+typedef struct BATCH_JOB {
+    char		line[BATCH_LINE_MAX];	/* manifest line, the fields point into it */
+    unsigned long 	lineNumber;
+    unsigned long 	sequence;		/* key number, from 0 */
+    const char 		*pemKeyFilename;
+    const char 		*password;
+    const char 		*outPublicFilename;
+    const char 		*outPrivateFilename;
+    const char 		*outSeedFilename;	/* -ipp only */
+    char		tempFilenames[BATCH_LINE_MAX +	/* write stage, the ".tmp" names */
+				      PEMTPM_WRITER_FILES_MAX * sizeof(".tmp")];
+    TPMI_ALG_HASH 	nalg;
+    TPMI_ALG_HASH	halg;
+    unsigned char 	pemData[BATCH_PEM_MAX];	/* read stage */
+    size_t 		pemLength;
+    TPM2B_PUBLIC	objectPublic;		/* parse stage */
+    TPM2B_PRIVATE	duplicate;
+    TPM2B_ENCRYPTED_SECRET inSymSeed;		/* -ipp only */
+    TPM2B_NAME		name;			/* wrapping or -ocf only */
+    PEMTPM_CIPHER 	*cipher;		/* -iek or -oek only */
+    uint8_t		publicBuffer[PEMTPM_PUBLIC_BUFFER_MAX];	/* marshal stage */
+    uint16_t		publicBufferSize;
+    uint8_t		privateBuffer[PEMTPM_PRIVATE_BUFFER_MAX];
+    uint16_t		privateBufferSize;
+    uint8_t		commandBuffer[PEMTPM_IMPORT_COMMAND_MAX];	/* -oic only */
+    uint32_t		commandSize;
+    uint8_t		keyId[PEMTPM_CONTAINER_KEY_ID_SIZE];	/* -ocf only */
+    int			stamped;		/* -stamps, the PEM size and mtime are known */
+    int			upToDate;		/* -stamps, the outputs are up to date */
+    off_t		pemSize;
+    struct timespec	pemMtime;
+    char		pemDigest[STAMP_HEX_SIZE];
+    char		params[STAMP_HEX_SIZE];
+    TPM_RC		rc;			/* first stage error */
+    uint64_t		stageTime[PEMTPM_STAGES];	/* nanoseconds, -stats only */
+    uint64_t		writeStart;		/* -stats only */
+} BATCH_JOB;
+
+typedef struct BATCH_CONTEXT {
+    const char 		*batchFilename;
+    TPMI_ALG_PUBLIC 	algPublic;
+    int			keyType;
+    const WRAPPING 	*wrapping;
+    const IMPORT_COMMANDS *importCommands;
+    unsigned long 	keysConverted;		/* updated by the write stage only */
+    unsigned long 	keysFailed;
+    unsigned long 	keysUpToDate;
+    const BATCH_STAMPS	*stamps;		/* -stamps, the previous batch */
+    FILE		*stampFile;		/* -stamps, the new stamps, NULL for none */
+    PEMTPM_WRITER	*writer;		/* the output files */
+    PEMTPM_CONTAINER	*container;		/* -ocf, NULL for none */
+    size_t		syncKeys;		/* -sync, 0 for none */
+    PEMTPM_QUEUE 	*freeJobs;		/* NULL for a single job */
+    BATCH_JOB 		**pendingJobs;		/* write stage reordering, NULL for none */
+    size_t 		pendingSize;		/* the job pool size */
+    unsigned long 	nextSequence;		/* the next job to write */
+} BATCH_CONTEXT;
+
+typedef void (*BatchStageFunction_t)(BATCH_CONTEXT *batchContext, BATCH_JOB *job);
+
+typedef struct BATCH_STAGE {
+    size_t		stageIndex;	/* into stageFunctions[] */
+    BATCH_CONTEXT 	*batchContext;
+    PEMTPM_QUEUE 	*in;
+    PEMTPM_QUEUE 	*out;		/* NULL for the last stage */
+    int 		threads;
+    int 		running;	/* threads not yet finished, protected by lock */
+    pthread_mutex_t 	lock;
+} BATCH_STAGE;
+
+/* parseBatchLine() splits a manifest or stamp line in place into its fields.  Returns the number of
+   fields, or -1 if there are more than 'fieldsMax'. */
+
+static int parseBatchLine(char 		*line,
+			  char 		**fields,
+			  int 		fieldsMax)
+{
+    int 	count = 0;
+    char 	*saveptr = NULL;
+    char 	*token;
+
+    for (token = strtok_r(line, " \t\r\n", &saveptr) ;
+	 token != NULL ;
+	 token = strtok_r(NULL, " \t\r\n", &saveptr)) {
+	if (count == fieldsMax) {
+	    return -1;
+	}
+	fields[count++] = token;
+    }
+    return count;
+}
+
+/* parseBatchJob() fills the job from job->line.  Returns 0 for a key, 1 for a line to skip, -1 for
+   a malformed line. */
+
+static int parseBatchJob(BATCH_JOB 		*job,
+			 TPMI_ALG_HASH 		nalg,
+			 TPMI_ALG_HASH		halg,
+			 int			wrap,
+			 int			container)
+{
+    char 	*fields[BATCH_FIELDS_MAX];
+    int		fieldCount;
+    int		hashField = container ? 2 : wrap ? 5 : 4;	/* first optional field */
+
+    fieldCount = parseBatchLine(job->line, fields, BATCH_FIELDS_MAX);
+    if ((fieldCount == 0) || (fields[0][0] == '#')) {
+	return 1;
+    }
+    job->nalg = nalg;
+    job->halg = halg;
+    if ((fieldCount < hashField) || (fieldCount > hashField + 2) ||
+	((fieldCount > hashField) && (getHashAlgorithm(&job->nalg, fields[hashField]) != 0)) ||
+	((fieldCount > hashField + 1) &&
+	 (getHashAlgorithm(&job->halg, fields[hashField + 1]) != 0))) {
+	return -1;
+    }
+    job->pemKeyFilename = fields[0];
+    job->password = (strcmp(fields[1], "-") == 0) ? "" : fields[1];
+    job->outPublicFilename = container ? NULL : fields[2];
+    job->outPrivateFilename = container ? NULL : fields[3];
+    job->outSeedFilename = (wrap && !container) ? fields[4] : NULL;
+    job->stamped = FALSE;
+    job->upToDate = FALSE;
+    /* batchFinishJob() clears the buffers, which a failed or up to date job never fills */
+    job->privateBufferSize = 0;
+    job->commandSize = 0;
+    job->rc = 0;
+    memset(job->stageTime, 0, sizeof(job->stageTime));
+    return 0;
+}
+
+/* bytesToHex() formats 'size' bytes as lower case hex */
+
+static void bytesToHex(char 		*hex,
+		       const uint8_t 	*bytes,
+		       size_t		size)
+{
+    static const char hexDigits[] = "0123456789abcdef";
+    size_t i;
+
+    for (i = 0 ; i < size ; i++) {
+	hex[2 * i] = hexDigits[bytes[i] >> 4];
+	hex[2 * i + 1] = hexDigits[bytes[i] & 0x0f];
+    }
+    hex[2 * size] = '\0';
+    return;
+}
+
+/* digestToHex() formats a SHA-256 digest as lower case hex */
+
+static void digestToHex(char 		*hex,
+			const uint8_t 	*digest)
+{
+    bytesToHex(hex, digest, SHA256_DIGEST_LENGTH);
+    return;
+}
+
+/* compareStamps() orders stamps by opr */
+
+static int compareStamps(const void *a, const void *b)
+{
+    const BATCH_STAMP *stampA = a;
+    const BATCH_STAMP *stampB = b;
+
+    return strcmp(stampA->fields[STAMP_OPR], stampB->fields[STAMP_OPR]);
+}
+
+/* deleteStamps() frees the stamps read by loadStamps() */
+
+static void deleteStamps(BATCH_STAMPS *stamps)
+{
+    size_t i;
+
+    for (i = 0 ; i < stamps->count ; i++) {
+	free(stamps->stamps[i].line);
+    }
+    free(stamps->stamps);
+    stamps->stamps = NULL;
+    stamps->count = 0;
+    return;
+}
+
+/* loadStamps() reads and sorts the stamps written by the previous batch.  A missing file is no
+   stamps, and a malformed line is ignored, so its key is converted again. */
+
+static TPM_RC loadStamps(BATCH_STAMPS 	*stamps,
+			 const char 	*stampsFilename)
+{
+    TPM_RC	rc = 0;
+    FILE	*stampsFile = NULL;
+    char	line[2 * BATCH_LINE_MAX];	/* the manifest fields and the stamp */
+    size_t	allocated = 0;
+    size_t	length;
+
+    stamps->stamps = NULL;
+    stamps->count = 0;
+    stamps->salted = FALSE;
+    stampsFile = fopen(stampsFilename, "r");	/* closed @1 */
+    if (stampsFile == NULL) {
+	if (errno != ENOENT) {
+	    printf("loadStamps: Error opening %s, %s\n", stampsFilename, strerror(errno));
+	    rc = TSS_RC_FILE_OPEN;
+	}
+	return rc;
+    }
+    /* stamps without a salt have other params, so their keys are converted again */
+    if ((fgets(line, sizeof(line), stampsFile) != NULL) &&
+	(strncmp(line, "# salt ", 7) == 0) &&
+	(strspn(line + 7, "0123456789abcdef") == 2 * STAMP_SALT_SIZE)) {
+	size_t i;
+
+	for (i = 0 ; i < STAMP_SALT_SIZE ; i++) {
+	    sscanf(line + 7 + 2 * i, "%2hhx", &stamps->salt[i]);
+	}
+	stamps->salted = TRUE;
+    }
+    while ((rc == 0) && stamps->salted && (fgets(line, sizeof(line), stampsFile) != NULL)) {
+	BATCH_STAMP *stamp;
+
+	length = strlen(line) + 1;
+	if (stamps->count == allocated) {
+	    rc = TSS_ArrayGrow((unsigned char **)&stamps->stamps, &allocated, sizeof(BATCH_STAMP));
+	}
+	if (rc == 0) {
+	    stamp = &stamps->stamps[stamps->count];
+	    stamp->line = NULL;
+	    rc = TSS_Malloc((unsigned char **)&stamp->line, length);	/* freed by deleteStamps() */
+	}
+	if (rc == 0) {
+	    memcpy(stamp->line, line, length);
+	    if ((parseBatchLine(stamp->line, stamp->fields, STAMP_FIELDS) == STAMP_FIELDS) &&
+		(strlen(stamp->fields[STAMP_DIGEST]) == STAMP_HEX_SIZE - 1)) {
+		stamps->count++;
+	    }
+	    else {
+		free(stamp->line);
+	    }
+	}
+    }
+    fclose(stampsFile);				/* @1 */
+    if (rc == 0) {
+	qsort(stamps->stamps, stamps->count, sizeof(BATCH_STAMP), compareStamps);
+    }
+    else {
+	deleteStamps(stamps);
+    }
+    return rc;
+}
+
+/* stampParams() computes the params field of the job's stamp */
+
+static void stampParams(BATCH_CONTEXT *batchContext, BATCH_JOB *job)
+{
+    const WRAPPING	*wrapping = batchContext->wrapping;
+    uint8_t		params[STAMP_SALT_SIZE + 12 + SHA256_DIGEST_LENGTH +
+			       2 + sizeof(wrapping->encryptionKey.t.buffer) + 2 + BATCH_LINE_MAX];
+    uint8_t		digest[SHA256_DIGEST_LENGTH];
+    uint32_t		keyType = batchContext->keyType;
+    uint16_t		keySize = wrapping->encryptionKey.t.size;
+    uint16_t		passwordSize = (uint16_t)strlen(job->password);
+    size_t		paramsSize = 0;
+
+    memcpy(params, batchContext->stamps->salt, STAMP_SALT_SIZE);
+    paramsSize = STAMP_SALT_SIZE;
+    memcpy(params + paramsSize, "PMST", 4);
+    paramsSize += 4;
+    params[paramsSize++] = (uint8_t)(batchContext->algPublic >> 8);
+    params[paramsSize++] = (uint8_t)(batchContext->algPublic >> 0);
+    params[paramsSize++] = (uint8_t)(keyType >> 8);
+    params[paramsSize++] = (uint8_t)(keyType >> 0);
+    params[paramsSize++] = (uint8_t)(job->nalg >> 8);
+    params[paramsSize++] = (uint8_t)(job->nalg >> 0);
+    params[paramsSize++] = (uint8_t)(job->halg >> 8);
+    params[paramsSize++] = (uint8_t)(job->halg >> 0);
+    /* all zero without -ipp */
+    memcpy(params + paramsSize, wrapping->parentDigest, SHA256_DIGEST_LENGTH);
+    paramsSize += SHA256_DIGEST_LENGTH;
+    params[paramsSize++] = (uint8_t)(keySize >> 8);
+    params[paramsSize++] = (uint8_t)(keySize >> 0);
+    memcpy(params + paramsSize, wrapping->encryptionKey.t.buffer, keySize);
+    paramsSize += keySize;
+    /* the password is a field of the manifest line, so it fits */
+    params[paramsSize++] = (uint8_t)(passwordSize >> 8);
+    params[paramsSize++] = (uint8_t)(passwordSize >> 0);
+    memcpy(params + paramsSize, job->password, passwordSize);
+    paramsSize += passwordSize;
+    SHA256(params, paramsSize, digest);
+    digestToHex(job->params, digest);
+    memset(params, 0, paramsSize);
+    return;
+}
+
+/* statOutput() formats the size and mtime of the output 'filename' as a stamp field, "-" if
+   'filename' is NULL.  Returns FALSE if the output cannot be stat'ed. */
+
+static int statOutput(char		*field,
+		      const char	*filename)
+{
+    struct stat		statBuffer;
+
+    if (filename == NULL) {
+	strcpy(field, "-");
+	return TRUE;
+    }
+    if (stat(filename, &statBuffer) != 0) {
+	return FALSE;
+    }
+    snprintf(field, STAMP_STAT_SIZE, "%llu:%lld.%09ld",
+	     (unsigned long long)statBuffer.st_size,
+	     (long long)statBuffer.st_mtim.tv_sec, (long)statBuffer.st_mtim.tv_nsec);
+    return TRUE;
+}
+
+/* findStamp() returns the previous stamp of the job's outputs, or NULL if there is none, it
+   names other files or parameters, or an output is missing or was changed since */
+
+static const BATCH_STAMP *findStamp(BATCH_CONTEXT *batchContext, BATCH_JOB *job)
+{
+    const BATCH_STAMP	*stamp;
+    BATCH_STAMP		key;
+    char		opuStat[STAMP_STAT_SIZE];
+    char		oprStat[STAMP_STAT_SIZE];
+    char		ossStat[STAMP_STAT_SIZE];
+
+    /* a first batch has no stamps array */
+    if (batchContext->stamps->count == 0) {
+	return NULL;
+    }
+    key.fields[STAMP_OPR] = (char *)job->outPrivateFilename;
+    stamp = bsearch(&key, batchContext->stamps->stamps, batchContext->stamps->count,
+		    sizeof(BATCH_STAMP), compareStamps);
+    if ((stamp == NULL) ||
+	(strcmp(stamp->fields[STAMP_PEM], job->pemKeyFilename) != 0) ||
+	(strcmp(stamp->fields[STAMP_OPU], job->outPublicFilename) != 0) ||
+	(strcmp(stamp->fields[STAMP_OSS],
+		(job->outSeedFilename != NULL) ? job->outSeedFilename : "-") != 0) ||
+	(strcmp(stamp->fields[STAMP_PARAMS], job->params) != 0)) {
+	return NULL;
+    }
+    /* a truncated or replaced output is converted again */
+    if (!statOutput(opuStat, job->outPublicFilename) ||
+	!statOutput(oprStat, job->outPrivateFilename) ||
+	!statOutput(ossStat, job->outSeedFilename) ||
+	(strcmp(stamp->fields[STAMP_OPU_STAT], opuStat) != 0) ||
+	(strcmp(stamp->fields[STAMP_OPR_STAT], oprStat) != 0) ||
+	(strcmp(stamp->fields[STAMP_OSS_STAT], ossStat) != 0)) {
+	return NULL;
+    }
+    return stamp;
+}
+
+/* writeStamp() appends the job's new stamp, once its outputs are written.  An output that cannot
+   be stat'ed leaves the key without a stamp, so it is converted again. */
+
+static void writeStamp(BATCH_CONTEXT *batchContext, BATCH_JOB *job)
+{
+    char		opuStat[STAMP_STAT_SIZE];
+    char		oprStat[STAMP_STAT_SIZE];
+    char		ossStat[STAMP_STAT_SIZE];
+
+    if (!statOutput(opuStat, job->outPublicFilename) ||
+	!statOutput(oprStat, job->outPrivateFilename) ||
+	!statOutput(ossStat, job->outSeedFilename)) {
+	return;
+    }
+    fprintf(batchContext->stampFile, "%s %s %s %s %llu %lld.%09ld %s %s %s %s %s\n",
+	    job->pemKeyFilename,
+	    job->outPublicFilename,
+	    job->outPrivateFilename,
+	    (job->outSeedFilename != NULL) ? job->outSeedFilename : "-",
+	    (unsigned long long)job->pemSize,
+	    (long long)job->pemMtime.tv_sec, (long)job->pemMtime.tv_nsec,
+	    job->pemDigest,
+	    job->params,
+	    opuStat,
+	    oprStat,
+	    ossStat);
+    return;
+}
+
+/* batchReadStage() reads the PEM file into memory.  With -stamps, it first decides whether the
+   key is up to date, in which case the file is not read if its size and mtime are unchanged. */
+
+static void batchReadStage(BATCH_CONTEXT *batchContext, BATCH_JOB *job)
+{
+    const BATCH_STAMP	*stamp = NULL;
+    struct stat		statBuffer;
+    char		size[24];
+    char		mtime[48];
+    uint8_t		digest[SHA256_DIGEST_LENGTH];
+
+    if (batchContext->stampFile != NULL) {
+	stampParams(batchContext, job);
+	stamp = findStamp(batchContext, job);
+	/* a PEM file that cannot be stat'ed is left to the read to report */
+	if (stat(job->pemKeyFilename, &statBuffer) == 0) {
+	    job->stamped = TRUE;
+	    job->pemSize = statBuffer.st_size;
+	    job->pemMtime = statBuffer.st_mtim;
+	}
+    }
+    if ((stamp != NULL) && job->stamped) {
+	snprintf(size, sizeof(size), "%llu", (unsigned long long)job->pemSize);
+	snprintf(mtime, sizeof(mtime), "%lld.%09ld",
+		 (long long)job->pemMtime.tv_sec, (long)job->pemMtime.tv_nsec);
+	if ((strcmp(stamp->fields[STAMP_SIZE], size) == 0) &&
+	    (strcmp(stamp->fields[STAMP_MTIME], mtime) == 0)) {
+	    memcpy(job->pemDigest, stamp->fields[STAMP_DIGEST], STAMP_HEX_SIZE);
+	    job->upToDate = TRUE;
+	    return;
+	}
+    }
+    job->rc = TSS_File_ReadBinaryFileBuffer(job->pemData,
+					    &job->pemLength,
+					    sizeof(job->pemData),
+					    job->pemKeyFilename);
+    if ((job->rc == 0) && job->stamped) {
+	SHA256(job->pemData, job->pemLength, digest);
+	digestToHex(job->pemDigest, digest);
+	/* touched but unchanged */
+	if ((stamp != NULL) && (strcmp(stamp->fields[STAMP_DIGEST], job->pemDigest) == 0)) {
+	    job->upToDate = TRUE;
+	}
+    }
+    return;
+}
+
+/* batchParseStage() decrypts and parses the PEM key and converts it to TPM structures.  When the
+   duplicate is wrapped, it also marshals the public, which the Name needs, and wraps it. */
+
+static void batchParseStage(BATCH_CONTEXT *batchContext, BATCH_JOB *job)
+{
+    job->rc = convertPem(&job->objectPublic,
+			 &job->duplicate,
+			 batchContext->algPublic,
+			 batchContext->keyType,
+			 job->nalg,
+			 job->halg,
+			 job->pemData,
+			 job->pemLength,
+			 job->password);
+    if ((job->rc == 0) && isWrapped(batchContext->wrapping)) {
+	job->rc = PEMTPM_MarshalPublic(job->publicBuffer,
+				       &job->publicBufferSize,
+				       sizeof(job->publicBuffer),
+				       &job->name,
+				       &job->objectPublic);
+    }
+    if ((job->rc == 0) && isWrapped(batchContext->wrapping)) {
+	job->rc = wrapDuplicate(&job->duplicate, &job->inSymSeed, &job->name,
+				batchContext->wrapping, job->cipher);
+    }
+    return;
+}
+
+/* batchMarshalStage() marshals the TPM2B_PUBLIC and TPM2B_PRIVATE, and with -oic the TPM2_Import
+   command.  With -ocf, it also computes the Name and the key ID. */
+
+static void batchMarshalStage(BATCH_CONTEXT *batchContext, BATCH_JOB *job)
+{
+    /* a wrapped duplicate needs the Name, so the parse stage has already marshaled the public */
+    if (!isWrapped(batchContext->wrapping)) {
+	job->rc = PEMTPM_MarshalPublic(job->publicBuffer,
+				       &job->publicBufferSize,
+				       sizeof(job->publicBuffer),
+				       (batchContext->container != NULL) ? &job->name : NULL,
+				       &job->objectPublic);
+    }
+    /* the key ID is the digest of the TPMT_PUBLIC, after the TPM2B size */
+    if ((job->rc == 0) && (batchContext->container != NULL)) {
+	SHA256(job->publicBuffer + sizeof(uint16_t), job->publicBufferSize - sizeof(uint16_t),
+	       job->keyId);
+    }
+    if (job->rc == 0) {
+	job->rc = TSS_Structure_MarshalBuffer(job->privateBuffer,
+					      &job->privateBufferSize,
+					      sizeof(job->privateBuffer),
+					      &job->duplicate,
+					      (MarshalFunction_t)PEMTPM_Marshal_TPM2B_PRIVATE);
+    }
+    if ((job->rc == 0) && (batchContext->importCommands->commandFile != NULL)) {
+	job->rc = marshalImportCommand(job->commandBuffer,
+				       &job->commandSize,
+				       sizeof(job->commandBuffer),
+				       &job->objectPublic,
+				       &job->duplicate,
+				       &job->inSymSeed,
+				       batchContext->wrapping,
+				       batchContext->importCommands);
+    }
+    return;
+}
+
+/* appendContainerRecord() appends the outputs of a converted key to the -ocf container */
+
+static TPM_RC appendContainerRecord(BATCH_CONTEXT *batchContext, BATCH_JOB *job)
+{
+    PEMTPM_CONTAINER_RECORD	record;
+
+    memset(&record, 0, sizeof(record));
+    record.sourceId = (const uint8_t *)job->pemKeyFilename;
+    record.sourceIdSize = (uint16_t)strlen(job->pemKeyFilename);
+    record.name = job->name.t.name;
+    record.nameSize = job->name.t.size;
+    record.algPublic = batchContext->algPublic;
+    record.keyType = (uint16_t)batchContext->keyType;
+    record.nalg = job->nalg;
+    record.halg = job->halg;
+    record.objectPublic = job->publicBuffer;
+    record.objectPublicSize = job->publicBufferSize;
+    record.duplicate = job->privateBuffer;
+    record.duplicateSize = job->privateBufferSize;
+    if (batchContext->wrapping->parent != NULL) {
+	record.inSymSeed = job->inSymSeed.t.secret;
+	record.inSymSeedSize = job->inSymSeed.t.size;
+    }
+    return PEMTPM_Container_Append(batchContext->container, job->keyId, &record);
+}
+
+/* batchFinishJob() reports the result of a job whose files are written, and recycles the job */
+
+static void batchFinishJob(BATCH_CONTEXT *batchContext, BATCH_JOB *job)
+{
+    if ((job->rc == 0) && !job->upToDate && (batchContext->importCommands->commandFile != NULL)) {
+	job->rc = writeImportCommand(batchContext->importCommands,
+				     job->commandBuffer, job->commandSize);
+    }
+    if ((job->rc == 0) && (batchContext->container != NULL)) {
+	job->rc = appendContainerRecord(batchContext, job);
+    }
+    if ((job->rc == 0) && job->stamped) {
+	writeStamp(batchContext, job);
+    }
+    if ((job->rc == 0) && job->upToDate) {
+	batchContext->keysUpToDate++;
+    }
+    else if (job->rc == 0) {
+	batchContext->keysConverted++;
+    }
+    else {
+	printf("processBatchFile: %s line %lu, %s failed, rc %08x\n",
+	       batchContext->batchFilename, job->lineNumber, job->pemKeyFilename, job->rc);
+	batchContext->keysFailed++;
+    }
+    /* timed here rather than by runBatchStage(), since the job is recycled below */
+    if (pemtpmStats) {
+	int	s;
+
+	job->stageTime[PEMTPM_STAGE_WRITE] = PEMTPM_Stats_Now() - job->writeStart;
+	PEMTPM_Stats_Time(PEMTPM_STAGE_WRITE, job->stageTime[PEMTPM_STAGE_WRITE]);
+	PEMTPM_Stats_Count((job->rc != 0) ? PEMTPM_STAT_KEYS_FAILED :
+			   job->upToDate ? PEMTPM_STAT_KEYS_UP_TO_DATE :
+			   PEMTPM_STAT_KEYS_CONVERTED, 1);
+	flockfile(stderr);
+	fprintf(stderr, "{\"line\": %lu, \"pem\": ", job->lineNumber);
+	PEMTPM_Stats_PrintJsonString(stderr, job->pemKeyFilename);
+	fprintf(stderr, ", \"rc\": %u", job->rc);
+	for (s = 0 ; s < PEMTPM_STAGES ; s++) {
+	    fprintf(stderr, ", \"%s_us\": %.1f", pemtpmStageNames[s], job->stageTime[s] / 1e3);
+	}
+	fprintf(stderr, "}\n");
+	funlockfile(stderr);
+    }
+    /* the duplicate is the unencrypted private key */
+    memset(&job->duplicate, 0, sizeof(job->duplicate));
+    memset(job->privateBuffer, 0, job->privateBufferSize);
+    if (batchContext->importCommands->commandFile != NULL) {
+	memset(job->commandBuffer, 0, job->commandSize);
+    }
+    if (batchContext->freeJobs != NULL) {
+	PEMTPM_Queue_Put(batchContext->freeJobs, job);
+    }
+    return;
+}
+
+/* batchCompleteJobs() finishes the jobs whose files are written, in the order they were handed to
+   the writer.  It waits for the oldest job if the writer is full, and for every job if 'drain' is
+   TRUE. */
+
+static void batchCompleteJobs(BATCH_CONTEXT *batchContext, int drain)
+{
+    BATCH_JOB	*job;
+    TPM_RC	rc;
+    int		wait = drain || PEMTPM_Writer_Full(batchContext->writer);
+
+    while ((job = PEMTPM_Writer_Complete(batchContext->writer, &rc, wait)) != NULL) {
+	if (job->rc == 0) {
+	    job->rc = rc;
+	}
+	batchFinishJob(batchContext, job);
+	wait = drain;
+    }
+    return;
+}
+
+/* batchWriteJob() hands the output files to the writer, each with its temporary name.  A job
+   that failed, is up to date, or goes to the -ocf container has no files, and goes through the
+   writer so that it is reported in order. */
+
+static void batchWriteJob(BATCH_CONTEXT *batchContext, BATCH_JOB *job)
+{
+    PEMTPM_WRITER_FILE	files[PEMTPM_WRITER_FILES_MAX];
+    size_t		count = 0;
+    char		*tempFilename = job->tempFilenames;
+    size_t		f;
+
+    if (pemtpmStats) job->writeStart = PEMTPM_Stats_Now();
+    if ((job->rc == 0) && !job->upToDate && (batchContext->container == NULL)) {
+	files[count].filename = job->outPublicFilename;
+	files[count].data = job->publicBuffer;
+	files[count].length = job->publicBufferSize;
+	count++;
+	files[count].filename = job->outPrivateFilename;
+	files[count].data = job->privateBuffer;
+	files[count].length = job->privateBufferSize;
+	count++;
+	if (job->outSeedFilename != NULL) {
+	    files[count].filename = job->outSeedFilename;
+	    files[count].data = job->inSymSeed.t.secret;
+	    files[count].length = job->inSymSeed.t.size;
+	    count++;
+	}
+    }
+    /* the names fit, since they are fields of the manifest line */
+    for (f = 0 ; f < count ; f++) {
+	files[f].tempFilename = tempFilename;
+	tempFilename += sprintf(tempFilename, "%s.tmp", files[f].filename) + 1;
+    }
+    batchCompleteJobs(batchContext, FALSE);
+    PEMTPM_Writer_Submit(batchContext->writer, files, count, job);
+    return;
+}
+
+/* batchWriteStage() writes the job.  It must run on one thread, since it updates the batch
+   counters and owns the writer.
+
+   With 'pendingJobs', jobs are written in manifest order.  At most the pool size of jobs are in
+   flight, so the sequence number modulo the pool size is a free slot.  The job the stage waits
+   for has already been queued, so holding jobs here cannot starve the reader of free jobs.
+*/
+
+static void batchWriteStage(BATCH_CONTEXT *batchContext, BATCH_JOB *job)
+{
+    if (batchContext->pendingJobs == NULL) {
+	batchWriteJob(batchContext, job);
+	return;
+    }
+    batchContext->pendingJobs[job->sequence % batchContext->pendingSize] = job;
+    while ((job = batchContext->pendingJobs[batchContext->nextSequence %
+					    batchContext->pendingSize]) != NULL) {
+	batchContext->pendingJobs[batchContext->nextSequence % batchContext->pendingSize] = NULL;
+	batchContext->nextSequence++;
+	batchWriteJob(batchContext, job);
+    }
+    return;
+}
+
+static void runBatchStage(size_t s, BATCH_CONTEXT *batchContext, BATCH_JOB *job);
+
+/* batchStageThread() runs one stage until its input queue is closed and drained.  A job that has
+   already failed or is up to date is passed through untouched so that the last stage reports it.
+   The last thread of a stage to finish closes the next queue.
+*/
+
+static void *batchStageThread(void *arg)
+{
+    BATCH_STAGE *stage = arg;
+    BATCH_JOB 	*job;
+
+    for ( ; ; ) {
+	/* the write stage finishes the writes it has before waiting for more jobs, so that a job
+	   is not held in the writer while the reader waits for a free job.  With -sync, the pool
+	   has a job for each one the writer holds. */
+	if ((stage->out == NULL) && PEMTPM_Queue_Empty(stage->in)) {
+	    batchCompleteJobs(stage->batchContext, (stage->batchContext->syncKeys == 0));
+	}
+	job = PEMTPM_Queue_Get(stage->in);
+	if (job == NULL) {
+	    if (stage->out == NULL) {
+		batchCompleteJobs(stage->batchContext, TRUE);
+	    }
+	    break;
+	}
+	if (((job->rc == 0) && !job->upToDate) || (stage->out == NULL)) {
+	    runBatchStage(stage->stageIndex, stage->batchContext, job);
+	}
+	if (stage->out != NULL) {
+	    PEMTPM_Queue_Put(stage->out, job);
+	}
+    }
+    pthread_mutex_lock(&stage->lock);
+    stage->running--;
+    if ((stage->running == 0) && (stage->out != NULL)) {
+	PEMTPM_Queue_Close(stage->out);
+    }
+    pthread_mutex_unlock(&stage->lock);
+    return NULL;
+}
+
+/* the pipeline stages in order, indexed by PEMTPM_STAGE_ */
+
+static const BatchStageFunction_t stageFunctions[] = {
+    batchReadStage,
+    batchParseStage,
+    batchMarshalStage,
+    batchWriteStage
+};
+
+#define BATCH_STAGES (sizeof(stageFunctions) / sizeof(stageFunctions[0]))
+
+/* runBatchStage() runs stage 's' on the job.  With -stats, it times every stage but the last,
+   which times itself. */
+
+static void runBatchStage(size_t s, BATCH_CONTEXT *batchContext, BATCH_JOB *job)
 {
-    TPM_RC 	rc = 0;
-    FILE 	*pemKeyFile = NULL;
+    uint64_t	start;
+
+    if (!pemtpmStats || (s + 1 == BATCH_STAGES)) {
+	stageFunctions[s](batchContext, job);
+    }
+    else {
+	start = PEMTPM_Stats_Now();
+	stageFunctions[s](batchContext, job);
+	job->stageTime[s] = PEMTPM_Stats_Now() - start;
+	PEMTPM_Stats_Time(s, job->stageTime[s]);
+    }
+    return;
+}
+
+/* processBatchFile() converts every key listed in the manifest 'batchFilename' in this process,
+   using 'jobs' parse threads.  If 'stampsFilename' is not NULL, keys that are up to date are
+   skipped, and the stamps file is replaced when the batch completes.  If 'containerFilename' is
+   not NULL, the outputs go to that container.  If 'syncKeys' is not 0, the outputs are synced
+   every 'syncKeys' keys.
+
+   A failing key is reported and skipped.  Returns an error if any key failed.
+*/
+
+static TPM_RC processBatchFile(TPMI_ALG_PUBLIC 	algPublic,
+			       int			keyType,
+			       TPMI_ALG_HASH 		nalg,
+			       TPMI_ALG_HASH		halg,
+			       const char 		*batchFilename,
+			       const WRAPPING 		*wrapping,
+			       const IMPORT_COMMANDS 	*importCommands,
+			       const char 		*stampsFilename,
+			       const char 		*containerFilename,
+			       size_t			syncKeys,
+			       int			jobs)
+{
+    TPM_RC 		rc = 0;
+    FILE 		*batchFile = NULL;
+    BATCH_CONTEXT 	batchContext;
+    BATCH_STAMPS 	stamps;
+    char 		*tempStampsFilename = NULL;
+    PEMTPM_QUEUE 	queues[BATCH_STAGES];
+    BATCH_STAGE 	stages[BATCH_STAGES];
+    PEMTPM_QUEUE 	freeJobs;
+    BATCH_JOB 		**jobPool = NULL;
+    size_t 		poolSize = 1;
+    size_t 		poolCount = 0;
+    size_t 		writerDepth = 1;
+    pthread_t 		*threads = NULL;
+    size_t 		threadCount = 0;
+    size_t 		queueCount = 0;
+    size_t 		s;
+    size_t 		t;
+    BATCH_JOB 		*job = NULL;
+    unsigned long 	lineNumber = 0;
+    unsigned long 	sequence = 0;
+    unsigned long 	linesMalformed = 0;
+
+    batchContext.batchFilename = batchFilename;
+    batchContext.algPublic = algPublic;
+    batchContext.keyType = keyType;
+    batchContext.wrapping = wrapping;
+    batchContext.importCommands = importCommands;
+    batchContext.pendingJobs = NULL;
+    batchContext.nextSequence = 0;
+    batchContext.keysConverted = 0;
+    batchContext.keysFailed = 0;
+    batchContext.keysUpToDate = 0;
+    batchContext.stamps = &stamps;
+    batchContext.stampFile = NULL;
+    batchContext.freeJobs = NULL;
+    batchContext.writer = NULL;
+    batchContext.container = NULL;
+    batchContext.syncKeys = syncKeys;
+    freeJobs.items = NULL;
+    stamps.stamps = NULL;
+    stamps.count = 0;
+    stamps.salted = FALSE;
+
+    if (rc == 0) {
+	rc = TSS_File_Open(&batchFile, batchFilename, "r");	/* closed @1 */
+    }
+    /* a stamp and a container key ID are SHA-256 digests */
+    if ((rc == 0) && ((stampsFilename != NULL) || (containerFilename != NULL))) {
+	rc = PEMTPM_Libcrypto_Load();
+    }
+    if ((rc == 0) && (containerFilename != NULL)) {
+	rc = PEMTPM_Container_Create(&batchContext.container,	/* closed @13 */
+				     containerFilename,
+				     ((wrapping->encryptionKey.t.size != 0) ?
+				      PEMTPM_CONTAINER_INNER : 0) |
+				     ((wrapping->parent != NULL) ? PEMTPM_CONTAINER_OUTER : 0),
+				     (wrapping->parent != NULL) ? wrapping->parentDigest : NULL);
+    }
+    /* the new stamps are written beside the old, and renamed over them at the end */
+    if ((rc == 0) && (stampsFilename != NULL)) {
+	rc = loadStamps(&stamps, stampsFilename);		/* freed @9 */
+    }
+    if ((rc == 0) && (stampsFilename != NULL)) {
+	rc = TSS_Malloc((unsigned char **)&tempStampsFilename,	/* freed @10 */
+			strlen(stampsFilename) + sizeof(".tmp"));
+    }
+    /* a new stamps file, or one from before the salt, gets a new salt */
+    if ((rc == 0) && (stampsFilename != NULL) && !stamps.salted) {
+	if (RAND_bytes(stamps.salt, sizeof(stamps.salt)) != 1) {
+	    printf("processBatchFile: Error generating the stamps salt\n");
+	    rc = TSS_RC_RNG_FAILURE;
+	}
+    }
+    if ((rc == 0) && (stampsFilename != NULL)) {
+	sprintf(tempStampsFilename, "%s.tmp", stampsFilename);
+	rc = TSS_File_Open(&batchContext.stampFile, tempStampsFilename, "w");	/* closed @11 */
+    }
+    if ((rc == 0) && (stampsFilename != NULL)) {
+	char	saltHex[2 * STAMP_SALT_SIZE + 1];
 
+	bytesToHex(saltHex, stamps.salt, sizeof(stamps.salt));
+	fprintf(batchContext.stampFile, "# salt %s\n", saltHex);
+    }
+    /* enough jobs to fill every queue, and with -sync, every job the writer holds */
     if (rc == 0) {
-	rc = TSS_File_Open(&pemKeyFile, pemKeyFilename, "rb"); 	/* closed @2 */
+	if (jobs > 1) {
+	    poolSize = jobs * BATCH_QUEUE_DEPTH * BATCH_STAGES;
+	    writerDepth = jobs * BATCH_QUEUE_DEPTH;
+	}
+	if (syncKeys > 0) {
+	    if (writerDepth < syncKeys) {
+		writerDepth = syncKeys;
+	    }
+	    poolSize += writerDepth;
+	}
+	rc = TSS_ArrayMalloc((unsigned char **)&jobPool,		/* freed @4 */
+			     poolSize, sizeof(BATCH_JOB *));
+    }
+    for (poolCount = 0 ; (rc == 0) && (poolCount < poolSize) ; ) {
+	jobPool[poolCount] = NULL;
+	rc = TSS_Malloc((unsigned char **)&jobPool[poolCount], sizeof(BATCH_JOB));	/* freed @5 */
+	if (rc == 0) {
+	    jobPool[poolCount]->cipher = NULL;
+	    poolCount++;
+	    if (wrapping->encryptionKey.t.size != 0) {
+		rc = PEMTPM_Cipher_Create(&jobPool[poolCount - 1]->cipher);	/* freed @7 */
+	    }
+	}
+    }
+    /* the commands and records share one file, so they are written in order */
+    if ((rc == 0) && (jobs > 1) &&
+	((importCommands->commandFile != NULL) || (batchContext.container != NULL))) {
+	batchContext.pendingJobs = calloc(poolSize, sizeof(BATCH_JOB *));	/* freed @8 */
+	if (batchContext.pendingJobs == NULL) {
+	    if (tssVerbose) printf("processBatchFile: Error allocating %lu pending jobs\n",
+				   (unsigned long)poolSize);
+	    rc = TSS_RC_OUT_OF_MEMORY;
+	}
+	else {
+	    batchContext.pendingSize = poolSize;
+	}
     }
+    /* fewer jobs than the pool in the writer, so the reader always has a job coming back */
     if (rc == 0) {
-	*evpPkey = PEM_read_PrivateKey(pemKeyFile, NULL, NULL, (void *)password);
-	if (*evpPkey == NULL) {
-	    printf("convertPemToEvpPrivKey: Error reading key file %s\n", pemKeyFilename);
+	rc = PEMTPM_Writer_Create(&batchContext.writer,		/* freed @12 */
+				  writerDepth, syncKeys);
+    }
+    if ((rc == 0) && pemtpmStats) {
+	PEMTPM_Stats_Writer(PEMTPM_Writer_Method(batchContext.writer));
+    }
+    if ((rc == 0) && (poolSize > 1)) {
+	rc = PEMTPM_Queue_Init(&freeJobs, poolSize);		/* freed @6 */
+	if (rc == 0) {
+	    batchContext.freeJobs = &freeJobs;
+	    for (t = 0 ; t < poolSize ; t++) {
+		PEMTPM_Queue_Put(&freeJobs, jobPool[t]);
+	    }
+	}
+    }
+    /* start the pipeline, stage s reads queue s and writes queue s+1 */
+    if ((rc == 0) && (jobs > 1)) {
+	for (s = 0 ; (rc == 0) && (s < BATCH_STAGES) ; s++) {
+	    rc = PEMTPM_Queue_Init(&queues[s], jobs * BATCH_QUEUE_DEPTH);	/* freed @2 */
+	    if (rc == 0) {
+		queueCount++;
+	    }
+	}
+	if (rc == 0) {
+	    rc = TSS_Malloc((unsigned char **)&threads,			/* freed @3 */
+			    (jobs + BATCH_STAGES) * sizeof(pthread_t));
+	}
+	for (s = 0 ; (rc == 0) && (s < BATCH_STAGES) ; s++) {
+	    stages[s].stageIndex = s;
+	    stages[s].batchContext = &batchContext;
+	    stages[s].in = &queues[s];
+	    stages[s].out = (s + 1 < BATCH_STAGES) ? &queues[s + 1] : NULL;
+	    /* only the parse stage is CPU bound, the write stage must be single threaded */
+	    stages[s].threads = (stageFunctions[s] == batchParseStage) ? jobs : 1;
+	    stages[s].running = stages[s].threads;
+	    pthread_mutex_init(&stages[s].lock, NULL);
+	    for (t = 0 ; (rc == 0) && (t < (size_t)stages[s].threads) ; t++) {
+		if (pthread_create(&threads[threadCount], NULL,
+				   batchStageThread, &stages[s]) != 0) {
+		    printf("processBatchFile: Error creating thread\n");
+		    rc = EXIT_FAILURE;
+		}
+		else {
+		    threadCount++;
+		}
+	    }
+	}
+	if (rc != 0) {
+	    /* cannot recover a partially started pipeline */
+	    exit(EXIT_FAILURE);
+	}
+    }
+    while (rc == 0) {
+	int 	irc;
+
+	if (job == NULL) {
+	    job = (batchContext.freeJobs != NULL) ? PEMTPM_Queue_Get(&freeJobs) : jobPool[0];
+	}
+	if (fgets(job->line, sizeof(job->line), batchFile) == NULL) {
+	    break;
+	}
+	lineNumber++;
+	if ((strchr(job->line, '\n') == NULL) && !feof(batchFile)) {
+	    printf("processBatchFile: %s line %lu too long\n", batchFilename, lineNumber);
 	    rc = EXIT_FAILURE;
+	    break;
+	}
+	irc = parseBatchJob(job, nalg, halg, (wrapping->parent != NULL),
+			    (containerFilename != NULL));
+	if (irc > 0) {
+	    continue;		/* reuse the job */
+	}
+	if (irc < 0) {
+	    printf("processBatchFile: %s line %lu malformed\n", batchFilename, lineNumber);
+	    linesMalformed++;
+	    continue;
+	}
+	job->lineNumber = lineNumber;
+	job->sequence = sequence++;
+	if (jobs > 1) {
+	    PEMTPM_Queue_Put(&queues[0], job);
+	}
+	else {
+	    for (s = 0 ; s < BATCH_STAGES ; s++) {
+		if (((job->rc == 0) && !job->upToDate) || (s + 1 == BATCH_STAGES)) {
+		    runBatchStage(s, &batchContext, job);
+		}
+	    }
+	    /* the one job is reused for the next line */
+	    if (batchContext.freeJobs == NULL) {
+		batchCompleteJobs(&batchContext, TRUE);
+	    }
 	}
+	job = NULL;	/* recycled by the write stage */
     }
-    if (pemKeyFile != NULL) {
-	fclose(pemKeyFile);			/* @2 */
+    /* drain the pipeline */
+    if (queueCount > 0) {
+	PEMTPM_Queue_Close(&queues[0]);
+	for (t = 0 ; t < threadCount ; t++) {
+	    pthread_join(threads[t], NULL);
+	}
+	for (s = 0 ; s < BATCH_STAGES ; s++) {
+	    pthread_mutex_destroy(&stages[s].lock);
+	}
     }
-    return rc;
-}
+    else if (batchContext.writer != NULL) {
+	batchCompleteJobs(&batchContext, TRUE);
+    }
+    /* the renames are durable before the stamps that record them */
+    if (batchContext.writer != NULL) {
+	TPM_RC	syncRc = PEMTPM_Writer_Sync(batchContext.writer);
 
-static TPM_RC convertEvpPkeyToRsakey(RSA **rsaKey,		/* freed by caller */
-			      EVP_PKEY *evpPkey)
-{
-    TPM_RC 	rc = 0;
+	if (rc == 0) {
+	    rc = syncRc;
+	}
+    }
+    for (s = 0 ; s < queueCount ; s++) {
+	PEMTPM_Queue_Delete(&queues[s]);	/* @2 */
+    }
+    free(threads);				/* @3 */
+    PEMTPM_Writer_Delete(batchContext.writer);	/* @12 */
+    PEMTPM_Queue_Delete(&freeJobs);		/* @6 */
+    for (t = 0 ; t < poolCount ; t++) {
+	PEMTPM_Cipher_Delete(jobPool[t]->cipher);	/* @7 */
+	free(jobPool[t]);			/* @5 */
+    }
+    free(jobPool);				/* @4 */
+    free(batchContext.pendingJobs);		/* @8 */
+    if (batchFile != NULL) {
+	fclose(batchFile);			/* @1 */
+    }
+    /* an incomplete batch leaves no container */
+    if (batchContext.container != NULL) {
+	TPM_RC	containerRc = PEMTPM_Container_Close(batchContext.container,	/* @13 */
+						     (rc == 0), (syncKeys > 0));
 
+	if (rc == 0) {
+	    rc = containerRc;
+	}
+    }
+    /* an incomplete batch keeps the old stamps, so its keys are checked again */
+    if (batchContext.stampFile != NULL) {
+	if ((rc == 0) && (syncKeys > 0) &&
+	    ((fflush(batchContext.stampFile) != 0) ||
+	     (fsync(fileno(batchContext.stampFile)) != 0))) {
+	    printf("processBatchFile: Error syncing %s, %s\n", tempStampsFilename, strerror(errno));
+	    rc = TSS_RC_FILE_WRITE;
+	}
+	if ((fclose(batchContext.stampFile) != 0) && (rc == 0)) {	/* @11 */
+	    printf("processBatchFile: Error writing %s\n", tempStampsFilename);
+	    rc = TSS_RC_FILE_WRITE;
+	}
+	if ((rc == 0) && (rename(tempStampsFilename, stampsFilename) != 0)) {
+	    printf("processBatchFile: Error renaming %s, %s\n",
+		   tempStampsFilename, strerror(errno));
+	    rc = TSS_RC_FILE_WRITE;
+	}
+	if (rc != 0) {
+	    unlink(tempStampsFilename);
+	}
+    }
+    free(tempStampsFilename);			/* @10 */
+    deleteStamps(&stamps);			/* @9 */
     if (rc == 0) {
-	*rsaKey = EVP_PKEY_get1_RSA(evpPkey);
-	if (*rsaKey == NULL) {
-	    printf("convertEvpPkeyToRsakey: EVP_PKEY_get1_RSA failed\n");
+	batchContext.keysFailed += linesMalformed;
+	if (stampsFilename != NULL) {
+	    printf("pemtpm: batch %s, %lu converted, %lu up to date, %lu failed\n",
+		   batchFilename, batchContext.keysConverted, batchContext.keysUpToDate,
+		   batchContext.keysFailed);
+	}
+	else {
+	    printf("pemtpm: batch %s, %lu converted, %lu failed\n",
+		   batchFilename, batchContext.keysConverted, batchContext.keysFailed);
+	}
+	if (batchContext.keysFailed != 0) {
 	    rc = EXIT_FAILURE;
 	}
     }
     return rc;
 }
 
-/* getRsaKeyParts() gets the RSA key parts from an OpenSSL RSA key token.
+/* Stream mode reads concatenated PEM keys from stdin and writes one set of records per key to
+   stdout, see PEMTPM_RECORD_ in pemtpm.h.  Text outside a -----BEGIN / -----END block is ignored.
 
-   If n is not NULL, returns n, e, and d.  If p is not NULL, returns p and q.
+   stdout is the data channel.  It is moved to a new descriptor and stdout is pointed at stderr, so
+   that every diagnostic, including those printed by the library, goes to stderr.
 */
 
-static TPM_RC getRsaKeyParts(const BIGNUM **n,
-		     const BIGNUM **e,
-		     const BIGNUM **d,
-		     const BIGNUM **p,
-		     const BIGNUM **q,
-		     const RSA *rsaKey)
+#define STREAM_RECORDS_MAX	(3 * PEMTPM_RECORD_HEADER_SIZE + PEMTPM_PUBLIC_BUFFER_MAX + \
+				 PEMTPM_PRIVATE_BUFFER_MAX + sizeof(TPMU_ENCRYPTED_SECRET))
+
+/* putRecordHeader() writes a record tag and length to 'buffer' */
+
+static uint8_t *putRecordHeader(uint8_t *buffer, uint8_t tag, uint32_t length)
 {
-    TPM_RC  	rc = 0;
-#if OPENSSL_VERSION_NUMBER < 0x10100000
-    if (n != NULL) {
-	*n = rsaKey->n;
-	*e = rsaKey->e;
-	*d = rsaKey->d;
+    buffer[0] = tag;
+    buffer[1] = (uint8_t)(length >> 24);
+    buffer[2] = (uint8_t)(length >> 16);
+    buffer[3] = (uint8_t)(length >>  8);
+    buffer[4] = (uint8_t)(length >>  0);
+    return buffer + PEMTPM_RECORD_HEADER_SIZE;
+}
+
+/* putErrorRecord() writes an ERROR record holding 'rc' to 'buffer'.  Returns the record size. */
+
+static size_t putErrorRecord(uint8_t *buffer, TPM_RC rc)
+{
+    uint8_t *rcBuffer = putRecordHeader(buffer, PEMTPM_RECORD_ERROR, sizeof(TPM_RC));
+
+    rcBuffer[0] = (uint8_t)(rc >> 24);
+    rcBuffer[1] = (uint8_t)(rc >> 16);
+    rcBuffer[2] = (uint8_t)(rc >>  8);
+    rcBuffer[3] = (uint8_t)(rc >>  0);
+    return PEMTPM_RECORD_HEADER_SIZE + sizeof(TPM_RC);
+}
+
+/* marshalKeyRecords() converts one PEM key to its records in 'records', which must hold
+   STREAM_RECORDS_MAX bytes.  The structures are marshaled in place, after their record headers.
+   The duplicate is wrapped as 'wrapping' configures, and with a parent a SEED record follows.
+
+   'recordsSize' always returns valid records, an ERROR record if the conversion failed.  Returns
+   the conversion result.
+*/
+
+static TPM_RC marshalKeyRecords(uint8_t 		*records,
+				size_t 			*recordsSize,
+				TPMI_ALG_PUBLIC 	algPublic,
+				int			keyType,
+				TPMI_ALG_HASH 		nalg,
+				TPMI_ALG_HASH		halg,
+				const unsigned char 	*pemData,
+				size_t 			pemLength,
+				const char 		*pemKeyPassword,
+				const WRAPPING 		*wrapping,
+				PEMTPM_CIPHER 		*cipher)
+{
+    TPM_RC		rc = 0;
+    TPM2B_PUBLIC	objectPublic;
+    TPM2B_PRIVATE	duplicate;
+    TPM2B_ENCRYPTED_SECRET inSymSeed;
+    TPM2B_NAME		name;
+    uint8_t		*publicBuffer = records + PEMTPM_RECORD_HEADER_SIZE;
+    uint16_t		publicSize = 0;
+    uint8_t		*privateBuffer = NULL;
+    uint16_t		privateSize = 0;
+    uint64_t		start = 0;
+
+    if (pemtpmStats) start = PEMTPM_Stats_Now();
+    if (rc == 0) {
+	rc = convertPem(&objectPublic,
+			&duplicate,
+			algPublic,
+			keyType,
+			nalg,
+			halg,
+			pemData,
+			pemLength,
+			pemKeyPassword);
     }
-    if (p != NULL) {
-	*p = rsaKey->p;
-	*q = rsaKey->q;
+    if (pemtpmStats) {
+	PEMTPM_Stats_Time(PEMTPM_STAGE_CONVERT, PEMTPM_Stats_Now() - start);
+	start = PEMTPM_Stats_Now();
     }
-#else
-    if (n != NULL) {
-	RSA_get0_key(rsaKey, n, e, d);
+    if (rc == 0) {
+	rc = PEMTPM_MarshalPublic(publicBuffer,
+				  &publicSize,
+				  PEMTPM_PUBLIC_BUFFER_MAX,
+				  isWrapped(wrapping) ? &name : NULL,
+				  &objectPublic);
     }
-    if (p != NULL) {
-	RSA_get0_factors(rsaKey, p, q);
+    if ((rc == 0) && isWrapped(wrapping)) {
+	rc = wrapDuplicate(&duplicate, &inSymSeed, &name, wrapping, cipher);
     }
-#endif
+    if (rc == 0) {
+	putRecordHeader(records, PEMTPM_RECORD_PUBLIC, publicSize);
+	privateBuffer = publicBuffer + publicSize + PEMTPM_RECORD_HEADER_SIZE;
+	rc = TSS_Structure_MarshalBuffer(privateBuffer,
+					 &privateSize,
+					 PEMTPM_PRIVATE_BUFFER_MAX,
+					 &duplicate,
+					 (MarshalFunction_t)PEMTPM_Marshal_TPM2B_PRIVATE);
+    }
+    if (rc == 0) {
+	putRecordHeader(privateBuffer - PEMTPM_RECORD_HEADER_SIZE,
+			PEMTPM_RECORD_PRIVATE, privateSize);
+	*recordsSize = (privateBuffer + privateSize) - records;
+	if (wrapping->parent != NULL) {
+	    uint8_t *seedBuffer = putRecordHeader(records + *recordsSize,
+						  PEMTPM_RECORD_SEED, inSymSeed.t.size);
+	    memcpy(seedBuffer, inSymSeed.t.secret, inSymSeed.t.size);
+	    *recordsSize += PEMTPM_RECORD_HEADER_SIZE + inSymSeed.t.size;
+	}
+    }
+    else {
+	*recordsSize = putErrorRecord(records, rc);
+    }
+    if (pemtpmStats) {
+	PEMTPM_Stats_Time(PEMTPM_STAGE_MARSHAL, PEMTPM_Stats_Now() - start);
+    }
+    /* the duplicate is the unencrypted private key */
+    memset(&duplicate, 0, sizeof(duplicate));
     return rc;
 }
 
+/* streamRecords() writes the records of one key to 'dataFile' with one fwrite().  'rc' is the
+   result of the key. */
 
-static TPM_RC convertRsaKeyToPrivateKeyBin(int 	*privateKeyBytes,
-				    uint8_t 	**privateKeyBin,	/* freed by caller */
-				    const RSA	 *rsaKey)
+static void streamRecords(FILE 			*dataFile,
+			  uint8_t 		*records,
+			  size_t 		recordsSize,
+			  TPM_RC 		rc)
 {
-    TPM_RC 		rc = 0;
-    const BIGNUM 	*p;
-    const BIGNUM 	*q;
+    uint64_t		start = 0;
+
+    if (pemtpmStats) start = PEMTPM_Stats_Now();
+    if ((fwrite(records, 1, recordsSize, dataFile) != recordsSize) ||
+	(fflush(dataFile) != 0)) {
+	printf("processStream: Error writing to stdout\n");
+	exit(EXIT_FAILURE);	/* the reader has lost the record stream */
+    }
+    if (pemtpmStats) {
+	PEMTPM_Stats_Time(PEMTPM_STAGE_WRITE, PEMTPM_Stats_Now() - start);
+	PEMTPM_Stats_Count(PEMTPM_STAT_BYTES_WRITTEN, recordsSize);
+	PEMTPM_Stats_Count((rc == 0) ?
+			   PEMTPM_STAT_KEYS_CONVERTED : PEMTPM_STAT_KEYS_FAILED, 1);
+    }
+    memset(records, 0, recordsSize);
+    return;
+}
+
+/* streamKey() converts one PEM key and writes its records to 'dataFile' */
+
+static TPM_RC streamKey(FILE 			*dataFile,
+			TPMI_ALG_PUBLIC 	algPublic,
+			int			keyType,
+			TPMI_ALG_HASH 		nalg,
+			TPMI_ALG_HASH		halg,
+			const unsigned char 	*pemData,
+			size_t 			pemLength,
+			const char 		*pemKeyPassword,
+			const WRAPPING 		*wrapping,
+			PEMTPM_CIPHER 		*cipher)
+{
+    TPM_RC		rc = 0;
+    uint8_t		records[STREAM_RECORDS_MAX];
+    size_t		recordsSize = 0;
+
+    rc = marshalKeyRecords(records, &recordsSize, algPublic, keyType, nalg, halg,
+			   pemData, pemLength, pemKeyPassword, wrapping, cipher);
+    streamRecords(dataFile, records, recordsSize, rc);
+    return rc;
+}
+
+/* processStream() converts every PEM key on stdin.  A failing key is reported and an ERROR record
+   is written in its place.  A key larger than BATCH_PEM_MAX is read up to its END line and fails
+   the same way.  Returns an error if any key failed. */
 
-    /* get the private primes */
+static TPM_RC processStream(TPMI_ALG_PUBLIC 	algPublic,
+			    int			keyType,
+			    TPMI_ALG_HASH 	nalg,
+			    TPMI_ALG_HASH	halg,
+			    const char 		*pemKeyPassword,
+			    const WRAPPING 	*wrapping)
+{
+    TPM_RC		rc = 0;
+    int			dataFd;
+    FILE		*dataFile = NULL;
+    char		line[BATCH_LINE_MAX];
+    unsigned char 	*pemData = NULL;	/* freed @1 */
+    size_t		pemLength = 0;
+    int			inKey = FALSE;
+    int			oversized = FALSE;	/* the key is skipped up to its END line */
+    uint8_t		errorRecord[PEMTPM_RECORD_HEADER_SIZE + sizeof(TPM_RC)];
+    PEMTPM_CIPHER 	*cipher = NULL;		/* freed @3 */
+    unsigned long 	keysConverted = 0;
+    unsigned long 	keysFailed = 0;
+
+    /* stdout becomes stderr, the data goes to a private descriptor */
     if (rc == 0) {
-	rc = getRsaKeyParts(NULL, NULL, NULL, &p, &q, rsaKey);
+	fflush(stdout);
+	dataFd = dup(STDOUT_FILENO);
+	if ((dataFd < 0) || (dup2(STDERR_FILENO, STDOUT_FILENO) < 0)) {
+	    printf("processStream: Error redirecting stdout\n");
+	    rc = EXIT_FAILURE;
+	}
     }
-    /* allocate a buffer for the private key array */
     if (rc == 0) {
-	*privateKeyBytes = BN_num_bytes(p);
-	rc = TSS_Malloc(privateKeyBin, *privateKeyBytes);
+	dataFile = fdopen(dataFd, "wb");		/* closed @2 */
+	if (dataFile == NULL) {
+	    printf("processStream: Error opening the data stream\n");
+	    rc = EXIT_FAILURE;
+	}
     }
-    /* convert the private key bignum to binary */
     if (rc == 0) {
-	BN_bn2bin(p, *privateKeyBin);
+	rc = TSS_Malloc(&pemData, BATCH_PEM_MAX);
+    }
+    if ((rc == 0) && (wrapping->encryptionKey.t.size != 0)) {
+	rc = PEMTPM_Cipher_Create(&cipher);
+    }
+    while ((rc == 0) && (fgets(line, sizeof(line), stdin) != NULL)) {
+	size_t lineLength = strlen(line);
+
+	if (!inKey) {
+	    if (strncmp(line, "-----BEGIN ", 11) != 0) {
+		continue;
+	    }
+	    inKey = TRUE;
+	    oversized = FALSE;
+	    pemLength = 0;
+	}
+	if (!oversized && (pemLength + lineLength > BATCH_PEM_MAX)) {
+	    printf("processStream: key %lu larger than %d bytes\n",
+		   keysConverted + keysFailed + 1, BATCH_PEM_MAX);
+	    oversized = TRUE;
+	}
+	if (!oversized) {
+	    memcpy(pemData + pemLength, line, lineLength);
+	    pemLength += lineLength;
+	}
+	PEMTPM_STATS_COUNT(PEMTPM_STAT_BYTES_READ, lineLength);
+	if (strncmp(line, "-----END ", 9) != 0) {
+	    continue;
+	}
+	inKey = FALSE;
+	if (oversized) {
+	    streamRecords(dataFile, errorRecord,
+			  putErrorRecord(errorRecord, TSS_RC_INSUFFICIENT_BUFFER),
+			  TSS_RC_INSUFFICIENT_BUFFER);
+	    keysFailed++;
+	}
+	else if (streamKey(dataFile, algPublic, keyType, nalg, halg,
+			   pemData, pemLength, pemKeyPassword, wrapping, cipher) == 0) {
+	    keysConverted++;
+	}
+	else {
+	    printf("processStream: key %lu failed\n", keysConverted + keysFailed + 1);
+	    keysFailed++;
+	}
+    }
+    if ((rc == 0) && inKey) {
+	printf("processStream: Error, truncated PEM key at end of input\n");
+	rc = EXIT_FAILURE;
+    }
+    if (pemData != NULL) {
+	memset(pemData, 0, BATCH_PEM_MAX);
+    }
+    free(pemData);			/* @1 */
+    PEMTPM_Cipher_Delete(cipher);	/* @3 */
+    if (dataFile != NULL) {
+	if (fclose(dataFile) != 0) {	/* @2 */
+	    printf("processStream: Error closing stdout\n");
+	    rc = EXIT_FAILURE;
+	}
+    }
+    printf("pemtpm: stream, %lu converted, %lu failed\n", keysConverted, keysFailed);
+    if ((rc == 0) && (keysFailed != 0)) {
+	rc = EXIT_FAILURE;
     }
     return rc;
 }
 
-static TPM_RC convertRsaPrivateKeyBinToPrivate(TPM2B_PRIVATE 	*objectPrivate,
-					TPM2B_SENSITIVE *objectSensitive,
-					int 		privateKeyBytes,
-					uint8_t 	*privateKeyBin,
-					const char 	*password)
+/* Serve mode keeps one warm process that converts keys for the clients of a UNIX stream socket.
+   A connection carries any number of requests, see PEMTPM_RECORD_REQUEST_ in pemtpm.h, and each
+   is answered in order with the same records as stream mode.
+
+   'jobs' worker threads each accept() on the shared listening socket and serve one connection at
+   a time.  The PEM, password and record buffers and the cipher context are allocated once per
+   worker.  A malformed request is answered with an ERROR record and the connection is closed,
+   since the framing is lost.  A client that stalls for SERVE_TIMEOUT seconds is disconnected.
+
+   The server runs until SIGINT or SIGTERM.
+*/
+
+#define SERVE_TIMEOUT		30	/* seconds */
+#define SERVE_PASSWORD_MAX	1024
+
+typedef struct SERVE_CONTEXT {
+    int			listenFd;
+    TPMI_ALG_PUBLIC 	algPublic;		/* request defaults */
+    int			keyType;
+    TPMI_ALG_HASH 	nalg;
+    TPMI_ALG_HASH	halg;
+    const WRAPPING 	*wrapping;
+    unsigned long 	keysConverted;		/* updated atomically by the workers */
+    unsigned long 	keysFailed;
+} SERVE_CONTEXT;
+
+typedef struct SERVE_WORKER {
+    SERVE_CONTEXT 	*serveContext;
+    PEMTPM_CIPHER 	*cipher;		/* -iek or -oek only */
+    unsigned char 	pemData[BATCH_PEM_MAX];
+    char		password[SERVE_PASSWORD_MAX + 1];
+    uint8_t		records[STREAM_RECORDS_MAX];
+} SERVE_WORKER;
+
+/* readSocket() reads exactly 'length' bytes.  Returns 0 on success, 1 if the peer closed the
+   connection before the first byte, -1 on an error, a timeout, or a short read. */
+
+static int readSocket(int fd, void *buffer, size_t length)
 {
-    TPM_RC 		rc = 0;
-    TPMT_SENSITIVE	tSensitive;
-    TPM2B_SENSITIVE	bSensitive;
+    size_t	done = 0;
+    ssize_t	bytes;
 
-    if (rc == 0) {
-	if (((objectPrivate == NULL) && (objectSensitive == NULL)) ||
-	    ((objectPrivate != NULL) && (objectSensitive != NULL))) {
-	    printf("convertRsaPrivateKeyBinToPrivate: Only one result supported\n");
-	    rc = EXIT_FAILURE;
+    while (done < length) {
+	bytes = recv(fd, (uint8_t *)buffer + done, length - done, 0);
+	if (bytes > 0) {
+	    done += bytes;
+	}
+	else if ((bytes < 0) && (errno == EINTR)) {
+	    continue;
+	}
+	else {
+	    return ((bytes == 0) && (done == 0)) ? 1 : -1;
 	}
     }
+    PEMTPM_STATS_COUNT(PEMTPM_STAT_BYTES_READ, length);
+    return 0;
+}
+
+/* writeSocket() writes 'length' bytes.  Returns 0 on success, -1 on an error or a timeout. */
+
+static int writeSocket(int fd, const void *buffer, size_t length)
+{
+    size_t	done = 0;
+    ssize_t	bytes;
+
+    while (done < length) {
+	/* a client that went away must not kill the server with SIGPIPE */
+	bytes = send(fd, (const uint8_t *)buffer + done, length - done, MSG_NOSIGNAL);
+	if (bytes > 0) {
+	    done += bytes;
+	}
+	else if ((bytes < 0) && (errno == EINTR)) {
+	    continue;
+	}
+	else {
+	    return -1;
+	}
+    }
+    PEMTPM_STATS_COUNT(PEMTPM_STAT_BYTES_WRITTEN, length);
+    return 0;
+}
+
+/* getUint16() reads a big endian uint16_t */
 
-    /* In some cases, the sensitive data is not encrypted and the integrity value is not present.
-       When an integrity value is not needed, it is not present and it is not represented by an
-       Empty Buffer.
+static uint16_t getUint16(const uint8_t *buffer)
+{
+    return (uint16_t)((buffer[0] << 8) | buffer[1]);
+}
 
-       In this case, the TPM2B_PRIVATE will just be a marshaled TPM2B_SENSITIVE, which is a
-       marshaled TPMT_SENSITIVE */
+/* serveRequest() reads one request from 'fd', converts the key, and writes the reply.  Returns 0
+   if the connection can carry another request. */
+
+static int serveRequest(SERVE_WORKER *worker, int fd)
+{
+    SERVE_CONTEXT 	*serveContext = worker->serveContext;
+    TPM_RC		rc = 0;
+    TPMI_ALG_PUBLIC 	algPublic = serveContext->algPublic;
+    int			keyType = serveContext->keyType;
+    TPMI_ALG_HASH 	nalg = serveContext->nalg;
+    TPMI_ALG_HASH	halg = serveContext->halg;
+    uint8_t		header[PEMTPM_RECORD_HEADER_SIZE];
+    uint8_t		params[4 * sizeof(uint16_t)];
+    uint32_t		length = 0;
+    size_t		recordsSize = 0;
+    int			done = FALSE;
+    int			irc = 0;
 
-    /* construct TPMT_SENSITIVE	*/
+    worker->password[0] = '\0';
+    while ((rc == 0) && !done) {
+	/* the peer closing the connection between requests is the normal end */
+	if (readSocket(fd, header, sizeof(header)) != 0) {
+	    return -1;
+	}
+	length = ((uint32_t)header[1] << 24) | ((uint32_t)header[2] << 16) |
+		 ((uint32_t)header[3] << 8) | header[4];
+	switch (header[0]) {
+	  case PEMTPM_RECORD_REQUEST_PARAMS:
+	    if (length != sizeof(params)) {
+		rc = TSS_RC_IN_PARAMETER;
+	    }
+	    else if (readSocket(fd, params, sizeof(params)) != 0) {
+		return -1;
+	    }
+	    else {
+		algPublic = getUint16(params);
+		keyType = getUint16(params + 2);
+		nalg = getUint16(params + 4);
+		halg = getUint16(params + 6);
+	    }
+	    break;
+	  case PEMTPM_RECORD_REQUEST_PASSWORD:
+	    if (length > SERVE_PASSWORD_MAX) {
+		rc = TSS_RC_INSUFFICIENT_BUFFER;
+	    }
+	    else if (readSocket(fd, worker->password, length) != 0) {
+		return -1;
+	    }
+	    else {
+		worker->password[length] = '\0';
+	    }
+	    break;
+	  case PEMTPM_RECORD_REQUEST_PEM:
+	    if ((length == 0) || (length > BATCH_PEM_MAX)) {
+		rc = TSS_RC_INSUFFICIENT_BUFFER;
+	    }
+	    else if (readSocket(fd, worker->pemData, length) != 0) {
+		return -1;
+	    }
+	    else {
+		done = TRUE;
+	    }
+	    break;
+	  default:
+	    rc = TSS_RC_IN_PARAMETER;
+	}
+    }
     if (rc == 0) {
-	/* This shall be the same as the type parameter of the associated public area. */
-	tSensitive.sensitiveType = TPM_ALG_RSA;
-	tSensitive.seedValue.b.size = 0;
-	/* key password converted to TPM2B */
-	rc = TSS_TPM2B_StringCopy(&tSensitive.authValue.b, password, sizeof(TPMU_HA));
+	rc = marshalKeyRecords(worker->records, &recordsSize, algPublic, keyType, nalg, halg,
+			       worker->pemData, length, worker->password,
+			       serveContext->wrapping, worker->cipher);
+	__atomic_fetch_add((rc == 0) ? &serveContext->keysConverted : &serveContext->keysFailed,
+			   1, __ATOMIC_RELAXED);
+	/* the OpenSSL error queue is per thread and the worker never exits */
+	if ((rc != 0) && PEMTPM_Libcrypto_Loaded()) {
+	    ERR_clear_error();
+	}
+	PEMTPM_STATS_COUNT((rc == 0) ? PEMTPM_STAT_KEYS_CONVERTED : PEMTPM_STAT_KEYS_FAILED, 1);
     }
+    else {
+	printf("serveRequest: Malformed request record %02x, rc %08x\n", header[0], rc);
+	recordsSize = putErrorRecord(worker->records, rc);
+	irc = -1;
+    }
+    if (writeSocket(fd, worker->records, recordsSize) != 0) {
+	irc = -1;
+    }
+    memset(worker->pemData, 0, done ? length : 0);
+    memset(worker->password, 0, sizeof(worker->password));
+    memset(worker->records, 0, recordsSize);
+    return irc;
+}
+
+/* serveThread() accepts and serves connections, one at a time, until shutdown */
+
+static void *serveThread(void *arg)
+{
+    SERVE_WORKER 	*worker = arg;
+    struct timeval 	timeout;
+    int			fd;
+
+    timeout.tv_sec = SERVE_TIMEOUT;
+    timeout.tv_usec = 0;
+    for ( ; ; ) {
+	fd = accept(worker->serveContext->listenFd, NULL, NULL);
+	if (fd < 0) {
+	    if ((errno == EBADF) || (errno == EINVAL)) {
+		break;			/* the listening socket was closed at shutdown */
+	    }
+	    if ((errno != EINTR) && (errno != ECONNABORTED)) {
+		printf("serveThread: accept failed, %s\n", strerror(errno));
+		sleep(1);		/* for example out of descriptors, do not spin */
+	    }
+	    continue;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+	while (serveRequest(worker, fd) == 0) {
+	}
+	close(fd);
+    }
+    return NULL;
+}
+
+/* processServe() listens on the UNIX socket 'socketFilename' and serves conversion requests on
+   'jobs' worker threads until SIGINT or SIGTERM.  The algorithm and hash arguments are the request
+   defaults. */
+
+static TPM_RC processServe(TPMI_ALG_PUBLIC 	algPublic,
+			   int			keyType,
+			   TPMI_ALG_HASH 	nalg,
+			   TPMI_ALG_HASH	halg,
+			   const char 		*socketFilename,
+			   const WRAPPING 	*wrapping,
+			   int			jobs)
+{
+    TPM_RC		rc = 0;
+    SERVE_CONTEXT 	serveContext;
+    SERVE_WORKER 	*worker = NULL;
+    struct sockaddr_un 	address;
+    struct stat		status;
+    mode_t		mask;
+    sigset_t		signals;
+    pthread_attr_t 	attr;
+    pthread_t		thread;
+    int			signalNumber;
+    int			irc;
+    int			t;
+
+    serveContext.listenFd = -1;
+    serveContext.algPublic = algPublic;
+    serveContext.keyType = keyType;
+    serveContext.nalg = nalg;
+    serveContext.halg = halg;
+    serveContext.wrapping = wrapping;
+    serveContext.keysConverted = 0;
+    serveContext.keysFailed = 0;
     if (rc == 0) {
-	if ((size_t)privateKeyBytes > sizeof(tSensitive.sensitive.rsa.t.buffer)) {
-	    printf("convertRsaPrivateKeyBinToPrivate: "
-		   "Error, private key modulus %d greater than %lu\n",
-		   privateKeyBytes, (unsigned long)sizeof(tSensitive.sensitive.rsa.t.buffer));
+	if (strlen(socketFilename) >= sizeof(address.sun_path)) {
+	    printf("processServe: socket name %s too long\n", socketFilename);
 	    rc = EXIT_FAILURE;
 	}
     }
+    /* load libcrypto, its configuration, ciphers and digests now rather than in the first
+       request */
+    if (rc == 0) {
+	rc = PEMTPM_Libcrypto_Load();
+    }
+    if (rc == 0) {
+#if OPENSSL_VERSION_NUMBER < 0x10100000
+	OpenSSL_add_all_algorithms();
+#else
+	OPENSSL_init_crypto(OPENSSL_INIT_LOAD_CONFIG |
+			    OPENSSL_INIT_ADD_ALL_CIPHERS |
+			    OPENSSL_INIT_ADD_ALL_DIGESTS, NULL);
+#endif
+    }
+    /* the workers inherit the mask, so only sigwait() below sees SIGINT and SIGTERM */
     if (rc == 0) {
-	tSensitive.sensitive.rsa.t.size = privateKeyBytes;
-	memcpy(tSensitive.sensitive.rsa.t.buffer, privateKeyBin, privateKeyBytes);
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
     }
-    /* FIXME common code for EC and RSA */
-    /* marshal the TPMT_SENSITIVE into a TPM2B_SENSITIVE */
     if (rc == 0) {
-	if (objectPrivate != NULL) {
-	    int32_t size = sizeof(bSensitive.t.sensitiveArea);	/* max size */
-	    uint8_t *buffer = bSensitive.b.buffer;		/* pointer that can move */
-	    bSensitive.t.size = 0;				/* required before marshaling */
-	    rc = TSS_TPMT_SENSITIVE_Marshal(&tSensitive,
-					    &bSensitive.b.size,	/* marshaled size */
-					    &buffer,		/* marshal here */
-					    &size);		/* max size */
+	serveContext.listenFd = socket(AF_UNIX, SOCK_STREAM, 0);	/* closed @1 */
+	if (serveContext.listenFd < 0) {
+	    printf("processServe: socket failed, %s\n", strerror(errno));
+	    rc = EXIT_FAILURE;
+	}
+    }
+    /* a socket left by an earlier server is replaced, any other file is not */
+    if (rc == 0) {
+	if ((lstat(socketFilename, &status) == 0) && S_ISSOCK(status.st_mode)) {
+	    unlink(socketFilename);
 	}
-	else {	/* return TPM2B_SENSITIVE */
-	    objectSensitive->t.sensitiveArea = tSensitive;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, socketFilename);
+	/* the replies hold unencrypted private keys, so only the owner may connect.  The socket is
+	   created owner only, before any worker thread exists to share the umask. */
+	mask = umask(077);
+	irc = bind(serveContext.listenFd, (struct sockaddr *)&address, sizeof(address));
+	umask(mask);
+	if ((irc != 0) || (listen(serveContext.listenFd, SOMAXCONN) != 0)) {
+	    printf("processServe: Cannot listen on %s, %s\n", socketFilename, strerror(errno));
+	    rc = EXIT_FAILURE;
 	}
     }
-    /* marshal the TPM2B_SENSITIVE (as a TPM2B_PRIVATE, see above) into a TPM2B_PRIVATE */
+    /* the workers run until the process exits, so they and their buffers are never freed */
     if (rc == 0) {
-	if (objectPrivate != NULL) {
-	    int32_t size = sizeof(objectPrivate->t.buffer);	/* max size */
-	    uint8_t *buffer = objectPrivate->t.buffer;		/* pointer that can move */
-	    objectPrivate->t.size = 0;				/* required before marshaling */
-	    rc = TSS_TPM2B_PRIVATE_Marshal((TPM2B_PRIVATE *)&bSensitive,
-					   &objectPrivate->t.size,	/* marshaled size */
-					   &buffer,		/* marshal here */
-					   &size);		/* max size */
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    }
+    for (t = 0 ; (rc == 0) && (t < jobs) ; t++) {
+	worker = NULL;
+	rc = TSS_Malloc((unsigned char **)&worker, sizeof(SERVE_WORKER));
+	if (rc == 0) {
+	    worker->serveContext = &serveContext;
+	    worker->cipher = NULL;
+	    if (wrapping->encryptionKey.t.size != 0) {
+		rc = PEMTPM_Cipher_Create(&worker->cipher);
+	    }
+	}
+	if (rc == 0) {
+	    if (pthread_create(&thread, &attr, serveThread, worker) != 0) {
+		printf("processServe: Error creating thread\n");
+		exit(EXIT_FAILURE);	/* cannot recover a partially started server */
+	    }
 	}
     }
+    if (rc == 0) {
+	pthread_attr_destroy(&attr);
+	printf("pemtpm: serving %s with %d workers\n", socketFilename, jobs);
+	sigwait(&signals, &signalNumber);
+	unlink(socketFilename);
+	printf("pemtpm: serve %s, %lu converted, %lu failed\n", socketFilename,
+	       __atomic_load_n(&serveContext.keysConverted, __ATOMIC_RELAXED),
+	       __atomic_load_n(&serveContext.keysFailed, __ATOMIC_RELAXED));
+    }
+    if (serveContext.listenFd >= 0) {
+	close(serveContext.listenFd);		/* @1 */
+    }
     return rc;
 }
 
+/* Bundle mode converts every PEM key in one file of concatenated PEM blocks, the form in which keys
+   are often delivered.  The file is mapped rather than read, and each block is passed to the
+   library in place, so neither the bundle nor its keys are copied.
+
+   The -opu, -opr, -opn and -oss values are templates containing one %u, which is replaced by the
+   key number, starting at 1.
+*/
+
+#define BUNDLE_FILENAME_MAX	4096
+
+/* findPemLine() returns the offset of the first line at or after 'offset' that starts with
+   'marker', or 'length' if there is none */
 
-static TPM_RC convertRsaKeyToPrivate(TPM2B_PRIVATE 	*objectPrivate,
-			      TPM2B_SENSITIVE 	*objectSensitive,
-			      RSA 		*rsaKey,
-			      const char 	*password)
+static size_t findPemLine(const unsigned char 	*data,
+			  size_t 		length,
+			  size_t 		offset,
+			  const char 		*marker)
 {
-    TPM_RC 	rc = 0;
-    int 	privateKeyBytes;
-    uint8_t 	*privateKeyBin = NULL;
+    size_t 		markerLength = strlen(marker);
+    const unsigned char *newline;
 
-    /* convert an openssl RSA key token private prime p to a binary array */
-    if (rc == 0) {
-	rc = convertRsaKeyToPrivateKeyBin(&privateKeyBytes,
-					  &privateKeyBin,	/* freed @1 */
-					  rsaKey);
+    while (offset < length) {
+	if ((length - offset >= markerLength) &&
+	    (memcmp(data + offset, marker, markerLength) == 0)) {
+	    return offset;
+	}
+	newline = memchr(data + offset, '\n', length - offset);
+	if (newline == NULL) {
+	    break;
+	}
+	offset = (newline - data) + 1;
     }
-    /* convert an RSA prime 'privateKeyBin' to either a TPM2B_PRIVATE or a TPM2B_SENSITIVE */
-    if (rc == 0) {
-	rc = convertRsaPrivateKeyBinToPrivate(objectPrivate,
-					      objectSensitive,
-					      privateKeyBytes,
-					      privateKeyBin,
-					      password);
+    return length;
+}
+
+/* findPemBlock() finds the next -----BEGIN to -----END block at or after 'offset'.  On return
+   'offset' is just past the block.  Returns 0 for a block, 1 at the end of the data, -1 for a
+   block with no end line. */
+
+static int findPemBlock(const unsigned char 	*data,
+			size_t 			length,
+			size_t 			*offset,
+			size_t 			*blockStart,
+			size_t 			*blockLength)
+{
+    size_t 		end;
+    const unsigned char *newline;
+
+    *blockStart = findPemLine(data, length, *offset, "-----BEGIN ");
+    if (*blockStart == length) {
+	*offset = length;
+	return 1;
     }
-    free(privateKeyBin);		/* @1 */
-    return rc;
+    end = findPemLine(data, length, *blockStart, "-----END ");
+    if (end == length) {
+	*offset = length;
+	return -1;
+    }
+    newline = memchr(data + end, '\n', length - end);
+    end = (newline == NULL) ? length : (size_t)(newline - data) + 1;
+    *blockLength = end - *blockStart;
+    *offset = end;
+    return 0;
 }
-static TPM_RC convertRsaPublicKeyBinToPublic(TPM2B_PUBLIC 	*objectPublic,
-				      int		keyType,
-				      TPMI_ALG_HASH 	nalg,
-				      TPMI_ALG_HASH	halg,
-				      int 		modulusBytes,
-				      uint8_t 		*modulusBin)
+
+/* isBundleTemplate() checks that an output filename template has exactly one conversion, a %u */
+
+static int isBundleTemplate(const char *filenameTemplate)
 {
-    TPM_RC 		rc = 0;
+    const char 	*percent = strchr(filenameTemplate, '%');
 
-    if (rc == 0) {
-	if ((size_t)modulusBytes > sizeof(objectPublic->publicArea.unique.rsa.t.buffer)) {
-	    printf("convertRsaPublicKeyBinToPublic: Error, "
-		   "public key modulus %d greater than %lu\n", modulusBytes,
-		   (unsigned long)sizeof(objectPublic->publicArea.unique.rsa.t.buffer));
-	    rc = EXIT_FAILURE;
-	}
+    return ((percent != NULL) && (percent[1] == 'u') && (strchr(percent + 2, '%') == NULL));
+}
+
+/* processBundle() converts every PEM key in 'bundleFilename'.  A failing key is reported and
+   skipped.  Returns an error if any key failed.  With 'sync', the outputs of each key are synced
+   before they are renamed, and the last renames are synced at the end. */
+
+static TPM_RC processBundle(TPMI_ALG_PUBLIC 	algPublic,
+			    int			keyType,
+			    TPMI_ALG_HASH 	nalg,
+			    TPMI_ALG_HASH	halg,
+			    const char 		*bundleFilename,
+			    const char 		*pemKeyPassword,
+			    const char 		*outPublicTemplate,
+			    const char 		*outPrivateTemplate,
+			    const char 		*outNameTemplate,
+			    const WRAPPING 	*wrapping,
+			    const char 		*outSeedTemplate,
+			    const IMPORT_COMMANDS *importCommands,
+			    int			sync)
+{
+    TPM_RC		rc = 0;
+    const unsigned char *bundle = NULL;
+    size_t		bundleLength = 0;
+    size_t		offset = 0;
+    size_t		blockStart;
+    size_t		blockLength;
+    char		outPublicFilename[BUNDLE_FILENAME_MAX];
+    char		outPrivateFilename[BUNDLE_FILENAME_MAX];
+    char		outNameFilename[BUNDLE_FILENAME_MAX];
+    char		outSeedFilename[BUNDLE_FILENAME_MAX];
+    unsigned long 	keyNumber = 0;
+    unsigned long 	keysConverted = 0;
+    unsigned long 	keysFailed = 0;
+    PEMTPM_CIPHER 	*cipher = NULL;		/* freed @2 */
+    PEMTPM_WRITER 	*writer = NULL;		/* freed @3 */
+    uint64_t		start = 0;
+    int			irc;
+
+    if ((rc == 0) && (wrapping->encryptionKey.t.size != 0)) {
+	rc = PEMTPM_Cipher_Create(&cipher);
+    }
+    if (rc == 0) {
+	rc = PEMTPM_Writer_Create(&writer, 1, sync ? 1 : 0);
     }
+    if (pemtpmStats) start = PEMTPM_Stats_Now();
     if (rc == 0) {
-	/* Table 184 - Definition of TPMT_PUBLIC Structure */
-	objectPublic->publicArea.type = TPM_ALG_RSA;
-	objectPublic->publicArea.nameAlg = nalg;
-	objectPublic->publicArea.objectAttributes.val = TPMA_OBJECT_NODA;
-	objectPublic->publicArea.objectAttributes.val |= TPMA_OBJECT_USERWITHAUTH;
-	if (keyType == TYPE_SI) {
-	    objectPublic->publicArea.objectAttributes.val |= TPMA_OBJECT_SIGN;
+	rc = TSS_File_MapFile(&bundle, &bundleLength, bundleFilename);	/* unmapped @1 */
+    }
+    if (pemtpmStats) {
+	PEMTPM_Stats_Time(PEMTPM_STAGE_READ, PEMTPM_Stats_Now() - start);
+    }
+    while (rc == 0) {
+	irc = findPemBlock(bundle, bundleLength, &offset, &blockStart, &blockLength);
+	if (irc > 0) {
+	    break;
 	}
-	else {
-	    objectPublic->publicArea.objectAttributes.val |= TPMA_OBJECT_DECRYPT;
+	keyNumber++;
+	if (irc < 0) {
+	    printf("processBundle: %s key %lu at offset %lu has no END line\n",
+		   bundleFilename, keyNumber, (unsigned long)blockStart);
+	    keysFailed++;
+	    break;
 	}
-	objectPublic->publicArea.authPolicy.t.size = 0;
-	/* Table 182 - Definition of TPMU_PUBLIC_PARMS Union <IN/OUT, S> */
-	objectPublic->publicArea.parameters.rsaDetail.symmetric.algorithm = TPM_ALG_NULL;
-	if (keyType == TYPE_SI) {
-	    objectPublic->publicArea.parameters.rsaDetail.scheme.scheme = TPM_ALG_RSASSA;
+	if ((snprintf(outPublicFilename, sizeof(outPublicFilename),
+		      outPublicTemplate, keyNumber) >= (int)sizeof(outPublicFilename)) ||
+	    (snprintf(outPrivateFilename, sizeof(outPrivateFilename),
+		      outPrivateTemplate, keyNumber) >= (int)sizeof(outPrivateFilename)) ||
+	    ((outNameTemplate != NULL) &&
+	     (snprintf(outNameFilename, sizeof(outNameFilename),
+		       outNameTemplate, keyNumber) >= (int)sizeof(outNameFilename))) ||
+	    ((outSeedTemplate != NULL) &&
+	     (snprintf(outSeedFilename, sizeof(outSeedFilename),
+		       outSeedTemplate, keyNumber) >= (int)sizeof(outSeedFilename)))) {
+	    printf("processBundle: output filename too long\n");
+	    rc = EXIT_FAILURE;
+	    break;
+	}
+	if (convertPemDataToFiles(algPublic,
+				  keyType,
+				  nalg,
+				  halg,
+				  bundle + blockStart,
+				  blockLength,
+				  pemKeyPassword,
+				  outPublicFilename,
+				  outPrivateFilename,
+				  (outNameTemplate != NULL) ? outNameFilename : NULL,
+				  wrapping,
+				  cipher,
+				  (outSeedTemplate != NULL) ? outSeedFilename : NULL,
+				  importCommands,
+				  writer) == 0) {
+	    keysConverted++;
 	}
 	else {
-	    objectPublic->publicArea.parameters.rsaDetail.scheme.scheme = TPM_ALG_NULL;
+	    printf("processBundle: %s key %lu at offset %lu failed\n",
+		   bundleFilename, keyNumber, (unsigned long)blockStart);
+	    keysFailed++;
+	}
+    }
+    if ((rc == 0) && (PEMTPM_Writer_Sync(writer) != 0)) {
+	printf("processBundle: Error syncing the outputs\n");
+	rc = EXIT_FAILURE;
+    }
+    TSS_File_UnmapFile(bundle, bundleLength);	/* @1 */
+    PEMTPM_Cipher_Delete(cipher);		/* @2 */
+    PEMTPM_Writer_Delete(writer);		/* @3 */
+    if (rc == 0) {
+	printf("pemtpm: bundle %s, %lu converted, %lu failed\n",
+	       bundleFilename, keysConverted, keysFailed);
+	if (keysFailed != 0) {
+	    rc = EXIT_FAILURE;
 	}
-	objectPublic->publicArea.parameters.rsaDetail.scheme.details.rsassa.hashAlg = halg;
-	objectPublic->publicArea.parameters.rsaDetail.keyBits = modulusBytes * 8;
-	objectPublic->publicArea.parameters.rsaDetail.exponent = 0;
-
-	objectPublic->publicArea.unique.rsa.t.size = modulusBytes;
-	memcpy(objectPublic->publicArea.unique.rsa.t.buffer, modulusBin, modulusBytes);
     }
     return rc;
 }
 
+/* readParent() reads and parses the TPM2B_PUBLIC of the TPM2_Import parent.  It also records the
+   digest of the file, which identifies the parent in -stamps. */
 
-/* convertRsaKeyToPublicKeyBin() converts from an openssl RSA key token to a public modulus */
-
-static TPM_RC convertRsaKeyToPublicKeyBin(int 		*modulusBytes,
-				   uint8_t 	**modulusBin,	/* freed by caller */
-				   const RSA 	*rsaKey)
+static TPM_RC readParent(WRAPPING 	*wrapping,
+			 const char 	*parentFilename)
 {
-    TPM_RC 		rc = 0;
-    const BIGNUM 	*n;
-    const BIGNUM 	*e;
-    const BIGNUM 	*d;
+    TPM_RC	rc = 0;
+    uint8_t	parentBuffer[PEMTPM_PUBLIC_BUFFER_MAX];
+    size_t	parentLength;
 
-    /* get the public modulus from the RSA key token */
     if (rc == 0) {
-	rc = getRsaKeyParts(&n, &e, &d, NULL, NULL, rsaKey);
+	rc = TSS_File_ReadBinaryFileBuffer(parentBuffer, &parentLength,
+					   sizeof(parentBuffer), parentFilename);
     }
     if (rc == 0) {
-	*modulusBytes = BN_num_bytes(n);
+	rc = PEMTPM_Parent_Create(&wrapping->parent, parentBuffer, parentLength);
     }
     if (rc == 0) {
-	rc = TSS_Malloc(modulusBin, *modulusBytes);
+	SHA256(parentBuffer, parentLength, wrapping->parentDigest);
     }
-    if (rc == 0) {
-	BN_bn2bin(n, *modulusBin);
+    if (rc != 0) {
+	printf("pemtpm: parent %s invalid, rc %08x\n", parentFilename, rc);
     }
     return rc;
 }
 
+/* readEncryptionKey() reads a raw AES-128, AES-192 or AES-256 inner wrapper key */
 
-static TPM_RC convertRsaKeyToPublic(TPM2B_PUBLIC 	*objectPublic,
-			     int		keyType,
-			     TPMI_ALG_HASH 	nalg,
-			     TPMI_ALG_HASH	halg,
-			     RSA 		*rsaKey)
+static TPM_RC readEncryptionKey(TPM2B_DATA 	*encryptionKey,
+				const char 	*keyFilename)
 {
-    TPM_RC 		rc = 0;
-    int 		modulusBytes;
-    uint8_t 		*modulusBin = NULL;
+    TPM_RC	rc = 0;
+    size_t	keyLength;
 
-    /* openssl RSA key token to a public modulus */
     if (rc == 0) {
-	rc = convertRsaKeyToPublicKeyBin(&modulusBytes,
-					 &modulusBin,		/* freed @1 */
-					 rsaKey);
+	rc = TSS_File_ReadBinaryFileBuffer(encryptionKey->t.buffer, &keyLength,
+					   sizeof(encryptionKey->t.buffer), keyFilename);
+    }
+    if ((rc == 0) && (keyLength != 16) && (keyLength != 24) && (keyLength != 32)) {
+	rc = TSS_RC_BAD_ENCRYPT_SIZE;
     }
-    /* public modulus to TPM2B_PUBLIC */
     if (rc == 0) {
-	rc = convertRsaPublicKeyBinToPublic(objectPublic,
-					    keyType,
-					    nalg,
-					    halg,
-					    modulusBytes,
-					    modulusBin);
+	encryptionKey->t.size = (uint16_t)keyLength;
+    }
+    else {
+	printf("pemtpm: encryption key %s invalid, rc %08x\n", keyFilename, rc);
+	memset(encryptionKey, 0, sizeof(TPM2B_DATA));
     }
-    free(modulusBin);		/* @1 */
     return rc;
 }
 
+/* createEncryptionKey() generates a random AES-128 inner wrapper key and writes it to
+   'keyFilename' */
 
-static TPM_RC convertRsaPemToKeyPair(TPM2B_PUBLIC 	*objectPublic,
-			      TPM2B_PRIVATE 	*objectPrivate,
-			      int		keyType,
-			      TPMI_ALG_HASH 	nalg,
-			      TPMI_ALG_HASH	halg,
-			      const char 	*pemKeyFilename,
-			      const char 	*password)
+static TPM_RC createEncryptionKey(TPM2B_DATA 	*encryptionKey,
+				  const char 	*keyFilename)
 {
-    TPM_RC 	rc = 0;
-    EVP_PKEY 	*evpPkey = NULL;
-    RSA		*rsaKey = NULL;
+    TPM_RC	rc = 0;
 
     if (rc == 0) {
-	rc = convertPemToEvpPrivKey(&evpPkey,		/* freed @1 */
-				    pemKeyFilename,
-				    password);
+	rc = PEMTPM_Libcrypto_Load();
     }
     if (rc == 0) {
-	rc = convertEvpPkeyToRsakey(&rsaKey,		/* freed @2 */
-				    evpPkey);
-    }
-    if (rc == 0) {
-	rc = convertRsaKeyToPrivate(objectPrivate,
-				    NULL,
-				    rsaKey,
-				    password);
+	encryptionKey->t.size = 16;
+	if (RAND_bytes(encryptionKey->t.buffer, encryptionKey->t.size) != 1) {
+	    rc = TSS_RC_RNG_FAILURE;
+	}
     }
     if (rc == 0) {
-	rc = convertRsaKeyToPublic(objectPublic,
-				   keyType,
-				   nalg,
-				   halg,
-				   rsaKey);
+	rc = TSS_File_WriteBinaryFile(encryptionKey->t.buffer, encryptionKey->t.size, keyFilename);
     }
-    if (rsaKey != NULL) {
-	RSA_free(rsaKey);		/* @2 */
+    if (rc != 0) {
+	printf("pemtpm: cannot create encryption key %s, rc %08x\n", keyFilename, rc);
+	memset(encryptionKey, 0, sizeof(TPM2B_DATA));
     }
-    if (evpPkey != NULL) {
-	EVP_PKEY_free(evpPkey);		/* @1 */
+    return rc;
+}
+
+/* closeImportCommands() closes the -oic file and clears the parent password */
+
+static TPM_RC closeImportCommands(IMPORT_COMMANDS *importCommands)
+{
+    TPM_RC	rc = 0;
+
+    if (importCommands->commandFile != NULL) {
+	if (fclose(importCommands->commandFile) != 0) {
+	    printf("pemtpm: Error closing the command file\n");
+	    rc = TSS_RC_FILE_CLOSE;
+	}
     }
+    memset(importCommands, 0, sizeof(IMPORT_COMMANDS));
     return rc;
 }
 
+/* deleteWrapping() frees the parent and clears the inner wrapper key */
+
+static void deleteWrapping(WRAPPING *wrapping)
+{
+    PEMTPM_Parent_Delete(wrapping->parent);
+    memset(wrapping, 0, sizeof(WRAPPING));
+    return;
+}
+
 int main(int argc, char *argv[])
 {
     TPM_RC			rc = 0;
     int				i;    /* argc iterator */
-    TPM2B_PUBLIC		objectPublic;
-    TPM2B_PRIVATE		duplicate;
     const char			*pemKeyFilename = NULL;
     const char			*pemKeyPassword = "";	/* default empty password */
     const char			*outPublicFilename = NULL;
     const char			*outPrivateFilename = NULL;
+    const char			*outNameFilename = NULL;
+    const char			*inPublicFilename = NULL;
+    const char			*inPrivateFilename = NULL;
+    const char			*batchFilename = NULL;
+    const char			*bundleFilename = NULL;
+    const char			*socketFilename = NULL;
+    const char			*parentFilename = NULL;
+    const char			*outSeedFilename = NULL;
+    const char			*inKeyFilename = NULL;
+    const char			*outKeyFilename = NULL;
+    const char			*outCommandFilename = NULL;
+    const char			*parentPassword = NULL;
+    const char			*cacheDirectory = NULL;
+    const char			*stampsFilename = NULL;
+    const char			*outContainerFilename = NULL;
+    const char			*inContainerFilename = NULL;
+    const char			*keyIdString = NULL;
+    unsigned long		syncKeys = 0;
+    unsigned long		cacheMax = PEMTPM_CACHE_MAX_DEFAULT;
+    int				cacheMaxSet = FALSE;
+    int				parentHandleSet = FALSE;
+    WRAPPING			wrapping;
+    IMPORT_COMMANDS		importCommands;
+    int				stream = FALSE;
+    int				jobs = 1;
     int				keyType = TYPE_SI;
     TPMI_ALG_PUBLIC 		algPublic = TPM_ALG_RSA;
     TPMI_ALG_HASH		halg = TPM_ALG_SHA256;
     TPMI_ALG_HASH		nalg = TPM_ALG_SHA256;
-
-    FILE 			*pemKeyFile = NULL;
+    uint64_t			start = 0;
 
     setvbuf(stdout, 0, _IONBF, 0);      /* output may be going through pipe to log file */
+    memset(&wrapping, 0, sizeof(wrapping));
+    memset(&importCommands, 0, sizeof(importCommands));
 
     /* command line argument defaults */
     for (i=1 ; (i<argc) && (rc == 0) ; i++) {
@@ -442,6 +2699,9 @@ int main(int argc, char *argv[])
 	else if (strcmp(argv[i], "-rsa") == 0) {
 	    algPublic = TPM_ALG_RSA;
 	}
+	else if (strcmp(argv[i], "-ecc") == 0) {
+	    algPublic = TPM_ALG_ECC;
+	}
 	else if (strcmp(argv[i],"-pwdk") == 0) {
 	    i++;
 	    if (i < argc) {
@@ -469,19 +2729,224 @@ int main(int argc, char *argv[])
 		printf("-opr option needs a value\n");
 	    }
 	}
-	else if (strcmp(argv[i],"-halg") == 0) {
+	else if (strcmp(argv[i],"-opn") == 0) {
+	    i++;
+	    if (i < argc) {
+		outNameFilename = argv[i];
+	    }
+	    else {
+		printf("-opn option needs a value\n");
+	    }
+	}
+	else if (strcmp(argv[i],"-ipp") == 0) {
+	    i++;
+	    if (i < argc) {
+		parentFilename = argv[i];
+	    }
+	    else {
+		printf("-ipp option needs a value\n");
+	    }
+	}
+	else if (strcmp(argv[i],"-oss") == 0) {
+	    i++;
+	    if (i < argc) {
+		outSeedFilename = argv[i];
+	    }
+	    else {
+		printf("-oss option needs a value\n");
+	    }
+	}
+	else if (strcmp(argv[i],"-iek") == 0) {
+	    i++;
+	    if (i < argc) {
+		inKeyFilename = argv[i];
+	    }
+	    else {
+		printf("-iek option needs a value\n");
+	    }
+	}
+	else if (strcmp(argv[i],"-oek") == 0) {
+	    i++;
+	    if (i < argc) {
+		outKeyFilename = argv[i];
+	    }
+	    else {
+		printf("-oek option needs a value\n");
+	    }
+	}
+	else if (strcmp(argv[i],"-oic") == 0) {
+	    i++;
+	    if (i < argc) {
+		outCommandFilename = argv[i];
+	    }
+	    else {
+		printf("-oic option needs a value\n");
+	    }
+	}
+	else if (strcmp(argv[i],"-hp") == 0) {
+	    i++;
+	    if (i < argc) {
+		if (sscanf(argv[i],"%x", &importCommands.parentHandle) != 1) {
+		    printf("Bad parameter for -hp\n");
+		    exit(1);
+		}
+		parentHandleSet = TRUE;
+	    }
+	    else {
+		printf("-hp option needs a value\n");
+	    }
+	}
+	else if (strcmp(argv[i],"-pwdp") == 0) {
+	    i++;
+	    if (i < argc) {
+		parentPassword = argv[i];
+	    }
+	    else {
+		printf("-pwdp option needs a value\n");
+	    }
+	}
+	else if (strcmp(argv[i],"-ipu") == 0) {
+	    i++;
+	    if (i < argc) {
+		inPublicFilename = argv[i];
+	    }
+	    else {
+		printf("-ipu option needs a value\n");
+	    }
+	}
+	else if (strcmp(argv[i],"-ipr") == 0) {
+	    i++;
+	    if (i < argc) {
+		inPrivateFilename = argv[i];
+	    }
+	    else {
+		printf("-ipr option needs a value\n");
+	    }
+	}
+	else if (strcmp(argv[i],"-batch") == 0) {
+	    i++;
+	    if (i < argc) {
+		batchFilename = argv[i];
+	    }
+	    else {
+		printf("-batch option needs a value\n");
+	    }
+	}
+	else if (strcmp(argv[i],"-ibundle") == 0) {
+	    i++;
+	    if (i < argc) {
+		bundleFilename = argv[i];
+	    }
+	    else {
+		printf("-ibundle option needs a value\n");
+	    }
+	}
+	else if (strcmp(argv[i],"-serve") == 0) {
+	    i++;
+	    if (i < argc) {
+		socketFilename = argv[i];
+	    }
+	    else {
+		printf("-serve option needs a value\n");
+	    }
+	}
+	else if (strcmp(argv[i],"-stream") == 0) {
+	    stream = TRUE;
+	}
+	else if (strcmp(argv[i],"-stamps") == 0) {
+	    i++;
+	    if (i < argc) {
+		stampsFilename = argv[i];
+	    }
+	    else {
+		printf("-stamps option needs a value\n");
+	    }
+	}
+	else if (strcmp(argv[i],"-ocf") == 0) {
 	    i++;
 	    if (i < argc) {
-		if (strcmp(argv[i],"sha1") == 0) {
-		    halg = TPM_ALG_SHA1;
+		outContainerFilename = argv[i];
+	    }
+	    else {
+		printf("-ocf option needs a value\n");
+	    }
+	}
+	else if (strcmp(argv[i],"-icf") == 0) {
+	    i++;
+	    if (i < argc) {
+		inContainerFilename = argv[i];
+	    }
+	    else {
+		printf("-icf option needs a value\n");
+	    }
+	}
+	else if (strcmp(argv[i],"-kid") == 0) {
+	    i++;
+	    if (i < argc) {
+		keyIdString = argv[i];
+	    }
+	    else {
+		printf("-kid option needs a value\n");
+	    }
+	}
+	else if (strcmp(argv[i],"-sync") == 0) {
+	    i++;
+	    if (i < argc) {
+		char *end;
+		syncKeys = strtoul(argv[i], &end, 10);
+		if ((*end != '\0') || (syncKeys == 0) || (syncKeys > BATCH_SYNC_MAX)) {
+		    printf("Bad parameter for -sync\n");
+		    exit(1);
 		}
-		else if (strcmp(argv[i],"sha256") == 0) {
-		    halg = TPM_ALG_SHA256;
+	    }
+	    else {
+		printf("-sync option needs a value\n");
+	    }
+	}
+	else if (strcmp(argv[i],"-cache") == 0) {
+	    i++;
+	    if (i < argc) {
+		cacheDirectory = argv[i];
+	    }
+	    else {
+		printf("-cache option needs a value\n");
+	    }
+	}
+	else if (strcmp(argv[i],"-cachemax") == 0) {
+	    i++;
+	    if (i < argc) {
+		char *end;
+		cacheMax = strtoul(argv[i], &end, 10);
+		if ((*end != '\0') || (cacheMax == 0)) {
+		    printf("Bad parameter for -cachemax\n");
+		    exit(1);
 		}
-		else if (strcmp(argv[i],"sha384") == 0) {
-		    halg = TPM_ALG_SHA384;
+		cacheMaxSet = TRUE;
+	    }
+	    else {
+		printf("-cachemax option needs a value\n");
+	    }
+	}
+	else if (strcmp(argv[i],"-j") == 0) {
+	    i++;
+	    if (i < argc) {
+		jobs = atoi(argv[i]);
+		if ((jobs < 1) || (jobs > 1024)) {
+		    printf("Bad parameter for -j\n");
+		    exit(1);
 		}
-		else {
+	    }
+	    else {
+		printf("-j option needs a value\n");
+	    }
+	}
+	else if (strcmp(argv[i],"-stats") == 0) {
+	    pemtpmStats = TRUE;
+	}
+	else if (strcmp(argv[i],"-halg") == 0) {
+	    i++;
+	    if (i < argc) {
+		if (getHashAlgorithm(&halg, argv[i]) != 0) {
 		    printf("Bad parameter for -halg\n");
 		}
 	    }
@@ -492,16 +2957,7 @@ int main(int argc, char *argv[])
 	else if (strcmp(argv[i],"-nalg") == 0) {
 	    i++;
 	    if (i < argc) {
-		if (strcmp(argv[i],"sha1") == 0) {
-		    nalg = TPM_ALG_SHA1;
-		}
-		else if (strcmp(argv[i],"sha256") == 0) {
-		    nalg = TPM_ALG_SHA256;
-		}
-		else if (strcmp(argv[i],"sha384") == 0) {
-		    nalg = TPM_ALG_SHA384;
-		}
-		else {
+		if (getHashAlgorithm(&nalg, argv[i]) != 0) {
 		    printf("Bad parameter for -nalg\n");
 		}
 	    }
@@ -510,6 +2966,247 @@ int main(int argc, char *argv[])
 	    }
 	}
     }
+    if (pemtpmStats) start = PEMTPM_Stats_Now();
+#if OPENSSL_VERSION_NUMBER < 0x10100000
+    /* older OpenSSL needs application locking callbacks to be thread safe */
+    if (jobs > 1) {
+	printf("-j requires OpenSSL 1.1.0 or later\n");
+	exit(1);
+    }
+#endif
+    if ((outSeedFilename != NULL) && (parentFilename == NULL) && (inContainerFilename == NULL)) {
+	printf("-oss requires -ipp or -icf\n");
+	exit(1);
+    }
+    if ((parentFilename != NULL) &&
+	((inPublicFilename != NULL) || (inPrivateFilename != NULL))) {
+	printf("-ipp cannot be used with -ipu or -ipr\n");
+	exit(1);
+    }
+    if ((inKeyFilename != NULL) && (outKeyFilename != NULL)) {
+	printf("-iek and -oek cannot be used together\n");
+	exit(1);
+    }
+    if (((inKeyFilename != NULL) || (outKeyFilename != NULL)) &&
+	((inPublicFilename != NULL) || (inPrivateFilename != NULL))) {
+	printf("-iek and -oek cannot be used with -ipu or -ipr\n");
+	exit(1);
+    }
+    if ((outCommandFilename == NULL) && (parentHandleSet || (parentPassword != NULL))) {
+	printf("-hp and -pwdp require -oic\n");
+	exit(1);
+    }
+    if ((outCommandFilename != NULL) && !parentHandleSet) {
+	printf("-oic requires -hp\n");
+	exit(1);
+    }
+    if ((outCommandFilename != NULL) &&
+	(stream || (inPublicFilename != NULL) || (inPrivateFilename != NULL))) {
+	printf("-oic cannot be used with -stream, -ipu or -ipr\n");
+	exit(1);
+    }
+    if ((stampsFilename != NULL) && (batchFilename == NULL)) {
+	printf("-stamps requires -batch\n");
+	exit(1);
+    }
+    if ((syncKeys > 0) &&
+	(batchFilename == NULL) && (pemKeyFilename == NULL) && (bundleFilename == NULL)) {
+	printf("-sync requires -batch, -ipem or -ibundle\n");
+	exit(1);
+    }
+    if ((outContainerFilename != NULL) && (batchFilename == NULL)) {
+	printf("-ocf requires -batch\n");
+	exit(1);
+    }
+    /* a skipped key would have no command or record, and -oek makes every key out of date */
+    if ((stampsFilename != NULL) &&
+	((outCommandFilename != NULL) || (outKeyFilename != NULL) ||
+	 (outContainerFilename != NULL))) {
+	printf("-stamps cannot be used with -oic, -oek or -ocf\n");
+	exit(1);
+    }
+    if ((inContainerFilename == NULL) != (keyIdString == NULL)) {
+	printf("-icf and -kid must be used together\n");
+	exit(1);
+    }
+    if ((inContainerFilename != NULL) &&
+	((pemKeyFilename != NULL) || (batchFilename != NULL) || (bundleFilename != NULL) ||
+	 stream || (socketFilename != NULL) ||
+	 (inPublicFilename != NULL) || (inPrivateFilename != NULL) ||
+	 (parentFilename != NULL) || (inKeyFilename != NULL) || (outKeyFilename != NULL) ||
+	 (outCommandFilename != NULL) || (cacheDirectory != NULL))) {
+	printf("-icf cannot be used with -ipem, -batch, -ibundle, -stream, -serve, -ipu, -ipr, "
+	       "-ipp, -iek, -oek, -oic or -cache\n");
+	exit(1);
+    }
+    if ((inContainerFilename != NULL) &&
+	((outPublicFilename == NULL) || (outPrivateFilename == NULL))) {
+	printf("-icf requires -opu and -opr\n");
+	exit(1);
+    }
+    if (inContainerFilename != NULL) {
+	rc = extractContainerKey(inContainerFilename, keyIdString,
+				 outPublicFilename, outPrivateFilename,
+				 outSeedFilename, outNameFilename);
+	return (rc == 0) ? 0 : EXIT_FAILURE;
+    }
+    if ((cacheDirectory == NULL) && cacheMaxSet) {
+	printf("-cachemax requires -cache\n");
+	exit(1);
+    }
+    if ((cacheDirectory != NULL) &&
+	((inPublicFilename != NULL) || (inPrivateFilename != NULL))) {
+	printf("-cache cannot be used with -ipu or -ipr\n");
+	exit(1);
+    }
+    /* parsed or generated once, and shared by every key */
+    if (parentFilename != NULL) {
+	if (readParent(&wrapping, parentFilename) != 0) {
+	    exit(1);
+	}
+    }
+    if (inKeyFilename != NULL) {
+	rc = readEncryptionKey(&wrapping.encryptionKey, inKeyFilename);
+    }
+    if (outKeyFilename != NULL) {
+	rc = createEncryptionKey(&wrapping.encryptionKey, outKeyFilename);
+    }
+    if ((rc == 0) && (parentPassword != NULL)) {
+	rc = TSS_TPM2B_StringCopy(&importCommands.parentAuth.b, parentPassword,
+				  sizeof(importCommands.parentAuth.t.buffer));
+    }
+    /* every command is appended to one file, opened once */
+    if ((rc == 0) && (outCommandFilename != NULL)) {
+	rc = TSS_File_Open(&importCommands.commandFile, outCommandFilename, "wb");
+    }
+    if ((rc == 0) && (cacheDirectory != NULL)) {
+	rc = PEMTPM_Cache_Open(&cache, cacheDirectory, cacheMax);
+	if (rc != 0) {
+	    printf("Cannot open the cache %s\n", cacheDirectory);
+	}
+    }
+    if (rc != 0) {
+	deleteWrapping(&wrapping);
+	exit(1);
+    }
+    if (socketFilename != NULL) {
+	if ((pemKeyFilename != NULL) || (outPublicFilename != NULL) ||
+	    (outPrivateFilename != NULL) || (outNameFilename != NULL) ||
+	    (outSeedFilename != NULL) || (outCommandFilename != NULL) || stream ||
+	    (batchFilename != NULL) || (bundleFilename != NULL) ||
+	    (inPublicFilename != NULL) || (inPrivateFilename != NULL)) {
+	    printf("-serve cannot be used with -ipem, -opu, -opr, -opn, -oss, -oic, -stream, "
+		   "-batch, -ibundle, -ipu or -ipr\n");
+	    deleteWrapping(&wrapping);
+	    exit(1);
+	}
+	verbose = FALSE;
+	rc = processServe(algPublic, keyType, nalg, halg, socketFilename, &wrapping, jobs);
+	if (pemtpmStats) PEMTPM_Stats_Print(stderr, FALSE, PEMTPM_Stats_Now() - start);
+	/* the wrapping and cache are not freed, a worker may still use them until the process exits */
+	return (rc == 0) ? 0 : EXIT_FAILURE;
+    }
+    if (stream) {
+	if ((pemKeyFilename != NULL) || (outPublicFilename != NULL) ||
+	    (outPrivateFilename != NULL) || (outNameFilename != NULL) ||
+	    (outSeedFilename != NULL) ||
+	    (batchFilename != NULL) || (bundleFilename != NULL) ||
+	    (inPublicFilename != NULL) || (inPrivateFilename != NULL)) {
+	    printf("-stream cannot be used with -ipem, -opu, -opr, -opn, -oss, -batch, -ibundle, "
+		   "-ipu or -ipr\n");
+	    exit(1);
+	}
+	if (jobs != 1) {
+	    printf("-j requires -batch\n");
+	    exit(1);
+	}
+	verbose = FALSE;
+	rc = processStream(algPublic, keyType, nalg, halg, pemKeyPassword, &wrapping);
+	if (pemtpmStats) PEMTPM_Stats_Print(stderr, FALSE, PEMTPM_Stats_Now() - start);
+	deleteWrapping(&wrapping);
+	PEMTPM_Cache_Close(cache);
+	return (rc == 0) ? 0 : EXIT_FAILURE;
+    }
+    if ((inPublicFilename != NULL) || (inPrivateFilename != NULL)) {
+	if ((inPublicFilename == NULL) || (inPrivateFilename == NULL)) {
+	    printf("-ipu and -ipr must be used together\n");
+	    exit(1);
+	}
+	if ((pemKeyFilename != NULL) || (batchFilename != NULL) || (bundleFilename != NULL)) {
+	    printf("-ipu and -ipr cannot be used with -ipem, -batch or -ibundle\n");
+	    exit(1);
+	}
+	rc = verifyFiles(inPublicFilename, inPrivateFilename);
+	if (pemtpmStats) PEMTPM_Stats_Print(stderr, FALSE, PEMTPM_Stats_Now() - start);
+	return (rc == 0) ? 0 : EXIT_FAILURE;
+    }
+    if (batchFilename != NULL) {
+	if ((pemKeyFilename != NULL) || (outPublicFilename != NULL) ||
+	    (outPrivateFilename != NULL) || (outNameFilename != NULL) ||
+	    (outSeedFilename != NULL) || (bundleFilename != NULL)) {
+	    printf("-batch cannot be used with -ipem, -opu, -opr, -opn, -oss or -ibundle\n");
+	    exit(1);
+	}
+	/* per-key messages would dominate a large batch, errors are still reported */
+	verbose = FALSE;
+	rc = processBatchFile(algPublic,
+			      keyType,
+			      nalg,
+			      halg,
+			      batchFilename,
+			      &wrapping,
+			      &importCommands,
+			      stampsFilename,
+			      outContainerFilename,
+			      syncKeys,
+			      jobs);
+	if (closeImportCommands(&importCommands) != 0) {
+	    rc = EXIT_FAILURE;
+	}
+	if (pemtpmStats) PEMTPM_Stats_Print(stderr, TRUE, PEMTPM_Stats_Now() - start);
+	deleteWrapping(&wrapping);
+	PEMTPM_Cache_Close(cache);
+	return (rc == 0) ? 0 : EXIT_FAILURE;
+    }
+    if (jobs != 1) {
+	printf("-j requires -batch\n");
+	exit(1);
+    }
+    if (bundleFilename != NULL) {
+	if (pemKeyFilename != NULL) {
+	    printf("-ibundle cannot be used with -ipem\n");
+	    exit(1);
+	}
+	if ((outPublicFilename == NULL) || !isBundleTemplate(outPublicFilename) ||
+	    (outPrivateFilename == NULL) || !isBundleTemplate(outPrivateFilename) ||
+	    ((outNameFilename != NULL) && !isBundleTemplate(outNameFilename)) ||
+	    ((wrapping.parent != NULL) &&
+	     ((outSeedFilename == NULL) || !isBundleTemplate(outSeedFilename)))) {
+	    printf("-ibundle requires -opu, -opr, -opn and -oss templates with one %%u\n");
+	    exit(1);
+	}
+	verbose = FALSE;
+	rc = processBundle(algPublic,
+			   keyType,
+			   nalg,
+			   halg,
+			   bundleFilename,
+			   pemKeyPassword,
+			   outPublicFilename,
+			   outPrivateFilename,
+			   outNameFilename,
+			   &wrapping,
+			   outSeedFilename,
+			   &importCommands,
+			   (syncKeys > 0));
+	if (closeImportCommands(&importCommands) != 0) {
+	    rc = EXIT_FAILURE;
+	}
+	if (pemtpmStats) PEMTPM_Stats_Print(stderr, FALSE, PEMTPM_Stats_Now() - start);
+	deleteWrapping(&wrapping);
+	PEMTPM_Cache_Close(cache);
+	return (rc == 0) ? 0 : EXIT_FAILURE;
+    }
     if (pemKeyFilename == NULL) {
 	printf("Missing parameter -ipem\n");
 	exit(1);
@@ -522,41 +3219,33 @@ int main(int argc, char *argv[])
 	printf("Missing parameter -opr\n");
 	exit(1);
     }
-    if (rc == 0) {
-	if (algPublic == TPM_ALG_RSA) {
-	    rc = convertRsaPemToKeyPair(&objectPublic,
-					&duplicate,
-					keyType,
-					nalg,
-					halg,
-					pemKeyFilename,
-					pemKeyPassword);
-	}
-	else {
-	    rc = EXIT_FAILURE;
-	}
+    if ((wrapping.parent != NULL) && (outSeedFilename == NULL)) {
+	printf("Missing parameter -oss\n");
+	exit(1);
     }
-
     if (rc == 0) {
-	printf("importpem: success\n");
-
-		rc = TSS_File_WriteStructure(&objectPublic,
-				(MarshalFunction_t)TSS_TPM2B_PUBLIC_Marshal, outPublicFilename);
-		if (rc == 0) {
-			printf("pemtpm: write to %s OK\n", outPublicFilename);
-			rc = TSS_File_WriteStructure(&duplicate,
-					(MarshalFunction_t)TSS_TPM2B_PRIVATE_Marshal, outPrivateFilename);
-
-			if (rc == 0) {
-				printf("pemtpm: write to %s OK duplicate.t.size=%d\n", outPrivateFilename, duplicate.t.size);
-			}
-		}
-
-    } else {
+	rc = convertPemToFiles(algPublic,
+			       keyType,
+			       nalg,
+			       halg,
+			       pemKeyFilename,
+			       pemKeyPassword,
+			       outPublicFilename,
+			       outPrivateFilename,
+			       outNameFilename,
+			       &wrapping,
+			       outSeedFilename,
+			       &importCommands,
+			       (syncKeys > 0));
+    }
+    if (closeImportCommands(&importCommands) != 0) {
 	rc = EXIT_FAILURE;
     }
-    if (pemKeyFile != NULL) {
-	fclose(pemKeyFile);			/* @2 */
+    if (pemtpmStats) PEMTPM_Stats_Print(stderr, FALSE, PEMTPM_Stats_Now() - start);
+    deleteWrapping(&wrapping);
+    PEMTPM_Cache_Close(cache);
+    if (rc != 0) {
+	rc = EXIT_FAILURE;
     }
     return rc;
 }
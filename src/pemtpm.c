@@ -0,0 +1,1322 @@
+/********************************************************************************/
+/*										*/
+/*		      PEM Keypair to TPM Structures Library			*/
+/*			     Written by Ken Goldman				*/
+/*		       IBM Thomas J. Watson Research Center			*/
+/*										*/
+/* (c) Copyright IBM Corporation 2016.						*/
+/*										*/
+/* All rights reserved.								*/
+/* 										*/
+/* Redistribution and use in source and binary forms, with or without		*/
+/* modification, are permitted provided that the following conditions are	*/
+/* met:										*/
+/* 										*/
+/* Redistributions of source code must retain the above copyright notice,	*/
+/* this list of conditions and the following disclaimer.			*/
+/* 										*/
+/* Redistributions in binary form must reproduce the above copyright		*/
+/* notice, this list of conditions and the following disclaimer in the		*/
+/* documentation and/or other materials provided with the distribution.		*/
+/* 										*/
+/* Neither the names of the IBM Corporation nor the names of its		*/
+/* contributors may be used to endorse or promote products derived from		*/
+/* this software without specific prior written permission.			*/
+/* 										*/
+/* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS		*/
+/* "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT		*/
+/* LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR	*/
+/* A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT		*/
+/* HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,	*/
+/* SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT		*/
+/* LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,	*/
+/* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY	*/
+/* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT		*/
+/* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE	*/
+/* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.		*/
+/********************************************************************************/
+
+/* Use OpenSSL to create an RSA  keypair like this
+
+   > openssl genrsa -out tmpprivkey.pem -aes256 -passout pass:rrrr 2048
+
+   or an ECC P-256 or P-384 keypair like this
+
+   > openssl ecparam -name prime256v1 -genkey -noout | openssl ec -aes256 -passout pass:rrrr -out tmpprivkey.pem
+
+   The library converts the PEM keypair in memory.  Nothing is read from or written to a file.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include <tss2/tss.h>
+#include <tss2/tssutils.h>
+#include <tss2/tssmarshal.h>
+#include <tss2/pemtpm.h>
+#include <openssl/pem.h>
+#include <openssl/evp.h>
+#include <openssl/ec.h>
+#include <openssl/objects.h>
+#include <openssl/obj_mac.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000
+#include <openssl/core_names.h>
+#endif
+
+#include "pemtpmcrypto.h"
+#include "pemtpmder.h"
+#include "pemtpmlibcrypto.h"
+#include "pemtpmmarshal.h"
+
+int tssVerbose = TRUE;
+
+/* convertPemBufferToEvpPrivKey() is convertPemToEvpPrivKey() for a PEM key already in memory */
+
+static TPM_RC convertPemBufferToEvpPrivKey(EVP_PKEY **evpPkey,		/* freed by caller */
+					   const unsigned char *pemData,
+					   size_t pemLength,
+					   const char *password)
+{
+    TPM_RC 	rc = 0;
+    BIO 	*pemBio = NULL;
+
+    if (rc == 0) {
+	if (pemLength > INT_MAX) {
+	    printf("convertPemBufferToEvpPrivKey: PEM length %lu too large\n",
+		   (unsigned long)pemLength);
+	    rc = EXIT_FAILURE;
+	}
+    }
+    if (rc == 0) {
+	pemBio = BIO_new_mem_buf(pemData, (int)pemLength);	/* freed @1 */
+	if (pemBio == NULL) {
+	    printf("convertPemBufferToEvpPrivKey: BIO_new_mem_buf failed\n");
+	    rc = TSS_RC_OUT_OF_MEMORY;
+	}
+    }
+    if (rc == 0) {
+	*evpPkey = PEM_read_bio_PrivateKey(pemBio, NULL, NULL, (void *)password);
+	if (*evpPkey == NULL) {
+	    printf("convertPemBufferToEvpPrivKey: Error reading key\n");
+	    rc = EXIT_FAILURE;
+	}
+    }
+    if (pemBio != NULL) {
+	BIO_free(pemBio);			/* @1 */
+    }
+    return rc;
+}
+
+static TPM_RC convertEvpPkeyToRsakey(RSA **rsaKey,		/* freed by caller */
+			      EVP_PKEY *evpPkey)
+{
+    TPM_RC 	rc = 0;
+
+    if (rc == 0) {
+	*rsaKey = EVP_PKEY_get1_RSA(evpPkey);
+	if (*rsaKey == NULL) {
+	    printf("convertEvpPkeyToRsakey: EVP_PKEY_get1_RSA failed\n");
+	    rc = EXIT_FAILURE;
+	}
+    }
+    return rc;
+}
+
+/* getRsaKeyParts() gets the RSA key parts from an OpenSSL RSA key token.
+
+   If n is not NULL, returns n, e, and d.  If p is not NULL, returns p and q.
+*/
+
+static TPM_RC getRsaKeyParts(const BIGNUM **n,
+		     const BIGNUM **e,
+		     const BIGNUM **d,
+		     const BIGNUM **p,
+		     const BIGNUM **q,
+		     const RSA *rsaKey)
+{
+    TPM_RC  	rc = 0;
+#if OPENSSL_VERSION_NUMBER < 0x10100000
+    if (n != NULL) {
+	*n = rsaKey->n;
+	*e = rsaKey->e;
+	*d = rsaKey->d;
+    }
+    if (p != NULL) {
+	*p = rsaKey->p;
+	*q = rsaKey->q;
+    }
+#else
+    if (n != NULL) {
+	RSA_get0_key(rsaKey, n, e, d);
+    }
+    if (p != NULL) {
+	RSA_get0_factors(rsaKey, p, q);
+    }
+#endif
+    return rc;
+}
+
+
+/* convertRsaKeyToPrivateKeyBin() converts the RSA private prime p to the caller's 'privateKeyBin'
+   of 'privateKeyBinSize' bytes */
+
+static TPM_RC convertRsaKeyToPrivateKeyBin(int 	*privateKeyBytes,
+				    uint8_t 	*privateKeyBin,
+				    size_t 	privateKeyBinSize,
+				    const RSA	 *rsaKey)
+{
+    TPM_RC 		rc = 0;
+    const BIGNUM 	*p;
+    const BIGNUM 	*q;
+
+    /* get the private primes */
+    if (rc == 0) {
+	rc = getRsaKeyParts(NULL, NULL, NULL, &p, &q, rsaKey);
+    }
+    if (rc == 0) {
+	*privateKeyBytes = BN_num_bytes(p);
+	if ((size_t)*privateKeyBytes > privateKeyBinSize) {
+	    printf("convertRsaKeyToPrivateKeyBin: Error, private prime %d greater than %lu\n",
+		   *privateKeyBytes, (unsigned long)privateKeyBinSize);
+	    rc = EXIT_FAILURE;
+	}
+    }
+    /* convert the private key bignum to binary */
+    if (rc == 0) {
+	BN_bn2bin(p, privateKeyBin);
+    }
+    return rc;
+}
+
+/* convertSensitiveToPrivate() converts a TPMT_SENSITIVE to either a TPM2B_PRIVATE or a
+   TPM2B_SENSITIVE.  It is common to RSA and ECC. */
+
+static TPM_RC convertSensitiveToPrivate(TPM2B_PRIVATE 		*objectPrivate,
+					TPM2B_SENSITIVE 	*objectSensitive,
+					const TPMT_SENSITIVE 	*tSensitive)
+{
+    TPM_RC 		rc = 0;
+    TPM2B_SENSITIVE	bSensitive;
+
+    if (rc == 0) {
+	if (((objectPrivate == NULL) && (objectSensitive == NULL)) ||
+	    ((objectPrivate != NULL) && (objectSensitive != NULL))) {
+	    printf("convertSensitiveToPrivate: Only one result supported\n");
+	    rc = EXIT_FAILURE;
+	}
+    }
+
+    /* In some cases, the sensitive data is not encrypted and the integrity value is not present.
+       When an integrity value is not needed, it is not present and it is not represented by an
+       Empty Buffer.
+
+       In this case, the TPM2B_PRIVATE will just be a marshaled TPM2B_SENSITIVE, which is a
+       marshaled TPMT_SENSITIVE */
+
+    /* marshal the TPMT_SENSITIVE into a TPM2B_SENSITIVE */
+    if (rc == 0) {
+	if (objectPrivate != NULL) {
+	    int32_t size = sizeof(bSensitive.t.sensitiveArea);	/* max size */
+	    uint8_t *buffer = bSensitive.b.buffer;		/* pointer that can move */
+	    bSensitive.t.size = 0;				/* required before marshaling */
+	    rc = PEMTPM_Marshal_TPMT_SENSITIVE(tSensitive,
+					       &bSensitive.b.size,	/* marshaled size */
+					       &buffer,		/* marshal here */
+					       &size);		/* max size */
+	}
+	else {	/* return TPM2B_SENSITIVE */
+	    objectSensitive->t.sensitiveArea = *tSensitive;
+	}
+    }
+    /* marshal the TPM2B_SENSITIVE (as a TPM2B_PRIVATE, see above) into a TPM2B_PRIVATE */
+    if (rc == 0) {
+	if (objectPrivate != NULL) {
+	    int32_t size = sizeof(objectPrivate->t.buffer);	/* max size */
+	    uint8_t *buffer = objectPrivate->t.buffer;		/* pointer that can move */
+	    objectPrivate->t.size = 0;				/* required before marshaling */
+	    rc = PEMTPM_Marshal_TPM2B_PRIVATE((TPM2B_PRIVATE *)&bSensitive,
+					      &objectPrivate->t.size,	/* marshaled size */
+					      &buffer,		/* marshal here */
+					      &size);		/* max size */
+	}
+    }
+    memset(&bSensitive, 0, sizeof(bSensitive));
+    return rc;
+}
+
+static TPM_RC convertRsaPrivateKeyBinToPrivate(TPM2B_PRIVATE 	*objectPrivate,
+					TPM2B_SENSITIVE *objectSensitive,
+					int 		privateKeyBytes,
+					const uint8_t 	*privateKeyBin,
+					const char 	*password)
+{
+    TPM_RC 		rc = 0;
+    TPMT_SENSITIVE	tSensitive;
+
+    /* construct TPMT_SENSITIVE	*/
+    if (rc == 0) {
+	/* This shall be the same as the type parameter of the associated public area. */
+	tSensitive.sensitiveType = TPM_ALG_RSA;
+	tSensitive.seedValue.b.size = 0;
+	/* key password converted to TPM2B */
+	rc = TSS_TPM2B_StringCopy(&tSensitive.authValue.b, password, sizeof(TPMU_HA));
+    }
+    if (rc == 0) {
+	if ((size_t)privateKeyBytes > sizeof(tSensitive.sensitive.rsa.t.buffer)) {
+	    printf("convertRsaPrivateKeyBinToPrivate: "
+		   "Error, private key modulus %d greater than %lu\n",
+		   privateKeyBytes, (unsigned long)sizeof(tSensitive.sensitive.rsa.t.buffer));
+	    rc = EXIT_FAILURE;
+	}
+    }
+    if (rc == 0) {
+	tSensitive.sensitive.rsa.t.size = privateKeyBytes;
+	memcpy(tSensitive.sensitive.rsa.t.buffer, privateKeyBin, privateKeyBytes);
+    }
+    if (rc == 0) {
+	rc = convertSensitiveToPrivate(objectPrivate, objectSensitive, &tSensitive);
+    }
+    memset(&tSensitive, 0, sizeof(tSensitive));
+    return rc;
+}
+
+
+static TPM_RC convertRsaKeyToPrivate(TPM2B_PRIVATE 	*objectPrivate,
+			      TPM2B_SENSITIVE 	*objectSensitive,
+			      RSA 		*rsaKey,
+			      const char 	*password)
+{
+    TPM_RC 	rc = 0;
+    int 	privateKeyBytes;
+    uint8_t 	privateKeyBin[MAX_RSA_KEY_BYTES];
+
+    /* convert an openssl RSA key token private prime p to a binary array */
+    if (rc == 0) {
+	rc = convertRsaKeyToPrivateKeyBin(&privateKeyBytes,
+					  privateKeyBin,
+					  sizeof(privateKeyBin),
+					  rsaKey);
+    }
+    /* convert an RSA prime 'privateKeyBin' to either a TPM2B_PRIVATE or a TPM2B_SENSITIVE */
+    if (rc == 0) {
+	rc = convertRsaPrivateKeyBinToPrivate(objectPrivate,
+					      objectSensitive,
+					      privateKeyBytes,
+					      privateKeyBin,
+					      password);
+    }
+    memset(privateKeyBin, 0, sizeof(privateKeyBin));
+    return rc;
+}
+static TPM_RC convertRsaPublicKeyBinToPublic(TPM2B_PUBLIC 	*objectPublic,
+				      int		keyType,
+				      TPMI_ALG_HASH 	nalg,
+				      TPMI_ALG_HASH	halg,
+				      int 		modulusBytes,
+				      const uint8_t 	*modulusBin)
+{
+    TPM_RC 		rc = 0;
+
+    if (rc == 0) {
+	if ((size_t)modulusBytes > sizeof(objectPublic->publicArea.unique.rsa.t.buffer)) {
+	    printf("convertRsaPublicKeyBinToPublic: Error, "
+		   "public key modulus %d greater than %lu\n", modulusBytes,
+		   (unsigned long)sizeof(objectPublic->publicArea.unique.rsa.t.buffer));
+	    rc = EXIT_FAILURE;
+	}
+    }
+    if (rc == 0) {
+	/* Table 184 - Definition of TPMT_PUBLIC Structure */
+	objectPublic->publicArea.type = TPM_ALG_RSA;
+	objectPublic->publicArea.nameAlg = nalg;
+	objectPublic->publicArea.objectAttributes.val = TPMA_OBJECT_NODA;
+	objectPublic->publicArea.objectAttributes.val |= TPMA_OBJECT_USERWITHAUTH;
+	if (keyType == TYPE_SI) {
+	    objectPublic->publicArea.objectAttributes.val |= TPMA_OBJECT_SIGN;
+	}
+	else {
+	    objectPublic->publicArea.objectAttributes.val |= TPMA_OBJECT_DECRYPT;
+	}
+	objectPublic->publicArea.authPolicy.t.size = 0;
+	/* Table 182 - Definition of TPMU_PUBLIC_PARMS Union <IN/OUT, S> */
+	objectPublic->publicArea.parameters.rsaDetail.symmetric.algorithm = TPM_ALG_NULL;
+	if (keyType == TYPE_SI) {
+	    objectPublic->publicArea.parameters.rsaDetail.scheme.scheme = TPM_ALG_RSASSA;
+	}
+	else {
+	    objectPublic->publicArea.parameters.rsaDetail.scheme.scheme = TPM_ALG_NULL;
+	}
+	objectPublic->publicArea.parameters.rsaDetail.scheme.details.rsassa.hashAlg = halg;
+	objectPublic->publicArea.parameters.rsaDetail.keyBits = modulusBytes * 8;
+	objectPublic->publicArea.parameters.rsaDetail.exponent = 0;
+
+	objectPublic->publicArea.unique.rsa.t.size = modulusBytes;
+	memcpy(objectPublic->publicArea.unique.rsa.t.buffer, modulusBin, modulusBytes);
+    }
+    return rc;
+}
+
+
+/* convertRsaKeyToPublicKeyBin() converts from an openssl RSA key token to a public modulus in the
+   caller's 'modulusBin' of 'modulusBinSize' bytes */
+
+static TPM_RC convertRsaKeyToPublicKeyBin(int 		*modulusBytes,
+				   uint8_t 	*modulusBin,
+				   size_t 	modulusBinSize,
+				   const RSA 	*rsaKey)
+{
+    TPM_RC 		rc = 0;
+    const BIGNUM 	*n;
+    const BIGNUM 	*e;
+    const BIGNUM 	*d;
+
+    /* get the public modulus from the RSA key token */
+    if (rc == 0) {
+	rc = getRsaKeyParts(&n, &e, &d, NULL, NULL, rsaKey);
+    }
+    if (rc == 0) {
+	*modulusBytes = BN_num_bytes(n);
+	if ((size_t)*modulusBytes > modulusBinSize) {
+	    printf("convertRsaKeyToPublicKeyBin: Error, public key modulus %d greater than %lu\n",
+		   *modulusBytes, (unsigned long)modulusBinSize);
+	    rc = EXIT_FAILURE;
+	}
+    }
+    if (rc == 0) {
+	BN_bn2bin(n, modulusBin);
+    }
+    return rc;
+}
+
+
+static TPM_RC convertRsaKeyToPublic(TPM2B_PUBLIC 	*objectPublic,
+			     int		keyType,
+			     TPMI_ALG_HASH 	nalg,
+			     TPMI_ALG_HASH	halg,
+			     RSA 		*rsaKey)
+{
+    TPM_RC 		rc = 0;
+    int 		modulusBytes;
+    uint8_t 		modulusBin[MAX_RSA_KEY_BYTES];
+
+    /* openssl RSA key token to a public modulus */
+    if (rc == 0) {
+	rc = convertRsaKeyToPublicKeyBin(&modulusBytes,
+					 modulusBin,
+					 sizeof(modulusBin),
+					 rsaKey);
+    }
+    /* public modulus to TPM2B_PUBLIC */
+    if (rc == 0) {
+	rc = convertRsaPublicKeyBinToPublic(objectPublic,
+					    keyType,
+					    nalg,
+					    halg,
+					    modulusBytes,
+					    modulusBin);
+    }
+    return rc;
+}
+
+/* convertRsaEvpPkeyToKeyPair() converts an OpenSSL RSA key to a TPM2B_PUBLIC and TPM2B_PRIVATE */
+
+static TPM_RC convertRsaEvpPkeyToKeyPair(TPM2B_PUBLIC 	*objectPublic,
+					 TPM2B_PRIVATE 	*objectPrivate,
+					 int		keyType,
+					 TPMI_ALG_HASH 	nalg,
+					 TPMI_ALG_HASH	halg,
+					 EVP_PKEY 	*evpPkey,
+					 const char 	*password)
+{
+    TPM_RC 	rc = 0;
+    RSA		*rsaKey = NULL;
+
+    if (rc == 0) {
+	rc = convertEvpPkeyToRsakey(&rsaKey,		/* freed @1 */
+				    evpPkey);
+    }
+    if (rc == 0) {
+	rc = convertRsaKeyToPrivate(objectPrivate,
+				    NULL,
+				    rsaKey,
+				    password);
+    }
+    if (rc == 0) {
+	rc = convertRsaKeyToPublic(objectPublic,
+				   keyType,
+				   nalg,
+				   halg,
+				   rsaKey);
+    }
+    if (rsaKey != NULL) {
+	RSA_free(rsaKey);		/* @1 */
+    }
+    return rc;
+}
+
+/* convertRsaDerKeyToKeyPair() converts an RSA key read by the native DER reader to a TPM2B_PUBLIC
+   and TPM2B_PRIVATE */
+
+static TPM_RC convertRsaDerKeyToKeyPair(TPM2B_PUBLIC 			*objectPublic,
+					TPM2B_PRIVATE 			*objectPrivate,
+					int				keyType,
+					TPMI_ALG_HASH 			nalg,
+					TPMI_ALG_HASH			halg,
+					const PEMTPM_DER_RSA_KEY 	*rsaKey,
+					const char 			*password)
+{
+    TPM_RC 	rc = 0;
+
+    if (rc == 0) {
+	rc = convertRsaPrivateKeyBinToPrivate(objectPrivate,
+					      NULL,
+					      (int)rsaKey->primeSize,
+					      rsaKey->prime,
+					      password);
+    }
+    if (rc == 0) {
+	rc = convertRsaPublicKeyBinToPublic(objectPublic,
+					    keyType,
+					    nalg,
+					    halg,
+					    (int)rsaKey->modulusSize,
+					    rsaKey->modulus);
+    }
+    return rc;
+}
+
+/* getEcCurve() maps the OpenSSL curve 'nid' to the TPM curve ID and the size in bytes of a
+   coordinate or private key.  Only the curves in Implementation.h are supported. */
+
+static TPM_RC getEcCurve(TPMI_ECC_CURVE *curveID,
+			 int 		*curveBytes,
+			 int		nid)
+{
+    TPM_RC 		rc = 0;
+
+    switch (nid) {
+#if ECC_NIST_P256
+      case NID_X9_62_prime256v1:
+	*curveID = TPM_ECC_NIST_P256;
+	*curveBytes = 32;
+	break;
+#endif
+#if ECC_NIST_P384
+      case NID_secp384r1:
+	*curveID = TPM_ECC_NIST_P384;
+	*curveBytes = 48;
+	break;
+#endif
+      default:
+	printf("getEcCurve: Error, unsupported curve, nid %d\n", nid);
+	rc = TPM_RC_CURVE;
+    }
+    return rc;
+}
+
+/* getEcKeyParts() retrieves the curve, the private key 'd' and the public point 'x', 'y' of an
+   OpenSSL EC key */
+
+static TPM_RC getEcKeyParts(TPMI_ECC_CURVE 	*curveID,
+			    int 		*curveBytes,
+			    BIGNUM 		**d,		/* freed by caller */
+			    BIGNUM 		**x,		/* freed by caller */
+			    BIGNUM 		**y,		/* freed by caller */
+			    EVP_PKEY 		*evpPkey)
+{
+    TPM_RC 	rc = 0;
+    int		nid = NID_undef;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000
+    char	curveName[64];
+
+    if (rc == 0) {
+	if (EVP_PKEY_get_utf8_string_param(evpPkey, OSSL_PKEY_PARAM_GROUP_NAME,
+					   curveName, sizeof(curveName), NULL) != 1) {
+	    printf("getEcKeyParts: Error, the key has no named curve\n");
+	    rc = TPM_RC_CURVE;
+	}
+    }
+    if (rc == 0) {
+	nid = OBJ_txt2nid(curveName);
+	if (nid == NID_undef) {
+	    nid = EC_curve_nist2nid(curveName);
+	}
+	rc = getEcCurve(curveID, curveBytes, nid);
+    }
+    if (rc == 0) {
+	if ((EVP_PKEY_get_bn_param(evpPkey, OSSL_PKEY_PARAM_PRIV_KEY, d) != 1) ||
+	    (EVP_PKEY_get_bn_param(evpPkey, OSSL_PKEY_PARAM_EC_PUB_X, x) != 1) ||
+	    (EVP_PKEY_get_bn_param(evpPkey, OSSL_PKEY_PARAM_EC_PUB_Y, y) != 1)) {
+	    printf("getEcKeyParts: Error getting the private key and public point\n");
+	    rc = EXIT_FAILURE;
+	}
+    }
+#else
+    EC_KEY	*ecKey = NULL;		/* freed @1 */
+
+    if (rc == 0) {
+	ecKey = EVP_PKEY_get1_EC_KEY(evpPkey);
+	if (ecKey == NULL) {
+	    printf("getEcKeyParts: EVP_PKEY_get1_EC_KEY failed\n");
+	    rc = EXIT_FAILURE;
+	}
+    }
+    if (rc == 0) {
+	nid = EC_GROUP_get_curve_name(EC_KEY_get0_group(ecKey));
+	rc = getEcCurve(curveID, curveBytes, nid);
+    }
+    if (rc == 0) {
+	*x = BN_new();
+	*y = BN_new();
+	if ((*x == NULL) || (*y == NULL)) {
+	    printf("getEcKeyParts: BN_new failed\n");
+	    rc = TSS_RC_OUT_OF_MEMORY;
+	}
+    }
+    if (rc == 0) {
+	if ((EC_KEY_get0_private_key(ecKey) == NULL) ||
+	    ((*d = BN_dup(EC_KEY_get0_private_key(ecKey))) == NULL) ||
+	    (EC_KEY_get0_public_key(ecKey) == NULL) ||
+	    (EC_POINT_get_affine_coordinates_GFp(EC_KEY_get0_group(ecKey),
+						 EC_KEY_get0_public_key(ecKey),
+						 *x, *y, NULL) != 1)) {
+	    printf("getEcKeyParts: Error getting the private key and public point\n");
+	    rc = EXIT_FAILURE;
+	}
+    }
+    if (ecKey != NULL) {
+	EC_KEY_free(ecKey);		/* @1 */
+    }
+#endif
+    return rc;
+}
+
+/* convertBnToBinPad() converts 'bn' to big endian 'bin', left padded with zeros to 'binBytes'.
+   TPM ECC parameters are always the full coordinate size. */
+
+static TPM_RC convertBnToBinPad(uint8_t 	*bin,
+				int 		binBytes,
+				const BIGNUM 	*bn)
+{
+    TPM_RC 	rc = 0;
+    int		bnBytes = BN_num_bytes(bn);
+
+    if (rc == 0) {
+	if (bnBytes > binBytes) {
+	    printf("convertBnToBinPad: Error, %d bytes greater than %d\n", bnBytes, binBytes);
+	    rc = EXIT_FAILURE;
+	}
+    }
+    if (rc == 0) {
+	memset(bin, 0, binBytes - bnBytes);
+	BN_bn2bin(bn, bin + (binBytes - bnBytes));
+    }
+    return rc;
+}
+
+/* convertEcKeyToPrivate() converts the EC private key to either a TPM2B_PRIVATE or a
+   TPM2B_SENSITIVE */
+
+static TPM_RC convertEcKeyToPrivate(TPM2B_PRIVATE 	*objectPrivate,
+				    TPM2B_SENSITIVE 	*objectSensitive,
+				    int			curveBytes,
+				    const BIGNUM 	*privateKeyBn,
+				    const char 		*password)
+{
+    TPM_RC 		rc = 0;
+    TPMT_SENSITIVE	tSensitive;
+
+    /* construct TPMT_SENSITIVE	*/
+    if (rc == 0) {
+	/* This shall be the same as the type parameter of the associated public area. */
+	tSensitive.sensitiveType = TPM_ALG_ECC;
+	tSensitive.seedValue.b.size = 0;
+	/* key password converted to TPM2B */
+	rc = TSS_TPM2B_StringCopy(&tSensitive.authValue.b, password, sizeof(TPMU_HA));
+    }
+    if (rc == 0) {
+	if ((size_t)curveBytes > sizeof(tSensitive.sensitive.ecc.t.buffer)) {
+	    printf("convertEcKeyToPrivate: Error, private key %d greater than %lu\n",
+		   curveBytes, (unsigned long)sizeof(tSensitive.sensitive.ecc.t.buffer));
+	    rc = EXIT_FAILURE;
+	}
+    }
+    if (rc == 0) {
+	tSensitive.sensitive.ecc.t.size = curveBytes;
+	rc = convertBnToBinPad(tSensitive.sensitive.ecc.t.buffer, curveBytes, privateKeyBn);
+    }
+    if (rc == 0) {
+	rc = convertSensitiveToPrivate(objectPrivate, objectSensitive, &tSensitive);
+    }
+    memset(&tSensitive, 0, sizeof(tSensitive));
+    return rc;
+}
+
+/* convertEcKeyToPublic() converts the EC public point to a TPM2B_PUBLIC */
+
+static TPM_RC convertEcKeyToPublic(TPM2B_PUBLIC 	*objectPublic,
+				   int			keyType,
+				   TPMI_ALG_HASH 	nalg,
+				   TPMI_ALG_HASH	halg,
+				   TPMI_ECC_CURVE 	curveID,
+				   int			curveBytes,
+				   const BIGNUM 	*x,
+				   const BIGNUM 	*y)
+{
+    TPM_RC 		rc = 0;
+
+    if (rc == 0) {
+	if ((size_t)curveBytes > sizeof(objectPublic->publicArea.unique.ecc.x.t.buffer)) {
+	    printf("convertEcKeyToPublic: Error, public key %d greater than %lu\n", curveBytes,
+		   (unsigned long)sizeof(objectPublic->publicArea.unique.ecc.x.t.buffer));
+	    rc = EXIT_FAILURE;
+	}
+    }
+    if (rc == 0) {
+	/* Table 184 - Definition of TPMT_PUBLIC Structure */
+	objectPublic->publicArea.type = TPM_ALG_ECC;
+	objectPublic->publicArea.nameAlg = nalg;
+	objectPublic->publicArea.objectAttributes.val = TPMA_OBJECT_NODA;
+	objectPublic->publicArea.objectAttributes.val |= TPMA_OBJECT_USERWITHAUTH;
+	if (keyType == TYPE_SI) {
+	    objectPublic->publicArea.objectAttributes.val |= TPMA_OBJECT_SIGN;
+	}
+	else {
+	    objectPublic->publicArea.objectAttributes.val |= TPMA_OBJECT_DECRYPT;
+	}
+	objectPublic->publicArea.authPolicy.t.size = 0;
+	/* Table 182 - Definition of TPMU_PUBLIC_PARMS Union <IN/OUT, S> */
+	objectPublic->publicArea.parameters.eccDetail.symmetric.algorithm = TPM_ALG_NULL;
+	if (keyType == TYPE_SI) {
+	    objectPublic->publicArea.parameters.eccDetail.scheme.scheme = TPM_ALG_ECDSA;
+	}
+	else {
+	    objectPublic->publicArea.parameters.eccDetail.scheme.scheme = TPM_ALG_NULL;
+	}
+	objectPublic->publicArea.parameters.eccDetail.scheme.details.ecdsa.hashAlg = halg;
+	objectPublic->publicArea.parameters.eccDetail.curveID = curveID;
+	objectPublic->publicArea.parameters.eccDetail.kdf.scheme = TPM_ALG_NULL;
+	objectPublic->publicArea.parameters.eccDetail.kdf.details.mgf1.hashAlg = halg;
+
+	objectPublic->publicArea.unique.ecc.x.t.size = curveBytes;
+	rc = convertBnToBinPad(objectPublic->publicArea.unique.ecc.x.t.buffer, curveBytes, x);
+    }
+    if (rc == 0) {
+	objectPublic->publicArea.unique.ecc.y.t.size = curveBytes;
+	rc = convertBnToBinPad(objectPublic->publicArea.unique.ecc.y.t.buffer, curveBytes, y);
+    }
+    return rc;
+}
+
+/* convertEcEvpPkeyToKeyPair() converts an OpenSSL EC key to a TPM2B_PUBLIC and TPM2B_PRIVATE */
+
+static TPM_RC convertEcEvpPkeyToKeyPair(TPM2B_PUBLIC 	*objectPublic,
+					TPM2B_PRIVATE 	*objectPrivate,
+					int		keyType,
+					TPMI_ALG_HASH 	nalg,
+					TPMI_ALG_HASH	halg,
+					EVP_PKEY 	*evpPkey,
+					const char 	*password)
+{
+    TPM_RC 		rc = 0;
+    TPMI_ECC_CURVE 	curveID;
+    int			curveBytes;
+    BIGNUM 		*d = NULL;		/* freed @1 */
+    BIGNUM 		*x = NULL;		/* freed @2 */
+    BIGNUM 		*y = NULL;		/* freed @3 */
+
+    if (rc == 0) {
+	rc = getEcKeyParts(&curveID, &curveBytes, &d, &x, &y, evpPkey);
+    }
+    if (rc == 0) {
+	rc = convertEcKeyToPrivate(objectPrivate,
+				   NULL,
+				   curveBytes,
+				   d,
+				   password);
+    }
+    if (rc == 0) {
+	rc = convertEcKeyToPublic(objectPublic,
+				  keyType,
+				  nalg,
+				  halg,
+				  curveID,
+				  curveBytes,
+				  x, y);
+    }
+    BN_clear_free(d);		/* @1 */
+    BN_free(x);			/* @2 */
+    BN_free(y);			/* @3 */
+    return rc;
+}
+
+/* PEMTPM_ConvertPemToKeyPair() converts the PEM keypair 'pemData' of 'pemLength' bytes, encrypted
+   with 'password', to TPM2_Import objectPublic and duplicate structures.
+
+   'password' is both the PEM decryption password and the TPM object authorization.  It can be
+   empty but not NULL.
+*/
+
+TPM_RC PEMTPM_ConvertPemToKeyPair(TPM2B_PUBLIC 		*objectPublic,
+				  TPM2B_PRIVATE 	*objectPrivate,
+				  TPMI_ALG_PUBLIC 	algPublic,
+				  int			keyType,
+				  TPMI_ALG_HASH 	nalg,
+				  TPMI_ALG_HASH		halg,
+				  const unsigned char 	*pemData,
+				  size_t 		pemLength,
+				  const char 		*password)
+{
+    TPM_RC 		rc = 0;
+    EVP_PKEY 		*evpPkey = NULL;
+    uint8_t		der[PEMTPM_DER_MAX];
+    PEMTPM_DER_RSA_KEY	derKey;
+    int			native = FALSE;
+
+    if (rc == 0) {
+	if ((objectPublic == NULL) || (objectPrivate == NULL) ||
+	    (pemData == NULL) || (password == NULL)) {
+	    rc = TSS_RC_NULL_PARAMETER;
+	}
+    }
+    /* an unencrypted RSA key is read without OpenSSL, see pemtpmder.h */
+    if ((rc == 0) && (algPublic == TPM_ALG_RSA)) {
+	native = PEMTPM_Der_ReadRsaPem(&derKey, der, sizeof(der), pemData, pemLength);
+    }
+    if ((rc == 0) && native) {
+	rc = convertRsaDerKeyToKeyPair(objectPublic,
+				       objectPrivate,
+				       keyType,
+				       nalg,
+				       halg,
+				       &derKey,
+				       password);
+    }
+    if ((rc == 0) && !native) {
+	rc = PEMTPM_Libcrypto_Load();
+    }
+    if ((rc == 0) && !native) {
+	rc = convertPemBufferToEvpPrivKey(&evpPkey,	/* freed @1 */
+					  pemData,
+					  pemLength,
+					  password);
+    }
+    if ((rc == 0) && !native) {
+	if (algPublic == TPM_ALG_RSA) {
+	    rc = convertRsaEvpPkeyToKeyPair(objectPublic,
+					    objectPrivate,
+					    keyType,
+					    nalg,
+					    halg,
+					    evpPkey,
+					    password);
+	}
+	else if (algPublic == TPM_ALG_ECC) {
+	    rc = convertEcEvpPkeyToKeyPair(objectPublic,
+					   objectPrivate,
+					   keyType,
+					   nalg,
+					   halg,
+					   evpPkey,
+					   password);
+	}
+	else {
+	    if (tssVerbose) printf("PEMTPM_ConvertPemToKeyPair: Unsupported algorithm %04x\n",
+				   algPublic);
+	    rc = TPM_RC_ASYMMETRIC;
+	}
+    }
+    if (evpPkey != NULL) {
+	EVP_PKEY_free(evpPkey);		/* @1 */
+    }
+    /* the decoded DER holds the private key */
+    memset(der, 0, sizeof(der));
+    return rc;
+}
+
+/* Public area templates
+
+   Every field of a TPM2B_PUBLIC that pemtpm creates, except the unique field, depends only on the
+   key type, nalg, halg and the key size.  The marshaled bytes up to and including the size of the
+   unique field are therefore the same for every key of a batch.  A PUBLIC_TEMPLATE holds those
+   bytes, the prefix, and the parameters they were marshaled from.  A public area with the same
+   parameters is marshaled as the prefix followed by the modulus, or by the ECC x coordinate and
+   the size and bytes of y.
+
+   A template is built from the first generic TSS_TPM2B_PUBLIC_Marshal() of a parameter set.  Each
+   thread keeps the template of its last parameter set, so a batch converts its keys without
+   locking and nearly always hits.  A public area that pemtpm does not create, such as one with an
+   authPolicy or a symmetric algorithm, is always marshaled generically.
+*/
+
+#define PUBLIC_TEMPLATE_PREFIX_MAX	64
+
+typedef struct PUBLIC_TEMPLATE {
+    /* the parameters, compared as bytes, so the structure is zeroed before they are set */
+    TPMI_ALG_PUBLIC	type;
+    TPMI_ALG_HASH	nameAlg;
+    UINT32		objectAttributes;
+    TPM_ALG_ID		scheme;
+    TPMI_ALG_HASH	schemeHash;		/* 0 for TPM_ALG_NULL, it is not marshaled */
+    UINT16		keyBits;		/* RSA */
+    UINT32		exponent;		/* RSA */
+    TPMI_ECC_CURVE	curveID;		/* ECC */
+    UINT16		uniqueSize;		/* the modulus or x */
+    UINT16		uniqueSizeY;		/* ECC y */
+    /* the marshaled prefix */
+    UINT16		prefixSize;
+    uint8_t		prefix[PUBLIC_TEMPLATE_PREFIX_MAX];
+} PUBLIC_TEMPLATE;
+
+#define PUBLIC_TEMPLATE_KEY_SIZE	offsetof(PUBLIC_TEMPLATE, prefixSize)
+
+static __thread PUBLIC_TEMPLATE publicTemplate;
+
+/* getPublicTemplateKey() fills the parameters of 'key' from 'publicArea'.  Returns FALSE if the
+   public area cannot use a template. */
+
+static int getPublicTemplateKey(PUBLIC_TEMPLATE 	*key,
+				const TPMT_PUBLIC 	*publicArea)
+{
+    memset(key, 0, PUBLIC_TEMPLATE_KEY_SIZE);
+    if (publicArea->authPolicy.t.size != 0) {
+	return FALSE;
+    }
+    key->type = publicArea->type;
+    key->nameAlg = publicArea->nameAlg;
+    key->objectAttributes = publicArea->objectAttributes.val;
+    if (publicArea->type == TPM_ALG_RSA) {
+	const TPMS_RSA_PARMS *rsaDetail = &publicArea->parameters.rsaDetail;
+
+	if ((rsaDetail->symmetric.algorithm != TPM_ALG_NULL) ||
+	    ((rsaDetail->scheme.scheme != TPM_ALG_NULL) &&
+	     (rsaDetail->scheme.scheme != TPM_ALG_RSASSA))) {
+	    return FALSE;
+	}
+	key->scheme = rsaDetail->scheme.scheme;
+	if (rsaDetail->scheme.scheme != TPM_ALG_NULL) {
+	    key->schemeHash = rsaDetail->scheme.details.rsassa.hashAlg;
+	}
+	key->keyBits = rsaDetail->keyBits;
+	key->exponent = rsaDetail->exponent;
+	key->uniqueSize = publicArea->unique.rsa.t.size;
+    }
+    else if (publicArea->type == TPM_ALG_ECC) {
+	const TPMS_ECC_PARMS *eccDetail = &publicArea->parameters.eccDetail;
+
+	if ((eccDetail->symmetric.algorithm != TPM_ALG_NULL) ||
+	    (eccDetail->kdf.scheme != TPM_ALG_NULL) ||
+	    ((eccDetail->scheme.scheme != TPM_ALG_NULL) &&
+	     (eccDetail->scheme.scheme != TPM_ALG_ECDSA))) {
+	    return FALSE;
+	}
+	key->scheme = eccDetail->scheme.scheme;
+	if (eccDetail->scheme.scheme != TPM_ALG_NULL) {
+	    key->schemeHash = eccDetail->scheme.details.ecdsa.hashAlg;
+	}
+	key->curveID = eccDetail->curveID;
+	key->uniqueSize = publicArea->unique.ecc.x.t.size;
+	key->uniqueSizeY = publicArea->unique.ecc.y.t.size;
+    }
+    else {
+	return FALSE;
+    }
+    return TRUE;
+}
+
+/* getPublicTemplateTail() returns the number of marshaled bytes after the template prefix */
+
+static uint32_t getPublicTemplateTail(const PUBLIC_TEMPLATE *key)
+{
+    if (key->type == TPM_ALG_ECC) {
+	return key->uniqueSize + sizeof(UINT16) + key->uniqueSizeY;
+    }
+    return key->uniqueSize;
+}
+
+/* marshalPublicTemplate() marshals 'objectPublic' with this thread's template.  Returns FALSE if
+   it does not match the template or the buffer is too small, and then nothing is written. */
+
+static int marshalPublicTemplate(uint8_t 		*publicBuffer,
+				 uint16_t 		*publicSize,
+				 uint32_t 		publicBufferSize,
+				 const PUBLIC_TEMPLATE 	*key,
+				 const TPM2B_PUBLIC 	*objectPublic)
+{
+    const TPMT_PUBLIC	*publicArea = &objectPublic->publicArea;
+    uint8_t		*buffer = publicBuffer + publicTemplate.prefixSize;
+    uint32_t		size = publicTemplate.prefixSize + getPublicTemplateTail(key);
+
+    if ((publicTemplate.prefixSize == 0) ||
+	(memcmp(key, &publicTemplate, PUBLIC_TEMPLATE_KEY_SIZE) != 0) ||
+	(size > publicBufferSize)) {
+	return FALSE;
+    }
+    memcpy(publicBuffer, publicTemplate.prefix, publicTemplate.prefixSize);
+    if (key->type == TPM_ALG_RSA) {
+	memcpy(buffer, publicArea->unique.rsa.t.buffer, key->uniqueSize);
+    }
+    else {
+	memcpy(buffer, publicArea->unique.ecc.x.t.buffer, key->uniqueSize);
+	buffer += key->uniqueSize;
+	buffer[0] = (uint8_t)(key->uniqueSizeY >> 8);
+	buffer[1] = (uint8_t)(key->uniqueSizeY >> 0);
+	memcpy(buffer + sizeof(UINT16), publicArea->unique.ecc.y.t.buffer, key->uniqueSizeY);
+    }
+    *publicSize = size;
+    return TRUE;
+}
+
+/* setPublicTemplate() makes the generically marshaled 'publicBuffer' this thread's template */
+
+static void setPublicTemplate(const PUBLIC_TEMPLATE 	*key,
+			      const uint8_t 		*publicBuffer,
+			      uint16_t 			publicSize)
+{
+    uint32_t	tail = getPublicTemplateTail(key);
+
+    if ((tail < publicSize) && (publicSize - tail <= PUBLIC_TEMPLATE_PREFIX_MAX)) {
+	memcpy(&publicTemplate, key, PUBLIC_TEMPLATE_KEY_SIZE);
+	publicTemplate.prefixSize = publicSize - tail;
+	memcpy(publicTemplate.prefix, publicBuffer, publicTemplate.prefixSize);
+    }
+    return;
+}
+
+/* PEMTPM_MarshalPublic() marshals 'objectPublic' to the caller's 'publicBuffer' of
+   'publicBufferSize' bytes.  'publicSize' returns the number of bytes used.
+
+   If 'name' is not NULL, it also returns the object Name, nameAlg || H(TPMT_PUBLIC), as
+   TPM2_Import and TPM2_Load compute it.  The digest is taken over the TPMT_PUBLIC bytes just
+   marshaled, after the TPM2B size, so the public area is marshaled only once.
+
+   The public area is marshaled from a template when it matches the parameters of the previous
+   one marshaled by this thread, see PUBLIC_TEMPLATE.
+*/
+
+TPM_RC PEMTPM_MarshalPublic(uint8_t 			*publicBuffer,
+			    uint16_t 			*publicSize,
+			    uint32_t 			publicBufferSize,
+			    TPM2B_NAME 			*name,
+			    const TPM2B_PUBLIC 		*objectPublic)
+{
+    TPM_RC		rc = 0;
+    const EVP_MD	*md = NULL;
+    unsigned int	digestSize;
+    PUBLIC_TEMPLATE	key;
+    int			templatable = FALSE;
+    int			templated = FALSE;
+
+    if (rc == 0) {
+	if ((publicBuffer == NULL) || (publicSize == NULL) || (objectPublic == NULL)) {
+	    rc = TSS_RC_NULL_PARAMETER;
+	}
+    }
+    if ((rc == 0) && (name != NULL)) {
+	rc = PEMTPM_Libcrypto_Load();
+    }
+    /* check the hash algorithm before doing any work */
+    if ((rc == 0) && (name != NULL)) {
+	rc = PEMTPM_Crypto_GetDigest(&md, objectPublic->publicArea.nameAlg);
+    }
+    if (rc == 0) {
+	templatable = getPublicTemplateKey(&key, &objectPublic->publicArea);
+	templated = templatable && marshalPublicTemplate(publicBuffer, publicSize,
+							 publicBufferSize, &key, objectPublic);
+    }
+    if ((rc == 0) && !templated) {
+	INT32 size = publicBufferSize;		/* max size */
+	uint8_t *buffer = publicBuffer;		/* pointer that can move */
+	*publicSize = 0;
+	rc = PEMTPM_Marshal_TPM2B_PUBLIC(objectPublic, publicSize, &buffer, &size);
+	/* a new parameter set becomes the template */
+	if ((rc == 0) && templatable) {
+	    setPublicTemplate(&key, publicBuffer, *publicSize);
+	}
+    }
+    if ((rc == 0) && (name != NULL)) {
+	uint8_t *buffer = name->t.name;
+	INT32 size = sizeof(name->t.name);
+	name->t.size = 0;
+	rc = TSS_TPMI_ALG_HASH_Marshal(&objectPublic->publicArea.nameAlg, &name->t.size,
+				       &buffer, &size);
+	if (rc == 0) {
+	    if (EVP_Digest(publicBuffer + sizeof(uint16_t), *publicSize - sizeof(uint16_t),
+			   buffer, &digestSize, md, NULL) != 1) {
+		if (tssVerbose) printf("PEMTPM_MarshalPublic: EVP_Digest failed\n");
+		rc = TSS_RC_HASH;
+	    }
+	    else {
+		name->t.size += digestSize;
+	    }
+	}
+    }
+    return rc;
+}
+
+/* PEMTPM_ConvertPem() is PEMTPM_ConvertPemToKeyPair() returning the marshaled TPM2B_PUBLIC and
+   TPM2B_PRIVATE, ready to be used as TPM2_Import parameters or saved.
+
+   The marshaled structures are written to the caller's 'publicBuffer' and 'privateBuffer' of
+   'publicBufferSize' and 'privateBufferSize' bytes.  PEMTPM_PUBLIC_BUFFER_MAX and
+   PEMTPM_PRIVATE_BUFFER_MAX are always sufficient.  'publicSize' and 'privateSize' return the
+   number of bytes used.
+*/
+
+TPM_RC PEMTPM_ConvertPem(uint8_t 		*publicBuffer,
+			 uint16_t 		*publicSize,
+			 uint32_t 		publicBufferSize,
+			 uint8_t 		*privateBuffer,
+			 uint16_t 		*privateSize,
+			 uint32_t 		privateBufferSize,
+			 TPMI_ALG_PUBLIC 	algPublic,
+			 int			keyType,
+			 TPMI_ALG_HASH 		nalg,
+			 TPMI_ALG_HASH		halg,
+			 const unsigned char 	*pemData,
+			 size_t 		pemLength,
+			 const char 		*password)
+{
+    TPM_RC		rc = 0;
+    TPM2B_PUBLIC	objectPublic;
+    TPM2B_PRIVATE	objectPrivate;
+
+    if (rc == 0) {
+	if ((publicBuffer == NULL) || (publicSize == NULL) ||
+	    (privateBuffer == NULL) || (privateSize == NULL)) {
+	    rc = TSS_RC_NULL_PARAMETER;
+	}
+    }
+    if (rc == 0) {
+	rc = PEMTPM_ConvertPemToKeyPair(&objectPublic,
+					&objectPrivate,
+					algPublic,
+					keyType,
+					nalg,
+					halg,
+					pemData,
+					pemLength,
+					password);
+    }
+    if (rc == 0) {
+	rc = PEMTPM_MarshalPublic(publicBuffer, publicSize, publicBufferSize,
+				  NULL, &objectPublic);
+    }
+    if (rc == 0) {
+	INT32 size = privateBufferSize;		/* max size */
+	uint8_t *buffer = privateBuffer;	/* pointer that can move */
+	*privateSize = 0;
+	rc = PEMTPM_Marshal_TPM2B_PRIVATE(&objectPrivate, privateSize, &buffer, &size);
+    }
+    /* the private buffer holds key material */
+    memset(&objectPrivate, 0, sizeof(objectPrivate));
+    return rc;
+}
+
+/* PEMTPM_MarshalImport() marshals a complete TPM2_Import command, ready to be sent to the TPM, to
+   the caller's 'commandBuffer' of 'commandBufferSize' bytes.  PEMTPM_IMPORT_COMMAND_MAX is always
+   sufficient.  'commandSize' returns the number of bytes used, which is also the commandSize in
+   the header.
+
+   The parent is authorized with a password session, TPM_RS_PW, using 'parentAuth'.
+   'parentAuth', 'inSymSeed' and 'encryptionKey' may be NULL for an empty value.  If
+   'encryptionKey' is not empty, symmetricAlg is AES-CFB with its size, as PEMTPM_WrapInner()
+   uses.  Otherwise symmetricAlg is TPM_ALG_NULL.
+
+   The parameters are marshaled with TSS_Import_In_Marshal(), whose first field is the parent
+   handle.  The parameters after the handle are then moved up to make room for the authorization
+   area.
+*/
+
+TPM_RC PEMTPM_MarshalImport(uint8_t 				*commandBuffer,
+			    uint32_t 				*commandSize,
+			    uint32_t 				commandBufferSize,
+			    TPMI_DH_OBJECT 			parentHandle,
+			    const TPM2B_AUTH 			*parentAuth,
+			    const TPM2B_PUBLIC 			*objectPublic,
+			    const TPM2B_PRIVATE 		*duplicate,
+			    const TPM2B_ENCRYPTED_SECRET 	*inSymSeed,
+			    const TPM2B_DATA 			*encryptionKey)
+{
+    TPM_RC		rc = 0;
+    Import_In		in;
+    TPMS_AUTH_COMMAND	authCommand;
+    TPMI_ST_COMMAND_TAG	tag = TPM_ST_SESSIONS;
+    TPM_CC		commandCode = TPM_CC_Import;
+    uint16_t		inSize = 0;		/* handle and parameters */
+    uint16_t		authSize = 0;		/* one session */
+    uint16_t		written = 0;		/* the header and authorization are counted above */
+    uint32_t		authorizationSize;
+    uint32_t		headerSize = sizeof(TPMI_ST_COMMAND_TAG) + sizeof(uint32_t) + sizeof(TPM_CC);
+
+    if (rc == 0) {
+	if ((commandBuffer == NULL) || (commandSize == NULL) ||
+	    (objectPublic == NULL) || (duplicate == NULL)) {
+	    rc = TSS_RC_NULL_PARAMETER;
+	}
+    }
+    if (rc == 0) {
+	in.parentHandle = parentHandle;
+	in.objectPublic = *objectPublic;
+	in.duplicate = *duplicate;
+	if (inSymSeed != NULL) {
+	    in.inSymSeed = *inSymSeed;
+	}
+	else {
+	    in.inSymSeed.t.size = 0;
+	}
+	if ((encryptionKey != NULL) && (encryptionKey->t.size != 0)) {
+	    in.encryptionKey = *encryptionKey;
+	    in.symmetricAlg.algorithm = TPM_ALG_AES;
+	    in.symmetricAlg.keyBits.aes = encryptionKey->t.size * 8;
+	    in.symmetricAlg.mode.aes = TPM_ALG_CFB;
+	}
+	else {
+	    in.encryptionKey.t.size = 0;
+	    in.symmetricAlg.algorithm = TPM_ALG_NULL;
+	}
+	authCommand.sessionHandle = TPM_RS_PW;
+	authCommand.nonce.t.size = 0;
+	authCommand.sessionAttributes.val = TPMA_SESSION_CONTINUESESSION;
+	if (parentAuth != NULL) {
+	    authCommand.hmac = *parentAuth;
+	}
+	else {
+	    authCommand.hmac.t.size = 0;
+	}
+	rc = TSS_TPMS_AUTH_COMMAND_Marshal(&authCommand, &authSize, NULL, NULL);
+    }
+    /* the handle lands right after the header */
+    if (rc == 0) {
+	INT32 size = (commandBufferSize > headerSize) ? commandBufferSize - headerSize : 0;
+	uint8_t *buffer = commandBuffer + headerSize;
+	rc = TSS_Import_In_Marshal(&in, &inSize, &buffer, &size);
+    }
+    if (rc == 0) {
+	authorizationSize = authSize;
+	*commandSize = headerSize + inSize + sizeof(uint32_t) + authSize;
+	if (*commandSize > commandBufferSize) {
+	    if (tssVerbose) printf("PEMTPM_MarshalImport: Buffer too small\n");
+	    rc = TSS_RC_INSUFFICIENT_BUFFER;
+	}
+    }
+    /* insert the authorization area between the handle and the parameters */
+    if (rc == 0) {
+	uint8_t *parameters = commandBuffer + headerSize + sizeof(TPM_HANDLE);
+	memmove(parameters + sizeof(uint32_t) + authSize, parameters, inSize - sizeof(TPM_HANDLE));
+	rc = TSS_UINT32_Marshal(&authorizationSize, &written, &parameters, NULL);
+	if (rc == 0) {
+	    rc = TSS_TPMS_AUTH_COMMAND_Marshal(&authCommand, &written, &parameters, NULL);
+	}
+    }
+    if (rc == 0) {
+	uint8_t *buffer = commandBuffer;
+	rc = TSS_TPMI_ST_COMMAND_TAG_Marshal(&tag, &written, &buffer, NULL);
+	if (rc == 0) {
+	    rc = TSS_UINT32_Marshal(commandSize, &written, &buffer, NULL);
+	}
+	if (rc == 0) {
+	    rc = TSS_TPM_CC_Marshal(&commandCode, &written, &buffer, NULL);
+	}
+    }
+    /* the structures may hold an unwrapped duplicate, the inner key and the parent password */
+    memset(&in, 0, sizeof(in));
+    memset(&authCommand, 0, sizeof(authCommand));
+    return rc;
+}
+
+/* PEMTPM_ReadKeyPair() is the inverse of PEMTPM_ConvertPem().  It unmarshals and validates the
+   TPM2B_PUBLIC in 'publicBuffer' and the unwrapped TPM2B_PRIVATE in 'privateBuffer', as written by
+   pemtpm.
+
+   The TPMT_SENSITIVE is unmarshaled directly from the TPM2B_PRIVATE payload, without an
+   intermediate TPM2B_PRIVATE copy.  Both buffers must be consumed exactly, the sensitive type
+   must match the public type, and for RSA the key sizes must be consistent.
+*/
+
+TPM_RC PEMTPM_ReadKeyPair(TPM2B_PUBLIC 		*objectPublic,
+			  TPMT_SENSITIVE 	*objectSensitive,
+			  const uint8_t 	*publicBuffer,
+			  uint32_t 		publicBufferSize,
+			  const uint8_t 	*privateBuffer,
+			  uint32_t 		privateBufferSize)
+{
+    TPM_RC		rc = 0;
+    UINT16		privateSize;		/* TPM2B_PRIVATE size */
+    TPM2B_SENSITIVE	sensitive;
+
+    if (rc == 0) {
+	if ((objectPublic == NULL) || (objectSensitive == NULL) ||
+	    (publicBuffer == NULL) || (privateBuffer == NULL)) {
+	    rc = TSS_RC_NULL_PARAMETER;
+	}
+    }
+    if (rc == 0) {
+	if ((publicBufferSize > INT32_MAX) || (privateBufferSize > INT32_MAX)) {
+	    rc = TPM_RC_SIZE;
+	}
+    }
+    if (rc == 0) {
+	INT32 size = publicBufferSize;
+	BYTE *buffer = (BYTE *)publicBuffer;	/* unmarshal does not write the input */
+	rc = TSS_TPM2B_PUBLIC_Unmarshal(objectPublic, &buffer, &size);
+	if ((rc == 0) && (size != 0)) {
+	    if (tssVerbose) printf("PEMTPM_ReadKeyPair: %d bytes after TPM2B_PUBLIC\n", size);
+	    rc = TPM_RC_SIZE;
+	}
+    }
+    if (rc == 0) {
+	INT32 size = privateBufferSize;
+	BYTE *buffer = (BYTE *)privateBuffer;
+	rc = TSS_UINT16_Unmarshal(&privateSize, &buffer, &size);
+	if ((rc == 0) && (privateSize != size)) {
+	    if (tssVerbose) printf("PEMTPM_ReadKeyPair: TPM2B_PRIVATE size %u, %d bytes\n",
+				   privateSize, size);
+	    rc = TPM_RC_SIZE;
+	}
+	/* no outer or inner wrapper, the TPM2B_PRIVATE payload is a TPM2B_SENSITIVE */
+	if (rc == 0) {
+	    rc = TSS_TPM2B_SENSITIVE_Unmarshal(&sensitive, &buffer, &size);
+	}
+	if ((rc == 0) && (size != 0)) {
+	    if (tssVerbose) printf("PEMTPM_ReadKeyPair: %d bytes after TPM2B_SENSITIVE\n", size);
+	    rc = TPM_RC_SIZE;
+	}
+    }
+    if (rc == 0) {
+	if (sensitive.t.sensitiveArea.sensitiveType != objectPublic->publicArea.type) {
+	    if (tssVerbose) printf("PEMTPM_ReadKeyPair: sensitive type %04x, public type %04x\n",
+				   sensitive.t.sensitiveArea.sensitiveType,
+				   objectPublic->publicArea.type);
+	    rc = TPM_RC_TYPE;
+	}
+    }
+    if (rc == 0) {
+	if (objectPublic->publicArea.type == TPM_ALG_RSA) {
+	    uint16_t modulusBytes = objectPublic->publicArea.unique.rsa.t.size;
+	    if ((modulusBytes * 8 != objectPublic->publicArea.parameters.rsaDetail.keyBits) ||
+		(sensitive.t.sensitiveArea.sensitive.rsa.t.size * 2 != modulusBytes)) {
+		if (tssVerbose) printf("PEMTPM_ReadKeyPair: inconsistent RSA key size\n");
+		rc = TPM_RC_KEY_SIZE;
+	    }
+	}
+	else if (objectPublic->publicArea.type == TPM_ALG_ECC) {
+	    uint16_t xBytes = objectPublic->publicArea.unique.ecc.x.t.size;
+	    if ((objectPublic->publicArea.unique.ecc.y.t.size != xBytes) ||
+		(sensitive.t.sensitiveArea.sensitive.ecc.t.size != xBytes)) {
+		if (tssVerbose) printf("PEMTPM_ReadKeyPair: inconsistent ECC key size\n");
+		rc = TPM_RC_KEY_SIZE;
+	    }
+	}
+    }
+    if (rc == 0) {
+	*objectSensitive = sensitive.t.sensitiveArea;
+    }
+    /* the sensitive area holds key material */
+    memset(&sensitive, 0, sizeof(sensitive));
+    return rc;
+}
@@ -0,0 +1,522 @@
+/********************************************************************************/
+/*										*/
+/*		     Conversion Result Cache for -cache				*/
+/*										*/
+/********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include <tss2/tssutils.h>
+#include <tss2/tsserror.h>
+#include <tss2/tssmarshal.h>
+#include <tss2/pemtpm.h>
+#include <openssl/evp.h>
+
+#include "pemtpmcache.h"
+#include "pemtpmlibcrypto.h"
+#include "pemtpmmarshal.h"
+#include "pemtpmstats.h"
+
+extern int tssVerbose;
+
+/* An entry file is the magic, the key it is named by, the marshaled TPM2B_PUBLIC and the marshaled
+   TPM2B_PRIVATE.  The key guards against a renamed or misplaced file. */
+
+#define CACHE_MAGIC		"PEMTPMC1"
+#define CACHE_MAGIC_SIZE	8
+#define CACHE_ENTRY_MAX		(CACHE_MAGIC_SIZE + PEMTPM_CACHE_KEY_SIZE +	\
+				 PEMTPM_PUBLIC_BUFFER_MAX + PEMTPM_PRIVATE_BUFFER_MAX)
+#define CACHE_NAME_SIZE		(2 * PEMTPM_CACHE_KEY_SIZE)
+#define CACHE_LOCK_NAME		".lock"
+
+/* eviction removes entries down to this percentage of the maximum, so that it runs once per many
+   puts rather than on every put once the cache is full */
+
+#define CACHE_EVICT_PERCENT	90
+
+struct PEMTPM_CACHE {
+    char		*directory;
+    unsigned long	maxEntries;
+    unsigned long	entries;	/* approximate, corrected by each eviction scan */
+    unsigned int	tempCounter;
+    pthread_mutex_t	lock;		/* entries and eviction within the process */
+};
+
+/* an entry seen by the eviction scan */
+
+typedef struct {
+    time_t	mtime;
+    long	mtimeNsec;
+    char	name[CACHE_NAME_SIZE + 1];
+} CACHE_SCAN_ENTRY;
+
+/* isEntryName() returns TRUE if 'name' is an entry file name, 64 lower case hex digits */
+
+static int isEntryName(const char *name)
+{
+    size_t i;
+
+    for (i = 0 ; i < CACHE_NAME_SIZE ; i++) {
+	if (!(((name[i] >= '0') && (name[i] <= '9')) ||
+	      ((name[i] >= 'a') && (name[i] <= 'f')))) {
+	    return FALSE;
+	}
+    }
+    return (name[CACHE_NAME_SIZE] == '\0');
+}
+
+/* entryPath() builds the path of the entry named by 'key'.  'path' must hold PATH_MAX bytes, which
+   PEMTPM_Cache_Open() has checked is enough. */
+
+static void entryPath(char 		*path,
+		      const PEMTPM_CACHE 	*cache,
+		      const uint8_t 	*key)
+{
+    static const char hex[] = "0123456789abcdef";
+    size_t directoryLength = strlen(cache->directory);
+    size_t i;
+
+    memcpy(path, cache->directory, directoryLength);
+    path[directoryLength] = '/';
+    path += directoryLength + 1;
+    for (i = 0 ; i < PEMTPM_CACHE_KEY_SIZE ; i++) {
+	path[2 * i] = hex[key[i] >> 4];
+	path[2 * i + 1] = hex[key[i] & 0x0f];
+    }
+    path[CACHE_NAME_SIZE] = '\0';
+    return;
+}
+
+/* scanEntries() lists the entries in the cache directory.  If 'entries' is NULL, they are only
+   counted.  Otherwise *entries is allocated with the name and modification time of each, and must
+   be freed by the caller. */
+
+static TPM_RC scanEntries(CACHE_SCAN_ENTRY 	**entries,
+			  unsigned long 	*count,
+			  const PEMTPM_CACHE 	*cache)
+{
+    TPM_RC		rc = 0;
+    DIR			*dir = NULL;
+    struct dirent	*dirent;
+    size_t		allocated = 0;
+    int			dirFd = -1;
+
+    *count = 0;
+    if (rc == 0) {
+	dir = opendir(cache->directory);		/* freed @1 */
+	if (dir == NULL) {
+	    if (tssVerbose) printf("scanEntries: Error opening %s, %s\n",
+				   cache->directory, strerror(errno));
+	    rc = TSS_RC_FILE_OPEN;
+	}
+	else {
+	    dirFd = dirfd(dir);
+	}
+    }
+    while ((rc == 0) && ((dirent = readdir(dir)) != NULL)) {
+	struct stat	statBuffer;
+
+	if (!isEntryName(dirent->d_name)) {
+	    continue;
+	}
+	if (entries == NULL) {
+	    (*count)++;
+	    continue;
+	}
+	/* an entry removed by another process since readdir() is skipped */
+	if (fstatat(dirFd, dirent->d_name, &statBuffer, AT_SYMLINK_NOFOLLOW) != 0) {
+	    continue;
+	}
+	if (*count == allocated) {
+	    rc = TSS_ArrayGrow((unsigned char **)entries, &allocated, sizeof(CACHE_SCAN_ENTRY));
+	}
+	if (rc == 0) {
+	    (*entries)[*count].mtime = statBuffer.st_mtim.tv_sec;
+	    (*entries)[*count].mtimeNsec = statBuffer.st_mtim.tv_nsec;
+	    memcpy((*entries)[*count].name, dirent->d_name, CACHE_NAME_SIZE + 1);
+	    (*count)++;
+	}
+    }
+    if (dir != NULL) {
+	closedir(dir);				/* @1 */
+    }
+    return rc;
+}
+
+/* compareScanEntries() orders entries least recently used first */
+
+static int compareScanEntries(const void *a, const void *b)
+{
+    const CACHE_SCAN_ENTRY *entryA = a;
+    const CACHE_SCAN_ENTRY *entryB = b;
+
+    if (entryA->mtime != entryB->mtime) {
+	return (entryA->mtime < entryB->mtime) ? -1 : 1;
+    }
+    if (entryA->mtimeNsec != entryB->mtimeNsec) {
+	return (entryA->mtimeNsec < entryB->mtimeNsec) ? -1 : 1;
+    }
+    return 0;
+}
+
+/* evictEntries() removes the least recently used entries down to CACHE_EVICT_PERCENT of the
+   maximum.  The caller holds cache->lock.  The lock file serializes eviction with other processes
+   sharing the directory, and the rescan counts their entries too. */
+
+static void evictEntries(PEMTPM_CACHE *cache)
+{
+    TPM_RC		rc = 0;
+    CACHE_SCAN_ENTRY	*entries = NULL;
+    unsigned long	count = 0;
+    unsigned long	keep = (cache->maxEntries / 100) * CACHE_EVICT_PERCENT +
+			       ((cache->maxEntries % 100) * CACHE_EVICT_PERCENT) / 100;
+    unsigned long	i;
+    char		path[PATH_MAX];
+    int			lockFd = -1;
+
+    if (rc == 0) {
+	snprintf(path, sizeof(path), "%s/%s", cache->directory, CACHE_LOCK_NAME);
+	lockFd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);	/* freed @1 */
+	if ((lockFd < 0) || (flock(lockFd, LOCK_EX) != 0)) {
+	    if (tssVerbose) printf("evictEntries: Error locking %s, %s\n", path, strerror(errno));
+	    rc = TSS_RC_FILE_OPEN;
+	}
+    }
+    if (rc == 0) {
+	rc = scanEntries(&entries, &count, cache);	/* freed @2 */
+    }
+    if ((rc == 0) && (count > keep)) {
+	qsort(entries, count, sizeof(CACHE_SCAN_ENTRY), compareScanEntries);
+	for (i = 0 ; i < count - keep ; i++) {
+	    snprintf(path, sizeof(path), "%s/%s", cache->directory, entries[i].name);
+	    if (unlink(path) == 0) {
+		PEMTPM_STATS_COUNT(PEMTPM_STAT_CACHE_EVICTIONS, 1);
+	    }
+	}
+	count = keep;
+    }
+    if (rc == 0) {
+	cache->entries = count;
+    }
+    free(entries);				/* @2 */
+    if (lockFd >= 0) {
+	close(lockFd);				/* @1, releases the lock */
+    }
+    return;
+}
+
+/* PEMTPM_Cache_Open() opens the cache in 'directory', creating it if needed, and counts the entries
+   already there.  The cache holds at most 'maxEntries' entries.  It must be closed with
+   PEMTPM_Cache_Close().
+*/
+
+TPM_RC PEMTPM_Cache_Open(PEMTPM_CACHE 		**cache,
+			 const char 		*directory,
+			 unsigned long 		maxEntries)
+{
+    TPM_RC 	rc = 0;
+    size_t	directoryLength = strlen(directory);
+    struct stat	statBuffer;
+    int		exists = FALSE;
+
+    if (rc == 0) {
+	if ((maxEntries == 0) || (directoryLength == 0) ||
+	    (directoryLength + 1 + CACHE_NAME_SIZE + 1 > PATH_MAX)) {
+	    if (tssVerbose) printf("PEMTPM_Cache_Open: Error, bad cache directory or size\n");
+	    rc = TSS_RC_BAD_PROPERTY_VALUE;
+	}
+    }
+    /* the cache keys are SHA-256 digests */
+    if (rc == 0) {
+	rc = PEMTPM_Libcrypto_Load();
+    }
+    if (rc == 0) {
+	if (mkdir(directory, 0700) != 0) {
+	    if (errno == EEXIST) {
+		exists = TRUE;
+	    }
+	    else {
+		if (tssVerbose) printf("PEMTPM_Cache_Open: Error creating %s, %s\n",
+				       directory, strerror(errno));
+		rc = TSS_RC_FILE_OPEN;
+	    }
+	}
+    }
+    /* another user could read the entries of, or plant entries in, a directory made by someone
+       else or open to others */
+    if ((rc == 0) && exists) {
+	if ((stat(directory, &statBuffer) != 0) || !S_ISDIR(statBuffer.st_mode) ||
+	    (statBuffer.st_uid != geteuid()) || ((statBuffer.st_mode & 07777) != 0700)) {
+	    if (tssVerbose) printf("PEMTPM_Cache_Open: Error, %s must be a directory owned by the "
+				   "user with mode 0700\n", directory);
+	    rc = TSS_RC_FILE_OPEN;
+	}
+    }
+    if (rc == 0) {
+	rc = TSS_Malloc((unsigned char **)cache, sizeof(PEMTPM_CACHE));
+    }
+    if (rc == 0) {
+	(*cache)->directory = NULL;
+	(*cache)->maxEntries = maxEntries;
+	(*cache)->entries = 0;
+	(*cache)->tempCounter = 0;
+	pthread_mutex_init(&(*cache)->lock, NULL);
+	rc = TSS_Malloc((unsigned char **)&(*cache)->directory, directoryLength + 1);
+	if (rc == 0) {
+	    memcpy((*cache)->directory, directory, directoryLength + 1);
+	}
+    }
+    if (rc == 0) {
+	rc = scanEntries(NULL, &(*cache)->entries, *cache);
+    }
+    if ((rc != 0) && (*cache != NULL)) {
+	PEMTPM_Cache_Close(*cache);
+	*cache = NULL;
+    }
+    return rc;
+}
+
+void PEMTPM_Cache_Close(PEMTPM_CACHE *cache)
+{
+    if (cache != NULL) {
+	pthread_mutex_destroy(&cache->lock);
+	free(cache->directory);
+	free(cache);
+    }
+    return;
+}
+
+/* PEMTPM_Cache_Key() computes the cache key of a conversion: the SHA-256 of a tag, the conversion
+   parameters, the password and the PEM bytes.  Each variable length field is preceded by its
+   length, so that no two inputs hash the same message.
+*/
+
+TPM_RC PEMTPM_Cache_Key(uint8_t 		*key,
+			TPMI_ALG_PUBLIC 	algPublic,
+			int			keyType,
+			TPMI_ALG_HASH 		nalg,
+			TPMI_ALG_HASH		halg,
+			const unsigned char 	*pemData,
+			size_t 			pemLength,
+			const char 		*password)
+{
+    TPM_RC 		rc = 0;
+    static const char	tag[] = "pemtpm cache 1";
+    uint8_t		parameters[2 + 2 + 4 + 2 + 2 + 4];
+    size_t		passwordLength = (password != NULL) ? strlen(password) : 0;
+    EVP_MD_CTX		*ctx = NULL;
+
+    parameters[0]  = (uint8_t)(sizeof(tag) >> 8);
+    parameters[1]  = (uint8_t)(sizeof(tag) >> 0);
+    parameters[2]  = (uint8_t)(algPublic >> 8);
+    parameters[3]  = (uint8_t)(algPublic >> 0);
+    parameters[4]  = (uint8_t)((uint32_t)keyType >> 24);
+    parameters[5]  = (uint8_t)((uint32_t)keyType >> 16);
+    parameters[6]  = (uint8_t)((uint32_t)keyType >>  8);
+    parameters[7]  = (uint8_t)((uint32_t)keyType >>  0);
+    parameters[8]  = (uint8_t)(nalg >> 8);
+    parameters[9]  = (uint8_t)(nalg >> 0);
+    parameters[10] = (uint8_t)(halg >> 8);
+    parameters[11] = (uint8_t)(halg >> 0);
+    parameters[12] = (uint8_t)(passwordLength >> 24);
+    parameters[13] = (uint8_t)(passwordLength >> 16);
+    parameters[14] = (uint8_t)(passwordLength >>  8);
+    parameters[15] = (uint8_t)(passwordLength >>  0);
+    if (rc == 0) {
+	ctx = EVP_MD_CTX_create();		/* freed @1 */
+	if (ctx == NULL) {
+	    rc = TSS_RC_OUT_OF_MEMORY;
+	}
+    }
+    if (rc == 0) {
+	if ((EVP_DigestInit_ex(ctx, EVP_sha256(), NULL) != 1) ||
+	    (EVP_DigestUpdate(ctx, tag, sizeof(tag)) != 1) ||
+	    (EVP_DigestUpdate(ctx, parameters, sizeof(parameters)) != 1) ||
+	    ((passwordLength != 0) && (EVP_DigestUpdate(ctx, password, passwordLength) != 1)) ||
+	    (EVP_DigestUpdate(ctx, pemData, pemLength) != 1) ||
+	    (EVP_DigestFinal_ex(ctx, key, NULL) != 1)) {
+	    if (tssVerbose) printf("PEMTPM_Cache_Key: Digest failed\n");
+	    rc = TSS_RC_HASH;
+	}
+    }
+    if (ctx != NULL) {
+	EVP_MD_CTX_destroy(ctx);		/* @1 */
+    }
+    return rc;
+}
+
+/* PEMTPM_Cache_Get() looks up 'key'.  On a hit, it returns TRUE with the cached TPM2B_PUBLIC and
+   unwrapped TPM2B_PRIVATE, and marks the entry most recently used.  The pair is checked with
+   PEMTPM_ReadKeyPair(), as -ipu and -ipr are.  An entry that does not unmarshal, or whose public
+   and private do not match, is removed and treated as a miss.
+*/
+
+int PEMTPM_Cache_Get(PEMTPM_CACHE 		*cache,
+		     const uint8_t 		*key,
+		     TPM2B_PUBLIC 		*objectPublic,
+		     TPM2B_PRIVATE 		*objectPrivate)
+{
+    TPM_RC		rc = 0;
+    char		path[PATH_MAX];
+    uint8_t		entry[CACHE_ENTRY_MAX + 1];
+    size_t		entrySize = 0;
+    ssize_t		bytes;
+    TPMT_SENSITIVE	sensitive;
+    int			fd = -1;
+    int			hit = FALSE;
+
+    entryPath(path, cache, key);
+    if (rc == 0) {
+	fd = open(path, O_RDONLY | O_CLOEXEC);	/* freed @1 */
+	if (fd < 0) {
+	    rc = TSS_RC_FILE_OPEN;		/* miss */
+	}
+    }
+    /* one byte more than the largest entry is requested, to detect an oversized file */
+    while ((rc == 0) && (entrySize < sizeof(entry))) {
+	bytes = read(fd, entry + entrySize, sizeof(entry) - entrySize);
+	if (bytes < 0) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    rc = TSS_RC_FILE_READ;
+	}
+	else if (bytes == 0) {
+	    break;
+	}
+	else {
+	    entrySize += bytes;
+	}
+    }
+    if (rc == 0) {
+	INT32 size = entrySize - CACHE_MAGIC_SIZE - PEMTPM_CACHE_KEY_SIZE;
+	BYTE *publicBuffer = entry + CACHE_MAGIC_SIZE + PEMTPM_CACHE_KEY_SIZE;
+	BYTE *buffer = publicBuffer;
+
+	if ((entrySize > CACHE_ENTRY_MAX) ||
+	    (entrySize < CACHE_MAGIC_SIZE + PEMTPM_CACHE_KEY_SIZE) ||
+	    (memcmp(entry, CACHE_MAGIC, CACHE_MAGIC_SIZE) != 0) ||
+	    (memcmp(entry + CACHE_MAGIC_SIZE, key, PEMTPM_CACHE_KEY_SIZE) != 0)) {
+	    rc = TPM_RC_SIZE;
+	}
+	if (rc == 0) {
+	    rc = TSS_TPM2B_PUBLIC_Unmarshal(objectPublic, &buffer, &size);
+	}
+	/* the private follows the public */
+	if (rc == 0) {
+	    rc = PEMTPM_ReadKeyPair(objectPublic, &sensitive,
+				    publicBuffer, buffer - publicBuffer, buffer, size);
+	}
+	if (rc == 0) {
+	    rc = TSS_TPM2B_PRIVATE_Unmarshal(objectPrivate, &buffer, &size);
+	}
+	if ((rc == 0) && (size != 0)) {
+	    rc = TPM_RC_SIZE;
+	}
+	if (rc == 0) {
+	    hit = TRUE;
+	    futimens(fd, NULL);		/* most recently used, best effort */
+	}
+	else {
+	    if (tssVerbose) printf("PEMTPM_Cache_Get: Removing bad entry %s\n", path);
+	    unlink(path);
+	}
+    }
+    if (fd >= 0) {
+	close(fd);			/* @1 */
+    }
+    /* the entry holds the unencrypted private key */
+    memset(entry, 0, entrySize);
+    memset(&sensitive, 0, sizeof(sensitive));
+    PEMTPM_STATS_COUNT(hit ? PEMTPM_STAT_CACHE_HITS : PEMTPM_STAT_CACHE_MISSES, 1);
+    return hit;
+}
+
+/* PEMTPM_Cache_Put() stores a conversion result under 'key'.  The cache is an optimization, so
+   failures are not reported to the caller.
+
+   The entry is written to a temporary file and renamed into place, so a concurrent
+   PEMTPM_Cache_Get() sees either no entry or a complete one.  Two threads that put the same key
+   both succeed, the second rename replaces an identical entry.
+*/
+
+void PEMTPM_Cache_Put(PEMTPM_CACHE 		*cache,
+		      const uint8_t 		*key,
+		      const TPM2B_PUBLIC 	*objectPublic,
+		      const TPM2B_PRIVATE 	*objectPrivate)
+{
+    TPM_RC		rc = 0;
+    char		path[PATH_MAX];
+    char		tempPath[PATH_MAX];
+    uint8_t		entry[CACHE_ENTRY_MAX];
+    uint16_t		written = 0;
+    uint16_t		entrySize = CACHE_MAGIC_SIZE + PEMTPM_CACHE_KEY_SIZE;
+    unsigned int	tempCounter;
+    int			fd = -1;
+
+    memcpy(entry, CACHE_MAGIC, CACHE_MAGIC_SIZE);
+    memcpy(entry + CACHE_MAGIC_SIZE, key, PEMTPM_CACHE_KEY_SIZE);
+    if (rc == 0) {
+	INT32 size = sizeof(entry) - entrySize;
+	BYTE *buffer = entry + entrySize;
+	rc = PEMTPM_Marshal_TPM2B_PUBLIC(objectPublic, &written, &buffer, &size);
+	if (rc == 0) {
+	    rc = PEMTPM_Marshal_TPM2B_PRIVATE(objectPrivate, &written, &buffer, &size);
+	}
+	entrySize += written;
+    }
+    /* the temporary name starts with a dot, so scans never count it as an entry */
+    if (rc == 0) {
+	entryPath(path, cache, key);
+	tempCounter = __atomic_fetch_add(&cache->tempCounter, 1, __ATOMIC_RELAXED);
+	snprintf(tempPath, sizeof(tempPath), "%s/.tmp-%ld-%u",
+		 cache->directory, (long)getpid(), tempCounter);
+	fd = open(tempPath, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);	/* freed @1 */
+	if (fd < 0) {
+	    if (tssVerbose) printf("PEMTPM_Cache_Put: Error opening %s, %s\n",
+				   tempPath, strerror(errno));
+	    rc = TSS_RC_FILE_OPEN;
+	}
+    }
+    if (rc == 0) {
+	if (write(fd, entry, entrySize) != entrySize) {
+	    if (tssVerbose) printf("PEMTPM_Cache_Put: Error writing %s\n", tempPath);
+	    rc = TSS_RC_FILE_WRITE;
+	}
+    }
+    if (fd >= 0) {
+	if ((close(fd) != 0) && (rc == 0)) {	/* @1 */
+	    rc = TSS_RC_FILE_CLOSE;
+	}
+	if ((rc == 0) && (rename(tempPath, path) != 0)) {
+	    if (tssVerbose) printf("PEMTPM_Cache_Put: Error renaming %s, %s\n",
+				   tempPath, strerror(errno));
+	    rc = TSS_RC_FILE_WRITE;
+	}
+	if (rc != 0) {
+	    unlink(tempPath);
+	}
+    }
+    if (rc == 0) {
+	pthread_mutex_lock(&cache->lock);
+	cache->entries++;
+	if (cache->entries > cache->maxEntries) {
+	    evictEntries(cache);
+	}
+	pthread_mutex_unlock(&cache->lock);
+    }
+    /* the entry holds the unencrypted private key */
+    memset(entry, 0, sizeof(entry));
+    return;
+}
@@ -0,0 +1,58 @@
+/********************************************************************************/
+/*										*/
+/*		     Conversion Result Cache for -cache				*/
+/*										*/
+/********************************************************************************/
+
+/* This is a private header for pemtpm.
+
+   A PEMTPM_CACHE is a directory of conversion results.  An entry holds the marshaled TPM2B_PUBLIC
+   and unwrapped TPM2B_PRIVATE of one key, and is named by the hex SHA-256 of everything the
+   conversion depends on: the PEM bytes, the password, algPublic, keyType, nalg and halg.  A hit
+   skips the PEM decryption and key conversion.  Wrapping is not cached, since each wrap uses a
+   fresh seed.
+
+   Entries are written to a temporary file and renamed into place, so a reader never sees a partial
+   entry.  A hit sets the entry modification time, and when the cache holds more than its maximum
+   number of entries, the least recently used are removed.  Eviction runs under a lock file, so
+   several threads and processes can share one cache directory.
+
+   The entries hold unwrapped private keys.  The directory and entries are created readable by the
+   owner only.
+*/
+
+#ifndef PEMTPMCACHE_H
+#define PEMTPMCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <tss2/TPM_Types.h>
+
+#define PEMTPM_CACHE_KEY_SIZE		32		/* SHA-256 */
+#define PEMTPM_CACHE_MAX_DEFAULT	100000		/* entries, for -cachemax */
+
+typedef struct PEMTPM_CACHE PEMTPM_CACHE;
+
+TPM_RC PEMTPM_Cache_Open(PEMTPM_CACHE 		**cache,
+			 const char 		*directory,
+			 unsigned long 		maxEntries);
+void PEMTPM_Cache_Close(PEMTPM_CACHE 		*cache);
+TPM_RC PEMTPM_Cache_Key(uint8_t 		*key,
+			TPMI_ALG_PUBLIC 	algPublic,
+			int			keyType,
+			TPMI_ALG_HASH 		nalg,
+			TPMI_ALG_HASH		halg,
+			const unsigned char 	*pemData,
+			size_t 			pemLength,
+			const char 		*password);
+int PEMTPM_Cache_Get(PEMTPM_CACHE 		*cache,
+		     const uint8_t 		*key,
+		     TPM2B_PUBLIC 		*objectPublic,
+		     TPM2B_PRIVATE 		*objectPrivate);
+void PEMTPM_Cache_Put(PEMTPM_CACHE 		*cache,
+		      const uint8_t 		*key,
+		      const TPM2B_PUBLIC 	*objectPublic,
+		      const TPM2B_PRIVATE 	*objectPrivate);
+
+#endif
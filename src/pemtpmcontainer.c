@@ -0,0 +1,199 @@
+/********************************************************************************/
+/*										*/
+/*		     Key Lookup in a pemtpm Container File			*/
+/*										*/
+/********************************************************************************/
+
+/* The container layout is described with PEMTPM_CONTAINER_MAGIC in pemtpm.h.  The reader trusts
+   nothing in the file: every size and offset is checked against the bounds of the region it lies
+   in before it is used, so a truncated or corrupt container returns an error rather than reading
+   outside the buffer. */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <tss2/tss.h>
+#include <tss2/pemtpm.h>
+
+/* CONTAINER_READER walks the bytes of one region */
+
+typedef struct {
+    const uint8_t	*buffer;
+    size_t		size;		/* bytes left */
+} CONTAINER_READER;
+
+static uint64_t getUint64(const uint8_t *buffer)
+{
+    uint64_t	value = 0;
+    size_t	i;
+
+    for (i = 0 ; i < 8 ; i++) {
+	value = (value << 8) | buffer[i];
+    }
+    return value;
+}
+
+static uint32_t getUint32(const uint8_t *buffer)
+{
+    return ((uint32_t)buffer[0] << 24) | ((uint32_t)buffer[1] << 16) |
+	((uint32_t)buffer[2] << 8) | buffer[3];
+}
+
+static uint16_t getUint16(const uint8_t *buffer)
+{
+    return (uint16_t)((buffer[0] << 8) | buffer[1]);
+}
+
+/* readUint16() reads a uint16_t.  Returns FALSE if the region is too short. */
+
+static int readUint16(uint16_t *value, CONTAINER_READER *reader)
+{
+    if (reader->size < 2) {
+	return FALSE;
+    }
+    *value = getUint16(reader->buffer);
+    reader->buffer += 2;
+    reader->size -= 2;
+    return TRUE;
+}
+
+/* readSized() reads a uint16_t size and that many bytes.  'data' points to the bytes, or with
+   'withSize' to the size.  Returns FALSE if the region is too short. */
+
+static int readSized(const uint8_t **data, uint32_t *dataSize, int withSize,
+		     CONTAINER_READER *reader)
+{
+    const uint8_t	*start = reader->buffer;
+    uint16_t		size;
+
+    if (!readUint16(&size, reader) || (reader->size < size)) {
+	return FALSE;
+    }
+    *data = withSize ? start : reader->buffer;
+    *dataSize = withSize ? (uint32_t)size + 2 : size;
+    reader->buffer += size;
+    reader->size -= size;
+    return TRUE;
+}
+
+/* PEMTPM_ContainerFind() finds the record of 'keyId', PEMTPM_CONTAINER_KEY_ID_SIZE bytes, in the
+   'containerSize' bytes of a pemtpm container, typically a read only mapping of the file.  The
+   index is binary searched, and only the pages of the trailer, the index entries visited and the
+   record are read.  If the key ID is in the container more than once, the first record written is
+   returned.
+
+   The pointers in 'record' point into 'container'.  Returns TPM_RC_NO_RESULT if the key is not in
+   the container, and TPM_RC_SIZE if the container is malformed.
+*/
+
+TPM_RC PEMTPM_ContainerFind(PEMTPM_CONTAINER_RECORD 	*record,
+			    const uint8_t 		*container,
+			    size_t 			containerSize,
+			    const uint8_t 		*keyId)
+{
+    TPM_RC		rc = 0;
+    const uint8_t	*trailer = NULL;
+    const uint8_t	*index = NULL;
+    uint64_t		indexOffset = 0;
+    uint64_t		entryCount = 0;
+    uint64_t		low = 0;
+    uint64_t		high = 0;
+    uint64_t		recordOffset = 0;
+    uint32_t		recordSize;
+    uint32_t		sourceIdSize;
+    uint32_t		nameSize;
+    uint32_t		inSymSeedSize;
+    CONTAINER_READER	reader;
+
+    /* the header and the trailer */
+    if (rc == 0) {
+	if ((containerSize < PEMTPM_CONTAINER_HEADER_SIZE + PEMTPM_CONTAINER_TRAILER_SIZE) ||
+	    (memcmp(container, PEMTPM_CONTAINER_MAGIC, PEMTPM_CONTAINER_MAGIC_SIZE) != 0) ||
+	    (getUint32(container + PEMTPM_CONTAINER_MAGIC_SIZE) != PEMTPM_CONTAINER_VERSION)) {
+	    if (tssVerbose) printf("PEMTPM_ContainerFind: Error, not a version %u container\n",
+				   PEMTPM_CONTAINER_VERSION);
+	    rc = TPM_RC_SIZE;
+	}
+    }
+    if (rc == 0) {
+	trailer = container + containerSize - PEMTPM_CONTAINER_TRAILER_SIZE;
+	indexOffset = getUint64(trailer);
+	entryCount = getUint64(trailer + 8);
+	if ((memcmp(trailer + 16, PEMTPM_CONTAINER_INDEX_MAGIC,
+		    PEMTPM_CONTAINER_MAGIC_SIZE) != 0) ||
+	    (indexOffset < PEMTPM_CONTAINER_HEADER_SIZE) ||
+	    (indexOffset > containerSize - PEMTPM_CONTAINER_TRAILER_SIZE) ||
+	    (entryCount != ((containerSize - PEMTPM_CONTAINER_TRAILER_SIZE - indexOffset) /
+			    PEMTPM_CONTAINER_ENTRY_SIZE)) ||
+	    (((containerSize - PEMTPM_CONTAINER_TRAILER_SIZE - indexOffset) %
+	      PEMTPM_CONTAINER_ENTRY_SIZE) != 0)) {
+	    if (tssVerbose) printf("PEMTPM_ContainerFind: Error, the index is malformed\n");
+	    rc = TPM_RC_SIZE;
+	}
+    }
+    /* the first entry not less than the key ID */
+    if (rc == 0) {
+	index = container + indexOffset;
+	low = 0;
+	high = entryCount;
+	while (low < high) {
+	    uint64_t middle = low + (high - low) / 2;
+	    if (memcmp(index + middle * PEMTPM_CONTAINER_ENTRY_SIZE, keyId,
+		       PEMTPM_CONTAINER_KEY_ID_SIZE) < 0) {
+		low = middle + 1;
+	    }
+	    else {
+		high = middle;
+	    }
+	}
+	if ((low == entryCount) ||
+	    (memcmp(index + low * PEMTPM_CONTAINER_ENTRY_SIZE, keyId,
+		    PEMTPM_CONTAINER_KEY_ID_SIZE) != 0)) {
+	    rc = TPM_RC_NO_RESULT;
+	}
+    }
+    /* the record lies between the header and the index */
+    if (rc == 0) {
+	recordOffset = getUint64(index + low * PEMTPM_CONTAINER_ENTRY_SIZE +
+				 PEMTPM_CONTAINER_KEY_ID_SIZE);
+	if ((recordOffset < PEMTPM_CONTAINER_HEADER_SIZE) || (recordOffset > indexOffset - 4)) {
+	    rc = TPM_RC_SIZE;
+	}
+    }
+    if (rc == 0) {
+	recordSize = getUint32(container + recordOffset);
+	if (recordSize > indexOffset - recordOffset - 4) {
+	    rc = TPM_RC_SIZE;
+	}
+    }
+    if (rc == 0) {
+	memset(record, 0, sizeof(PEMTPM_CONTAINER_RECORD));
+	record->flags = getUint32(container + PEMTPM_CONTAINER_MAGIC_SIZE + 4);
+	record->parentDigest = container + PEMTPM_CONTAINER_MAGIC_SIZE + 4 + 4;
+	reader.buffer = container + recordOffset + 4;
+	reader.size = recordSize;
+	if (!readSized(&record->sourceId, &sourceIdSize, FALSE, &reader) ||
+	    !readSized(&record->name, &nameSize, FALSE, &reader) ||
+	    !readUint16(&record->algPublic, &reader) ||
+	    !readUint16(&record->keyType, &reader) ||
+	    !readUint16(&record->nalg, &reader) ||
+	    !readUint16(&record->halg, &reader) ||
+	    !readSized(&record->objectPublic, &record->objectPublicSize, TRUE, &reader) ||
+	    !readSized(&record->duplicate, &record->duplicateSize, TRUE, &reader) ||
+	    !readSized(&record->inSymSeed, &inSymSeedSize, FALSE, &reader) ||
+	    (reader.size != 0)) {
+	    rc = TPM_RC_SIZE;
+	}
+    }
+    if (rc == 0) {
+	record->sourceIdSize = (uint16_t)sourceIdSize;
+	record->nameSize = (uint16_t)nameSize;
+	record->inSymSeedSize = (uint16_t)inSymSeedSize;
+    }
+    if ((rc == TPM_RC_SIZE) && (recordOffset != 0)) {
+	if (tssVerbose) printf("PEMTPM_ContainerFind: Error, the record at %llu is malformed\n",
+			       (unsigned long long)recordOffset);
+    }
+    return rc;
+}
@@ -0,0 +1,296 @@
+/********************************************************************************/
+/*										*/
+/*		     Container File Writer for -ocf				*/
+/*										*/
+/********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <tss2/tssutils.h>
+#include <tss2/tsserror.h>
+#include <tss2/tssfile.h>
+#include <tss2/pemtpm.h>
+
+#include "pemtpmcontainerwriter.h"
+#include "pemtpmstats.h"
+
+extern int tssVerbose;
+
+/* one index entry, in memory */
+
+typedef struct {
+    uint8_t		keyId[PEMTPM_CONTAINER_KEY_ID_SIZE];
+    uint64_t		offset;
+} CONTAINER_ENTRY;
+
+struct PEMTPM_CONTAINER {
+    char		*filename;
+    char		*tempFilename;
+    FILE		*file;
+    uint64_t		offset;		/* of the next record */
+    CONTAINER_ENTRY	*entries;
+    size_t		entryCount;
+    size_t		entriesAllocated;
+    TPM_RC		rc;		/* the first write error */
+};
+
+static void putUint64(uint8_t *buffer, uint64_t value)
+{
+    size_t	i;
+
+    for (i = 0 ; i < 8 ; i++) {
+	buffer[i] = (uint8_t)(value >> (56 - 8 * i));
+    }
+    return;
+}
+
+static void putUint32(uint8_t *buffer, uint32_t value)
+{
+    buffer[0] = (uint8_t)(value >> 24);
+    buffer[1] = (uint8_t)(value >> 16);
+    buffer[2] = (uint8_t)(value >> 8);
+    buffer[3] = (uint8_t)value;
+    return;
+}
+
+static void putUint16(uint8_t *buffer, uint16_t value)
+{
+    buffer[0] = (uint8_t)(value >> 8);
+    buffer[1] = (uint8_t)value;
+    return;
+}
+
+/* writeBytes() writes to the temporary file, and records the first error */
+
+static void writeBytes(PEMTPM_CONTAINER *container, const void *data, size_t length)
+{
+    if ((container->rc == 0) && (length > 0) &&
+	(fwrite(data, 1, length, container->file) != length)) {
+	printf("PEMTPM_Container: Error writing %s\n", container->tempFilename);
+	container->rc = TSS_RC_FILE_WRITE;
+    }
+    container->offset += length;
+    return;
+}
+
+/* writeSized() writes a uint16_t size and the bytes */
+
+static void writeSized(PEMTPM_CONTAINER *container, const uint8_t *data, uint16_t size)
+{
+    uint8_t	sizeBuffer[2];
+
+    putUint16(sizeBuffer, size);
+    writeBytes(container, sizeBuffer, sizeof(sizeBuffer));
+    writeBytes(container, data, size);
+    return;
+}
+
+/* compareEntries() orders index entries by key ID, and then by offset */
+
+static int compareEntries(const void *a, const void *b)
+{
+    const CONTAINER_ENTRY	*entryA = a;
+    const CONTAINER_ENTRY	*entryB = b;
+    int				irc;
+
+    irc = memcmp(entryA->keyId, entryB->keyId, PEMTPM_CONTAINER_KEY_ID_SIZE);
+    if (irc == 0) {
+	irc = (entryA->offset > entryB->offset) - (entryA->offset < entryB->offset);
+    }
+    return irc;
+}
+
+/* PEMTPM_Container_Create() creates the temporary file of container 'filename' and writes the
+   header.  'flags' are the PEMTPM_CONTAINER_ wrapping flags, and 'parentDigest' is the 32 byte
+   digest of the parent, or NULL. */
+
+TPM_RC PEMTPM_Container_Create(PEMTPM_CONTAINER 	**container,
+			       const char 		*filename,
+			       uint32_t 		flags,
+			       const uint8_t 		*parentDigest)
+{
+    TPM_RC	rc = 0;
+    uint8_t	header[PEMTPM_CONTAINER_HEADER_SIZE];
+
+    if (rc == 0) {
+	rc = TSS_Malloc((unsigned char **)container, sizeof(PEMTPM_CONTAINER));
+    }
+    if (rc == 0) {
+	memset(*container, 0, sizeof(PEMTPM_CONTAINER));
+	rc = TSS_Malloc((unsigned char **)&(*container)->filename, strlen(filename) + 1);
+    }
+    if (rc == 0) {
+	strcpy((*container)->filename, filename);
+	rc = TSS_Malloc((unsigned char **)&(*container)->tempFilename,
+			strlen(filename) + sizeof(".tmp"));
+    }
+    if (rc == 0) {
+	sprintf((*container)->tempFilename, "%s.tmp", filename);
+	rc = TSS_File_Open(&(*container)->file, (*container)->tempFilename, "wb");
+    }
+    if (rc == 0) {
+	memset(header, 0, sizeof(header));
+	memcpy(header, PEMTPM_CONTAINER_MAGIC, PEMTPM_CONTAINER_MAGIC_SIZE);
+	putUint32(header + PEMTPM_CONTAINER_MAGIC_SIZE, PEMTPM_CONTAINER_VERSION);
+	putUint32(header + PEMTPM_CONTAINER_MAGIC_SIZE + 4, flags);
+	if (parentDigest != NULL) {
+	    memcpy(header + PEMTPM_CONTAINER_MAGIC_SIZE + 4 + 4, parentDigest, 32);
+	}
+	writeBytes(*container, header, sizeof(header));
+	rc = (*container)->rc;
+    }
+    if ((rc != 0) && (*container != NULL)) {
+	PEMTPM_Container_Close(*container, FALSE, FALSE);
+	*container = NULL;
+    }
+    return rc;
+}
+
+/* PEMTPM_Container_Append() appends the record of one key, with its key ID.  The flags and
+   parentDigest of 'record' are not used.  An error is also returned by
+   PEMTPM_Container_Close(). */
+
+TPM_RC PEMTPM_Container_Append(PEMTPM_CONTAINER 		*container,
+			       const uint8_t 			*keyId,
+			       const PEMTPM_CONTAINER_RECORD 	*record)
+{
+    uint8_t		buffer[8];
+    uint64_t		start = container->offset;
+    uint32_t		recordSize;
+    CONTAINER_ENTRY	*entry;
+
+    if ((container->rc == 0) && (container->entryCount == container->entriesAllocated)) {
+	container->rc = TSS_ArrayGrow((unsigned char **)&container->entries,
+				      &container->entriesAllocated, sizeof(CONTAINER_ENTRY));
+    }
+    if (container->rc != 0) {
+	return container->rc;
+    }
+    recordSize = 2 + record->sourceIdSize + 2 + record->nameSize + 4 * 2 +
+		 record->objectPublicSize + record->duplicateSize + 2 + record->inSymSeedSize;
+    putUint32(buffer, recordSize);
+    writeBytes(container, buffer, 4);
+    writeSized(container, record->sourceId, record->sourceIdSize);
+    writeSized(container, record->name, record->nameSize);
+    putUint16(buffer, record->algPublic);
+    putUint16(buffer + 2, record->keyType);
+    putUint16(buffer + 4, record->nalg);
+    putUint16(buffer + 6, record->halg);
+    writeBytes(container, buffer, 8);
+    writeBytes(container, record->objectPublic, record->objectPublicSize);
+    writeBytes(container, record->duplicate, record->duplicateSize);
+    writeSized(container, record->inSymSeed, record->inSymSeedSize);
+    PEMTPM_STATS_COUNT(PEMTPM_STAT_BYTES_WRITTEN, container->offset - start);
+    if (container->rc == 0) {
+	entry = &container->entries[container->entryCount++];
+	memcpy(entry->keyId, keyId, PEMTPM_CONTAINER_KEY_ID_SIZE);
+	entry->offset = start;
+    }
+    return container->rc;
+}
+
+/* syncDirectory() fsyncs the directory holding 'filename', so that a rename into it survives a
+   crash */
+
+static TPM_RC syncDirectory(const char *filename)
+{
+    TPM_RC	rc = 0;
+    const char	*slash = strrchr(filename, '/');
+    const char	*name = ".";
+    size_t	length = 1;
+    char	*directory = NULL;
+    int		fd = -1;
+
+    if (slash == filename) {
+	name = "/";
+    }
+    else if (slash != NULL) {
+	name = filename;
+	length = slash - filename;
+    }
+    if (rc == 0) {
+	rc = TSS_Malloc((unsigned char **)&directory, length + 1);	/* freed @1 */
+    }
+    if (rc == 0) {
+	memcpy(directory, name, length);
+	directory[length] = '\0';
+	fd = open(directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);	/* closed @2 */
+	if ((fd < 0) || (fsync(fd) != 0)) {
+	    printf("PEMTPM_Container_Close: Error syncing %s, %s\n", directory, strerror(errno));
+	    rc = TSS_RC_FILE_WRITE;
+	}
+    }
+    if (fd >= 0) {
+	close(fd);		/* @2 */
+    }
+    free(directory);		/* @1 */
+    return rc;
+}
+
+/* PEMTPM_Container_Close() frees the container.  If 'commit' is TRUE, it writes the sorted index
+   and the trailer, and renames the file into place.  If 'sync' is TRUE, the file is synced before
+   the rename and its directory after it.  Otherwise, or after an error, the temporary file is
+   removed. */
+
+TPM_RC PEMTPM_Container_Close(PEMTPM_CONTAINER 	*container,
+			      int 			commit,
+			      int 			sync)
+{
+    TPM_RC		rc = 0;
+    uint64_t		indexOffset;
+    uint8_t		buffer[PEMTPM_CONTAINER_TRAILER_SIZE];
+    size_t		i;
+
+    if (container == NULL) {
+	return rc;
+    }
+    if (commit && (container->rc == 0)) {
+	indexOffset = container->offset;
+	qsort(container->entries, container->entryCount, sizeof(CONTAINER_ENTRY),
+	      compareEntries);
+	for (i = 0 ; i < container->entryCount ; i++) {
+	    writeBytes(container, container->entries[i].keyId, PEMTPM_CONTAINER_KEY_ID_SIZE);
+	    putUint64(buffer, container->entries[i].offset);
+	    writeBytes(container, buffer, 8);
+	}
+	putUint64(buffer, indexOffset);
+	putUint64(buffer + 8, container->entryCount);
+	memcpy(buffer + 16, PEMTPM_CONTAINER_INDEX_MAGIC, PEMTPM_CONTAINER_MAGIC_SIZE);
+	writeBytes(container, buffer, PEMTPM_CONTAINER_TRAILER_SIZE);
+    }
+    rc = container->rc;
+    if ((rc == 0) && commit && sync &&
+	((fflush(container->file) != 0) || (fsync(fileno(container->file)) != 0))) {
+	printf("PEMTPM_Container_Close: Error syncing %s, %s\n",
+	       container->tempFilename, strerror(errno));
+	rc = TSS_RC_FILE_WRITE;
+    }
+    if (container->file != NULL) {
+	if ((fclose(container->file) != 0) && (rc == 0) && commit) {
+	    printf("PEMTPM_Container_Close: Error writing %s\n", container->tempFilename);
+	    rc = TSS_RC_FILE_WRITE;
+	}
+	if ((rc == 0) && commit && (rename(container->tempFilename, container->filename) != 0)) {
+	    printf("PEMTPM_Container_Close: Error renaming %s, %s\n",
+		   container->tempFilename, strerror(errno));
+	    rc = TSS_RC_FILE_WRITE;
+	}
+	if ((rc != 0) || !commit) {
+	    unlink(container->tempFilename);
+	}
+	else if (sync) {
+	    rc = syncDirectory(container->filename);
+	}
+    }
+    free(container->entries);
+    free(container->tempFilename);
+    free(container->filename);
+    free(container);
+    return rc;
+}
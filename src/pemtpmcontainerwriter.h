@@ -0,0 +1,40 @@
+/********************************************************************************/
+/*										*/
+/*		     Container File Writer for -ocf				*/
+/*										*/
+/********************************************************************************/
+
+/* This is a private header for pemtpm.
+
+   A PEMTPM_CONTAINER writes the outputs of a batch to one file, in the layout described with
+   PEMTPM_CONTAINER_MAGIC in pemtpm.h, instead of two or three small files per key.  Records are
+   appended as the keys are converted, and the index entries are kept in memory.  When the
+   container is closed, the index is sorted by key ID and written after the records, followed by
+   the trailer.
+
+   The file is written to "<name>.tmp" and renamed over its name when it is closed, so a reader
+   never maps a container without its index.
+*/
+
+#ifndef PEMTPMCONTAINERWRITER_H
+#define PEMTPMCONTAINERWRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <tss2/pemtpm.h>
+
+typedef struct PEMTPM_CONTAINER PEMTPM_CONTAINER;
+
+TPM_RC PEMTPM_Container_Create(PEMTPM_CONTAINER 		**container,
+			       const char 			*filename,
+			       uint32_t 			flags,
+			       const uint8_t 			*parentDigest);
+TPM_RC PEMTPM_Container_Append(PEMTPM_CONTAINER 		*container,
+			       const uint8_t 			*keyId,
+			       const PEMTPM_CONTAINER_RECORD 	*record);
+TPM_RC PEMTPM_Container_Close(PEMTPM_CONTAINER 		*container,
+			      int 				commit,
+			      int 				sync);
+
+#endif
@@ -0,0 +1,262 @@
+/********************************************************************************/
+/*										*/
+/*		     TPM Key Derivation and Symmetric Helpers			*/
+/*										*/
+/********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <tss2/tsserror.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#include "pemtpmcrypto.h"
+#include "pemtpmlibcrypto.h"
+
+extern int tssVerbose;
+
+/* the counter, label, contexts and size of one KDF iteration.  The largest contexts are an object
+   Name or two ECC coordinates. */
+
+#define KDF_MESSAGE_MAX		(4 + 32 + 2 * sizeof(TPMU_NAME) + 4)
+
+/* putUint32() writes 'value' big endian */
+
+static uint8_t *putUint32(uint8_t *buffer, uint32_t value)
+{
+    buffer[0] = (uint8_t)(value >> 24);
+    buffer[1] = (uint8_t)(value >> 16);
+    buffer[2] = (uint8_t)(value >>  8);
+    buffer[3] = (uint8_t)(value >>  0);
+    return buffer + 4;
+}
+
+/* PEMTPM_Crypto_GetDigest() maps a TPM hash algorithm to the OpenSSL digest */
+
+TPM_RC PEMTPM_Crypto_GetDigest(const EVP_MD 	**md,
+			       TPMI_ALG_HASH 	halg)
+{
+    TPM_RC rc = 0;
+
+    switch (halg) {
+      case TPM_ALG_SHA1:
+	*md = EVP_sha1();
+	break;
+      case TPM_ALG_SHA256:
+	*md = EVP_sha256();
+	break;
+      case TPM_ALG_SHA384:
+	*md = EVP_sha384();
+	break;
+      default:
+	if (tssVerbose) printf("PEMTPM_Crypto_GetDigest: Unsupported hash algorithm %04x\n", halg);
+	rc = TSS_RC_BAD_HASH_ALGORITHM;
+    }
+    return rc;
+}
+
+/* kdfMessage() builds the part of a KDF iteration after the counter, Label || 0 || U || V.  The
+   terminating zero of 'label' is part of the message.  Returns the message size, or 0 if it does
+   not fit. */
+
+static size_t kdfMessage(uint8_t 		*message,
+			 const char 		*label,
+			 const uint8_t 		*contextU,
+			 size_t 		contextUSize,
+			 const uint8_t 		*contextV,
+			 size_t 		contextVSize)
+{
+    size_t labelSize = strlen(label) + 1;
+
+    if (4 + labelSize + contextUSize + contextVSize + 4 > KDF_MESSAGE_MAX) {
+	return 0;
+    }
+    memcpy(message, label, labelSize);
+    if (contextUSize != 0) {
+	memcpy(message + labelSize, contextU, contextUSize);
+    }
+    if (contextVSize != 0) {
+	memcpy(message + labelSize + contextUSize, contextV, contextVSize);
+    }
+    return labelSize + contextUSize + contextVSize;
+}
+
+/* PEMTPM_Crypto_KDFa() derives 'sizeInBits' of 'keyStream' from 'key':
+
+   K(i) = HMAC(key, [i]32 || Label || 0 || contextU || contextV || [sizeInBits]32)
+
+   'sizeInBits' must be a multiple of 8.
+*/
+
+TPM_RC PEMTPM_Crypto_KDFa(uint8_t 		*keyStream,
+			  const EVP_MD 		*md,
+			  const uint8_t 	*key,
+			  size_t 		keySize,
+			  const char 		*label,
+			  const uint8_t 	*contextU,
+			  size_t 		contextUSize,
+			  const uint8_t 	*contextV,
+			  size_t 		contextVSize,
+			  uint32_t 		sizeInBits)
+{
+    TPM_RC		rc = 0;
+    uint8_t		message[KDF_MESSAGE_MAX];
+    size_t		messageSize = 0;
+    uint8_t		digest[EVP_MAX_MD_SIZE];
+    unsigned int	digestSize;
+    size_t		bytes = sizeInBits / 8;
+    size_t		done;
+    uint32_t		counter;
+
+    if (rc == 0) {
+	messageSize = kdfMessage(message + 4, label, contextU, contextUSize, contextV, contextVSize);
+	if ((messageSize == 0) || ((sizeInBits % 8) != 0)) {
+	    if (tssVerbose) printf("PEMTPM_Crypto_KDFa: Bad %s parameters\n", label);
+	    rc = TSS_RC_KDFA_FAILED;
+	}
+    }
+    if (rc == 0) {
+	putUint32(message + 4 + messageSize, sizeInBits);
+	messageSize += 8;
+    }
+    for (counter = 1, done = 0 ; (rc == 0) && (done < bytes) ; counter++) {
+	putUint32(message, counter);
+	if (HMAC(md, key, (int)keySize, message, messageSize, digest, &digestSize) == NULL) {
+	    if (tssVerbose) printf("PEMTPM_Crypto_KDFa: HMAC failed\n");
+	    rc = TSS_RC_KDFA_FAILED;
+	}
+	else {
+	    size_t copy = ((bytes - done) < digestSize) ? (bytes - done) : digestSize;
+	    memcpy(keyStream + done, digest, copy);
+	    done += copy;
+	}
+    }
+    memset(digest, 0, sizeof(digest));
+    return rc;
+}
+
+/* PEMTPM_Crypto_KDFe() derives 'sizeInBits' of 'keyStream' from the ECDH shared secret 'z':
+
+   K(i) = H([i]32 || Z || Label || 0 || partyUInfo || partyVInfo)
+
+   'sizeInBits' must be a multiple of 8.
+*/
+
+TPM_RC PEMTPM_Crypto_KDFe(uint8_t 		*keyStream,
+			  const EVP_MD 		*md,
+			  const uint8_t 	*z,
+			  size_t 		zSize,
+			  const char 		*label,
+			  const uint8_t 	*partyUInfo,
+			  size_t 		partyUInfoSize,
+			  const uint8_t 	*partyVInfo,
+			  size_t 		partyVInfoSize,
+			  uint32_t 		sizeInBits)
+{
+    TPM_RC		rc = 0;
+    uint8_t		message[KDF_MESSAGE_MAX];
+    size_t		messageSize = 0;
+    uint8_t		counterBuffer[4];
+    uint8_t		digest[EVP_MAX_MD_SIZE];
+    unsigned int	digestSize;
+    size_t		bytes = sizeInBits / 8;
+    size_t		done;
+    uint32_t		counter;
+    EVP_MD_CTX		*ctx = NULL;
+
+    if (rc == 0) {
+	messageSize = kdfMessage(message, label, partyUInfo, partyUInfoSize,
+				 partyVInfo, partyVInfoSize);
+	if ((messageSize == 0) || ((sizeInBits % 8) != 0)) {
+	    if (tssVerbose) printf("PEMTPM_Crypto_KDFe: Bad %s parameters\n", label);
+	    rc = TSS_RC_KDFE_FAILED;
+	}
+    }
+    if (rc == 0) {
+	ctx = EVP_MD_CTX_create();		/* freed @1 */
+	if (ctx == NULL) {
+	    rc = TSS_RC_OUT_OF_MEMORY;
+	}
+    }
+    for (counter = 1, done = 0 ; (rc == 0) && (done < bytes) ; counter++) {
+	putUint32(counterBuffer, counter);
+	if ((EVP_DigestInit_ex(ctx, md, NULL) != 1) ||
+	    (EVP_DigestUpdate(ctx, counterBuffer, sizeof(counterBuffer)) != 1) ||
+	    (EVP_DigestUpdate(ctx, z, zSize) != 1) ||
+	    (EVP_DigestUpdate(ctx, message, messageSize) != 1) ||
+	    (EVP_DigestFinal_ex(ctx, digest, &digestSize) != 1)) {
+	    if (tssVerbose) printf("PEMTPM_Crypto_KDFe: Digest failed\n");
+	    rc = TSS_RC_KDFE_FAILED;
+	}
+	else {
+	    size_t copy = ((bytes - done) < digestSize) ? (bytes - done) : digestSize;
+	    memcpy(keyStream + done, digest, copy);
+	    done += copy;
+	}
+    }
+    if (ctx != NULL) {
+	EVP_MD_CTX_destroy(ctx);		/* @1 */
+    }
+    memset(digest, 0, sizeof(digest));
+    return rc;
+}
+
+/* PEMTPM_Crypto_AesCfbEncrypt() encrypts 'data' in place with AES-CFB and a zero IV, as the
+   duplication wrappers require.
+
+   'ctx' may be a context kept by the caller, which saves an allocation per call when many keys
+   are wrapped.  If it is NULL, a context is created for the call.
+*/
+
+TPM_RC PEMTPM_Crypto_AesCfbEncrypt(EVP_CIPHER_CTX 	*ctx,
+				   uint8_t 		*data,
+				   size_t 		dataSize,
+				   const uint8_t 	*key,
+				   uint32_t 		keyBits)
+{
+    TPM_RC		rc = 0;
+    const EVP_CIPHER	*cipher = NULL;
+    EVP_CIPHER_CTX	*localCtx = NULL;
+    uint8_t		iv[16];
+    int			length;
+
+    if (rc == 0) {
+	switch (keyBits) {
+	  case 128:
+	    cipher = EVP_aes_128_cfb128();
+	    break;
+	  case 192:
+	    cipher = EVP_aes_192_cfb128();
+	    break;
+	  case 256:
+	    cipher = EVP_aes_256_cfb128();
+	    break;
+	  default:
+	    if (tssVerbose) printf("PEMTPM_Crypto_AesCfbEncrypt: Bad key size %u\n", keyBits);
+	    rc = TSS_RC_BAD_ENCRYPT_ALGORITHM;
+	}
+    }
+    if ((rc == 0) && (ctx == NULL)) {
+	localCtx = EVP_CIPHER_CTX_new();		/* freed @1 */
+	if (localCtx == NULL) {
+	    rc = TSS_RC_OUT_OF_MEMORY;
+	}
+	ctx = localCtx;
+    }
+    if (rc == 0) {
+	memset(iv, 0, sizeof(iv));
+	if ((EVP_EncryptInit_ex(ctx, cipher, NULL, key, iv) != 1) ||
+	    (EVP_EncryptUpdate(ctx, data, &length, data, (int)dataSize) != 1) ||
+	    ((size_t)length != dataSize)) {
+	    if (tssVerbose) printf("PEMTPM_Crypto_AesCfbEncrypt: Encryption failed\n");
+	    rc = TSS_RC_AES_ENCRYPT_FAILURE;
+	}
+    }
+    if (localCtx != NULL) {
+	EVP_CIPHER_CTX_free(localCtx);		/* @1 */
+    }
+    return rc;
+}
@@ -0,0 +1,54 @@
+/********************************************************************************/
+/*										*/
+/*		     TPM Key Derivation and Symmetric Helpers			*/
+/*										*/
+/********************************************************************************/
+
+/* This is a private header for the libpemtpm duplication wrappers.
+
+   The functions follow TPM 2.0 Part 1, 11.4.10 (KDFa and KDFe) and use OpenSSL for the hash,
+   HMAC and AES primitives.
+*/
+
+#ifndef PEMTPMCRYPTO_H
+#define PEMTPMCRYPTO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef TPM_TSS
+#define TPM_TSS
+#endif
+#include <tss2/TPM_Types.h>
+
+#include <openssl/evp.h>
+
+TPM_RC PEMTPM_Crypto_GetDigest(const EVP_MD 		**md,
+			       TPMI_ALG_HASH 		halg);
+TPM_RC PEMTPM_Crypto_KDFa(uint8_t 			*keyStream,
+			  const EVP_MD 			*md,
+			  const uint8_t 		*key,
+			  size_t 			keySize,
+			  const char 			*label,
+			  const uint8_t 		*contextU,
+			  size_t 			contextUSize,
+			  const uint8_t 		*contextV,
+			  size_t 			contextVSize,
+			  uint32_t 			sizeInBits);
+TPM_RC PEMTPM_Crypto_KDFe(uint8_t 			*keyStream,
+			  const EVP_MD 			*md,
+			  const uint8_t 		*z,
+			  size_t 			zSize,
+			  const char 			*label,
+			  const uint8_t 		*partyUInfo,
+			  size_t 			partyUInfoSize,
+			  const uint8_t 		*partyVInfo,
+			  size_t 			partyVInfoSize,
+			  uint32_t 			sizeInBits);
+TPM_RC PEMTPM_Crypto_AesCfbEncrypt(EVP_CIPHER_CTX 	*ctx,
+				   uint8_t 		*data,
+				   size_t 		dataSize,
+				   const uint8_t 	*key,
+				   uint32_t 		keyBits);
+
+#endif
@@ -0,0 +1,346 @@
+/********************************************************************************/
+/*										*/
+/*		     Native PEM and DER RSA Private Key Reader			*/
+/*										*/
+/********************************************************************************/
+
+#include <string.h>
+#include <stdint.h>
+
+#ifndef TPM_TSS
+#define TPM_TSS
+#endif
+#include <tss2/TPM_Types.h>
+
+#include "pemtpmder.h"
+
+/* the longest base64 line read natively, what OpenSSL and other PEM writers emit */
+#define PEM_LINE_MAX		64
+
+#define PEM_BEGIN		"-----BEGIN "
+#define PEM_END			"-----END "
+#define PEM_DASHES		"-----"
+
+#define PEM_LABEL_PKCS1		"RSA PRIVATE KEY"
+#define PEM_LABEL_PKCS8		"PRIVATE KEY"
+
+#define DER_INTEGER		0x02
+#define DER_OCTET_STRING	0x04
+#define DER_SEQUENCE		0x30
+
+/* the PKCS#8 AlgorithmIdentifier contents for rsaEncryption, 1.2.840.113549.1.1.1, with NULL
+   parameters */
+
+static const uint8_t rsaEncryption[] = {
+    0x06, 0x09, 0x2a, 0x86, 0x48, 0x86, 0xf7, 0x0d, 0x01, 0x01, 0x01,
+    0x05, 0x00
+};
+
+/* getLine() returns the next line from 'cursor', without its line ending, and moves the cursor
+   past it */
+
+static void getLine(const unsigned char 	**line,
+		    size_t 			*lineLength,
+		    const unsigned char 	**cursor,
+		    const unsigned char 	*end)
+{
+    const unsigned char *newline = memchr(*cursor, '\n', end - *cursor);
+
+    *line = *cursor;
+    *lineLength = ((newline != NULL) ? newline : end) - *cursor;
+    *cursor = (newline != NULL) ? newline + 1 : end;
+    if ((*lineLength > 0) && ((*line)[*lineLength - 1] == '\r')) {
+	(*lineLength)--;
+    }
+    return;
+}
+
+/* isBoundary() returns TRUE if 'line' is 'marker' 'label' followed by the closing dashes */
+
+static int isBoundary(const unsigned char 	*line,
+		      size_t 			lineLength,
+		      const char 		*marker,
+		      const char 		*label)
+{
+    size_t markerLength = strlen(marker);
+    size_t labelLength = strlen(label);
+
+    return (lineLength == markerLength + labelLength + sizeof(PEM_DASHES) - 1) &&
+	(memcmp(line, marker, markerLength) == 0) &&
+	(memcmp(line + markerLength, label, labelLength) == 0) &&
+	(memcmp(line + markerLength + labelLength, PEM_DASHES, sizeof(PEM_DASHES) - 1) == 0);
+}
+
+/* getBase64Value() returns the 6 bit value of a base64 character, or -1 */
+
+static int getBase64Value(unsigned char c)
+{
+    if ((c >= 'A') && (c <= 'Z')) {
+	return c - 'A';
+    }
+    if ((c >= 'a') && (c <= 'z')) {
+	return c - 'a' + 26;
+    }
+    if ((c >= '0') && (c <= '9')) {
+	return c - '0' + 52;
+    }
+    if (c == '+') {
+	return 62;
+    }
+    if (c == '/') {
+	return 63;
+    }
+    return -1;
+}
+
+/* decodeBody() decodes the base64 lines from 'cursor' up to the END line of 'label' into 'der'.
+   Returns FALSE for a header, a long or empty line, a non canonical encoding, or a 'der' that is
+   too small. */
+
+static int decodeBody(uint8_t 			*der,
+		      size_t 			*derLength,
+		      size_t 			derSize,
+		      const unsigned char 	*cursor,
+		      const unsigned char 	*end,
+		      const char 		*label)
+{
+    const unsigned char	*line;
+    size_t		lineLength;
+    size_t		characters = 0;		/* base64 characters, with padding */
+    size_t		padding = 0;
+    uint32_t		bits = 0;
+    unsigned int	bitCount = 0;
+    size_t		i;
+
+    *derLength = 0;
+    while (cursor < end) {
+	getLine(&line, &lineLength, &cursor, end);
+	if (isBoundary(line, lineLength, PEM_END, label)) {
+	    /* every group of four characters is complete, and the unused bits are zero */
+	    return (*derLength > 0) && ((characters % 4) == 0) && (padding <= 2) && (bits == 0);
+	}
+	if ((lineLength == 0) || (lineLength > PEM_LINE_MAX)) {
+	    return FALSE;
+	}
+	for (i = 0 ; i < lineLength ; i++) {
+	    int value;
+
+	    characters++;
+	    if (line[i] == '=') {
+		padding++;
+		continue;
+	    }
+	    value = getBase64Value(line[i]);
+	    /* a header line has a colon, and data cannot follow the padding */
+	    if ((value < 0) || (padding > 0)) {
+		return FALSE;
+	    }
+	    bits = (bits << 6) | value;
+	    bitCount += 6;
+	    if (bitCount >= 8) {
+		if (*derLength == derSize) {
+		    return FALSE;
+		}
+		bitCount -= 8;
+		der[(*derLength)++] = (uint8_t)(bits >> bitCount);
+		bits &= (1 << bitCount) - 1;
+	    }
+	}
+    }
+    return FALSE;
+}
+
+/* getElement() reads one DER element with 'tag' at 'cursor' and moves the cursor past it.  Only
+   definite lengths in their shortest form are accepted. */
+
+static int getElement(const uint8_t 	**content,
+		      size_t 		*contentLength,
+		      const uint8_t 	**cursor,
+		      const uint8_t 	*end,
+		      uint8_t 		tag)
+{
+    const uint8_t	*element = *cursor;
+    size_t		length;
+
+    if ((end - element < 2) || (element[0] != tag)) {
+	return FALSE;
+    }
+    length = element[1];
+    element += 2;
+    if (length == 0x81) {
+	if ((end - element < 1) || (element[0] < 0x80)) {
+	    return FALSE;
+	}
+	length = element[0];
+	element += 1;
+    }
+    else if (length == 0x82) {
+	if ((end - element < 2) || (element[0] == 0)) {
+	    return FALSE;
+	}
+	length = ((size_t)element[0] << 8) | element[1];
+	element += 2;
+    }
+    else if (length >= 0x80) {
+	return FALSE;
+    }
+    if ((size_t)(end - element) < length) {
+	return FALSE;
+    }
+    *content = element;
+    *contentLength = length;
+    *cursor = element + length;
+    return TRUE;
+}
+
+/* getInteger() reads a non-negative, minimally encoded DER INTEGER and returns its value without
+   leading zeros, as BN_bn2bin() would.  'value' can be NULL to skip the INTEGER. */
+
+static int getInteger(const uint8_t 	**value,
+		      size_t 		*valueSize,
+		      const uint8_t 	**cursor,
+		      const uint8_t 	*end)
+{
+    const uint8_t	*content;
+    size_t		contentLength;
+
+    if (!getElement(&content, &contentLength, cursor, end, DER_INTEGER) ||
+	(contentLength == 0) ||
+	((content[0] & 0x80) != 0) ||
+	((contentLength > 1) && (content[0] == 0) && ((content[1] & 0x80) == 0))) {
+	return FALSE;
+    }
+    while ((contentLength > 0) && (content[0] == 0)) {
+	content++;
+	contentLength--;
+    }
+    if (value != NULL) {
+	*value = content;
+	*valueSize = contentLength;
+    }
+    return TRUE;
+}
+
+/* getVersionZero() reads an INTEGER that must be 0 */
+
+static int getVersionZero(const uint8_t **cursor, const uint8_t *end)
+{
+    const uint8_t	*value;
+    size_t		valueSize;
+
+    return getInteger(&value, &valueSize, cursor, end) && (valueSize == 0);
+}
+
+/* readRsaPrivateKey() reads a two prime PKCS#1 RSAPrivateKey that fills 'der' to 'end'
+
+	RSAPrivateKey ::= SEQUENCE {
+	    version INTEGER (0), modulus, publicExponent, privateExponent,
+	    prime1, prime2, exponent1, exponent2, coefficient INTEGER }
+*/
+
+static int readRsaPrivateKey(PEMTPM_DER_RSA_KEY 	*rsaKey,
+			     const uint8_t 		*der,
+			     const uint8_t 		*end)
+{
+    const uint8_t	*cursor;
+    size_t		sequenceLength;
+    const uint8_t	*sequenceEnd;
+    int			i;
+
+    if (!getElement(&cursor, &sequenceLength, &der, end, DER_SEQUENCE) || (der != end)) {
+	return FALSE;
+    }
+    sequenceEnd = cursor + sequenceLength;
+    if (!getVersionZero(&cursor, sequenceEnd) ||
+	!getInteger(&rsaKey->modulus, &rsaKey->modulusSize, &cursor, sequenceEnd) ||
+	!getInteger(NULL, NULL, &cursor, sequenceEnd) ||
+	!getInteger(NULL, NULL, &cursor, sequenceEnd) ||
+	!getInteger(&rsaKey->prime, &rsaKey->primeSize, &cursor, sequenceEnd)) {
+	return FALSE;
+    }
+    /* prime2, exponent1, exponent2, coefficient */
+    for (i = 0 ; i < 4 ; i++) {
+	if (!getInteger(NULL, NULL, &cursor, sequenceEnd)) {
+	    return FALSE;
+	}
+    }
+    return cursor == sequenceEnd;
+}
+
+/* readPrivateKeyInfo() reads a PKCS#8 PrivateKeyInfo holding an RSA key, without attributes
+
+	PrivateKeyInfo ::= SEQUENCE {
+	    version INTEGER (0),
+	    privateKeyAlgorithm AlgorithmIdentifier,
+	    privateKey OCTET STRING }
+*/
+
+static int readPrivateKeyInfo(PEMTPM_DER_RSA_KEY 	*rsaKey,
+			      const uint8_t 		*der,
+			      const uint8_t 		*end)
+{
+    const uint8_t	*cursor;
+    size_t		sequenceLength;
+    const uint8_t	*sequenceEnd;
+    const uint8_t	*algorithm;
+    size_t		algorithmLength;
+    const uint8_t	*privateKey;
+    size_t		privateKeyLength;
+
+    if (!getElement(&cursor, &sequenceLength, &der, end, DER_SEQUENCE) || (der != end)) {
+	return FALSE;
+    }
+    sequenceEnd = cursor + sequenceLength;
+    if (!getVersionZero(&cursor, sequenceEnd) ||
+	!getElement(&algorithm, &algorithmLength, &cursor, sequenceEnd, DER_SEQUENCE) ||
+	(algorithmLength != sizeof(rsaEncryption)) ||
+	(memcmp(algorithm, rsaEncryption, sizeof(rsaEncryption)) != 0) ||
+	!getElement(&privateKey, &privateKeyLength, &cursor, sequenceEnd, DER_OCTET_STRING) ||
+	(cursor != sequenceEnd)) {
+	return FALSE;
+    }
+    return readRsaPrivateKey(rsaKey, privateKey, privateKey + privateKeyLength);
+}
+
+/* PEMTPM_Der_ReadRsaPem() reads the modulus and first prime of an unencrypted RSA private key from
+   the first PEM block of 'pemData'.  The DER is decoded into 'der' of 'derSize' bytes, and the
+   results point into it.
+
+   Returns FALSE if the key is not one that the native reader handles, see pemtpmder.h.  The
+   caller then reads the key with OpenSSL.
+*/
+
+int PEMTPM_Der_ReadRsaPem(PEMTPM_DER_RSA_KEY 		*rsaKey,
+			  uint8_t 			*der,
+			  size_t 			derSize,
+			  const unsigned char 		*pemData,
+			  size_t 			pemLength)
+{
+    const unsigned char	*cursor = pemData;
+    const unsigned char	*end = pemData + pemLength;
+    const unsigned char	*line;
+    size_t		lineLength = 0;
+    size_t		derLength;
+
+    /* like OpenSSL, skip any text before the first BEGIN line */
+    while (cursor < end) {
+	getLine(&line, &lineLength, &cursor, end);
+	if ((lineLength >= sizeof(PEM_BEGIN) - 1) &&
+	    (memcmp(line, PEM_BEGIN, sizeof(PEM_BEGIN) - 1) == 0)) {
+	    break;
+	}
+	lineLength = 0;
+    }
+    if (lineLength == 0) {
+	return FALSE;
+    }
+    if (isBoundary(line, lineLength, PEM_BEGIN, PEM_LABEL_PKCS1)) {
+	return decodeBody(der, &derLength, derSize, cursor, end, PEM_LABEL_PKCS1) &&
+	    readRsaPrivateKey(rsaKey, der, der + derLength);
+    }
+    if (isBoundary(line, lineLength, PEM_BEGIN, PEM_LABEL_PKCS8)) {
+	return decodeBody(der, &derLength, derSize, cursor, end, PEM_LABEL_PKCS8) &&
+	    readPrivateKeyInfo(rsaKey, der, der + derLength);
+    }
+    return FALSE;
+}
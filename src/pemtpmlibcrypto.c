@@ -0,0 +1,81 @@
+/********************************************************************************/
+/*										*/
+/*		     Run Time Loading of libcrypto				*/
+/*										*/
+/********************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <pthread.h>
+
+#include <tss2/tsserror.h>
+
+/* the table is filled by name, so the OpenSSL names are not redirected in this file */
+#define PEMTPM_LIBCRYPTO_NO_REDIRECT
+#include "pemtpmlibcrypto.h"
+
+extern int tssVerbose;
+
+PEMTPM_LIBCRYPTO pemtpmLibcrypto;
+
+static pthread_once_t libcryptoOnce = PTHREAD_ONCE_INIT;
+static TPM_RC libcryptoRc;
+static int libcryptoLoaded;
+
+/* loadLibcrypto() opens libcrypto and resolves every function in the table.  The handle is never
+   closed. */
+
+static void loadLibcrypto(void)
+{
+    TPM_RC	rc = 0;
+    void	*handle = NULL;
+    void	*symbol;
+
+    if (rc == 0) {
+	handle = dlopen(PEMTPM_LIBCRYPTO_NAME, RTLD_NOW | RTLD_LOCAL);
+	if (handle == NULL) {
+	    if (tssVerbose) printf("loadLibcrypto: Error, cannot load %s, %s\n",
+				   PEMTPM_LIBCRYPTO_NAME, dlerror());
+	    rc = TSS_RC_NOT_IMPLEMENTED;
+	}
+    }
+#define PEMTPM_LIBCRYPTO_RESOLVE(name)					\
+    if (rc == 0) {							\
+	symbol = dlsym(handle, #name);					\
+	if (symbol == NULL) {						\
+	    if (tssVerbose) printf("loadLibcrypto: Error, %s not in %s\n",	\
+				   #name, PEMTPM_LIBCRYPTO_NAME);	\
+	    rc = TSS_RC_NOT_IMPLEMENTED;				\
+	}								\
+	else {								\
+	    memcpy(&pemtpmLibcrypto.name, &symbol, sizeof(symbol));	\
+	}								\
+    }
+    PEMTPM_LIBCRYPTO_FUNCTIONS(PEMTPM_LIBCRYPTO_RESOLVE)
+#undef PEMTPM_LIBCRYPTO_RESOLVE
+    if (rc == 0) {
+	__atomic_store_n(&libcryptoLoaded, 1, __ATOMIC_RELEASE);
+    }
+    else if (handle != NULL) {
+	dlclose(handle);
+    }
+    libcryptoRc = rc;
+    return;
+}
+
+/* PEMTPM_Libcrypto_Load() loads libcrypto on the first call.  It is thread safe, and returns the
+   result of the first call to every later one. */
+
+TPM_RC PEMTPM_Libcrypto_Load(void)
+{
+    pthread_once(&libcryptoOnce, loadLibcrypto);
+    return libcryptoRc;
+}
+
+/* PEMTPM_Libcrypto_Loaded() returns TRUE if libcrypto has been loaded, without loading it */
+
+int PEMTPM_Libcrypto_Loaded(void)
+{
+    return __atomic_load_n(&libcryptoLoaded, __ATOMIC_ACQUIRE);
+}
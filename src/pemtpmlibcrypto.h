@@ -0,0 +1,235 @@
+/********************************************************************************/
+/*										*/
+/*		     Run Time Loading of libcrypto				*/
+/*										*/
+/********************************************************************************/
+
+/* This is a private header for libpemtpm and pemtpm.  It is included after the OpenSSL headers.
+
+   By default libcrypto is linked, and PEMTPM_Libcrypto_Load() does nothing.
+
+   With configure --disable-openssl, PEMTPM_DLOPEN_CRYPTO is defined and libcrypto is not linked.
+   Every OpenSSL function that pemtpm calls is then a pointer in pemtpmLibcrypto, and the OpenSSL
+   names below are redirected to it, so the callers are unchanged.  PEMTPM_Libcrypto_Load()
+   dlopen()s libcrypto and resolves the table once.  It is called at each entry point that
+   reaches OpenSSL: reading a key that the native reader does not handle, computing a Name,
+   creating a wrapping parent or inner cipher, opening a cache, stamps, -oek and -serve.  An
+   unencrypted RSA conversion never loads libcrypto.
+*/
+
+#ifndef PEMTPMLIBCRYPTO_H
+#define PEMTPMLIBCRYPTO_H
+
+#ifndef TPM_TSS
+#define TPM_TSS
+#endif
+#include <tss2/TPM_Types.h>
+
+#include <openssl/opensslv.h>
+#include <openssl/bio.h>
+#include <openssl/bn.h>
+#include <openssl/crypto.h>
+#include <openssl/ec.h>
+#include <openssl/ecdh.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/objects.h>
+#include <openssl/pem.h>
+#include <openssl/rand.h>
+#include <openssl/rsa.h>
+#include <openssl/sha.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000
+#include <openssl/param_build.h>
+#endif
+
+#ifdef PEMTPM_DLOPEN_CRYPTO
+
+#if OPENSSL_VERSION_NUMBER < 0x30000000
+#error "--disable-openssl requires OpenSSL 3.0 or later"
+#endif
+
+/* the library name, for the OpenSSL headers used at build time */
+#ifndef PEMTPM_LIBCRYPTO_NAME
+#define PEMTPM_LIBCRYPTO_STRING(x)	#x
+#define PEMTPM_LIBCRYPTO_SONAME(x)	"libcrypto.so." PEMTPM_LIBCRYPTO_STRING(x)
+#define PEMTPM_LIBCRYPTO_NAME		PEMTPM_LIBCRYPTO_SONAME(OPENSSL_SHLIB_VERSION)
+#endif
+
+#define PEMTPM_LIBCRYPTO_FUNCTIONS(F)		\
+    F(BIO_free)					\
+    F(BIO_new_mem_buf)				\
+    F(BN_bin2bn)				\
+    F(BN_bn2bin)				\
+    F(BN_clear_free)				\
+    F(BN_free)					\
+    F(BN_new)					\
+    F(BN_num_bits)				\
+    F(BN_set_word)				\
+    F(CRYPTO_free)				\
+    F(CRYPTO_malloc)				\
+    F(EC_curve_nist2nid)			\
+    F(ERR_clear_error)				\
+    F(EVP_CIPHER_CTX_free)			\
+    F(EVP_CIPHER_CTX_new)			\
+    F(EVP_Digest)				\
+    F(EVP_DigestFinal_ex)			\
+    F(EVP_DigestInit_ex)			\
+    F(EVP_DigestUpdate)				\
+    F(EVP_EncryptInit_ex)			\
+    F(EVP_EncryptUpdate)			\
+    F(EVP_MD_CTX_free)				\
+    F(EVP_MD_CTX_new)				\
+    F(EVP_MD_get_size)				\
+    F(EVP_PKEY_CTX_free)			\
+    F(EVP_PKEY_CTX_new)				\
+    F(EVP_PKEY_CTX_new_from_name)		\
+    F(EVP_PKEY_CTX_new_from_pkey)		\
+    F(EVP_PKEY_CTX_set0_rsa_oaep_label)		\
+    F(EVP_PKEY_CTX_set_group_name)		\
+    F(EVP_PKEY_CTX_set_rsa_mgf1_md)		\
+    F(EVP_PKEY_CTX_set_rsa_oaep_md)		\
+    F(EVP_PKEY_CTX_set_rsa_padding)		\
+    F(EVP_PKEY_derive)				\
+    F(EVP_PKEY_derive_init)			\
+    F(EVP_PKEY_derive_set_peer_ex)		\
+    F(EVP_PKEY_encrypt)				\
+    F(EVP_PKEY_encrypt_init)			\
+    F(EVP_PKEY_free)				\
+    F(EVP_PKEY_fromdata)			\
+    F(EVP_PKEY_fromdata_init)			\
+    F(EVP_PKEY_get1_RSA)			\
+    F(EVP_PKEY_get_bn_param)			\
+    F(EVP_PKEY_get_utf8_string_param)		\
+    F(EVP_PKEY_keygen)				\
+    F(EVP_PKEY_keygen_init)			\
+    F(EVP_PKEY_public_check)			\
+    F(EVP_aes_128_cfb128)			\
+    F(EVP_aes_192_cfb128)			\
+    F(EVP_aes_256_cfb128)			\
+    F(EVP_sha1)					\
+    F(EVP_sha256)				\
+    F(EVP_sha384)				\
+    F(EVP_sha512)				\
+    F(HMAC)					\
+    F(OBJ_txt2nid)				\
+    F(OPENSSL_init_crypto)			\
+    F(OSSL_PARAM_BLD_free)			\
+    F(OSSL_PARAM_BLD_new)			\
+    F(OSSL_PARAM_BLD_push_BN)			\
+    F(OSSL_PARAM_BLD_push_octet_string)		\
+    F(OSSL_PARAM_BLD_push_utf8_string)		\
+    F(OSSL_PARAM_BLD_to_param)			\
+    F(OSSL_PARAM_free)				\
+    F(PEM_read_bio_PrivateKey)			\
+    F(RAND_bytes)				\
+    F(RSA_free)					\
+    F(RSA_get0_factors)				\
+    F(RSA_get0_key)				\
+    F(SHA256)
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+
+typedef struct {
+#define PEMTPM_LIBCRYPTO_MEMBER(name)	__typeof__(&name) name;
+    PEMTPM_LIBCRYPTO_FUNCTIONS(PEMTPM_LIBCRYPTO_MEMBER)
+#undef PEMTPM_LIBCRYPTO_MEMBER
+} PEMTPM_LIBCRYPTO;
+
+#pragma GCC diagnostic pop
+
+extern PEMTPM_LIBCRYPTO pemtpmLibcrypto;
+
+TPM_RC PEMTPM_Libcrypto_Load(void);
+int PEMTPM_Libcrypto_Loaded(void);
+
+/* pemtpmlibcrypto.c resolves the table by name, so it does not redirect */
+#ifndef PEMTPM_LIBCRYPTO_NO_REDIRECT
+#define BIO_free				(*pemtpmLibcrypto.BIO_free)
+#define BIO_new_mem_buf				(*pemtpmLibcrypto.BIO_new_mem_buf)
+#define BN_bin2bn				(*pemtpmLibcrypto.BN_bin2bn)
+#define BN_bn2bin				(*pemtpmLibcrypto.BN_bn2bin)
+#define BN_clear_free				(*pemtpmLibcrypto.BN_clear_free)
+#define BN_free					(*pemtpmLibcrypto.BN_free)
+#define BN_new					(*pemtpmLibcrypto.BN_new)
+#define BN_num_bits				(*pemtpmLibcrypto.BN_num_bits)
+#define BN_set_word				(*pemtpmLibcrypto.BN_set_word)
+#define CRYPTO_free				(*pemtpmLibcrypto.CRYPTO_free)
+#define CRYPTO_malloc				(*pemtpmLibcrypto.CRYPTO_malloc)
+#define EC_curve_nist2nid			(*pemtpmLibcrypto.EC_curve_nist2nid)
+#define ERR_clear_error				(*pemtpmLibcrypto.ERR_clear_error)
+#define EVP_CIPHER_CTX_free			(*pemtpmLibcrypto.EVP_CIPHER_CTX_free)
+#define EVP_CIPHER_CTX_new			(*pemtpmLibcrypto.EVP_CIPHER_CTX_new)
+#define EVP_Digest				(*pemtpmLibcrypto.EVP_Digest)
+#define EVP_DigestFinal_ex			(*pemtpmLibcrypto.EVP_DigestFinal_ex)
+#define EVP_DigestInit_ex			(*pemtpmLibcrypto.EVP_DigestInit_ex)
+#define EVP_DigestUpdate			(*pemtpmLibcrypto.EVP_DigestUpdate)
+#define EVP_EncryptInit_ex			(*pemtpmLibcrypto.EVP_EncryptInit_ex)
+#define EVP_EncryptUpdate			(*pemtpmLibcrypto.EVP_EncryptUpdate)
+#define EVP_MD_CTX_free				(*pemtpmLibcrypto.EVP_MD_CTX_free)
+#define EVP_MD_CTX_new				(*pemtpmLibcrypto.EVP_MD_CTX_new)
+#define EVP_MD_get_size				(*pemtpmLibcrypto.EVP_MD_get_size)
+#define EVP_PKEY_CTX_free			(*pemtpmLibcrypto.EVP_PKEY_CTX_free)
+#define EVP_PKEY_CTX_new			(*pemtpmLibcrypto.EVP_PKEY_CTX_new)
+#define EVP_PKEY_CTX_new_from_name		(*pemtpmLibcrypto.EVP_PKEY_CTX_new_from_name)
+#define EVP_PKEY_CTX_new_from_pkey		(*pemtpmLibcrypto.EVP_PKEY_CTX_new_from_pkey)
+#define EVP_PKEY_CTX_set0_rsa_oaep_label	(*pemtpmLibcrypto.EVP_PKEY_CTX_set0_rsa_oaep_label)
+#define EVP_PKEY_CTX_set_group_name		(*pemtpmLibcrypto.EVP_PKEY_CTX_set_group_name)
+#define EVP_PKEY_CTX_set_rsa_mgf1_md		(*pemtpmLibcrypto.EVP_PKEY_CTX_set_rsa_mgf1_md)
+#define EVP_PKEY_CTX_set_rsa_oaep_md		(*pemtpmLibcrypto.EVP_PKEY_CTX_set_rsa_oaep_md)
+#define EVP_PKEY_CTX_set_rsa_padding		(*pemtpmLibcrypto.EVP_PKEY_CTX_set_rsa_padding)
+#define EVP_PKEY_derive				(*pemtpmLibcrypto.EVP_PKEY_derive)
+#define EVP_PKEY_derive_init			(*pemtpmLibcrypto.EVP_PKEY_derive_init)
+#define EVP_PKEY_derive_set_peer_ex		(*pemtpmLibcrypto.EVP_PKEY_derive_set_peer_ex)
+#define EVP_PKEY_encrypt			(*pemtpmLibcrypto.EVP_PKEY_encrypt)
+#define EVP_PKEY_encrypt_init			(*pemtpmLibcrypto.EVP_PKEY_encrypt_init)
+#define EVP_PKEY_free				(*pemtpmLibcrypto.EVP_PKEY_free)
+#define EVP_PKEY_fromdata			(*pemtpmLibcrypto.EVP_PKEY_fromdata)
+#define EVP_PKEY_fromdata_init			(*pemtpmLibcrypto.EVP_PKEY_fromdata_init)
+#define EVP_PKEY_get1_RSA			(*pemtpmLibcrypto.EVP_PKEY_get1_RSA)
+#define EVP_PKEY_get_bn_param			(*pemtpmLibcrypto.EVP_PKEY_get_bn_param)
+#define EVP_PKEY_get_utf8_string_param		(*pemtpmLibcrypto.EVP_PKEY_get_utf8_string_param)
+#define EVP_PKEY_keygen				(*pemtpmLibcrypto.EVP_PKEY_keygen)
+#define EVP_PKEY_keygen_init			(*pemtpmLibcrypto.EVP_PKEY_keygen_init)
+#define EVP_PKEY_public_check			(*pemtpmLibcrypto.EVP_PKEY_public_check)
+#define EVP_aes_128_cfb128			(*pemtpmLibcrypto.EVP_aes_128_cfb128)
+#define EVP_aes_192_cfb128			(*pemtpmLibcrypto.EVP_aes_192_cfb128)
+#define EVP_aes_256_cfb128			(*pemtpmLibcrypto.EVP_aes_256_cfb128)
+#define EVP_sha1				(*pemtpmLibcrypto.EVP_sha1)
+#define EVP_sha256				(*pemtpmLibcrypto.EVP_sha256)
+#define EVP_sha384				(*pemtpmLibcrypto.EVP_sha384)
+#define EVP_sha512				(*pemtpmLibcrypto.EVP_sha512)
+#define HMAC					(*pemtpmLibcrypto.HMAC)
+#define OBJ_txt2nid				(*pemtpmLibcrypto.OBJ_txt2nid)
+#define OPENSSL_init_crypto			(*pemtpmLibcrypto.OPENSSL_init_crypto)
+#define OSSL_PARAM_BLD_free			(*pemtpmLibcrypto.OSSL_PARAM_BLD_free)
+#define OSSL_PARAM_BLD_new			(*pemtpmLibcrypto.OSSL_PARAM_BLD_new)
+#define OSSL_PARAM_BLD_push_BN			(*pemtpmLibcrypto.OSSL_PARAM_BLD_push_BN)
+#define OSSL_PARAM_BLD_push_octet_string	(*pemtpmLibcrypto.OSSL_PARAM_BLD_push_octet_string)
+#define OSSL_PARAM_BLD_push_utf8_string		(*pemtpmLibcrypto.OSSL_PARAM_BLD_push_utf8_string)
+#define OSSL_PARAM_BLD_to_param			(*pemtpmLibcrypto.OSSL_PARAM_BLD_to_param)
+#define OSSL_PARAM_free				(*pemtpmLibcrypto.OSSL_PARAM_free)
+#define PEM_read_bio_PrivateKey			(*pemtpmLibcrypto.PEM_read_bio_PrivateKey)
+#define RAND_bytes				(*pemtpmLibcrypto.RAND_bytes)
+#define RSA_free				(*pemtpmLibcrypto.RSA_free)
+#define RSA_get0_factors			(*pemtpmLibcrypto.RSA_get0_factors)
+#define RSA_get0_key				(*pemtpmLibcrypto.RSA_get0_key)
+#define SHA256					(*pemtpmLibcrypto.SHA256)
+#endif
+
+#else
+
+static inline TPM_RC PEMTPM_Libcrypto_Load(void)
+{
+    return 0;
+}
+
+static inline int PEMTPM_Libcrypto_Loaded(void)
+{
+    return 1;
+}
+
+#endif
+
+#endif
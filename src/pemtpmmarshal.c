@@ -0,0 +1,266 @@
+/********************************************************************************/
+/*										*/
+/*		     Presized Structure Marshaling				*/
+/*										*/
+/********************************************************************************/
+
+#include <string.h>
+#include <stdint.h>
+
+#include <tss2/tsserror.h>
+#include <tss2/tssmarshal.h>
+
+#include "pemtpmmarshal.h"
+
+/* Each get*Size() function returns the marshaled size of its structure, or 0 if the fast path does
+   not cover it.  The matching marshal*() function stores it. */
+
+/* getSymDefSize() covers TPM_ALG_NULL and AES, the parent symmetric algorithm */
+
+static UINT32 getSymDefSize(const TPMT_SYM_DEF_OBJECT *symmetric)
+{
+    switch (symmetric->algorithm) {
+      case TPM_ALG_NULL:
+	return sizeof(UINT16);
+      case TPM_ALG_AES:
+	return 3 * sizeof(UINT16);
+      default:
+	return 0;
+    }
+}
+
+static BYTE *marshalSymDef(BYTE *buffer, const TPMT_SYM_DEF_OBJECT *symmetric)
+{
+    buffer = PEMTPM_Marshal_Uint16(buffer, symmetric->algorithm);
+    if (symmetric->algorithm == TPM_ALG_AES) {
+	buffer = PEMTPM_Marshal_Uint16(buffer, symmetric->keyBits.aes);
+	buffer = PEMTPM_Marshal_Uint16(buffer, symmetric->mode.aes);
+    }
+    return buffer;
+}
+
+/* getSchemeSize() covers TPM_ALG_NULL, the schemes whose details are just a hash algorithm, and
+   RSAES, which has no details */
+
+static UINT32 getSchemeSize(TPMI_ALG_PUBLIC type, TPM_ALG_ID scheme)
+{
+    switch (scheme) {
+      case TPM_ALG_NULL:
+	return sizeof(UINT16);
+      case TPM_ALG_RSAES:
+	return (type == TPM_ALG_RSA) ? sizeof(UINT16) : 0;
+      case TPM_ALG_RSASSA:
+      case TPM_ALG_RSAPSS:
+      case TPM_ALG_OAEP:
+	return (type == TPM_ALG_RSA) ? 2 * sizeof(UINT16) : 0;
+      case TPM_ALG_ECDSA:
+      case TPM_ALG_ECDH:
+      case TPM_ALG_SM2:
+      case TPM_ALG_ECSCHNORR:
+	return (type == TPM_ALG_ECC) ? 2 * sizeof(UINT16) : 0;
+      default:
+	return 0;
+    }
+}
+
+static BYTE *marshalScheme(BYTE *buffer, TPM_ALG_ID scheme, const TPMU_ASYM_SCHEME *details)
+{
+    buffer = PEMTPM_Marshal_Uint16(buffer, scheme);
+    if ((scheme != TPM_ALG_NULL) && (scheme != TPM_ALG_RSAES)) {
+	buffer = PEMTPM_Marshal_Uint16(buffer, details->anySig.hashAlg);
+    }
+    return buffer;
+}
+
+/* getTPM2BSize() returns the marshaled size of a TPM2B, or 0 if its size exceeds its buffer */
+
+static UINT32 getTPM2BSize(const TPM2B *source, size_t bufferSize)
+{
+    if (source->size > bufferSize) {
+	return 0;
+    }
+    return sizeof(UINT16) + source->size;
+}
+
+/* getPublicAreaSize() covers RSA and ECC keys with the symmetric algorithms and schemes above, and
+   an ECC kdf of TPM_ALG_NULL */
+
+static UINT32 getPublicAreaSize(const TPMT_PUBLIC *publicArea)
+{
+    UINT32	areaSize;
+    UINT32	symSize;
+    UINT32	schemeSize;
+    UINT32	policySize;
+    UINT32	uniqueSize;
+
+    /* type, nameAlg, objectAttributes */
+    areaSize = 2 * sizeof(UINT16) + sizeof(UINT32);
+    policySize = getTPM2BSize(&publicArea->authPolicy.b,
+			      sizeof(publicArea->authPolicy.t.buffer));
+    if (publicArea->type == TPM_ALG_RSA) {
+	const TPMS_RSA_PARMS *rsaDetail = &publicArea->parameters.rsaDetail;
+
+	symSize = getSymDefSize(&rsaDetail->symmetric);
+	schemeSize = getSchemeSize(TPM_ALG_RSA, rsaDetail->scheme.scheme);
+	uniqueSize = getTPM2BSize(&publicArea->unique.rsa.b,
+				  sizeof(publicArea->unique.rsa.t.buffer));
+	/* keyBits, exponent */
+	areaSize += sizeof(UINT16) + sizeof(UINT32);
+    }
+    else if (publicArea->type == TPM_ALG_ECC) {
+	const TPMS_ECC_PARMS *eccDetail = &publicArea->parameters.eccDetail;
+	UINT32 uniqueSizeY = getTPM2BSize(&publicArea->unique.ecc.y.b,
+					  sizeof(publicArea->unique.ecc.y.t.buffer));
+
+	symSize = getSymDefSize(&eccDetail->symmetric);
+	schemeSize = getSchemeSize(TPM_ALG_ECC, eccDetail->scheme.scheme);
+	uniqueSize = getTPM2BSize(&publicArea->unique.ecc.x.b,
+				  sizeof(publicArea->unique.ecc.x.t.buffer));
+	if ((eccDetail->kdf.scheme != TPM_ALG_NULL) || (uniqueSizeY == 0)) {
+	    return 0;
+	}
+	uniqueSize += uniqueSizeY;
+	/* curveID, kdf scheme */
+	areaSize += 2 * sizeof(UINT16);
+    }
+    else {
+	return 0;
+    }
+    if ((policySize == 0) || (symSize == 0) || (schemeSize == 0) || (uniqueSize == 0)) {
+	return 0;
+    }
+    return areaSize + policySize + symSize + schemeSize + uniqueSize;
+}
+
+static BYTE *marshalPublicArea(BYTE *buffer, const TPMT_PUBLIC *publicArea)
+{
+    buffer = PEMTPM_Marshal_Uint16(buffer, publicArea->type);
+    buffer = PEMTPM_Marshal_Uint16(buffer, publicArea->nameAlg);
+    buffer = PEMTPM_Marshal_Uint32(buffer, publicArea->objectAttributes.val);
+    buffer = PEMTPM_Marshal_TPM2B(buffer, &publicArea->authPolicy.b);
+    if (publicArea->type == TPM_ALG_RSA) {
+	const TPMS_RSA_PARMS *rsaDetail = &publicArea->parameters.rsaDetail;
+
+	buffer = marshalSymDef(buffer, &rsaDetail->symmetric);
+	buffer = marshalScheme(buffer, rsaDetail->scheme.scheme, &rsaDetail->scheme.details);
+	buffer = PEMTPM_Marshal_Uint16(buffer, rsaDetail->keyBits);
+	buffer = PEMTPM_Marshal_Uint32(buffer, rsaDetail->exponent);
+	buffer = PEMTPM_Marshal_TPM2B(buffer, &publicArea->unique.rsa.b);
+    }
+    else {
+	const TPMS_ECC_PARMS *eccDetail = &publicArea->parameters.eccDetail;
+
+	buffer = marshalSymDef(buffer, &eccDetail->symmetric);
+	buffer = marshalScheme(buffer, eccDetail->scheme.scheme, &eccDetail->scheme.details);
+	buffer = PEMTPM_Marshal_Uint16(buffer, eccDetail->curveID);
+	buffer = PEMTPM_Marshal_Uint16(buffer, eccDetail->kdf.scheme);
+	buffer = PEMTPM_Marshal_TPM2B(buffer, &publicArea->unique.ecc.x.b);
+	buffer = PEMTPM_Marshal_TPM2B(buffer, &publicArea->unique.ecc.y.b);
+    }
+    return buffer;
+}
+
+/* getSensitiveSize() covers RSA and ECC sensitive areas */
+
+static UINT32 getSensitiveSize(const TPMT_SENSITIVE *source)
+{
+    UINT32	authSize;
+    UINT32	seedSize;
+    UINT32	sensitiveSize;
+
+    authSize = getTPM2BSize(&source->authValue.b, sizeof(source->authValue.t.buffer));
+    seedSize = getTPM2BSize(&source->seedValue.b, sizeof(source->seedValue.t.buffer));
+    if (source->sensitiveType == TPM_ALG_RSA) {
+	sensitiveSize = getTPM2BSize(&source->sensitive.rsa.b,
+				     sizeof(source->sensitive.rsa.t.buffer));
+    }
+    else if (source->sensitiveType == TPM_ALG_ECC) {
+	sensitiveSize = getTPM2BSize(&source->sensitive.ecc.b,
+				     sizeof(source->sensitive.ecc.t.buffer));
+    }
+    else {
+	return 0;
+    }
+    if ((authSize == 0) || (seedSize == 0) || (sensitiveSize == 0)) {
+	return 0;
+    }
+    return sizeof(UINT16) + authSize + seedSize + sensitiveSize;
+}
+
+/* checkBuffer() returns TRUE if 'marshalSize' bytes fit the caller's buffer */
+
+static int checkBuffer(UINT32 marshalSize, BYTE **buffer, INT32 *size)
+{
+    return (marshalSize != 0) && (buffer != NULL) &&
+	((size == NULL) || ((*size >= 0) && ((UINT32)*size >= marshalSize)));
+}
+
+/* advance() returns the marshaled size to the caller, as the TSS functions do */
+
+static void advance(UINT32 marshalSize, UINT16 *written, BYTE **buffer, INT32 *size)
+{
+    *written += marshalSize;
+    *buffer += marshalSize;
+    if (size != NULL) {
+	*size -= marshalSize;
+    }
+    return;
+}
+
+/* PEMTPM_Marshal_TPM2B_PUBLIC() is TSS_TPM2B_PUBLIC_Marshal() for a presized buffer */
+
+TPM_RC PEMTPM_Marshal_TPM2B_PUBLIC(const TPM2B_PUBLIC 		*source,
+				   UINT16 			*written,
+				   BYTE 			**buffer,
+				   INT32 			*size)
+{
+    UINT32	areaSize = getPublicAreaSize(&source->publicArea);
+    UINT32	marshalSize = sizeof(UINT16) + areaSize;
+
+    if ((areaSize == 0) || !checkBuffer(marshalSize, buffer, size)) {
+	return TSS_TPM2B_PUBLIC_Marshal(source, written, buffer, size);
+    }
+    marshalPublicArea(PEMTPM_Marshal_Uint16(*buffer, areaSize), &source->publicArea);
+    advance(marshalSize, written, buffer, size);
+    return 0;
+}
+
+/* PEMTPM_Marshal_TPMT_SENSITIVE() is TSS_TPMT_SENSITIVE_Marshal() for a presized buffer */
+
+TPM_RC PEMTPM_Marshal_TPMT_SENSITIVE(const TPMT_SENSITIVE 	*source,
+				     UINT16 			*written,
+				     BYTE 			**buffer,
+				     INT32 			*size)
+{
+    UINT32	marshalSize = getSensitiveSize(source);
+    BYTE	*next;
+
+    if (!checkBuffer(marshalSize, buffer, size)) {
+	return TSS_TPMT_SENSITIVE_Marshal(source, written, buffer, size);
+    }
+    next = PEMTPM_Marshal_Uint16(*buffer, source->sensitiveType);
+    next = PEMTPM_Marshal_TPM2B(next, &source->authValue.b);
+    next = PEMTPM_Marshal_TPM2B(next, &source->seedValue.b);
+    /* the RSA and ECC members are both TPM2B */
+    PEMTPM_Marshal_TPM2B(next, (source->sensitiveType == TPM_ALG_RSA) ?
+			 &source->sensitive.rsa.b : &source->sensitive.ecc.b);
+    advance(marshalSize, written, buffer, size);
+    return 0;
+}
+
+/* PEMTPM_Marshal_TPM2B_PRIVATE() is TSS_TPM2B_PRIVATE_Marshal() for a presized buffer */
+
+TPM_RC PEMTPM_Marshal_TPM2B_PRIVATE(const TPM2B_PRIVATE 	*source,
+				    UINT16 			*written,
+				    BYTE 			**buffer,
+				    INT32 			*size)
+{
+    UINT32	marshalSize = getTPM2BSize(&source->b, sizeof(source->t.buffer));
+
+    if (!checkBuffer(marshalSize, buffer, size)) {
+	return TSS_TPM2B_PRIVATE_Marshal(source, written, buffer, size);
+    }
+    PEMTPM_Marshal_TPM2B(*buffer, &source->b);
+    advance(marshalSize, written, buffer, size);
+    return 0;
+}
@@ -0,0 +1,93 @@
+/********************************************************************************/
+/*										*/
+/*		     Presized Structure Marshaling				*/
+/*										*/
+/********************************************************************************/
+
+/* This is a private header for libpemtpm.
+
+   The TSS_*_Marshal() functions check the remaining buffer size before every field, and reach each
+   field through several levels of calls.  The PEMTPM_Marshal_*() structure functions have the
+   same signature and produce the same bytes.  They compute the marshaled size of the structure
+   first, check it once against the buffer, and then store every field with the unchecked
+   primitives below.
+
+   A structure that the fast path does not cover, a TPM2B whose size exceeds its buffer, a NULL
+   buffer or a buffer that is too small is passed to the checked TSS_*_Marshal(), so the result and
+   the error are always those of the checked API.  Callers that marshal untrusted structures or
+   need the field by field checks keep using the TSS functions.
+*/
+
+#ifndef PEMTPMMARSHAL_H
+#define PEMTPMMARSHAL_H
+
+#include <string.h>
+
+#ifndef TPM_TSS
+#define TPM_TSS
+#endif
+#include <tss2/TPM_Types.h>
+
+/* The unchecked primitives store 'source' big endian at 'buffer' and return the buffer after it.
+   The caller has already checked that the buffer is large enough. */
+
+static inline BYTE *PEMTPM_Marshal_Uint8(BYTE *buffer, UINT8 source)
+{
+    buffer[0] = source;
+    return buffer + sizeof(UINT8);
+}
+
+static inline BYTE *PEMTPM_Marshal_Uint16(BYTE *buffer, UINT16 source)
+{
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+    source = __builtin_bswap16(source);
+    memcpy(buffer, &source, sizeof(UINT16));
+#elif defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    memcpy(buffer, &source, sizeof(UINT16));
+#else
+    buffer[0] = (BYTE)(source >> 8);
+    buffer[1] = (BYTE)(source >> 0);
+#endif
+    return buffer + sizeof(UINT16);
+}
+
+static inline BYTE *PEMTPM_Marshal_Uint32(BYTE *buffer, UINT32 source)
+{
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+    source = __builtin_bswap32(source);
+    memcpy(buffer, &source, sizeof(UINT32));
+#elif defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    memcpy(buffer, &source, sizeof(UINT32));
+#else
+    buffer[0] = (BYTE)(source >> 24);
+    buffer[1] = (BYTE)(source >> 16);
+    buffer[2] = (BYTE)(source >>  8);
+    buffer[3] = (BYTE)(source >>  0);
+#endif
+    return buffer + sizeof(UINT32);
+}
+
+/* PEMTPM_Marshal_TPM2B() stores the size and the bytes of a TPM2B.  The caller has already
+   checked the size against both the TPM2B buffer and the output buffer. */
+
+static inline BYTE *PEMTPM_Marshal_TPM2B(BYTE *buffer, const TPM2B *source)
+{
+    buffer = PEMTPM_Marshal_Uint16(buffer, source->size);
+    memcpy(buffer, source->buffer, source->size);
+    return buffer + source->size;
+}
+
+TPM_RC PEMTPM_Marshal_TPM2B_PUBLIC(const TPM2B_PUBLIC 		*source,
+				   UINT16 			*written,
+				   BYTE 			**buffer,
+				   INT32 			*size);
+TPM_RC PEMTPM_Marshal_TPMT_SENSITIVE(const TPMT_SENSITIVE 	*source,
+				     UINT16 			*written,
+				     BYTE 			**buffer,
+				     INT32 			*size);
+TPM_RC PEMTPM_Marshal_TPM2B_PRIVATE(const TPM2B_PRIVATE 	*source,
+				    UINT16 			*written,
+				    BYTE 			**buffer,
+				    INT32 			*size);
+
+#endif
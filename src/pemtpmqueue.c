@@ -0,0 +1,125 @@
+/********************************************************************************/
+/*										*/
+/*		     Bounded Work Queue for the Batch Pipeline			*/
+/*										*/
+/********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <tss2/tssutils.h>
+#include <tss2/tsserror.h>
+
+#include "pemtpmqueue.h"
+
+extern int tssVerbose;
+
+/* PEMTPM_Queue_Init() initializes an empty queue that holds up to 'capacity' items.  The queue must
+   be freed with PEMTPM_Queue_Delete().
+*/
+
+TPM_RC PEMTPM_Queue_Init(PEMTPM_QUEUE *queue,
+			 size_t capacity)
+{
+    TPM_RC 	rc = 0;
+
+    queue->items = NULL;
+    queue->capacity = capacity;
+    queue->head = 0;
+    queue->count = 0;
+    queue->closed = FALSE;
+    if (rc == 0) {
+	if (capacity == 0) {
+	    if (tssVerbose) printf("PEMTPM_Queue_Init: Error, capacity is zero\n");
+	    rc = TSS_RC_MALLOC_SIZE;
+	}
+    }
+    if (rc == 0) {
+	rc = TSS_ArrayMalloc((unsigned char **)&queue->items, capacity, sizeof(void *));
+    }
+    if (rc == 0) {
+	pthread_mutex_init(&queue->lock, NULL);
+	pthread_cond_init(&queue->notEmpty, NULL);
+	pthread_cond_init(&queue->notFull, NULL);
+    }
+    return rc;
+}
+
+void PEMTPM_Queue_Delete(PEMTPM_QUEUE *queue)
+{
+    if (queue->items != NULL) {
+	pthread_cond_destroy(&queue->notFull);
+	pthread_cond_destroy(&queue->notEmpty);
+	pthread_mutex_destroy(&queue->lock);
+	free(queue->items);
+	queue->items = NULL;
+    }
+    return;
+}
+
+/* PEMTPM_Queue_Put() appends 'item', waiting while the queue is full.  The queue must not be
+   closed.
+*/
+
+void PEMTPM_Queue_Put(PEMTPM_QUEUE *queue,
+		      void *item)
+{
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == queue->capacity) {
+	pthread_cond_wait(&queue->notFull, &queue->lock);
+    }
+    queue->items[(queue->head + queue->count) % queue->capacity] = item;
+    queue->count++;
+    pthread_cond_signal(&queue->notEmpty);
+    pthread_mutex_unlock(&queue->lock);
+    return;
+}
+
+/* PEMTPM_Queue_Get() removes the oldest item, waiting while the queue is empty.
+
+   Returns NULL once the queue is closed and drained.
+*/
+
+void *PEMTPM_Queue_Get(PEMTPM_QUEUE *queue)
+{
+    void 	*item = NULL;
+
+    pthread_mutex_lock(&queue->lock);
+    while ((queue->count == 0) && !queue->closed) {
+	pthread_cond_wait(&queue->notEmpty, &queue->lock);
+    }
+    if (queue->count != 0) {
+	item = queue->items[queue->head];
+	queue->head = (queue->head + 1) % queue->capacity;
+	queue->count--;
+	pthread_cond_signal(&queue->notFull);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return item;
+}
+
+/* PEMTPM_Queue_Empty() returns TRUE if a get would wait, or return NULL once the queue is closed */
+
+int PEMTPM_Queue_Empty(PEMTPM_QUEUE *queue)
+{
+    int		empty;
+
+    pthread_mutex_lock(&queue->lock);
+    empty = (queue->count == 0);
+    pthread_mutex_unlock(&queue->lock);
+    return empty;
+}
+
+/* PEMTPM_Queue_Close() marks the end of input.  Waiting consumers return NULL once the remaining
+   items are drained.
+*/
+
+void PEMTPM_Queue_Close(PEMTPM_QUEUE *queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    queue->closed = TRUE;
+    pthread_cond_broadcast(&queue->notEmpty);
+    pthread_mutex_unlock(&queue->lock);
+    return;
+}
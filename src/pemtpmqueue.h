@@ -0,0 +1,42 @@
+/********************************************************************************/
+/*										*/
+/*		     Bounded Work Queue for the Batch Pipeline			*/
+/*										*/
+/********************************************************************************/
+
+/* This is a private header for the pemtpm batch pipeline.
+
+   A PEMTPM_QUEUE is a fixed capacity FIFO of pointers shared between threads.  PEMTPM_Queue_Put()
+   blocks while the queue is full and PEMTPM_Queue_Get() blocks while it is empty, so a slow stage
+   throttles the stages feeding it.
+*/
+
+#ifndef PEMTPMQUEUE_H
+#define PEMTPMQUEUE_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+#include <tss2/TPM_Types.h>
+
+typedef struct PEMTPM_QUEUE {
+    void		**items;	/* ring buffer of 'capacity' entries */
+    size_t		capacity;
+    size_t		head;		/* next entry to get */
+    size_t		count;		/* entries in the queue */
+    int			closed;		/* no more puts */
+    pthread_mutex_t	lock;
+    pthread_cond_t	notEmpty;
+    pthread_cond_t	notFull;
+} PEMTPM_QUEUE;
+
+TPM_RC PEMTPM_Queue_Init(PEMTPM_QUEUE *queue,
+			 size_t capacity);
+void PEMTPM_Queue_Delete(PEMTPM_QUEUE *queue);
+void PEMTPM_Queue_Put(PEMTPM_QUEUE *queue,
+		      void *item);
+void *PEMTPM_Queue_Get(PEMTPM_QUEUE *queue);
+int PEMTPM_Queue_Empty(PEMTPM_QUEUE *queue);
+void PEMTPM_Queue_Close(PEMTPM_QUEUE *queue);
+
+#endif
@@ -0,0 +1,179 @@
+/********************************************************************************/
+/*										*/
+/*			Conversion Statistics for -stats			*/
+/*										*/
+/********************************************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "pemtpmstats.h"
+
+int pemtpmStats = 0;
+
+static uint64_t statCounters[PEMTPM_STAT_COUNTERS];
+
+static const char *statCounterNames[PEMTPM_STAT_COUNTERS] = {
+    "keys_converted",
+    "keys_failed",
+    "keys_up_to_date",
+    "files_read",
+    "bytes_read",
+    "files_written",
+    "bytes_written",
+    "malloc_calls",
+    "malloc_bytes",
+    "realloc_calls",
+    "realloc_bytes",
+    "cache_hits",
+    "cache_misses",
+    "cache_evictions"
+};
+
+/* stage timers, protected by statLock.  A stage runs for at least microseconds, so a lock per
+   stage per key is negligible. */
+
+typedef struct {
+    uint64_t	count;
+    uint64_t	total;		/* nanoseconds */
+    uint64_t	max;
+} STAT_TIMER;
+
+static STAT_TIMER statTimers[PEMTPM_STAGES];
+static pthread_mutex_t statLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* the batch writer, "io_uring" or "thread", NULL without a batch */
+
+static const char *statWriter = NULL;
+
+const char *pemtpmStageNames[PEMTPM_STAGES] = {
+    "read",
+    "convert",
+    "marshal",
+    "write"
+};
+
+/* PEMTPM_Stats_Count() adds 'value' to 'counter'.  Counters are updated from the worker threads,
+   including every TSS_Malloc(), so they are atomic rather than locked. */
+
+void PEMTPM_Stats_Count(int counter, uint64_t value)
+{
+    __atomic_fetch_add(&statCounters[counter], value, __ATOMIC_RELAXED);
+    return;
+}
+
+/* PEMTPM_Stats_Now() returns a monotonic time stamp in nanoseconds */
+
+uint64_t PEMTPM_Stats_Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* PEMTPM_Stats_Time() records one run of 'stage' that took 'nanoseconds' */
+
+void PEMTPM_Stats_Time(int stage, uint64_t nanoseconds)
+{
+    pthread_mutex_lock(&statLock);
+    statTimers[stage].count++;
+    statTimers[stage].total += nanoseconds;
+    if (nanoseconds > statTimers[stage].max) {
+	statTimers[stage].max = nanoseconds;
+    }
+    pthread_mutex_unlock(&statLock);
+    return;
+}
+
+/* PEMTPM_Stats_Writer() records the method of the batch writer, a static string */
+
+void PEMTPM_Stats_Writer(const char *method)
+{
+    statWriter = method;
+    return;
+}
+
+/* PEMTPM_Stats_PrintJsonString() prints 'string' as a quoted JSON string */
+
+void PEMTPM_Stats_PrintJsonString(FILE *file, const char *string)
+{
+    const unsigned char *p;
+
+    fputc('"', file);
+    for (p = (const unsigned char *)string ; *p != '\0' ; p++) {
+	if ((*p == '"') || (*p == '\\')) {
+	    fprintf(file, "\\%c", *p);
+	}
+	else if (*p < 0x20) {
+	    fprintf(file, "\\u%04x", *p);
+	}
+	else {
+	    fputc(*p, file);
+	}
+    }
+    fputc('"', file);
+    return;
+}
+
+/* PEMTPM_Stats_Print() prints the counters and stage timers, either as one JSON line or as one
+   line per item.  'elapsed' is the run time in nanoseconds. */
+
+void PEMTPM_Stats_Print(FILE *file, int json, uint64_t elapsed)
+{
+    STAT_TIMER 	timers[PEMTPM_STAGES];
+    uint64_t	keys;
+    int		i;
+
+    pthread_mutex_lock(&statLock);
+    for (i = 0 ; i < PEMTPM_STAGES ; i++) {
+	timers[i] = statTimers[i];
+    }
+    pthread_mutex_unlock(&statLock);
+    keys = __atomic_load_n(&statCounters[PEMTPM_STAT_KEYS_CONVERTED], __ATOMIC_RELAXED);
+
+    flockfile(file);
+    if (json) {
+	fprintf(file, "{\"summary\": {\"elapsed_us\": %.1f, \"keys_per_sec\": %.1f",
+		elapsed / 1e3, (elapsed != 0) ? keys / (elapsed / 1e9) : 0.0);
+	for (i = 0 ; i < PEMTPM_STAT_COUNTERS ; i++) {
+	    fprintf(file, ", \"%s\": %llu", statCounterNames[i],
+		    (unsigned long long)__atomic_load_n(&statCounters[i], __ATOMIC_RELAXED));
+	}
+	if (statWriter != NULL) {
+	    fprintf(file, ", \"writer\": \"%s\"", statWriter);
+	}
+	fprintf(file, ", \"stages\": {");
+	for (i = 0 ; i < PEMTPM_STAGES ; i++) {
+	    fprintf(file, "%s\"%s\": {\"count\": %llu, \"total_us\": %.1f, \"mean_us\": %.1f, "
+		    "\"max_us\": %.1f}",
+		    (i == 0) ? "" : ", ", pemtpmStageNames[i],
+		    (unsigned long long)timers[i].count,
+		    timers[i].total / 1e3,
+		    (timers[i].count != 0) ? (timers[i].total / 1e3) / timers[i].count : 0.0,
+		    timers[i].max / 1e3);
+	}
+	fprintf(file, "}}}\n");
+    }
+    else {
+	fprintf(file, "pemtpm: stats elapsed %.1f us, %.1f keys/sec\n",
+		elapsed / 1e3, (elapsed != 0) ? keys / (elapsed / 1e9) : 0.0);
+	for (i = 0 ; i < PEMTPM_STAT_COUNTERS ; i++) {
+	    fprintf(file, "pemtpm: stats %s %llu\n", statCounterNames[i],
+		    (unsigned long long)__atomic_load_n(&statCounters[i], __ATOMIC_RELAXED));
+	}
+	if (statWriter != NULL) {
+	    fprintf(file, "pemtpm: stats writer %s\n", statWriter);
+	}
+	for (i = 0 ; i < PEMTPM_STAGES ; i++) {
+	    fprintf(file, "pemtpm: stats stage %s count %llu total %.1f us max %.1f us\n",
+		    pemtpmStageNames[i],
+		    (unsigned long long)timers[i].count,
+		    timers[i].total / 1e3,
+		    timers[i].max / 1e3);
+	}
+    }
+    funlockfile(file);
+    return;
+}
@@ -0,0 +1,69 @@
+/********************************************************************************/
+/*										*/
+/*			Conversion Statistics for -stats			*/
+/*										*/
+/********************************************************************************/
+
+/* This is a private header for pemtpm instrumentation.
+
+   Counters and stage timers are process wide and thread safe.  Nothing is counted unless
+   pemtpmStats is nonzero, which -stats sets before any thread starts, so the disabled cost is one
+   test of a global.
+*/
+
+#ifndef PEMTPMSTATS_H
+#define PEMTPMSTATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* counters */
+
+enum {
+    PEMTPM_STAT_KEYS_CONVERTED,
+    PEMTPM_STAT_KEYS_FAILED,
+    PEMTPM_STAT_KEYS_UP_TO_DATE,
+    PEMTPM_STAT_FILES_READ,
+    PEMTPM_STAT_BYTES_READ,
+    PEMTPM_STAT_FILES_WRITTEN,
+    PEMTPM_STAT_BYTES_WRITTEN,
+    PEMTPM_STAT_MALLOC_CALLS,
+    PEMTPM_STAT_MALLOC_BYTES,
+    PEMTPM_STAT_REALLOC_CALLS,
+    PEMTPM_STAT_REALLOC_BYTES,
+    PEMTPM_STAT_CACHE_HITS,
+    PEMTPM_STAT_CACHE_MISSES,
+    PEMTPM_STAT_CACHE_EVICTIONS,
+    PEMTPM_STAT_COUNTERS
+};
+
+/* timed stages, in batch pipeline order */
+
+enum {
+    PEMTPM_STAGE_READ,
+    PEMTPM_STAGE_CONVERT,
+    PEMTPM_STAGE_MARSHAL,
+    PEMTPM_STAGE_WRITE,
+    PEMTPM_STAGES
+};
+
+extern int pemtpmStats;
+extern const char *pemtpmStageNames[PEMTPM_STAGES];
+
+void PEMTPM_Stats_Count(int counter, uint64_t value);
+uint64_t PEMTPM_Stats_Now(void);
+void PEMTPM_Stats_Time(int stage, uint64_t nanoseconds);
+void PEMTPM_Stats_Writer(const char *method);
+void PEMTPM_Stats_PrintJsonString(FILE *file, const char *string);
+void PEMTPM_Stats_Print(FILE *file, int json, uint64_t elapsed);
+
+/* PEMTPM_STATS_COUNT() is PEMTPM_Stats_Count() without the call when -stats is off */
+
+#define PEMTPM_STATS_COUNT(counter, value)		\
+    do {						\
+	if (pemtpmStats) {				\
+	    PEMTPM_Stats_Count((counter), (value));	\
+	}						\
+    } while (0)
+
+#endif
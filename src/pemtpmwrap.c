@@ -0,0 +1,785 @@
+/********************************************************************************/
+/*										*/
+/*		  Duplication Inner and Outer Wrappers for TPM2_Import		*/
+/*										*/
+/********************************************************************************/
+
+/* The outer wrapper protects a duplicate for one parent, as TPM 2.0 Part 1, 23.3 describes.
+
+   A random seed is encrypted to the parent, with RSA-OAEP or with ECDH and KDFe, and becomes the
+   TPM2_Import inSymSeed.  The seed derives, with KDFa and the parent nameAlg, an AES key that
+   encrypts the TPM2B_SENSITIVE ("STORAGE") and an HMAC key that binds it to the object Name
+   ("INTEGRITY").
+
+   duplicate = TPM2B_DIGEST(outerHMAC) || AES-CFB(TPM2B_SENSITIVE)
+   outerHMAC = HMAC(HMACkey, encSensitive || Name)
+
+   The optional inner wrapper, applied first, uses a symmetric key that TPM2_Import receives as
+   encryptionKey, and an integrity digest with the object nameAlg:
+
+   encSensitive = AES-CFB(encryptionKey, TPM2B_DIGEST(innerIntegrity) || TPM2B_SENSITIVE)
+   innerIntegrity = H(TPM2B_SENSITIVE || Name)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <tss2/tss.h>
+#include <tss2/tssutils.h>
+#include <tss2/tssmarshal.h>
+#include <tss2/pemtpm.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <openssl/rsa.h>
+#include <openssl/ec.h>
+#include <openssl/ecdh.h>
+#include <openssl/obj_mac.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000
+#include <openssl/core_names.h>
+#include <openssl/param_build.h>
+#endif
+
+#include "pemtpmcrypto.h"
+#include "pemtpmlibcrypto.h"
+
+/* the OAEP label and KDFe label for the seed, Part 1, Annex B.10.3 and C.6.1 */
+#define DUPLICATE_LABEL		"DUPLICATE"
+
+struct PEMTPM_CIPHER {
+    EVP_CIPHER_CTX 	*ctx;
+};
+
+struct PEMTPM_PARENT {
+    TPMT_PUBLIC		publicArea;
+    const EVP_MD 	*md;		/* parent nameAlg */
+    uint32_t		symKeyBits;	/* parent AES key size */
+    EVP_PKEY 		*evpPkey;	/* RSA or EC public key */
+    int			curveNid;	/* ECC only */
+    const char		*curveName;
+    int			curveBytes;
+};
+
+/* getParentCurve() maps the parent TPM curve to the OpenSSL curve */
+
+static TPM_RC getParentCurve(PEMTPM_PARENT *parent)
+{
+    TPM_RC 	rc = 0;
+
+    switch (parent->publicArea.parameters.eccDetail.curveID) {
+#if ECC_NIST_P256
+      case TPM_ECC_NIST_P256:
+	parent->curveNid = NID_X9_62_prime256v1;
+	parent->curveName = SN_X9_62_prime256v1;
+	parent->curveBytes = 32;
+	break;
+#endif
+#if ECC_NIST_P384
+      case TPM_ECC_NIST_P384:
+	parent->curveNid = NID_secp384r1;
+	parent->curveName = SN_secp384r1;
+	parent->curveBytes = 48;
+	break;
+#endif
+      default:
+	if (tssVerbose) printf("getParentCurve: Error, unsupported curve %04x\n",
+			       parent->publicArea.parameters.eccDetail.curveID);
+	rc = TPM_RC_CURVE;
+    }
+    return rc;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000
+
+/* createPublicKey() creates the public 'evpPkey' of 'keyType', "RSA" or "EC", from the parameters
+   in 'bld', and checks it.  'errorRc' is returned on failure. */
+
+static TPM_RC createPublicKey(EVP_PKEY 		**evpPkey,
+			      const char 	*keyType,
+			      OSSL_PARAM_BLD 	*bld,
+			      TPM_RC 		errorRc)
+{
+    TPM_RC 		rc = 0;
+    OSSL_PARAM 		*params = NULL;		/* freed @1 */
+    EVP_PKEY_CTX 	*ctx = NULL;		/* freed @2 */
+    EVP_PKEY_CTX 	*checkCtx = NULL;	/* freed @3 */
+
+    if (rc == 0) {
+	params = OSSL_PARAM_BLD_to_param(bld);
+	ctx = EVP_PKEY_CTX_new_from_name(NULL, keyType, NULL);
+	if ((params == NULL) || (ctx == NULL)) {
+	    rc = TSS_RC_OUT_OF_MEMORY;
+	}
+    }
+    if (rc == 0) {
+	if ((EVP_PKEY_fromdata_init(ctx) != 1) ||
+	    (EVP_PKEY_fromdata(ctx, evpPkey, EVP_PKEY_PUBLIC_KEY, params) != 1)) {
+	    if (tssVerbose) printf("createPublicKey: Error creating the %s key\n", keyType);
+	    rc = errorRc;
+	}
+    }
+    /* for EC, also checks that the point is on the curve */
+    if (rc == 0) {
+	checkCtx = EVP_PKEY_CTX_new_from_pkey(NULL, *evpPkey, NULL);
+	if ((checkCtx == NULL) || (EVP_PKEY_public_check(checkCtx) != 1)) {
+	    if (tssVerbose) printf("createPublicKey: Error, invalid %s public key\n", keyType);
+	    rc = errorRc;
+	}
+    }
+    OSSL_PARAM_free(params);		/* @1 */
+    EVP_PKEY_CTX_free(ctx);		/* @2 */
+    EVP_PKEY_CTX_free(checkCtx);	/* @3 */
+    return rc;
+}
+
+/* convertParentToRsaKey() converts the parent RSA public area to an EVP_PKEY */
+
+static TPM_RC convertParentToRsaKey(PEMTPM_PARENT *parent)
+{
+    TPM_RC 		rc = 0;
+    OSSL_PARAM_BLD 	*bld = NULL;		/* freed @1 */
+    BIGNUM 		*n = NULL;		/* freed @2 */
+    BIGNUM 		*e = NULL;		/* freed @3 */
+    UINT32 		exponent = parent->publicArea.parameters.rsaDetail.exponent;
+
+    if (rc == 0) {
+	bld = OSSL_PARAM_BLD_new();
+	n = BN_bin2bn(parent->publicArea.unique.rsa.t.buffer,
+		      parent->publicArea.unique.rsa.t.size, NULL);
+	e = BN_new();
+	if ((bld == NULL) || (n == NULL) || (e == NULL) ||
+	    (BN_set_word(e, (exponent == 0) ? RSA_F4 : exponent) != 1) ||
+	    (OSSL_PARAM_BLD_push_BN(bld, OSSL_PKEY_PARAM_RSA_N, n) != 1) ||
+	    (OSSL_PARAM_BLD_push_BN(bld, OSSL_PKEY_PARAM_RSA_E, e) != 1)) {
+	    if (tssVerbose) printf("convertParentToRsaKey: Error creating the RSA key\n");
+	    rc = TSS_RC_RSA_KEY_CONVERT;
+	}
+    }
+    if (rc == 0) {
+	rc = createPublicKey(&parent->evpPkey, "RSA", bld, TSS_RC_RSA_KEY_CONVERT);
+    }
+    OSSL_PARAM_BLD_free(bld);	/* @1 */
+    BN_free(n);			/* @2 */
+    BN_free(e);			/* @3 */
+    return rc;
+}
+
+/* convertParentToEcKey() converts the parent ECC public area to an EVP_PKEY */
+
+static TPM_RC convertParentToEcKey(PEMTPM_PARENT *parent)
+{
+    TPM_RC 		rc = 0;
+    OSSL_PARAM_BLD 	*bld = NULL;		/* freed @1 */
+    const TPMS_ECC_POINT *point = &parent->publicArea.unique.ecc;
+    uint8_t		pointBin[1 + 2 * MAX_ECC_KEY_BYTES];	/* uncompressed */
+
+    if (rc == 0) {
+	rc = getParentCurve(parent);
+    }
+    if (rc == 0) {
+	if ((point->x.t.size > parent->curveBytes) || (point->y.t.size > parent->curveBytes)) {
+	    if (tssVerbose) printf("convertParentToEcKey: Error, invalid public point\n");
+	    rc = TSS_RC_EC_KEY_CONVERT;
+	}
+    }
+    if (rc == 0) {
+	memset(pointBin, 0, sizeof(pointBin));
+	pointBin[0] = POINT_CONVERSION_UNCOMPRESSED;
+	memcpy(pointBin + 1 + (parent->curveBytes - point->x.t.size),
+	       point->x.t.buffer, point->x.t.size);
+	memcpy(pointBin + 1 + parent->curveBytes + (parent->curveBytes - point->y.t.size),
+	       point->y.t.buffer, point->y.t.size);
+	bld = OSSL_PARAM_BLD_new();
+	if ((bld == NULL) ||
+	    (OSSL_PARAM_BLD_push_utf8_string(bld, OSSL_PKEY_PARAM_GROUP_NAME,
+					     parent->curveName, 0) != 1) ||
+	    (OSSL_PARAM_BLD_push_octet_string(bld, OSSL_PKEY_PARAM_PUB_KEY,
+					      pointBin, 1 + 2 * parent->curveBytes) != 1)) {
+	    if (tssVerbose) printf("convertParentToEcKey: Error creating the EC key\n");
+	    rc = TSS_RC_EC_KEY_CONVERT;
+	}
+    }
+    if (rc == 0) {
+	rc = createPublicKey(&parent->evpPkey, "EC", bld, TSS_RC_EC_KEY_CONVERT);
+    }
+    OSSL_PARAM_BLD_free(bld);	/* @1 */
+    return rc;
+}
+
+#else
+
+/* convertParentToRsaKey() converts the parent RSA public area to an EVP_PKEY */
+
+static TPM_RC convertParentToRsaKey(PEMTPM_PARENT *parent)
+{
+    TPM_RC 	rc = 0;
+    RSA 	*rsaKey = NULL;		/* freed @1 */
+    BIGNUM 	*n = NULL;
+    BIGNUM 	*e = NULL;
+    UINT32 	exponent = parent->publicArea.parameters.rsaDetail.exponent;
+
+    if (rc == 0) {
+	parent->evpPkey = EVP_PKEY_new();
+	rsaKey = RSA_new();
+	n = BN_bin2bn(parent->publicArea.unique.rsa.t.buffer,
+		      parent->publicArea.unique.rsa.t.size, NULL);
+	e = BN_new();
+	if ((parent->evpPkey == NULL) || (rsaKey == NULL) || (n == NULL) || (e == NULL) ||
+	    (BN_set_word(e, (exponent == 0) ? RSA_F4 : exponent) != 1)) {
+	    if (tssVerbose) printf("convertParentToRsaKey: Error creating the RSA key\n");
+	    rc = TSS_RC_RSA_KEY_CONVERT;
+	}
+    }
+    if (rc == 0) {
+#if OPENSSL_VERSION_NUMBER < 0x10100000
+	rsaKey->n = n;
+	rsaKey->e = e;
+#else
+	RSA_set0_key(rsaKey, n, e, NULL);
+#endif
+	n = NULL;		/* owned by rsaKey */
+	e = NULL;
+	if (EVP_PKEY_set1_RSA(parent->evpPkey, rsaKey) != 1) {
+	    if (tssVerbose) printf("convertParentToRsaKey: EVP_PKEY_set1_RSA failed\n");
+	    rc = TSS_RC_RSA_KEY_CONVERT;
+	}
+    }
+    BN_free(n);
+    BN_free(e);
+    if (rsaKey != NULL) {
+	RSA_free(rsaKey);	/* @1 */
+    }
+    return rc;
+}
+
+/* convertParentToEcKey() converts the parent ECC public area to an EVP_PKEY */
+
+static TPM_RC convertParentToEcKey(PEMTPM_PARENT *parent)
+{
+    TPM_RC 	rc = 0;
+    EC_KEY 	*ecKey = NULL;		/* freed @1 */
+    BIGNUM 	*x = NULL;		/* freed @2 */
+    BIGNUM 	*y = NULL;		/* freed @3 */
+
+    if (rc == 0) {
+	rc = getParentCurve(parent);
+    }
+    if (rc == 0) {
+	parent->evpPkey = EVP_PKEY_new();
+	ecKey = EC_KEY_new_by_curve_name(parent->curveNid);
+	x = BN_bin2bn(parent->publicArea.unique.ecc.x.t.buffer,
+		      parent->publicArea.unique.ecc.x.t.size, NULL);
+	y = BN_bin2bn(parent->publicArea.unique.ecc.y.t.buffer,
+		      parent->publicArea.unique.ecc.y.t.size, NULL);
+	if ((parent->evpPkey == NULL) || (ecKey == NULL) || (x == NULL) || (y == NULL)) {
+	    if (tssVerbose) printf("convertParentToEcKey: Error creating the EC key\n");
+	    rc = TSS_RC_EC_KEY_CONVERT;
+	}
+    }
+    /* also checks that the point is on the curve */
+    if (rc == 0) {
+	if (EC_KEY_set_public_key_affine_coordinates(ecKey, x, y) != 1) {
+	    if (tssVerbose) printf("convertParentToEcKey: Error, invalid public point\n");
+	    rc = TSS_RC_EC_KEY_CONVERT;
+	}
+    }
+    if (rc == 0) {
+	if (EVP_PKEY_set1_EC_KEY(parent->evpPkey, ecKey) != 1) {
+	    if (tssVerbose) printf("convertParentToEcKey: EVP_PKEY_set1_EC_KEY failed\n");
+	    rc = TSS_RC_EC_KEY_CONVERT;
+	}
+    }
+    if (ecKey != NULL) {
+	EC_KEY_free(ecKey);	/* @1 */
+    }
+    BN_free(x);			/* @2 */
+    BN_free(y);			/* @3 */
+    return rc;
+}
+
+#endif
+
+/* PEMTPM_Parent_Create() unmarshals and validates the TPM2B_PUBLIC of a parent in 'publicBuffer',
+   for example as written by TPM2_ReadPublic, and prepares it for PEMTPM_WrapDuplicate().
+
+   The parent must be a restricted decryption key with an AES-CFB symmetric algorithm.  A parent is
+   read only after it is created, so one parent can be shared by any number of keys and threads.
+   It is freed with PEMTPM_Parent_Delete().
+*/
+
+TPM_RC PEMTPM_Parent_Create(PEMTPM_PARENT 	**parent,
+			    const uint8_t 	*publicBuffer,
+			    uint32_t 		publicBufferSize)
+{
+    TPM_RC		rc = 0;
+    TPM2B_PUBLIC	parentPublic;
+    TPMT_PUBLIC		*publicArea = &parentPublic.publicArea;
+    BYTE		*buffer = (BYTE *)publicBuffer;
+    INT32		size = publicBufferSize;
+
+    if (rc == 0) {
+	*parent = NULL;
+	if ((publicBuffer == NULL) || (publicBufferSize > INT32_MAX)) {
+	    rc = TSS_RC_NULL_PARAMETER;
+	}
+    }
+    if (rc == 0) {
+	rc = PEMTPM_Libcrypto_Load();
+    }
+    if (rc == 0) {
+	rc = TSS_TPM2B_PUBLIC_Unmarshal(&parentPublic, &buffer, &size);
+    }
+    if ((rc == 0) && (size != 0)) {
+	if (tssVerbose) printf("PEMTPM_Parent_Create: Error, %d bytes after the public\n", size);
+	rc = TSS_RC_MALFORMED_PUBLIC;
+    }
+    if (rc == 0) {
+	if (((publicArea->type != TPM_ALG_RSA) && (publicArea->type != TPM_ALG_ECC)) ||
+	    ((publicArea->objectAttributes.val & TPMA_OBJECT_RESTRICTED) == 0) ||
+	    ((publicArea->objectAttributes.val & TPMA_OBJECT_DECRYPT) == 0) ||
+	    ((publicArea->objectAttributes.val & TPMA_OBJECT_SIGN) != 0)) {
+	    if (tssVerbose) printf("PEMTPM_Parent_Create: Error, not a storage key\n");
+	    rc = TSS_RC_BAD_SALT_KEY;
+	}
+    }
+    if (rc == 0) {
+	if ((publicArea->parameters.asymDetail.symmetric.algorithm != TPM_ALG_AES) ||
+	    (publicArea->parameters.asymDetail.symmetric.mode.aes != TPM_ALG_CFB)) {
+	    if (tssVerbose) printf("PEMTPM_Parent_Create: Error, parent symmetric is not AES-CFB\n");
+	    rc = TSS_RC_BAD_ENCRYPT_ALGORITHM;
+	}
+    }
+    if (rc == 0) {
+	rc = TSS_Malloc((unsigned char **)parent, sizeof(PEMTPM_PARENT));
+    }
+    if (rc == 0) {
+	memset(*parent, 0, sizeof(PEMTPM_PARENT));
+	(*parent)->publicArea = *publicArea;
+	(*parent)->symKeyBits = publicArea->parameters.asymDetail.symmetric.keyBits.aes;
+	rc = PEMTPM_Crypto_GetDigest(&(*parent)->md, publicArea->nameAlg);
+    }
+    if (rc == 0) {
+	if (publicArea->type == TPM_ALG_RSA) {
+	    rc = convertParentToRsaKey(*parent);
+	}
+	else {
+	    rc = convertParentToEcKey(*parent);
+	}
+    }
+    if ((rc != 0) && (*parent != NULL)) {
+	PEMTPM_Parent_Delete(*parent);
+	*parent = NULL;
+    }
+    return rc;
+}
+
+/* PEMTPM_Parent_Delete() frees a parent from PEMTPM_Parent_Create() */
+
+void PEMTPM_Parent_Delete(PEMTPM_PARENT *parent)
+{
+    if (parent != NULL) {
+	if (parent->evpPkey != NULL) {
+	    EVP_PKEY_free(parent->evpPkey);
+	}
+	free(parent);
+    }
+    return;
+}
+
+/* createRsaSeed() creates a random 'seed' and encrypts it to the RSA parent with OAEP, the parent
+   nameAlg and the label "DUPLICATE" */
+
+static TPM_RC createRsaSeed(uint8_t 			*seed,
+			    size_t 			seedSize,
+			    TPM2B_ENCRYPTED_SECRET 	*inSymSeed,
+			    const PEMTPM_PARENT 	*parent)
+{
+    TPM_RC 		rc = 0;
+    EVP_PKEY_CTX 	*ctx = NULL;		/* freed @1 */
+    unsigned char 	*label = NULL;
+    size_t		outLength = sizeof(inSymSeed->t.secret);
+
+    if (rc == 0) {
+	if (RAND_bytes(seed, (int)seedSize) != 1) {
+	    if (tssVerbose) printf("createRsaSeed: RAND_bytes failed\n");
+	    rc = TSS_RC_RNG_FAILURE;
+	}
+    }
+    if (rc == 0) {
+	ctx = EVP_PKEY_CTX_new(parent->evpPkey, NULL);
+	label = OPENSSL_malloc(sizeof(DUPLICATE_LABEL));	/* freed by ctx */
+	if ((ctx == NULL) || (label == NULL)) {
+	    rc = TSS_RC_OUT_OF_MEMORY;
+	}
+    }
+    if (rc == 0) {
+	memcpy(label, DUPLICATE_LABEL, sizeof(DUPLICATE_LABEL));
+	if ((EVP_PKEY_encrypt_init(ctx) != 1) ||
+	    (EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_PKCS1_OAEP_PADDING) != 1) ||
+	    (EVP_PKEY_CTX_set_rsa_oaep_md(ctx, parent->md) != 1) ||
+	    (EVP_PKEY_CTX_set_rsa_mgf1_md(ctx, parent->md) != 1) ||
+	    (EVP_PKEY_CTX_set0_rsa_oaep_label(ctx, label, sizeof(DUPLICATE_LABEL)) != 1)) {
+	    if (tssVerbose) printf("createRsaSeed: Error setting up OAEP\n");
+	    rc = TSS_RC_RSA_PADDING;
+	}
+	else {
+	    label = NULL;	/* owned by ctx */
+	}
+    }
+    if (rc == 0) {
+	if (EVP_PKEY_encrypt(ctx, inSymSeed->t.secret, &outLength, seed, seedSize) != 1) {
+	    if (tssVerbose) printf("createRsaSeed: EVP_PKEY_encrypt failed\n");
+	    rc = TSS_RC_RSA_ENCRYPT;
+	}
+	else {
+	    inSymSeed->t.size = (uint16_t)outLength;
+	}
+    }
+    OPENSSL_free(label);
+    if (ctx != NULL) {
+	EVP_PKEY_CTX_free(ctx);		/* @1 */
+    }
+    return rc;
+}
+
+/* createEccSeed() derives 'seed' from an ephemeral ECDH with the ECC parent.  inSymSeed is the
+   ephemeral public point.
+
+   seed = KDFe(nameAlg, Z, "DUPLICATE", ephemeral x, parent x)
+*/
+
+static TPM_RC createEccSeed(uint8_t 			*seed,
+			    size_t 			seedSize,
+			    TPM2B_ENCRYPTED_SECRET 	*inSymSeed,
+			    const PEMTPM_PARENT 	*parent)
+{
+    TPM_RC 		rc = 0;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000
+    EVP_PKEY_CTX 	*keygenCtx = NULL;	/* freed @1 */
+    EVP_PKEY 		*ephemeralKey = NULL;	/* freed @2 */
+    EVP_PKEY_CTX 	*deriveCtx = NULL;	/* freed @5 */
+    size_t		zSize;
+#else
+    EC_KEY 		*parentKey = NULL;	/* freed @1 */
+    EC_KEY 		*ephemeralKey = NULL;	/* freed @2 */
+#endif
+    BIGNUM 		*x = NULL;		/* freed @3 */
+    BIGNUM 		*y = NULL;		/* freed @4 */
+    TPMS_ECC_POINT 	ephemeralPoint;
+    uint8_t		z[MAX_ECC_KEY_BYTES];
+    int			bnBytes;
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000
+    if (rc == 0) {
+	keygenCtx = EVP_PKEY_CTX_new_from_name(NULL, "EC", NULL);
+	if (keygenCtx == NULL) {
+	    rc = TSS_RC_OUT_OF_MEMORY;
+	}
+    }
+    if (rc == 0) {
+	if ((EVP_PKEY_keygen_init(keygenCtx) != 1) ||
+	    (EVP_PKEY_CTX_set_group_name(keygenCtx, parent->curveName) != 1) ||
+	    (EVP_PKEY_keygen(keygenCtx, &ephemeralKey) != 1) ||
+	    (EVP_PKEY_get_bn_param(ephemeralKey, OSSL_PKEY_PARAM_EC_PUB_X, &x) != 1) ||
+	    (EVP_PKEY_get_bn_param(ephemeralKey, OSSL_PKEY_PARAM_EC_PUB_Y, &y) != 1)) {
+	    if (tssVerbose) printf("createEccSeed: Error creating the ephemeral key\n");
+	    rc = TSS_RC_EC_EPHEMERAL_FAILURE;
+	}
+    }
+    /* Z is the x coordinate of the shared point, the full coordinate size.  The parent point was
+       checked when the parent was created. */
+    if (rc == 0) {
+	deriveCtx = EVP_PKEY_CTX_new_from_pkey(NULL, ephemeralKey, NULL);
+	zSize = sizeof(z);
+	if ((deriveCtx == NULL) ||
+	    (EVP_PKEY_derive_init(deriveCtx) != 1) ||
+	    (EVP_PKEY_derive_set_peer_ex(deriveCtx, parent->evpPkey, 0) != 1) ||
+	    (EVP_PKEY_derive(deriveCtx, z, &zSize) != 1) ||
+	    (zSize != (size_t)parent->curveBytes)) {
+	    if (tssVerbose) printf("createEccSeed: EVP_PKEY_derive failed\n");
+	    rc = TSS_RC_EC_EPHEMERAL_FAILURE;
+	}
+    }
+#else
+    if (rc == 0) {
+	parentKey = EVP_PKEY_get1_EC_KEY(parent->evpPkey);
+	ephemeralKey = EC_KEY_new_by_curve_name(parent->curveNid);
+	x = BN_new();
+	y = BN_new();
+	if ((parentKey == NULL) || (ephemeralKey == NULL) || (x == NULL) || (y == NULL)) {
+	    rc = TSS_RC_OUT_OF_MEMORY;
+	}
+    }
+    if (rc == 0) {
+	if ((EC_KEY_generate_key(ephemeralKey) != 1) ||
+	    (EC_POINT_get_affine_coordinates_GFp(EC_KEY_get0_group(ephemeralKey),
+						 EC_KEY_get0_public_key(ephemeralKey),
+						 x, y, NULL) != 1)) {
+	    if (tssVerbose) printf("createEccSeed: Error creating the ephemeral key\n");
+	    rc = TSS_RC_EC_EPHEMERAL_FAILURE;
+	}
+    }
+    /* Z is the x coordinate of the shared point, the full coordinate size */
+    if (rc == 0) {
+	if (ECDH_compute_key(z, parent->curveBytes,
+			     EC_KEY_get0_public_key(parentKey), ephemeralKey,
+			     NULL) != parent->curveBytes) {
+	    if (tssVerbose) printf("createEccSeed: ECDH_compute_key failed\n");
+	    rc = TSS_RC_EC_EPHEMERAL_FAILURE;
+	}
+    }
+#endif
+    if (rc == 0) {
+	bnBytes = BN_num_bytes(x);
+	ephemeralPoint.x.t.size = parent->curveBytes;
+	memset(ephemeralPoint.x.t.buffer, 0, parent->curveBytes - bnBytes);
+	BN_bn2bin(x, ephemeralPoint.x.t.buffer + (parent->curveBytes - bnBytes));
+	bnBytes = BN_num_bytes(y);
+	ephemeralPoint.y.t.size = parent->curveBytes;
+	memset(ephemeralPoint.y.t.buffer, 0, parent->curveBytes - bnBytes);
+	BN_bn2bin(y, ephemeralPoint.y.t.buffer + (parent->curveBytes - bnBytes));
+	rc = PEMTPM_Crypto_KDFe(seed, parent->md,
+				z, parent->curveBytes,
+				DUPLICATE_LABEL,
+				ephemeralPoint.x.t.buffer, ephemeralPoint.x.t.size,
+				parent->publicArea.unique.ecc.x.t.buffer,
+				parent->publicArea.unique.ecc.x.t.size,
+				seedSize * 8);
+    }
+    if (rc == 0) {
+	uint8_t *buffer = inSymSeed->t.secret;
+	INT32 size = sizeof(inSymSeed->t.secret);
+	inSymSeed->t.size = 0;
+	rc = TSS_TPMS_ECC_POINT_Marshal(&ephemeralPoint, &inSymSeed->t.size, &buffer, &size);
+    }
+    memset(z, 0, sizeof(z));
+#if OPENSSL_VERSION_NUMBER >= 0x30000000
+    EVP_PKEY_CTX_free(keygenCtx);	/* @1 */
+    EVP_PKEY_free(ephemeralKey);	/* @2 */
+    EVP_PKEY_CTX_free(deriveCtx);	/* @5 */
+#else
+    if (parentKey != NULL) {
+	EC_KEY_free(parentKey);		/* @1 */
+    }
+    if (ephemeralKey != NULL) {
+	EC_KEY_free(ephemeralKey);	/* @2 */
+    }
+#endif
+    BN_free(x);				/* @3 */
+    BN_free(y);				/* @4 */
+    return rc;
+}
+
+/* PEMTPM_WrapDuplicate() applies the outer wrapper for 'parent' to 'duplicate' in place.
+
+   On input 'duplicate' is the unwrapped TPM2B_PRIVATE from PEMTPM_ConvertPemToKeyPair(), a
+   marshaled TPM2B_SENSITIVE.  On output it is the protected duplicate, and 'inSymSeed' is the
+   encrypted seed.  'name' is the object Name, from PEMTPM_MarshalPublic().
+
+   TPM2_Import then takes the two with a symmetricAlg of TPM_ALG_NULL.  A new seed is created for
+   every call.
+*/
+
+TPM_RC PEMTPM_WrapDuplicate(TPM2B_PRIVATE 		*duplicate,
+			    TPM2B_ENCRYPTED_SECRET 	*inSymSeed,
+			    const PEMTPM_PARENT 	*parent,
+			    const TPM2B_NAME 		*name)
+{
+    TPM_RC		rc = 0;
+    uint8_t		seed[EVP_MAX_MD_SIZE];
+    uint8_t		symKey[32];
+    uint8_t		hmacKey[EVP_MAX_MD_SIZE];
+    size_t		digestSize = 0;
+    size_t		sensitiveSize = 0;
+    TPM2B_PRIVATE	wrapped;
+    uint8_t		*encSensitive = NULL;
+    uint8_t		hmacData[sizeof(duplicate->t.buffer) + sizeof(name->t.name)];
+    unsigned int	hmacSize;
+
+    if (rc == 0) {
+	if ((duplicate == NULL) || (inSymSeed == NULL) || (parent == NULL) || (name == NULL)) {
+	    rc = TSS_RC_NULL_PARAMETER;
+	}
+    }
+    if (rc == 0) {
+	digestSize = EVP_MD_size(parent->md);
+	sensitiveSize = duplicate->t.size;
+	if ((parent->symKeyBits > sizeof(symKey) * 8) ||
+	    (sizeof(uint16_t) + digestSize + sensitiveSize > sizeof(wrapped.t.buffer))) {
+	    if (tssVerbose) printf("PEMTPM_WrapDuplicate: Error, duplicate too large\n");
+	    rc = TSS_RC_INSUFFICIENT_BUFFER;
+	}
+    }
+    if (rc == 0) {
+	if (parent->publicArea.type == TPM_ALG_RSA) {
+	    rc = createRsaSeed(seed, digestSize, inSymSeed, parent);
+	}
+	else {
+	    rc = createEccSeed(seed, digestSize, inSymSeed, parent);
+	}
+    }
+    if (rc == 0) {
+	rc = PEMTPM_Crypto_KDFa(symKey, parent->md, seed, digestSize, "STORAGE",
+				name->t.name, name->t.size, NULL, 0,
+				parent->symKeyBits);
+    }
+    if (rc == 0) {
+	rc = PEMTPM_Crypto_KDFa(hmacKey, parent->md, seed, digestSize, "INTEGRITY",
+				NULL, 0, NULL, 0,
+				digestSize * 8);
+    }
+    /* encrypt the TPM2B_SENSITIVE in place, after the room for the HMAC */
+    if (rc == 0) {
+	encSensitive = wrapped.t.buffer + sizeof(uint16_t) + digestSize;
+	memcpy(encSensitive, duplicate->t.buffer, sensitiveSize);
+	rc = PEMTPM_Crypto_AesCfbEncrypt(NULL, encSensitive, sensitiveSize,
+					 symKey, parent->symKeyBits);
+    }
+    if (rc == 0) {
+	memcpy(hmacData, encSensitive, sensitiveSize);
+	memcpy(hmacData + sensitiveSize, name->t.name, name->t.size);
+	if (HMAC(parent->md, hmacKey, (int)digestSize, hmacData, sensitiveSize + name->t.size,
+		 wrapped.t.buffer + sizeof(uint16_t), &hmacSize) == NULL) {
+	    if (tssVerbose) printf("PEMTPM_WrapDuplicate: HMAC failed\n");
+	    rc = TSS_RC_HMAC;
+	}
+    }
+    if (rc == 0) {
+	wrapped.t.buffer[0] = (uint8_t)(digestSize >> 8);
+	wrapped.t.buffer[1] = (uint8_t)(digestSize >> 0);
+	wrapped.t.size = sizeof(uint16_t) + digestSize + sensitiveSize;
+	memcpy(duplicate, &wrapped, sizeof(uint16_t) + wrapped.t.size);
+    }
+    memset(seed, 0, sizeof(seed));
+    memset(symKey, 0, sizeof(symKey));
+    memset(hmacKey, 0, sizeof(hmacKey));
+    /* a failure may leave the plaintext sensitive in wrapped */
+    if (rc != 0) {
+	memset(&wrapped, 0, sizeof(wrapped));
+    }
+    return rc;
+}
+
+/* PEMTPM_Cipher_Create() creates a cipher context for PEMTPM_WrapInner().  A context may be reused
+   for any number of keys, but by one thread at a time.  It is freed with PEMTPM_Cipher_Delete().
+*/
+
+TPM_RC PEMTPM_Cipher_Create(PEMTPM_CIPHER **cipher)
+{
+    TPM_RC	rc = 0;
+
+    if (rc == 0) {
+	*cipher = NULL;
+	rc = PEMTPM_Libcrypto_Load();
+    }
+    if (rc == 0) {
+	rc = TSS_Malloc((unsigned char **)cipher, sizeof(PEMTPM_CIPHER));
+    }
+    if (rc == 0) {
+	(*cipher)->ctx = EVP_CIPHER_CTX_new();
+	if ((*cipher)->ctx == NULL) {
+	    free(*cipher);
+	    *cipher = NULL;
+	    rc = TSS_RC_OUT_OF_MEMORY;
+	}
+    }
+    return rc;
+}
+
+/* PEMTPM_Cipher_Delete() frees a cipher context from PEMTPM_Cipher_Create() */
+
+void PEMTPM_Cipher_Delete(PEMTPM_CIPHER *cipher)
+{
+    if (cipher != NULL) {
+	EVP_CIPHER_CTX_free(cipher->ctx);
+	free(cipher);
+    }
+    return;
+}
+
+/* PEMTPM_WrapInner() applies the inner wrapper to 'duplicate' in place, with the AES-CFB
+   'encryptionKey' of 16, 24 or 32 bytes.
+
+   On input 'duplicate' is the unwrapped TPM2B_PRIVATE from PEMTPM_ConvertPemToKeyPair().  'name'
+   is the object Name, from PEMTPM_MarshalPublic(), and its algorithm is the integrity hash.
+   'cipher' is a context from PEMTPM_Cipher_Create(), or NULL.
+
+   The result can be passed to PEMTPM_WrapDuplicate() for the outer wrapper.  TPM2_Import then
+   takes 'encryptionKey' and a symmetricAlg of AES, the key size in bits, and CFB.
+*/
+
+TPM_RC PEMTPM_WrapInner(TPM2B_PRIVATE 		*duplicate,
+			const TPM2B_DATA 	*encryptionKey,
+			const TPM2B_NAME 	*name,
+			PEMTPM_CIPHER 		*cipher)
+{
+    TPM_RC		rc = 0;
+    TPMI_ALG_HASH	nameAlg;
+    const EVP_MD 	*md = NULL;
+    size_t		digestSize = 0;
+    size_t		sensitiveSize = 0;
+    TPM2B_PRIVATE	wrapped;
+    EVP_MD_CTX		*mdCtx = NULL;		/* freed @1 */
+    unsigned int	length;
+
+    if (rc == 0) {
+	if ((duplicate == NULL) || (encryptionKey == NULL) || (name == NULL)) {
+	    rc = TSS_RC_NULL_PARAMETER;
+	}
+    }
+    if (rc == 0) {
+	if (name->t.size < sizeof(TPMI_ALG_HASH)) {
+	    rc = TSS_RC_MALFORMED_PUBLIC;
+	}
+    }
+    if (rc == 0) {
+	nameAlg = (TPMI_ALG_HASH)((name->t.name[0] << 8) | name->t.name[1]);
+	rc = PEMTPM_Crypto_GetDigest(&md, nameAlg);
+    }
+    if (rc == 0) {
+	digestSize = EVP_MD_size(md);
+	sensitiveSize = duplicate->t.size;
+	if (sizeof(uint16_t) + digestSize + sensitiveSize > sizeof(wrapped.t.buffer)) {
+	    if (tssVerbose) printf("PEMTPM_WrapInner: Error, duplicate too large\n");
+	    rc = TSS_RC_INSUFFICIENT_BUFFER;
+	}
+    }
+    if (rc == 0) {
+	mdCtx = EVP_MD_CTX_create();
+	if (mdCtx == NULL) {
+	    rc = TSS_RC_OUT_OF_MEMORY;
+	}
+    }
+    /* innerIntegrity = H(TPM2B_SENSITIVE || Name), written ahead of the sensitive */
+    if (rc == 0) {
+	if ((EVP_DigestInit_ex(mdCtx, md, NULL) != 1) ||
+	    (EVP_DigestUpdate(mdCtx, duplicate->t.buffer, sensitiveSize) != 1) ||
+	    (EVP_DigestUpdate(mdCtx, name->t.name, name->t.size) != 1) ||
+	    (EVP_DigestFinal_ex(mdCtx, wrapped.t.buffer + sizeof(uint16_t), &length) != 1)) {
+	    if (tssVerbose) printf("PEMTPM_WrapInner: Digest failed\n");
+	    rc = TSS_RC_HASH;
+	}
+    }
+    if (rc == 0) {
+	wrapped.t.buffer[0] = (uint8_t)(digestSize >> 8);
+	wrapped.t.buffer[1] = (uint8_t)(digestSize >> 0);
+	memcpy(wrapped.t.buffer + sizeof(uint16_t) + digestSize, duplicate->t.buffer, sensitiveSize);
+	wrapped.t.size = sizeof(uint16_t) + digestSize + sensitiveSize;
+	rc = PEMTPM_Crypto_AesCfbEncrypt((cipher != NULL) ? cipher->ctx : NULL,
+					 wrapped.t.buffer, wrapped.t.size,
+					 encryptionKey->t.buffer, encryptionKey->t.size * 8);
+    }
+    if (rc == 0) {
+	memcpy(duplicate, &wrapped, sizeof(uint16_t) + wrapped.t.size);
+    }
+    /* a failure may leave the plaintext sensitive in wrapped */
+    if (rc != 0) {
+	memset(&wrapped, 0, sizeof(wrapped));
+    }
+    if (mdCtx != NULL) {
+	EVP_MD_CTX_destroy(mdCtx);	/* @1 */
+    }
+    return rc;
+}
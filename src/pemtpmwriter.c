@@ -0,0 +1,1132 @@
+/********************************************************************************/
+/*										*/
+/*		     Asynchronous File Writer for the Batch Pipeline		*/
+/*										*/
+/********************************************************************************/
+
+/* for syncfs() */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include <tss2/tssutils.h>
+#include <tss2/tsserror.h>
+#include <tss2/tssfile.h>
+
+#include "pemtpmstats.h"
+#include "pemtpmwriter.h"
+
+/* The io_uring writer is built with the kernel header only, since liburing is not needed for the
+   four operations it uses.  Opening to a fixed file needs Linux 5.15.  IORING_FEAT_CQE_SKIP, from
+   5.17, is the first feature flag after it, and is used to test for it. */
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#ifdef IORING_FEAT_CQE_SKIP
+#define PEMTPM_WRITER_URING
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+extern int tssVerbose;
+
+/* the io_uring operations of one file, in the low bits of the user data */
+enum {
+    WRITER_OP_OPEN,
+    WRITER_OP_WRITE,
+    WRITER_OP_CLOSE,
+    WRITER_OP_RENAME,
+    WRITER_OPS
+};
+
+/* open, write and close, in flight together for each file */
+#define WRITER_FILE_OPS		3
+
+/* the ring sizes, from IORING_MAX_ENTRIES down to one full group */
+#define WRITER_RING_ENTRIES_MAX	32768
+#define WRITER_RING_ENTRIES_MIN	(PEMTPM_WRITER_FILES_MAX * WRITER_FILE_OPS)
+
+/* submit once this many groups are queued, rather than waiting for a flush */
+#define WRITER_SUBMIT_BATCH	8
+
+/* the output directories tracked for syncfs(), beyond which sync() is used */
+#define WRITER_DIRECTORIES_MAX	16
+
+/* a group moves through these states in order */
+enum {
+    WRITER_WRITING,		/* the files are being written */
+    WRITER_WRITTEN,		/* every file is written or has failed */
+    WRITER_COMMITTING,		/* taken by a commit, about to be renamed */
+    WRITER_RENAMING,		/* io_uring renames in flight */
+    WRITER_DONE
+};
+
+/* one submitted group of files */
+
+typedef struct {
+    void		*tag;
+    PEMTPM_WRITER_FILE	files[PEMTPM_WRITER_FILES_MAX];
+    size_t		count;
+    TPM_RC		fileRc[PEMTPM_WRITER_FILES_MAX];
+    unsigned int	remaining;	/* io_uring operations not yet completed */
+    uint32_t		fileSlot;	/* io_uring fixed files while writing */
+    int			state;		/* WRITER_WRITING is ended by the writer thread */
+} WRITER_GROUP;
+
+/* a directory that holds outputs, with 'syncKeys' */
+
+typedef struct {
+    char		*name;
+    size_t		length;
+    int			fd;
+    dev_t		dev;
+    int			dirty;		/* written since the last sync */
+} WRITER_DIRECTORY;
+
+#ifdef PEMTPM_WRITER_URING
+
+/* the mapped submission and completion rings */
+
+typedef struct {
+    int			fd;
+    void		*sqRing;
+    size_t		sqRingSize;
+    void		*cqRing;	/* may be sqRing */
+    size_t		cqRingSize;
+    struct io_uring_sqe	*sqes;
+    size_t		sqesSize;
+    unsigned int	*sqTail;
+    unsigned int	sqMask;
+    unsigned int	*sqArray;
+    unsigned int	*cqHead;
+    unsigned int	*cqTail;
+    unsigned int	cqMask;
+    struct io_uring_cqe	*cqes;
+    unsigned int	sqeTail;	/* prepared entries, published by a flush */
+    unsigned int	toSubmit;	/* published entries not yet submitted */
+    unsigned int	capacity;	/* operations that fit in both rings */
+    unsigned int	inFlight;	/* prepared operations not yet completed */
+    uint32_t		*freeSlots;	/* fixed file slots, PEMTPM_WRITER_FILES_MAX files each */
+    unsigned int	freeSlotCount;
+} WRITER_RING;
+
+#endif
+
+struct PEMTPM_WRITER {
+    WRITER_GROUP	*groups;	/* ring buffer of 'depth' groups */
+    size_t		depth;
+    unsigned long	head;		/* the oldest group not yet completed by the caller */
+    unsigned long	tail;		/* the next group to submit */
+    unsigned long	queued;		/* groups prepared but not yet submitted, io_uring */
+    size_t		syncKeys;	/* 0 to rename without syncing */
+    size_t		writtenCount;	/* groups in WRITER_WRITTEN */
+    WRITER_DIRECTORY	directories[WRITER_DIRECTORIES_MAX];
+    size_t		directoryCount;
+    int			syncAll;	/* too many directories, sync() every file system */
+    int			renamed;	/* renames since the last sync */
+    int			useRing;
+#ifdef PEMTPM_WRITER_URING
+    WRITER_RING		ring;
+    TPM_RC		ringRc;		/* io_uring_enter() failed, the ring is deleted */
+#endif
+    /* the writer thread, without io_uring */
+    pthread_t		thread;
+    int			threadStarted;
+    unsigned long	next;		/* the next group for the thread to write */
+    int			closing;
+    pthread_mutex_t	lock;
+    pthread_cond_t	submitted;
+    pthread_cond_t	completed;
+};
+
+#ifdef PEMTPM_WRITER_URING
+
+/* ringEnter() is the io_uring_enter system call, retried when interrupted */
+
+static int ringEnter(WRITER_RING *ring, unsigned int toSubmit, unsigned int minComplete)
+{
+    int		irc;
+
+    do {
+	irc = syscall(__NR_io_uring_enter, ring->fd, toSubmit, minComplete,
+		      (minComplete > 0) ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while ((irc < 0) && (errno == EINTR));
+    return irc;
+}
+
+/* ringDelete() unmaps the rings and closes the ring descriptor, which also closes any fixed file
+   still open */
+
+static void ringDelete(WRITER_RING *ring)
+{
+    if (ring->sqes != NULL) {
+	munmap(ring->sqes, ring->sqesSize);
+    }
+    if ((ring->cqRing != NULL) && (ring->cqRing != ring->sqRing)) {
+	munmap(ring->cqRing, ring->cqRingSize);
+    }
+    if (ring->sqRing != NULL) {
+	munmap(ring->sqRing, ring->sqRingSize);
+    }
+    if (ring->fd >= 0) {
+	close(ring->fd);
+    }
+    free(ring->freeSlots);
+    memset(ring, 0, sizeof(WRITER_RING));
+    ring->fd = -1;
+    return;
+}
+
+/* ringSupported() returns TRUE if the kernel supports every operation the writer uses */
+
+static int ringSupported(WRITER_RING *ring)
+{
+    static const uint8_t	ops[] = {IORING_OP_OPENAT, IORING_OP_WRITE, IORING_OP_CLOSE,
+					 IORING_OP_RENAMEAT};
+    struct io_uring_probe	*probe;
+    size_t			probeSize;
+    size_t			i;
+    int				supported;
+
+    probeSize = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    probe = calloc(1, probeSize);
+    if (probe == NULL) {
+	return FALSE;
+    }
+    supported = (syscall(__NR_io_uring_register, ring->fd,
+			 IORING_REGISTER_PROBE, probe, 256) >= 0);
+    for (i = 0 ; supported && (i < sizeof(ops)) ; i++) {
+	supported = (ops[i] <= probe->last_op) &&
+		    ((probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED) != 0);
+    }
+    free(probe);
+    return supported;
+}
+
+/* ringCreate() sets up a ring for up to 'entries' operations and registers empty fixed files for
+   up to 'slots' groups.  Both are clamped to what the kernel and RLIMIT_NOFILE allow, and the
+   groups being written share the slots.  Returns FALSE if io_uring is not available. */
+
+static int ringCreate(WRITER_RING *ring, size_t entries, size_t slots)
+{
+    struct io_uring_params	params;
+    struct rlimit		limit;
+    int				*fds = NULL;
+    size_t			i;
+    int				ok = TRUE;
+
+    memset(ring, 0, sizeof(WRITER_RING));
+    if (entries > WRITER_RING_ENTRIES_MAX) {
+	entries = WRITER_RING_ENTRIES_MAX;
+    }
+    /* smaller rings when the kernel is short of memory */
+    for ( ; ; entries /= 2) {
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CLAMP;
+	ring->fd = syscall(__NR_io_uring_setup, (unsigned int)entries, &params);
+	if ((ring->fd >= 0) || (errno != ENOMEM) || (entries / 2 < WRITER_RING_ENTRIES_MIN)) {
+	    break;
+	}
+    }
+    if (ring->fd < 0) {
+	if (tssVerbose) printf("PEMTPM_Writer_Create: io_uring not available, %s\n",
+			       strerror(errno));
+	ring->fd = -1;
+	ok = FALSE;
+    }
+    if (ok && ((params.features & IORING_FEAT_CQE_SKIP) == 0)) {
+	if (tssVerbose) printf("PEMTPM_Writer_Create: io_uring is too old\n");
+	ok = FALSE;
+    }
+    if (ok) {
+	ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+	    if (ring->cqRingSize > ring->sqRingSize) {
+		ring->sqRingSize = ring->cqRingSize;
+	    }
+	    ring->cqRingSize = ring->sqRingSize;
+	}
+	ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE,
+			    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sqRing == MAP_FAILED) {
+	    ring->sqRing = NULL;
+	    ok = FALSE;
+	}
+    }
+    if (ok) {
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+	    ring->cqRing = ring->sqRing;
+	}
+	else {
+	    ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+	    if (ring->cqRing == MAP_FAILED) {
+		ring->cqRing = NULL;
+		ok = FALSE;
+	    }
+	}
+    }
+    if (ok) {
+	ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+	    ring->sqes = NULL;
+	    ok = FALSE;
+	}
+    }
+    if (ok) {
+	ring->sqTail = (unsigned int *)((uint8_t *)ring->sqRing + params.sq_off.tail);
+	ring->sqMask = *(unsigned int *)((uint8_t *)ring->sqRing + params.sq_off.ring_mask);
+	ring->sqArray = (unsigned int *)((uint8_t *)ring->sqRing + params.sq_off.array);
+	ring->cqHead = (unsigned int *)((uint8_t *)ring->cqRing + params.cq_off.head);
+	ring->cqTail = (unsigned int *)((uint8_t *)ring->cqRing + params.cq_off.tail);
+	ring->cqMask = *(unsigned int *)((uint8_t *)ring->cqRing + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)((uint8_t *)ring->cqRing + params.cq_off.cqes);
+	ring->sqeTail = *ring->sqTail;
+	ring->capacity = (params.cq_entries < params.sq_entries) ?
+			 params.cq_entries : params.sq_entries;
+	ok = ringSupported(ring);
+	if (!ok && tssVerbose) printf("PEMTPM_Writer_Create: io_uring cannot open files\n");
+    }
+    /* no more groups are written at once than the ring holds, and a fixed file table may not
+       exceed RLIMIT_NOFILE */
+    if (ok) {
+	if (slots > ring->capacity / WRITER_RING_ENTRIES_MIN) {
+	    slots = ring->capacity / WRITER_RING_ENTRIES_MIN;
+	}
+	if ((getrlimit(RLIMIT_NOFILE, &limit) == 0) && (limit.rlim_cur != RLIM_INFINITY) &&
+	    (slots > limit.rlim_cur / PEMTPM_WRITER_FILES_MAX)) {
+	    slots = limit.rlim_cur / PEMTPM_WRITER_FILES_MAX;
+	}
+	ring->freeSlots = malloc(slots * sizeof(uint32_t));
+	fds = malloc(slots * PEMTPM_WRITER_FILES_MAX * sizeof(int));
+	ok = (slots > 0) && (ring->freeSlots != NULL) && (fds != NULL);
+    }
+    /* an empty fixed file table, which the opens fill, smaller if the kernel refuses it */
+    if (ok) {
+	for (i = 0 ; i < slots * PEMTPM_WRITER_FILES_MAX ; i++) {
+	    fds[i] = -1;
+	}
+	for ( ; slots > 0 ; slots /= 2) {
+	    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_FILES, fds,
+			(unsigned int)(slots * PEMTPM_WRITER_FILES_MAX)) == 0) {
+		break;
+	    }
+	}
+	if (slots == 0) {
+	    if (tssVerbose) printf("PEMTPM_Writer_Create: io_uring cannot register files, %s\n",
+				   strerror(errno));
+	    ok = FALSE;
+	}
+    }
+    free(fds);
+    if (ok) {
+	for (i = 0 ; i < slots ; i++) {
+	    ring->freeSlots[i] = i;
+	}
+	ring->freeSlotCount = slots;
+    }
+    if (!ok) {
+	ringDelete(ring);
+    }
+    return ok;
+}
+
+/* ringPrepare() returns the next submission queue entry, cleared, with the operation, flags and
+   user data */
+
+static struct io_uring_sqe *ringPrepare(WRITER_RING *ring, uint8_t opcode, uint8_t flags,
+					uint64_t userData)
+{
+    struct io_uring_sqe *sqe = &ring->sqes[ring->sqeTail & ring->sqMask];
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = opcode;
+    sqe->flags = flags;
+    sqe->user_data = userData;
+    ring->sqArray[ring->sqeTail & ring->sqMask] = ring->sqeTail & ring->sqMask;
+    ring->sqeTail++;
+    ring->inFlight++;
+    return sqe;
+}
+
+/* ringPrepared() returns TRUE if there are entries to submit */
+
+static int ringPrepared(const WRITER_RING *ring)
+{
+    return (ring->sqeTail != *ring->sqTail) || (ring->toSubmit > 0);
+}
+
+/* ringPrepareGroup() queues open, write and close for each file of the group, on a free fixed file
+   slot.  The write is hard linked to the close, so the file is closed even if the write fails.  If
+   the open fails, the write and close are cancelled.  The room must have been reserved with
+   ringReserve(). */
+
+static void ringPrepareGroup(PEMTPM_WRITER *writer, size_t slot)
+{
+    WRITER_GROUP	*group = &writer->groups[slot];
+    struct io_uring_sqe	*sqe;
+    const char		*filename;
+    size_t		f;
+    uint32_t		fileSlot;
+    uint64_t		userData;
+
+    group->fileSlot = writer->ring.freeSlots[--writer->ring.freeSlotCount];
+    for (f = 0 ; f < group->count ; f++) {
+	fileSlot = group->fileSlot * PEMTPM_WRITER_FILES_MAX + f;
+	userData = ((uint64_t)slot * PEMTPM_WRITER_FILES_MAX + f) * WRITER_OPS;
+	filename = (group->files[f].tempFilename != NULL) ?
+		   group->files[f].tempFilename : group->files[f].filename;
+	sqe = ringPrepare(&writer->ring, IORING_OP_OPENAT, IOSQE_IO_LINK,
+			  userData + WRITER_OP_OPEN);
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (uintptr_t)filename;
+	/* a fixed file is not a descriptor, so O_CLOEXEC does not apply */
+	sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC;
+	sqe->len = 0666;
+	sqe->file_index = fileSlot + 1;
+	sqe = ringPrepare(&writer->ring, IORING_OP_WRITE, IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK,
+			  userData + WRITER_OP_WRITE);
+	sqe->fd = fileSlot;
+	sqe->addr = (uintptr_t)group->files[f].data;
+	sqe->len = group->files[f].length;
+	sqe->off = 0;
+	sqe = ringPrepare(&writer->ring, IORING_OP_CLOSE, 0, userData + WRITER_OP_CLOSE);
+	sqe->file_index = fileSlot + 1;
+    }
+    group->remaining = group->count * WRITER_FILE_OPS;
+    return;
+}
+
+/* ringPrepareRename() queues the rename of one file of the group */
+
+static void ringPrepareRename(PEMTPM_WRITER *writer, size_t slot, size_t f)
+{
+    WRITER_GROUP	*group = &writer->groups[slot];
+    struct io_uring_sqe	*sqe;
+
+    sqe = ringPrepare(&writer->ring, IORING_OP_RENAMEAT, 0,
+		      ((uint64_t)slot * PEMTPM_WRITER_FILES_MAX + f) * WRITER_OPS +
+		      WRITER_OP_RENAME);
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uintptr_t)group->files[f].tempFilename;
+    sqe->len = AT_FDCWD;
+    sqe->addr2 = (uintptr_t)group->files[f].filename;
+    group->remaining++;
+    return;
+}
+
+/* ringComplete() records one completion against its file */
+
+static void ringComplete(PEMTPM_WRITER *writer, uint64_t userData, int32_t res)
+{
+    uint64_t		file = userData / WRITER_OPS;
+    WRITER_GROUP	*group = &writer->groups[file / PEMTPM_WRITER_FILES_MAX];
+    size_t		f = file % PEMTPM_WRITER_FILES_MAX;
+    const char		*filename = (group->files[f].tempFilename != NULL) ?
+					group->files[f].tempFilename : group->files[f].filename;
+
+    switch (userData % WRITER_OPS) {
+      case WRITER_OP_OPEN:
+	if (res < 0) {
+	    if (tssVerbose) printf("PEMTPM_Writer: Error opening %s, %s\n",
+				   filename, strerror(-res));
+	    group->fileRc[f] = TSS_RC_FILE_OPEN;
+	}
+	break;
+      case WRITER_OP_WRITE:
+	/* a write cancelled by a failed open is already reported */
+	if ((group->fileRc[f] == 0) && (res != -ECANCELED) &&
+	    ((res < 0) || ((size_t)res != group->files[f].length))) {
+	    if (tssVerbose) printf("PEMTPM_Writer: Error writing %s, %lu bytes, %s\n",
+				   filename, (unsigned long)group->files[f].length,
+				   (res < 0) ? strerror(-res) : "short write");
+	    group->fileRc[f] = TSS_RC_FILE_WRITE;
+	}
+	break;
+      case WRITER_OP_CLOSE:
+	if ((group->fileRc[f] == 0) && (res < 0)) {
+	    if (tssVerbose) printf("PEMTPM_Writer: Error closing %s, %s\n",
+				   filename, strerror(-res));
+	    group->fileRc[f] = TSS_RC_FILE_CLOSE;
+	}
+	if (group->fileRc[f] == 0) {
+	    PEMTPM_STATS_COUNT(PEMTPM_STAT_FILES_WRITTEN, 1);
+	    PEMTPM_STATS_COUNT(PEMTPM_STAT_BYTES_WRITTEN, group->files[f].length);
+	}
+	break;
+      case WRITER_OP_RENAME:
+	if (res < 0) {
+	    if (tssVerbose) printf("PEMTPM_Writer: Error renaming %s, %s\n",
+				   filename, strerror(-res));
+	    unlink(filename);
+	    group->fileRc[f] = TSS_RC_FILE_WRITE;
+	}
+	break;
+    }
+    writer->ring.inFlight--;
+    group->remaining--;
+    if (group->remaining == 0) {
+	if (group->state == WRITER_WRITING) {
+	    /* every file is closed, so its fixed file slot is free */
+	    writer->ring.freeSlots[writer->ring.freeSlotCount++] = group->fileSlot;
+	    group->state = WRITER_WRITTEN;
+	    writer->writtenCount++;
+	}
+	else {
+	    group->state = WRITER_DONE;
+	}
+    }
+    return;
+}
+
+/* ringReap() takes every completion from the completion queue */
+
+static void ringReap(PEMTPM_WRITER *writer)
+{
+    WRITER_RING		*ring = &writer->ring;
+    unsigned int	head = *ring->cqHead;
+    unsigned int	tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+
+    for ( ; head != tail ; head++) {
+	struct io_uring_cqe *cqe = &ring->cqes[head & ring->cqMask];
+	ringComplete(writer, cqe->user_data, cqe->res);
+    }
+    __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+    return;
+}
+
+/* ringFail() ends every group in the ring with an error after io_uring_enter() fails.  The ring is
+   deleted, which cancels the operations in flight, and the later groups fail as they are submitted.
+   A file that may have been renamed is reported as failed. */
+
+static void ringFail(PEMTPM_WRITER *writer)
+{
+    WRITER_GROUP	*group;
+    unsigned long	g;
+    size_t		f;
+
+    if (tssVerbose) printf("PEMTPM_Writer: Error, io_uring_enter failed, %s\n", strerror(errno));
+    writer->ringRc = TSS_RC_FILE_WRITE;
+    ringDelete(&writer->ring);
+    writer->queued = 0;
+    for (g = writer->head ; g != writer->tail ; g++) {
+	group = &writer->groups[g % writer->depth];
+	if ((group->state != WRITER_WRITING) && (group->state != WRITER_RENAMING)) {
+	    continue;
+	}
+	for (f = 0 ; f < group->count ; f++) {
+	    if (group->fileRc[f] == 0) {
+		group->fileRc[f] = writer->ringRc;
+	    }
+	    if ((group->state == WRITER_RENAMING) && (group->files[f].tempFilename != NULL)) {
+		unlink(group->files[f].tempFilename);
+	    }
+	}
+	group->remaining = 0;
+	if (group->state == WRITER_WRITING) {
+	    group->state = WRITER_WRITTEN;
+	    writer->writtenCount++;
+	}
+	else {
+	    group->state = WRITER_DONE;
+	}
+    }
+    return;
+}
+
+/* ringSubmit() publishes the prepared entries and submits them, waiting for 'minComplete'
+   completions.  ringReserve() keeps the operations in flight within the rings, so the kernel takes
+   all the entries unless it is short of memory, in which case the writer waits for completions
+   and tries again.  An interrupted call is retried by ringEnter().  Any other error fails the
+   groups through ringFail(). */
+
+static void ringSubmit(PEMTPM_WRITER *writer, unsigned int minComplete)
+{
+    WRITER_RING		*ring = &writer->ring;
+    int			irc;
+
+    if (writer->ringRc != 0) {
+	return;
+    }
+    ring->toSubmit += ring->sqeTail - *ring->sqTail;
+    __atomic_store_n(ring->sqTail, ring->sqeTail, __ATOMIC_RELEASE);
+    writer->queued = 0;
+    do {
+	irc = ringEnter(ring, ring->toSubmit, minComplete);
+	if (irc >= 0) {
+	    ring->toSubmit -= irc;
+	}
+	else if ((errno == EAGAIN) || (errno == EBUSY)) {
+	    irc = ringEnter(ring, 0, 1);
+	}
+	if (irc < 0) {
+	    /* the groups in flight would never complete */
+	    ringFail(writer);
+	    return;
+	}
+	ringReap(writer);
+	minComplete = 0;
+    } while (ring->toSubmit > 0);
+    return;
+}
+
+/* ringReserve() waits until 'ops' more operations fit in the rings and, if 'fileSlot' is TRUE, a
+   fixed file slot is free.  Either is held by operations in flight, so waiting for completions
+   makes room.  Returns at once after a ring failure. */
+
+static void ringReserve(PEMTPM_WRITER *writer, unsigned int ops, int fileSlot)
+{
+    WRITER_RING		*ring = &writer->ring;
+
+    while ((writer->ringRc == 0) &&
+	   (((ring->inFlight + ops) > ring->capacity) ||
+	    (fileSlot && (ring->freeSlotCount == 0)))) {
+	ringSubmit(writer, 1);
+    }
+    return;
+}
+
+#endif	/* PEMTPM_WRITER_URING */
+
+/* writerThread() writes the groups in submission order until the writer is deleted.  The renames
+   are left to the caller's thread. */
+
+static void *writerThread(void *arg)
+{
+    PEMTPM_WRITER	*writer = arg;
+    WRITER_GROUP	*group;
+    size_t		f;
+
+    pthread_mutex_lock(&writer->lock);
+    for ( ; ; ) {
+	while ((writer->next == writer->tail) && !writer->closing) {
+	    pthread_cond_wait(&writer->submitted, &writer->lock);
+	}
+	if (writer->next == writer->tail) {
+	    break;
+	}
+	group = &writer->groups[writer->next % writer->depth];
+	pthread_mutex_unlock(&writer->lock);
+	for (f = 0 ; f < group->count ; f++) {
+	    group->fileRc[f] = TSS_File_WriteBinaryFile(group->files[f].data,
+							group->files[f].length,
+							(group->files[f].tempFilename != NULL) ?
+							group->files[f].tempFilename :
+							group->files[f].filename);
+	    if (group->fileRc[f] != 0) {
+		break;
+	    }
+	}
+	pthread_mutex_lock(&writer->lock);
+	group->state = WRITER_WRITTEN;
+	writer->writtenCount++;
+	writer->next++;
+	pthread_cond_signal(&writer->completed);
+    }
+    pthread_mutex_unlock(&writer->lock);
+    return NULL;
+}
+
+/* writerLock() and writerUnlock() guard the group states and writtenCount from the writer
+   thread.  With io_uring, only the caller's thread uses them. */
+
+static void writerLock(PEMTPM_WRITER *writer)
+{
+    if (!writer->useRing) {
+	pthread_mutex_lock(&writer->lock);
+    }
+    return;
+}
+
+static void writerUnlock(PEMTPM_WRITER *writer)
+{
+    if (!writer->useRing) {
+	pthread_mutex_unlock(&writer->lock);
+    }
+    return;
+}
+
+/* getGroupState() returns the state of 'group' */
+
+static int getGroupState(PEMTPM_WRITER *writer, WRITER_GROUP *group)
+{
+    int		state;
+
+    writerLock(writer);
+    state = group->state;
+    writerUnlock(writer);
+    return state;
+}
+
+/* markDirectory() marks the directory of 'filename' as needing a sync, opening it the first time
+   it is seen */
+
+static void markDirectory(PEMTPM_WRITER *writer, const char *filename)
+{
+    const char		*slash = strrchr(filename, '/');
+    const char		*name = ".";
+    size_t		length = 1;
+    WRITER_DIRECTORY	*directory;
+    struct stat		statBuffer;
+    int			missing;
+    size_t		d;
+
+    if (slash == filename) {
+	name = "/";
+    }
+    else if (slash != NULL) {
+	name = filename;
+	length = slash - filename;
+    }
+    for (d = 0 ; d < writer->directoryCount ; d++) {
+	directory = &writer->directories[d];
+	if ((directory->length == length) && (memcmp(directory->name, name, length) == 0)) {
+	    directory->dirty = TRUE;
+	    return;
+	}
+    }
+    if (writer->syncAll) {
+	return;
+    }
+    if (writer->directoryCount < WRITER_DIRECTORIES_MAX) {
+	directory = &writer->directories[writer->directoryCount];
+	directory->name = malloc(length + 1);
+	directory->fd = -1;
+	if (directory->name != NULL) {
+	    memcpy(directory->name, name, length);
+	    directory->name[length] = '\0';
+	    directory->fd = open(directory->name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	}
+	if ((directory->fd >= 0) && (fstat(directory->fd, &statBuffer) == 0)) {
+	    directory->length = length;
+	    directory->dev = statBuffer.st_dev;
+	    directory->dirty = TRUE;
+	    writer->directoryCount++;
+	    return;
+	}
+	missing = (directory->fd < 0) && ((errno == ENOENT) || (errno == ENOTDIR));
+	if (directory->fd >= 0) {
+	    close(directory->fd);
+	}
+	free(directory->name);
+	/* the file cannot be written either */
+	if (missing) {
+	    return;
+	}
+    }
+    if (tssVerbose) printf("PEMTPM_Writer: cannot track %.*s, syncing every file system\n",
+			   (int)length, name);
+    writer->syncAll = TRUE;
+    return;
+}
+
+/* syncDirectories() flushes the file systems of the dirty directories, or of every directory if
+   'all' is TRUE, with one syncfs() per file system */
+
+static TPM_RC syncDirectories(PEMTPM_WRITER *writer, int all)
+{
+    TPM_RC		rc = 0;
+    int			synced[WRITER_DIRECTORIES_MAX];
+    WRITER_DIRECTORY	*directory;
+    size_t		d;
+    size_t		e;
+
+    if (writer->syncAll) {
+	sync();
+	for (d = 0 ; d < writer->directoryCount ; d++) {
+	    writer->directories[d].dirty = FALSE;
+	}
+	return rc;
+    }
+    for (d = 0 ; d < writer->directoryCount ; d++) {
+	directory = &writer->directories[d];
+	synced[d] = FALSE;
+	if (!directory->dirty && !all) {
+	    continue;
+	}
+	directory->dirty = FALSE;
+	for (e = 0 ; (e < d) && !(synced[e] && (writer->directories[e].dev == directory->dev)) ;
+	     e++);
+	if (e < d) {
+	    continue;
+	}
+	synced[d] = TRUE;
+#ifdef HAVE_SYNCFS
+	if (syncfs(directory->fd) != 0) {
+	    printf("PEMTPM_Writer: Error syncing %s, %s\n", directory->name, strerror(errno));
+	    rc = TSS_RC_FILE_WRITE;
+	}
+#else
+	sync();
+	break;
+#endif
+    }
+    return rc;
+}
+
+/* renameGroup() renames the temporary files of a group taken by a commit.  If a file failed, or
+   'syncRc' is an error, the temporary files are removed instead. */
+
+static void renameGroup(PEMTPM_WRITER *writer, size_t slot, TPM_RC syncRc)
+{
+    WRITER_GROUP	*group = &writer->groups[slot];
+    TPM_RC		rc = 0;
+    size_t		f;
+
+    for (f = 0 ; (rc == 0) && (f < group->count) ; f++) {
+	rc = group->fileRc[f];
+    }
+    if ((rc == 0) && (syncRc != 0) && (group->count > 0)) {
+	rc = group->fileRc[0] = syncRc;
+    }
+#ifdef PEMTPM_WRITER_URING
+    /* room for every rename first, so that none completes before the last is queued */
+    if ((rc == 0) && writer->useRing) {
+	ringReserve(writer, group->count, FALSE);
+    }
+#endif
+    group->state = WRITER_DONE;
+    for (f = 0 ; f < group->count ; f++) {
+	const char *tempFilename = group->files[f].tempFilename;
+
+	if (tempFilename == NULL) {
+	    continue;
+	}
+	if (rc != 0) {
+	    unlink(tempFilename);
+	    continue;
+	}
+	writer->renamed = TRUE;
+#ifdef PEMTPM_WRITER_URING
+	if (writer->useRing && (writer->ringRc == 0)) {
+	    ringPrepareRename(writer, slot, f);
+	    group->state = WRITER_RENAMING;
+	    continue;
+	}
+#endif
+	if (rename(tempFilename, group->files[f].filename) != 0) {
+	    if (tssVerbose) printf("PEMTPM_Writer: Error renaming %s, %s\n",
+				   tempFilename, strerror(errno));
+	    unlink(tempFilename);
+	    group->fileRc[f] = rc = TSS_RC_FILE_WRITE;
+	}
+    }
+    return;
+}
+
+/* commitGroups() takes every written group, syncs the file systems with 'syncKeys', and renames
+   the files */
+
+static void commitGroups(PEMTPM_WRITER *writer)
+{
+    TPM_RC		syncRc = 0;
+    WRITER_GROUP	*group;
+    unsigned long	g;
+
+    /* the writer thread does not touch a written group again */
+    writerLock(writer);
+    for (g = writer->head ; g != writer->tail ; g++) {
+	group = &writer->groups[g % writer->depth];
+	if (group->state == WRITER_WRITTEN) {
+	    group->state = WRITER_COMMITTING;
+	    writer->writtenCount--;
+	}
+    }
+    writerUnlock(writer);
+    /* the temporary files are durable before any of them is renamed */
+    if (writer->syncKeys > 0) {
+	syncRc = syncDirectories(writer, FALSE);
+    }
+    for (g = writer->head ; g != writer->tail ; g++) {
+	if (getGroupState(writer, &writer->groups[g % writer->depth]) == WRITER_COMMITTING) {
+	    renameGroup(writer, g % writer->depth, syncRc);
+	}
+    }
+    return;
+}
+
+/* commitWritten() commits the written groups.  With 'syncKeys', they wait until there are that
+   many, unless 'force' is TRUE. */
+
+static void commitWritten(PEMTPM_WRITER *writer, int force)
+{
+    size_t	writtenCount;
+
+    writerLock(writer);
+    writtenCount = writer->writtenCount;
+    writerUnlock(writer);
+    if ((writtenCount > 0) &&
+	(force || (writer->syncKeys == 0) || (writtenCount >= writer->syncKeys))) {
+	commitGroups(writer);
+    }
+    return;
+}
+
+/* PEMTPM_Writer_Create() creates a writer that holds up to 'depth' groups in flight.  With
+   'syncKeys', the files are renamed after a sync once that many groups are written.
+
+   It uses io_uring if the kernel supports it, otherwise it starts a writer thread.  The writer
+   must be freed with PEMTPM_Writer_Delete().
+*/
+
+TPM_RC PEMTPM_Writer_Create(PEMTPM_WRITER **writer,
+			    size_t depth,
+			    size_t syncKeys)
+{
+    TPM_RC 	rc = 0;
+
+    if (rc == 0) {
+	if (depth == 0) {
+	    if (tssVerbose) printf("PEMTPM_Writer_Create: Error, depth is zero\n");
+	    rc = TSS_RC_MALLOC_SIZE;
+	}
+    }
+    if (rc == 0) {
+	rc = TSS_Malloc((unsigned char **)writer, sizeof(PEMTPM_WRITER));
+    }
+    if (rc == 0) {
+	memset(*writer, 0, sizeof(PEMTPM_WRITER));
+	(*writer)->depth = depth;
+	(*writer)->syncKeys = syncKeys;
+	rc = TSS_ArrayMalloc((unsigned char **)&(*writer)->groups, depth, sizeof(WRITER_GROUP));
+	if (rc != 0) {
+	    free(*writer);
+	    *writer = NULL;
+	}
+    }
+#ifdef PEMTPM_WRITER_URING
+    /* room for every group if the kernel allows it, otherwise groups wait for room */
+    if (rc == 0) {
+	(*writer)->useRing = ringCreate(&(*writer)->ring,
+					depth * PEMTPM_WRITER_FILES_MAX * WRITER_FILE_OPS,
+					depth);
+    }
+#endif
+    if ((rc == 0) && !(*writer)->useRing) {
+	pthread_mutex_init(&(*writer)->lock, NULL);
+	pthread_cond_init(&(*writer)->submitted, NULL);
+	pthread_cond_init(&(*writer)->completed, NULL);
+	if (pthread_create(&(*writer)->thread, NULL, writerThread, *writer) != 0) {
+	    if (tssVerbose) printf("PEMTPM_Writer_Create: Error creating thread\n");
+	    PEMTPM_Writer_Delete(*writer);
+	    *writer = NULL;
+	    rc = TSS_RC_OUT_OF_MEMORY;
+	}
+	else {
+	    (*writer)->threadStarted = TRUE;
+	}
+    }
+    return rc;
+}
+
+/* PEMTPM_Writer_Delete() frees the writer.  Every group must have been completed. */
+
+void PEMTPM_Writer_Delete(PEMTPM_WRITER *writer)
+{
+    size_t	d;
+
+    if (writer != NULL) {
+#ifdef PEMTPM_WRITER_URING
+	if (writer->useRing) {
+	    ringDelete(&writer->ring);
+	}
+#endif
+	if (!writer->useRing) {
+	    if (writer->threadStarted) {
+		pthread_mutex_lock(&writer->lock);
+		writer->closing = TRUE;
+		pthread_cond_signal(&writer->submitted);
+		pthread_mutex_unlock(&writer->lock);
+		pthread_join(writer->thread, NULL);
+	    }
+	    pthread_cond_destroy(&writer->completed);
+	    pthread_cond_destroy(&writer->submitted);
+	    pthread_mutex_destroy(&writer->lock);
+	}
+	for (d = 0 ; d < writer->directoryCount ; d++) {
+	    close(writer->directories[d].fd);
+	    free(writer->directories[d].name);
+	}
+	free(writer->groups);
+	free(writer);
+    }
+    return;
+}
+
+/* PEMTPM_Writer_Method() returns "io_uring" or "thread" */
+
+const char *PEMTPM_Writer_Method(const PEMTPM_WRITER *writer)
+{
+    return writer->useRing ? "io_uring" : "thread";
+}
+
+/* PEMTPM_Writer_Full() returns TRUE if a group must be completed before the next submit */
+
+int PEMTPM_Writer_Full(const PEMTPM_WRITER *writer)
+{
+    return (writer->tail - writer->head) == writer->depth;
+}
+
+/* PEMTPM_Writer_Empty() returns TRUE if every submitted group has been completed */
+
+int PEMTPM_Writer_Empty(const PEMTPM_WRITER *writer)
+{
+    return writer->tail == writer->head;
+}
+
+/* PEMTPM_Writer_Submit() queues the 'count' files as one group with 'tag', which must not be
+   NULL.  A group with no files completes in order with no error, which lets the caller pass keys
+   that write nothing through the writer.  The writer must not be full.
+
+   With io_uring, the group may only be prepared, and is submitted by a later submit or by
+   PEMTPM_Writer_Flush() or PEMTPM_Writer_Complete().  It first waits for earlier groups if the
+   ring is full.
+*/
+
+void PEMTPM_Writer_Submit(PEMTPM_WRITER *writer,
+			  const PEMTPM_WRITER_FILE *files,
+			  size_t count,
+			  void *tag)
+{
+    size_t		slot = writer->tail % writer->depth;
+    WRITER_GROUP	*group = &writer->groups[slot];
+    size_t		f;
+
+    group->tag = tag;
+    group->count = count;
+    for (f = 0 ; f < count ; f++) {
+	group->files[f] = files[f];
+	group->fileRc[f] = 0;
+	if (writer->syncKeys > 0) {
+	    markDirectory(writer, files[f].filename);
+	}
+    }
+    group->state = WRITER_WRITING;
+#ifdef PEMTPM_WRITER_URING
+    if (writer->useRing) {
+	/* before the group is in the ring, where the completions of other groups can see it */
+	if (count > 0) {
+	    ringReserve(writer, count * WRITER_FILE_OPS, TRUE);
+	}
+	writer->tail++;
+	/* after a ring failure, the group fails without being written */
+	if ((count == 0) || (writer->ringRc != 0)) {
+	    for (f = 0 ; f < count ; f++) {
+		group->fileRc[f] = writer->ringRc;
+	    }
+	    group->state = WRITER_WRITTEN;
+	    writer->writtenCount++;
+	    return;
+	}
+	ringPrepareGroup(writer, slot);
+	writer->queued++;
+	if (writer->queued == WRITER_SUBMIT_BATCH) {
+	    ringSubmit(writer, 0);
+	}
+	return;
+    }
+#endif
+    pthread_mutex_lock(&writer->lock);
+    writer->tail++;
+    pthread_cond_signal(&writer->submitted);
+    pthread_mutex_unlock(&writer->lock);
+    return;
+}
+
+/* PEMTPM_Writer_Flush() submits the groups that are prepared but not yet submitted */
+
+void PEMTPM_Writer_Flush(PEMTPM_WRITER *writer)
+{
+#ifdef PEMTPM_WRITER_URING
+    if (writer->useRing && (writer->ringRc == 0) && ringPrepared(&writer->ring)) {
+	ringSubmit(writer, 0);
+    }
+#else
+    (void)writer;
+#endif
+    return;
+}
+
+/* PEMTPM_Writer_Complete() completes the oldest group, returning its tag and the first error of
+   its files in 'rc'.  If 'wait' is FALSE, returns NULL when the oldest group is still being
+   written or, with 'syncKeys', is waiting for more groups.  If 'wait' is TRUE, the written groups
+   are committed at once.  Returns NULL when there is no group.
+*/
+
+void *PEMTPM_Writer_Complete(PEMTPM_WRITER *writer,
+			     TPM_RC *rc,
+			     int wait)
+{
+    WRITER_GROUP	*group;
+    int			state;
+    size_t		f;
+
+    if (writer->head == writer->tail) {
+	return NULL;
+    }
+    group = &writer->groups[writer->head % writer->depth];
+#ifdef PEMTPM_WRITER_URING
+    if (writer->useRing && (writer->ringRc == 0)) {
+	if (ringPrepared(&writer->ring)) {
+	    ringSubmit(writer, 0);
+	}
+	else {
+	    ringReap(writer);
+	}
+    }
+#endif
+    commitWritten(writer, FALSE);
+    while (((state = getGroupState(writer, group)) != WRITER_DONE) && wait) {
+	if (state == WRITER_WRITTEN) {
+	    commitWritten(writer, TRUE);
+	}
+#ifdef PEMTPM_WRITER_URING
+	else if (writer->useRing) {
+	    ringSubmit(writer, 1);
+	    commitWritten(writer, FALSE);
+	}
+#endif
+	else {
+	    pthread_mutex_lock(&writer->lock);
+	    while (group->state == WRITER_WRITING) {
+		pthread_cond_wait(&writer->completed, &writer->lock);
+	    }
+	    pthread_mutex_unlock(&writer->lock);
+	}
+    }
+    if (state != WRITER_DONE) {
+	return NULL;
+    }
+    *rc = 0;
+    for (f = 0 ; (*rc == 0) && (f < group->count) ; f++) {
+	*rc = group->fileRc[f];
+    }
+    writer->head++;
+    return group->tag;
+}
+
+/* PEMTPM_Writer_Sync() makes the renames durable, with 'syncKeys'.  Every group must have been
+   completed. */
+
+TPM_RC PEMTPM_Writer_Sync(PEMTPM_WRITER *writer)
+{
+    TPM_RC	rc = 0;
+
+    if ((writer->syncKeys > 0) && writer->renamed) {
+	rc = syncDirectories(writer, TRUE);
+	writer->renamed = FALSE;
+    }
+    return rc;
+}
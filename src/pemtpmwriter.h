@@ -0,0 +1,66 @@
+/********************************************************************************/
+/*										*/
+/*		     Asynchronous File Writer for the Batch Pipeline		*/
+/*										*/
+/********************************************************************************/
+
+/* This is a private header for the pemtpm batch pipeline.
+
+   A PEMTPM_WRITER writes whole files in the background, so that the write stage does not block on
+   each open, write and close.  The caller submits the output files of one key as a group, with a
+   tag, and later takes the completed groups back in submission order, with the first error of
+   each.  The file names and data must stay valid until the group is completed.
+
+   A file with a temporary name is written there and renamed over its name once every file of the
+   group is written, so a reader never sees a partial file.  If any file of the group fails, none
+   is renamed and the temporary files are removed, so the old outputs of the key stay together.
+
+   With 'syncKeys', the renames wait until that many groups are written.  The file systems holding
+   them are then flushed with one syncfs() each before the renames, so after a crash each output
+   is either the old file or the whole new one, without an fsync() per file.  PEMTPM_Writer_Sync()
+   makes the last renames durable.
+
+   On Linux, the writer uses io_uring when the kernel supports it: each file is an open, a write
+   and a close linked in the submission queue, the open installs a fixed file, and the files of
+   many keys are submitted with one system call, as are the renames.  Otherwise, one writer thread
+   writes the files with TSS_File_WriteBinaryFile().
+*/
+
+#ifndef PEMTPMWRITER_H
+#define PEMTPMWRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <tss2/TPM_Types.h>
+
+/* the most files in one group, opu, opr, opn and oss */
+#define PEMTPM_WRITER_FILES_MAX		4
+
+typedef struct {
+    const char		*filename;
+    const char		*tempFilename;	/* NULL to write 'filename' in place */
+    const uint8_t	*data;
+    size_t		length;
+} PEMTPM_WRITER_FILE;
+
+typedef struct PEMTPM_WRITER PEMTPM_WRITER;
+
+TPM_RC PEMTPM_Writer_Create(PEMTPM_WRITER **writer,
+			    size_t depth,
+			    size_t syncKeys);
+void PEMTPM_Writer_Delete(PEMTPM_WRITER *writer);
+const char *PEMTPM_Writer_Method(const PEMTPM_WRITER *writer);
+int PEMTPM_Writer_Full(const PEMTPM_WRITER *writer);
+int PEMTPM_Writer_Empty(const PEMTPM_WRITER *writer);
+void PEMTPM_Writer_Submit(PEMTPM_WRITER *writer,
+			  const PEMTPM_WRITER_FILE *files,
+			  size_t count,
+			  void *tag);
+void PEMTPM_Writer_Flush(PEMTPM_WRITER *writer);
+void *PEMTPM_Writer_Complete(PEMTPM_WRITER *writer,
+			     TPM_RC *rc,
+			     int wait);
+TPM_RC PEMTPM_Writer_Sync(PEMTPM_WRITER *writer);
+
+#endif
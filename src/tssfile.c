@@ -41,12 +41,18 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <tss2/tssresponsecode.h>
 #include <tss2/tsserror.h>
 #include <tss2/tssprint.h>
 #include <tss2/tssfile.h>
 
+#include "pemtpmstats.h"
+
 extern int tssVerbose;
 
 /* TSS_File_Open() opens the 'filename' for 'mode'
@@ -131,6 +137,10 @@ TPM_RC TSS_File_ReadBinaryFile(unsigned char **data,     /* must be freed by cal
 	    rc = TSS_RC_FILE_READ;
 	}
     }
+    if (rc == 0) {
+	PEMTPM_STATS_COUNT(PEMTPM_STAT_FILES_READ, 1);
+	PEMTPM_STATS_COUNT(PEMTPM_STAT_BYTES_READ, *length);
+    }
     if (file != NULL) {
 	irc = fclose(file);		/* @1 */
 	if (irc != 0) {
@@ -147,6 +157,127 @@ TPM_RC TSS_File_ReadBinaryFile(unsigned char **data,     /* must be freed by cal
     return rc;
 }
 
+/* TSS_File_ReadBinaryFileBuffer() reads 'filename' into the caller's 'data' of 'dataSize' bytes.
+   'length' indicates the number of bytes read.
+
+   Unlike TSS_File_ReadBinaryFile(), it does not allocate or seek.  It is an error if the file is
+   larger than 'dataSize'.
+*/
+
+TPM_RC TSS_File_ReadBinaryFileBuffer(unsigned char *data,
+				     size_t *length,
+				     size_t dataSize,
+				     const char *filename)
+{
+    int		rc = 0;
+    int		irc;
+    FILE	*file = NULL;
+
+    *length = 0;
+    if (rc == 0) {
+	rc = TSS_File_Open(&file, filename, "rb");				/* closed @1 */
+    }
+    /* a full buffer followed by more data means the file is too large */
+    if (rc == 0) {
+	*length = fread(data, 1, dataSize, file);
+	if (ferror(file)) {
+	    if (tssVerbose) printf("TSS_File_ReadBinaryFileBuffer: Error reading %s\n", filename);
+	    rc = TSS_RC_FILE_READ;
+	}
+	else if ((*length == dataSize) && (fgetc(file) != EOF)) {
+	    if (tssVerbose) printf("TSS_File_ReadBinaryFileBuffer: %s larger than %lu bytes\n",
+				   filename, (unsigned long)dataSize);
+	    rc = TSS_RC_INSUFFICIENT_BUFFER;
+	}
+    }
+    if (rc == 0) {
+	PEMTPM_STATS_COUNT(PEMTPM_STAT_FILES_READ, 1);
+	PEMTPM_STATS_COUNT(PEMTPM_STAT_BYTES_READ, *length);
+    }
+    if (file != NULL) {
+	irc = fclose(file);		/* @1 */
+	if (irc != 0) {
+	    if (tssVerbose) printf("TSS_File_ReadBinaryFileBuffer: Error closing %s\n",
+				   filename);
+	    rc = TSS_RC_FILE_CLOSE;
+	}
+    }
+    return rc;
+}
+
+/* TSS_File_MapFile() maps 'filename' read only.  'data' points to the 'length' bytes of the file
+   and must be released with TSS_File_UnmapFile().
+
+   Unlike TSS_File_ReadBinaryFile(), nothing is allocated or copied, and there is no size limit.
+   An empty file has a NULL 'data'.
+*/
+
+TPM_RC TSS_File_MapFile(const unsigned char **data,	/* unmapped by caller */
+			size_t *length,
+			const char *filename)
+{
+    TPM_RC	rc = 0;
+    int		fd = -1;
+    struct stat	st;
+    void	*map;
+
+    *data = NULL;
+    *length = 0;
+    if (rc == 0) {
+	fd = open(filename, O_RDONLY);		/* closed @1 */
+	if (fd < 0) {
+	    if (tssVerbose) printf("TSS_File_MapFile: Error opening %s, %s\n",
+				   filename, strerror(errno));
+	    rc = TSS_RC_FILE_OPEN;
+	}
+    }
+    if (rc == 0) {
+	if (fstat(fd, &st) != 0) {
+	    if (tssVerbose) printf("TSS_File_MapFile: Error sizing %s, %s\n",
+				   filename, strerror(errno));
+	    rc = TSS_RC_FILE_FTELL;
+	}
+	else if (!S_ISREG(st.st_mode)) {
+	    if (tssVerbose) printf("TSS_File_MapFile: %s is not a regular file\n", filename);
+	    rc = TSS_RC_FILE_READ;
+	}
+    }
+    /* mmap() rejects a zero length */
+    if ((rc == 0) && (st.st_size != 0)) {
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+	    if (tssVerbose) printf("TSS_File_MapFile: Error mapping %s, %s\n",
+				   filename, strerror(errno));
+	    rc = TSS_RC_FILE_READ;
+	}
+	else {
+	    /* the file is scanned once, front to back */
+	    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+	    *data = map;
+	    *length = (size_t)st.st_size;
+	}
+    }
+    if (rc == 0) {
+	PEMTPM_STATS_COUNT(PEMTPM_STAT_FILES_READ, 1);
+	PEMTPM_STATS_COUNT(PEMTPM_STAT_BYTES_READ, *length);
+    }
+    if (fd >= 0) {
+	close(fd);		/* @1, the mapping stays valid */
+    }
+    return rc;
+}
+
+/* TSS_File_UnmapFile() releases a mapping from TSS_File_MapFile() */
+
+void TSS_File_UnmapFile(const unsigned char *data,
+			size_t length)
+{
+    if (data != NULL) {
+	munmap((void *)data, length);
+    }
+    return;
+}
+
 /* TSS_File_WriteBinaryFile() writes 'data' of 'length' to 'filename'
  */
 
@@ -173,6 +304,10 @@ TPM_RC TSS_File_WriteBinaryFile(const unsigned char *data,
 	    rc = TSS_RC_FILE_WRITE;
 	}
     }
+    if (rc == 0) {
+	PEMTPM_STATS_COUNT(PEMTPM_STAT_FILES_WRITTEN, 1);
+	PEMTPM_STATS_COUNT(PEMTPM_STAT_BYTES_WRITTEN, length);
+    }
     if (file != NULL) {
 	irc = fclose(file);		/* @1 */
 	if (irc != 0) {
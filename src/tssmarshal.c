@@ -64,6 +64,18 @@
    If 'size' is NULL, the source is unmarshaled without a size check.  The caller must ensure that
    the buffer is sufficient, often due to a malloc after the first pass.  */
 
+/* Unless TPM_TSS_MARSHAL_ALL is defined, see TpmBuildSwitches.h, only the functions reachable from
+   those that pemtpm calls are compiled: TSS_Import_In_Marshal() and the command header and
+   authorization area for PEMTPM_MarshalImport(), TSS_TPM2B_PUBLIC_Marshal(),
+   TSS_TPMT_SENSITIVE_Marshal() and TSS_TPM2B_PRIVATE_Marshal() as the pemtpmmarshal.c fallbacks,
+   and TSS_TPMS_ECC_POINT_Marshal() for an ECC parent.  The unions of those structures are limited
+   to RSA and ECC objects, the schemes without extra parameters, and an ECC kdf of TPM_ALG_NULL.
+   Any other selector returns TPM_RC_SELECTOR.
+
+   A function that pemtpm starts to call must be moved out of its TPM_TSS_MARSHAL_ALL block, here
+   and in tssmarshal.h.
+*/
+
 /*
   Command parameter marshaling
 */
@@ -122,6 +134,8 @@ TSS_UINT8_Marshal(const UINT8 *source, UINT16 *written, BYTE **buffer, INT32 *si
     return rc;
 }
 
+#ifdef TPM_TSS_MARSHAL_ALL
+
 TPM_RC
 TSS_INT8_Marshal(const INT8 *source, UINT16 *written, BYTE **buffer, INT32 *size)
 {
@@ -130,6 +144,8 @@ TSS_INT8_Marshal(const INT8 *source, UINT16 *written, BYTE **buffer, INT32 *size
     return rc;
 }
 
+#endif	/* TPM_TSS_MARSHAL_ALL */
+
 TPM_RC
 TSS_UINT16_Marshal(const UINT16 *source, UINT16 *written, BYTE **buffer, INT32 *size)
 {
@@ -178,6 +194,8 @@ TSS_UINT32_Marshal(const UINT32 *source, UINT16 *written, BYTE **buffer, INT32 *
     return rc;
 }
 
+#ifdef TPM_TSS_MARSHAL_ALL
+
 TPM_RC
 TSS_INT32_Marshal(const INT32 *source, UINT16 *written, BYTE **buffer, INT32 *size)
 {
@@ -215,6 +233,8 @@ TSS_UINT64_Marshal(const UINT64 *source, UINT16 *written, BYTE **buffer, INT32 *
     return rc;
 }
 
+#endif	/* TPM_TSS_MARSHAL_ALL */
+
 TPM_RC
 TSS_Array_Marshal(const BYTE *source, UINT16 sourceSize, UINT16 *written, BYTE **buffer, INT32 *size)
 {
@@ -262,6 +282,8 @@ TSS_TPM_KEY_BITS_Marshal(const TPM_KEY_BITS *source, UINT16 *written, BYTE **buf
     return rc;
 }
 
+#ifdef TPM_TSS_MARSHAL_ALL
+
 /* Table 7 - Definition of (UINT32) TPM_GENERATED Constants <O> */
 
 TPM_RC
@@ -274,13 +296,14 @@ TSS_TPM_GENERATED_Marshal(const TPM_GENERATED *source, UINT16 *written, BYTE **b
     return rc;
 }
 
+#endif	/* TPM_TSS_MARSHAL_ALL */
+
 /* Table 9 - Definition of (UINT16) TPM_ALG_ID Constants <IN/OUT, S> */
 
 TPM_RC
 TSS_TPM_ALG_ID_Marshal(const TPM_ALG_ID *source, UINT16 *written, BYTE **buffer, INT32 *size)
 {
     TPM_RC rc = 0;
-    printf("algid=%x\n", *source);
     if (rc == 0) {
 	rc = TSS_UINT16_Marshal(source, written, buffer, size);
     }
@@ -301,6 +324,8 @@ TSS_TPM_ECC_CURVE_Marshal(const TPM_ECC_CURVE *source, UINT16 *written, BYTE **b
 }
 #endif
 
+#ifdef TPM_TSS_MARSHAL_ALL
+
 /* Table 17 - Definition of (UINT32) TPM_RC Constants (Actions) <OUT> */
 
 TPM_RC
@@ -337,6 +362,8 @@ TSS_TPM_EO_Marshal(const TPM_EO *source, UINT16 *written, BYTE **buffer, INT32 *
     return rc;
 }
 
+#endif	/* TPM_TSS_MARSHAL_ALL */
+
 /* Table 20 - Definition of (UINT16) TPM_ST Constants <IN/OUT, S> */
 
 TPM_RC
@@ -349,6 +376,8 @@ TSS_TPM_ST_Marshal(const TPM_ST *source, UINT16 *written, BYTE **buffer, INT32 *
     return rc;
 }
 
+#ifdef TPM_TSS_MARSHAL_ALL
+
 /* Table 21 - Definition of (UINT16) TPM_SU Constants <IN> */
 
 TPM_RC
@@ -409,6 +438,8 @@ TSS_TPM_PT_PCR_Marshal(const TPM_PT_PCR *source, UINT16 *written, BYTE **buffer,
     return rc;
 }
 
+#endif	/* TPM_TSS_MARSHAL_ALL */
+
 /* Table 27 - Definition of Types for Handles */
 
 TPM_RC
@@ -421,6 +452,8 @@ TSS_TPM_HANDLE_Marshal(const TPM_HANDLE *source, UINT16 *written, BYTE **buffer,
     return rc;
 }
 
+#ifdef TPM_TSS_MARSHAL_ALL
+
 /* Table 31 - Definition of (UINT32) TPMA_ALGORITHM Bits */
 
 TPM_RC
@@ -433,6 +466,8 @@ TSS_TPMA_ALGORITHM_Marshal(const TPMA_ALGORITHM *source, UINT16 *written, BYTE *
     return rc;
 }
 
+#endif	/* TPM_TSS_MARSHAL_ALL */
+
 /* Table 32 - Definition of (UINT32) TPMA_OBJECT Bits */
 
 TPM_RC
@@ -457,6 +492,8 @@ TSS_TPMA_SESSION_Marshal(const TPMA_SESSION *source, UINT16 *written, BYTE **buf
     return rc;
 }
 
+#ifdef TPM_TSS_MARSHAL_ALL
+
 /* Table 34 - Definition of (UINT8) TPMA_LOCALITY Bits <IN/OUT> */
 
 TPM_RC
@@ -469,6 +506,8 @@ TSS_TPMA_LOCALITY_Marshal(const TPMA_LOCALITY *source, UINT16 *written, BYTE **b
     return rc;
 }
 
+#endif	/* TPM_TSS_MARSHAL_ALL */
+
 /* Table 38 - Definition of (TPM_CC) TPMA_CC Bits <OUT> */
 
 TPM_RC
@@ -481,6 +520,8 @@ TSS_TPM_CC_Marshal(const TPM_CC *source, UINT16 *written, BYTE **buffer, INT32 *
     return rc;
 }
 
+#ifdef TPM_TSS_MARSHAL_ALL
+
 /* Table 38 - Definition of (TPM_CC) TPMA_CC Bits <OUT> */
 
 TPM_RC
@@ -505,6 +546,8 @@ TSS_TPMI_YES_NO_Marshal(const TPMI_YES_NO *source, UINT16 *written, BYTE **buffe
     return rc;
 }
 
+#endif	/* TPM_TSS_MARSHAL_ALL */
+
 /* Table 40 - Definition of (TPM_HANDLE) TPMI_DH_OBJECT Type */
 
 TPM_RC
@@ -517,6 +560,8 @@ TSS_TPMI_DH_OBJECT_Marshal(const TPMI_DH_OBJECT *source, UINT16 *written, BYTE *
     return rc;
 }
 
+#ifdef TPM_TSS_MARSHAL_ALL
+
 /* Table 41 - Definition of (TPM_HANDLE) TPMI_DH_PERSISTENT Type */
 
 TPM_RC
@@ -553,6 +598,8 @@ TSS_TPMI_DH_PCR_Marshal(const TPMI_DH_PCR  *source, UINT16 *written, BYTE **buff
     return rc;
 }
 
+#endif	/* TPM_TSS_MARSHAL_ALL */
+
 /* Table 44 - Definition of (TPM_HANDLE) TPMI_SH_AUTH_SESSION Type <IN/OUT> */
 
 TPM_RC
@@ -565,6 +612,8 @@ TSS_TPMI_SH_AUTH_SESSION_Marshal(const TPMI_SH_AUTH_SESSION *source, UINT16 *wri
     return rc;
 }
 
+#ifdef TPM_TSS_MARSHAL_ALL
+
 /* Table 45 - Definition of (TPM_HANDLE) TPMI_SH_HMAC Type <IN/OUT> */
 
 TPM_RC
@@ -721,6 +770,8 @@ TSS_TPMI_RH_NV_INDEX_Marshal(const TPMI_RH_NV_INDEX *source, UINT16 *written, BY
     return rc;
 }
 
+#endif	/* TPM_TSS_MARSHAL_ALL */
+
 /* Table 59 - Definition of (TPM_ALG_ID) TPMI_ALG_HASH Type  */
 
 TPM_RC
@@ -733,6 +784,8 @@ TSS_TPMI_ALG_HASH_Marshal(const TPMI_ALG_HASH *source, UINT16 *written, BYTE **b
     return rc;
 }
 
+#ifdef TPM_TSS_MARSHAL_ALL
+
 /* Table 61 - Definition of (TPM_ALG_ID) TPMI_ALG_SYM Type */
 
 TPM_RC
@@ -745,6 +798,8 @@ TSS_TPMI_ALG_SYM_Marshal(const TPMI_ALG_SYM *source, UINT16 *written, BYTE **buf
     return rc;
 }
 
+#endif	/* TPM_TSS_MARSHAL_ALL */
+
 /* Table 62 - Definition of (TPM_ALG_ID) TPMI_ALG_SYM_OBJECT Type */
 
 TPM_RC
@@ -781,6 +836,8 @@ TSS_TPMI_ALG_KDF_Marshal(const TPMI_ALG_KDF *source, UINT16 *written, BYTE **buf
     return rc;
 }
 
+#ifdef TPM_TSS_MARSHAL_ALL
+
 /* Table 65 - Definition of (TPM_ALG_ID) TPMI_ALG_SIG_SCHEME Type */
 
 TPM_RC
@@ -805,6 +862,8 @@ TSS_TPMI_ECC_KEY_EXCHANGE_Marshal(const TPMI_ECC_KEY_EXCHANGE *source, UINT16 *w
     return rc;
 }
 
+#endif	/* TPM_TSS_MARSHAL_ALL */
+
 /* Table 67 - Definition of (TPM_ST) TPMI_ST_COMMAND_TAG Type */
 
 TPM_RC
@@ -817,6 +876,8 @@ TSS_TPMI_ST_COMMAND_TAG_Marshal(const TPMI_ST_COMMAND_TAG *source, UINT16 *writt
     return rc;
 }
 
+#ifdef TPM_TSS_MARSHAL_ALL
+
 /* Table 70 - Definition of TPMU_HA Union <IN/OUT, S> */
 
 TPM_RC
@@ -883,6 +944,8 @@ TSS_TPMT_HA_Marshal(const TPMT_HA *source, UINT16 *written, BYTE **buffer, INT32
     return rc;
 }
 
+#endif	/* TPM_TSS_MARSHAL_ALL */
+
 /* Table 72 - Definition of TPM2B_DIGEST Structure */
 
 TPM_RC
@@ -931,6 +994,8 @@ TSS_TPM2B_AUTH_Marshal(const TPM2B_AUTH *source, UINT16 *written, BYTE **buffer,
     return rc;
 }
 
+#ifdef TPM_TSS_MARSHAL_ALL
+
 /* Table 76 - Definition of Types for TPM2B_OPERAND */
 
 TPM_RC
@@ -1689,6 +1754,8 @@ TSS_TPM2B_ATTEST_Marshal(const TPM2B_ATTEST *source, UINT16 *written, BYTE **buf
     return rc;
 }
 
+#endif	/* TPM_TSS_MARSHAL_ALL */
+
 /* Table 122 - Definition of TPMS_AUTH_COMMAND Structure <IN> */
 
 TPM_RC
@@ -1804,6 +1871,8 @@ TSS_TPMU_SYM_MODE_Marshal(const TPMU_SYM_MODE *source, UINT16 *written, BYTE **b
     return rc;
 }
 
+#ifdef TPM_TSS_MARSHAL_ALL
+
 /* Table 128 - Definition of TPMT_SYM_DEF Structure */
 
 TPM_RC
@@ -1822,6 +1891,8 @@ TSS_TPMT_SYM_DEF_Marshal(const TPMT_SYM_DEF *source, UINT16 *written, BYTE **buf
     return rc;
 }
 
+#endif	/* TPM_TSS_MARSHAL_ALL */
+
 /* Table 129 - Definition of TPMT_SYM_DEF_OBJECT Structure */
 
 TPM_RC
@@ -1840,6 +1911,8 @@ TSS_TPMT_SYM_DEF_OBJECT_Marshal(const TPMT_SYM_DEF_OBJECT *source, UINT16 *writt
     return rc;
 }
 
+#ifdef TPM_TSS_MARSHAL_ALL
+
 /* Table 130 - Definition of TPM2B_SYM_KEY Structure */
 
 TPM_RC
@@ -1931,6 +2004,8 @@ TSS_TPM2B_SENSITIVE_CREATE_Marshal(const TPM2B_SENSITIVE_CREATE  *source, UINT16
     return rc;
 }
 
+#endif	/* TPM_TSS_MARSHAL_ALL */
+
 /* Table 135 - Definition of TPMS_SCHEME_HASH Structure */
 
 TPM_RC
@@ -1943,6 +2018,8 @@ TSS_TPMS_SCHEME_HASH_Marshal(const TPMS_SCHEME_HASH *source, UINT16 *written, BY
     return rc;
 }
 
+#ifdef TPM_TSS_MARSHAL_ALL
+
 /* Table 136 - Definition of {ECC} TPMS_SCHEME_ECDAA Structure */
 
 TPM_RC
@@ -2041,6 +2118,8 @@ TSS_TPMT_KEYEDHASH_SCHEME_Marshal(const TPMT_KEYEDHASH_SCHEME *source, UINT16 *w
     return rc;
 }
 
+#endif	/* TPM_TSS_MARSHAL_ALL */
+
 /* Table 142 - Definition of {RSA} Types for RSA Signature Schemes */
 
 TPM_RC
@@ -2093,6 +2172,8 @@ TSS_TPMS_SIG_SCHEME_ECSCHNORR_Marshal(const TPMS_SIG_SCHEME_ECSCHNORR *source, U
     return rc;
 }
 
+#ifdef TPM_TSS_MARSHAL_ALL
+
 /* Table 143 - Definition of {ECC} Types for ECC Signature Schemes */
 
 TPM_RC
@@ -2184,6 +2265,8 @@ TSS_TPMT_SIG_SCHEME_Marshal(const TPMT_SIG_SCHEME *source, UINT16 *written, BYTE
     return rc;
 }
 
+#endif	/* TPM_TSS_MARSHAL_ALL */
+
 /* Table 146 - Definition of Types for {RSA} Encryption Schemes */
 
 TPM_RC
@@ -2219,6 +2302,8 @@ TSS_TPMS_KEY_SCHEME_ECDH_Marshal(const TPMS_KEY_SCHEME_ECDH *source, UINT16 *wri
     }
     return rc;
 }
+#ifdef TPM_TSS_MARSHAL_ALL
+
 TPM_RC
 TSS_TPMS_KEY_SCHEME_ECMQV_Marshal(const TPMS_KEY_SCHEME_ECMQV *source, UINT16 *written, BYTE **buffer, INT32 *size)
 {
@@ -2268,35 +2353,44 @@ TSS_TPMS_SCHEME_KDF1_SP800_108_Marshal(const TPMS_SCHEME_KDF1_SP800_108 *source,
     return rc;
 }
 
+#endif	/* TPM_TSS_MARSHAL_ALL */
+
 /* Table 149 - Definition of TPMU_KDF_SCHEME Union <IN/OUT, S> */
 
 TPM_RC
 TSS_TPMU_KDF_SCHEME_Marshal(const TPMU_KDF_SCHEME *source, UINT16 *written, BYTE **buffer, INT32 *size, UINT32 selector)
 {
     TPM_RC rc = 0;
+#ifndef TPM_TSS_MARSHAL_ALL
+    /* pemtpm marshals only the NULL KDF */
+    (void)source;
+    (void)written;
+    (void)buffer;
+    (void)size;
+#endif
     switch (selector) {
-#ifdef TPM_ALG_MGF1
+#if defined TPM_ALG_MGF1 && defined TPM_TSS_MARSHAL_ALL
       case TPM_ALG_MGF1:
 	if (rc == 0) {
 	    rc = TSS_TPMS_SCHEME_MGF1_Marshal(&source->mgf1, written, buffer, size);
 	}
 	break;
 #endif
-#ifdef TPM_ALG_KDF1_SP800_56A
+#if defined TPM_ALG_KDF1_SP800_56A && defined TPM_TSS_MARSHAL_ALL
       case TPM_ALG_KDF1_SP800_56A:
 	if (rc == 0) {
 	    rc = TSS_TPMS_SCHEME_KDF1_SP800_56A_Marshal(&source->kdf1_SP800_56a, written, buffer, size);
 	}
 	break;
 #endif
-#ifdef TPM_ALG_KDF2
+#if defined TPM_ALG_KDF2 && defined TPM_TSS_MARSHAL_ALL
       case TPM_ALG_KDF2:
 	if (rc == 0) {
 	    rc = TSS_TPMS_SCHEME_KDF2_Marshal(&source->kdf2, written, buffer, size);
 	}
 	break;
 #endif
-#ifdef TPM_ALG_KDF1_SP800_108
+#if defined TPM_ALG_KDF1_SP800_108 && defined TPM_TSS_MARSHAL_ALL
       case TPM_ALG_KDF1_SP800_108:
 	if (rc == 0) {
 	    rc = TSS_TPMS_SCHEME_KDF1_SP800_108_Marshal(&source->kdf1_sp800_108, written, buffer, size);
@@ -2367,7 +2461,7 @@ TSS_TPMU_ASYM_SCHEME_Marshal(const TPMU_ASYM_SCHEME  *source, UINT16 *written, B
 	}
 	break;
 #endif
-#ifdef TPM_ALG_ECDAA
+#if defined TPM_ALG_ECDAA && defined TPM_TSS_MARSHAL_ALL
       case TPM_ALG_ECDAA:
 	if (rc == 0) {
 	    rc = TSS_TPMS_SIG_SCHEME_ECDAA_Marshal(&source->ecdaa, written, buffer, size);
@@ -2437,6 +2531,8 @@ TSS_TPMT_RSA_SCHEME_Marshal(const TPMT_RSA_SCHEME *source, UINT16 *written, BYTE
     return rc;
 }
 
+#ifdef TPM_TSS_MARSHAL_ALL
+
 /* Table 156 - Definition of (TPM_ALG_ID) {RSA} TPMI_ALG_RSA_DECRYPT Type */
 
 TPM_RC
@@ -2464,6 +2560,8 @@ TSS_TPMT_RSA_DECRYPT_Marshal(const TPMT_RSA_DECRYPT  *source, UINT16 *written, B
     return rc;
 }
 
+#endif	/* TPM_TSS_MARSHAL_ALL */
+
 /* Table 158 - Definition of {RSA} TPM2B_PUBLIC_KEY_RSA Structure */
 
 TPM_RC
@@ -2527,6 +2625,8 @@ TSS_TPMS_ECC_POINT_Marshal(const TPMS_ECC_POINT *source, UINT16 *written, BYTE *
     return rc;
 }
 
+#ifdef TPM_TSS_MARSHAL_ALL
+
 /* Table 163 - Definition of {ECC} TPM2B_ECC_POINT Structure */
 
 TPM_RC
@@ -2555,6 +2655,8 @@ TSS_TPM2B_ECC_POINT_Marshal(const TPM2B_ECC_POINT *source, UINT16 *written, BYTE
     return rc;
 }
 
+#endif	/* TPM_TSS_MARSHAL_ALL */
+
 /* Table 164 - Definition of (TPM_ALG_ID) {ECC} TPMI_ALG_ECC_SCHEME Type */
 
 TPM_RC
@@ -2594,6 +2696,8 @@ TSS_TPMT_ECC_SCHEME_Marshal(const TPMT_ECC_SCHEME *source, UINT16 *written, BYTE
     return rc;
 }
 
+#ifdef TPM_TSS_MARSHAL_ALL
+
 /* Table 167 - Definition of {ECC} TPMS_ALGORITHM_DETAIL_ECC Structure <OUT> */
 
 TPM_RC
@@ -2811,6 +2915,8 @@ TSS_TPMT_SIGNATURE_Marshal(const TPMT_SIGNATURE *source, UINT16 *written, BYTE *
     return rc;
 }
 
+#endif	/* TPM_TSS_MARSHAL_ALL */
+
 /* Table 175 - Definition of TPM2B_ENCRYPTED_SECRET Structure */
 
 TPM_RC
@@ -2842,14 +2948,14 @@ TSS_TPMU_PUBLIC_ID_Marshal(const TPMU_PUBLIC_ID *source, UINT16 *written, BYTE *
 {
     TPM_RC rc = 0;
     switch (selector) {
-#ifdef TPM_ALG_KEYEDHASH
+#if defined TPM_ALG_KEYEDHASH && defined TPM_TSS_MARSHAL_ALL
       case TPM_ALG_KEYEDHASH:
 	if (rc == 0) {
 	    rc = TSS_TPM2B_DIGEST_Marshal(&source->keyedHash, written, buffer, size);
 	}
 	break;
 #endif
-#ifdef TPM_ALG_SYMCIPHER
+#if defined TPM_ALG_SYMCIPHER && defined TPM_TSS_MARSHAL_ALL
       case TPM_ALG_SYMCIPHER:
 	if (rc == 0) {
 	    rc = TSS_TPM2B_DIGEST_Marshal(&source->sym, written, buffer, size);
@@ -2876,6 +2982,8 @@ TSS_TPMU_PUBLIC_ID_Marshal(const TPMU_PUBLIC_ID *source, UINT16 *written, BYTE *
     return rc;
 }
 
+#ifdef TPM_TSS_MARSHAL_ALL
+
 /* Table 178 - Definition of TPMS_KEYEDHASH_PARMS Structure */
 
 TPM_RC
@@ -2888,6 +2996,8 @@ TSS_TPMS_KEYEDHASH_PARMS_Marshal(const TPMS_KEYEDHASH_PARMS *source, UINT16 *wri
     return rc;
 }
 
+#endif	/* TPM_TSS_MARSHAL_ALL */
+
 /* Table 180 - Definition of {RSA} TPMS_RSA_PARMS Structure */
 
 TPM_RC
@@ -2936,14 +3046,14 @@ TSS_TPMU_PUBLIC_PARMS_Marshal(const TPMU_PUBLIC_PARMS *source, UINT16 *written,
 {
     TPM_RC rc = 0;
     switch (selector) {
-#ifdef TPM_ALG_KEYEDHASH
+#if defined TPM_ALG_KEYEDHASH && defined TPM_TSS_MARSHAL_ALL
       case TPM_ALG_KEYEDHASH:
 	if (rc == 0) {
 	    rc = TSS_TPMS_KEYEDHASH_PARMS_Marshal(&source->keyedHashDetail, written, buffer, size);
 	}
 	break;
 #endif
-#ifdef TPM_ALG_SYMCIPHER
+#if defined TPM_ALG_SYMCIPHER && defined TPM_TSS_MARSHAL_ALL
       case TPM_ALG_SYMCIPHER:
 	if (rc == 0) {
 	    rc = TSS_TPMS_SYMCIPHER_PARMS_Marshal(&source->symDetail, written, buffer, size);
@@ -2970,6 +3080,8 @@ TSS_TPMU_PUBLIC_PARMS_Marshal(const TPMU_PUBLIC_PARMS *source, UINT16 *written,
     return rc;
 }
 
+#ifdef TPM_TSS_MARSHAL_ALL
+
 /* Table 183 - Definition of TPMT_PUBLIC_PARMS Structure */
 
 TPM_RC
@@ -2985,6 +3097,8 @@ TSS_TPMT_PUBLIC_PARMS_Marshal(const TPMT_PUBLIC_PARMS *source, UINT16 *written,
     return rc;
 }
 
+#endif	/* TPM_TSS_MARSHAL_ALL */
+
 /* Table 184 - Definition of TPMT_PUBLIC Structure */
 
 TPM_RC
@@ -3012,6 +3126,8 @@ TSS_TPMT_PUBLIC_Marshal(const TPMT_PUBLIC *source, UINT16 *written, BYTE **buffe
     return rc;
 }
 
+#ifdef TPM_TSS_MARSHAL_ALL
+
 /* Table 184 - Definition of TPMT_PUBLIC Structure - special marshaling for derived object template */
 
 TPM_RC
@@ -3028,6 +3144,8 @@ TSS_TPMT_PUBLIC_D_Marshal(const TPMT_PUBLIC *source, UINT16 *written, BYTE **buf
     return rc;
 }
 
+#endif	/* TPM_TSS_MARSHAL_ALL */
+
 /* Table 185 - Definition of TPM2B_PUBLIC Structure */
 
 TPM_RC
@@ -3056,6 +3174,8 @@ TSS_TPM2B_PUBLIC_Marshal(const TPM2B_PUBLIC *source, UINT16 *written, BYTE **buf
     return rc;
 }
 
+#ifdef TPM_TSS_MARSHAL_ALL
+
 TPM_RC
 TSS_TPM2B_TEMPLATE_Marshal(const TPM2B_TEMPLATE *source, UINT16 *written, BYTE **buffer, INT32 *size)
 {
@@ -3066,6 +3186,8 @@ TSS_TPM2B_TEMPLATE_Marshal(const TPM2B_TEMPLATE *source, UINT16 *written, BYTE *
     return rc;
 }
 
+#endif	/* TPM_TSS_MARSHAL_ALL */
+
 /* Table 187 - Definition of TPMU_SENSITIVE_COMPOSITE Union <IN/OUT, S> */
 
 TPM_RC
@@ -3087,14 +3209,14 @@ TSS_TPMU_SENSITIVE_COMPOSITE_Marshal(const TPMU_SENSITIVE_COMPOSITE *source, UIN
 	}
 	break;
 #endif
-#ifdef TPM_ALG_KEYEDHASH
+#if defined TPM_ALG_KEYEDHASH && defined TPM_TSS_MARSHAL_ALL
       case TPM_ALG_KEYEDHASH:
 	if (rc == 0) {
 	    rc = TSS_TPM2B_SENSITIVE_DATA_Marshal(&source->bits, written, buffer, size);
 	}
 	break;
 #endif
-#ifdef TPM_ALG_SYMCIPHER
+#if defined TPM_ALG_SYMCIPHER && defined TPM_TSS_MARSHAL_ALL
       case TPM_ALG_SYMCIPHER:
 	if (rc == 0) {
 	    rc = TSS_TPM2B_SYM_KEY_Marshal(&source->sym, written, buffer, size);
@@ -3128,6 +3250,8 @@ TSS_TPMT_SENSITIVE_Marshal(const TPMT_SENSITIVE *source, UINT16 *written, BYTE *
     return rc;
 }
 
+#ifdef TPM_TSS_MARSHAL_ALL
+
 /* Table 189 - Definition of TPM2B_SENSITIVE Structure <IN/OUT> */
 
 TPM_RC
@@ -3156,6 +3280,8 @@ TSS_TPM2B_SENSITIVE_Marshal(const TPM2B_SENSITIVE *source, UINT16 *written, BYTE
     return rc;
 }
 
+#endif	/* TPM_TSS_MARSHAL_ALL */
+
 /* Table 191 - Definition of TPM2B_PRIVATE Structure <IN/OUT, S> */
 
 TPM_RC
@@ -3168,6 +3294,8 @@ TSS_TPM2B_PRIVATE_Marshal(const TPM2B_PRIVATE *source, UINT16 *written, BYTE **b
     return rc;
 }
 
+#ifdef TPM_TSS_MARSHAL_ALL
+
 /* Table 193 - Definition of TPM2B_ID_OBJECT Structure <IN/OUT> */
 
 TPM_RC
@@ -3346,3 +3474,5 @@ TSS_TPM2B_CREATION_DATA_Marshal(const TPM2B_CREATION_DATA *source, UINT16 *writt
     }
     return rc;
 }
+
+#endif	/* TPM_TSS_MARSHAL_ALL */
@@ -0,0 +1,1247 @@
+/********************************************************************************/
+/*										*/
+/*			    TSS Unmarshal					*/
+/*										*/
+/********************************************************************************/
+
+#include <string.h>
+
+#include <tss2/tssmarshal.h>
+#include <tss2/tsserror.h>
+
+/* The unmarshaling functions are the inverse of the TSS marshaling functions, limited to the
+   structures that pemtpm writes: TPM2B_PUBLIC, TPM2B_PRIVATE, and the TPM2B_SENSITIVE /
+   TPMT_SENSITIVE carried inside an unwrapped duplicate.
+
+   The prototype pattern is the TPM one:
+
+   'target' is the structure to be unmarshaled.
+   'buffer' is the input, advanced past the bytes consumed.
+   'size' is the remaining size of the input, decremented by the bytes consumed.  It is always
+   checked, since the input is never trusted.
+
+   TPMI_ functions take an extra 'allowNull' that permits TPM_ALG_NULL.  Union functions take the
+   'selector' like the marshaling functions.
+
+   Scalars are decoded directly into the target.  A TPM2B payload is bounds checked against both
+   the input and the target buffer and then copied once, directly from the input.  Nothing is
+   allocated.  A caller that only needs to validate a TPM2B_PRIVATE can skip the TPM2B_PRIVATE
+   copy by unmarshaling the TPM2B_SENSITIVE in place, starting after the TPM2B_PRIVATE size.
+*/
+
+/*
+  Basic types
+*/
+
+TPM_RC
+TSS_UINT8_Unmarshal(UINT8 *target, BYTE **buffer, INT32 *size)
+{
+    if (*size < (INT32)sizeof(UINT8)) {
+	return TPM_RC_INSUFFICIENT;
+    }
+    *target = (*buffer)[0];
+    *buffer += sizeof(UINT8);
+    *size -= sizeof(UINT8);
+    return TPM_RC_SUCCESS;
+}
+
+TPM_RC
+TSS_UINT16_Unmarshal(UINT16 *target, BYTE **buffer, INT32 *size)
+{
+    if (*size < (INT32)sizeof(UINT16)) {
+	return TPM_RC_INSUFFICIENT;
+    }
+    *target = ((UINT16)(*buffer)[0] << 8) |
+	      ((UINT16)(*buffer)[1] << 0);
+    *buffer += sizeof(UINT16);
+    *size -= sizeof(UINT16);
+    return TPM_RC_SUCCESS;
+}
+
+TPM_RC
+TSS_UINT32_Unmarshal(UINT32 *target, BYTE **buffer, INT32 *size)
+{
+    if (*size < (INT32)sizeof(UINT32)) {
+	return TPM_RC_INSUFFICIENT;
+    }
+    *target = ((UINT32)(*buffer)[0] << 24) |
+	      ((UINT32)(*buffer)[1] << 16) |
+	      ((UINT32)(*buffer)[2] <<  8) |
+	      ((UINT32)(*buffer)[3] <<  0);
+    *buffer += sizeof(UINT32);
+    *size -= sizeof(UINT32);
+    return TPM_RC_SUCCESS;
+}
+
+/* TSS_TPM2B_Unmarshal() unmarshals a TPM2B whose buffer holds at most targetSize bytes.  The
+   payload is copied once, directly from the input. */
+
+TPM_RC
+TSS_TPM2B_Unmarshal(TPM2B *target, UINT16 targetSize, BYTE **buffer, INT32 *size)
+{
+    TPM_RC rc = 0;
+    if (rc == 0) {
+	rc = TSS_UINT16_Unmarshal(&target->size, buffer, size);
+    }
+    if (rc == 0) {
+	if (target->size > targetSize) {
+	    target->size = 0;
+	    rc = TPM_RC_SIZE;
+	}
+    }
+    if (rc == 0) {
+	if (*size < (INT32)target->size) {
+	    target->size = 0;
+	    rc = TPM_RC_INSUFFICIENT;
+	}
+    }
+    if (rc == 0) {
+	memcpy(target->buffer, *buffer, target->size);
+	*buffer += target->size;
+	*size -= target->size;
+    }
+    return rc;
+}
+
+/* Table 9 - Definition of (UINT16) TPM_ALG_ID Constants <IN/OUT, S> */
+
+TPM_RC
+TSS_TPM_ALG_ID_Unmarshal(TPM_ALG_ID *target, BYTE **buffer, INT32 *size)
+{
+    TPM_RC rc = 0;
+    if (rc == 0) {
+	rc = TSS_UINT16_Unmarshal(target, buffer, size);
+    }
+    return rc;
+}
+
+/* Table 11 - Definition of (UINT16) {ECC} TPM_ECC_CURVE Constants <IN/OUT, S> */
+
+TPM_RC
+TSS_TPM_ECC_CURVE_Unmarshal(TPM_ECC_CURVE *target, BYTE **buffer, INT32 *size)
+{
+    TPM_RC rc = 0;
+    if (rc == 0) {
+	rc = TSS_UINT16_Unmarshal(target, buffer, size);
+    }
+    return rc;
+}
+
+/* Table 31 - Definition of (UINT32) TPMA_OBJECT Bits */
+
+TPM_RC
+TSS_TPMA_OBJECT_Unmarshal(TPMA_OBJECT *target, BYTE **buffer, INT32 *size)
+{
+    TPM_RC rc = 0;
+    if (rc == 0) {
+	rc = TSS_UINT32_Unmarshal(&target->val, buffer, size);
+    }
+    if (rc == 0) {
+	if (target->val & TPMA_OBJECT_RESERVED) {
+	    rc = TPM_RC_RESERVED_BITS;
+	}
+    }
+    return rc;
+}
+
+/* Table 57 - Definition of (TPM_ALG_ID) TPMI_ALG_HASH Type */
+
+TPM_RC
+TSS_TPMI_ALG_HASH_Unmarshal(TPMI_ALG_HASH *target, BYTE **buffer, INT32 *size, BOOL allowNull)
+{
+    TPM_RC rc = 0;
+    if (rc == 0) {
+	rc = TSS_TPM_ALG_ID_Unmarshal(target, buffer, size);
+    }
+    if (rc == 0) {
+	switch (*target) {
+#ifdef TPM_ALG_SHA1
+	  case TPM_ALG_SHA1:
+#endif
+#ifdef TPM_ALG_SHA256
+	  case TPM_ALG_SHA256:
+#endif
+#ifdef TPM_ALG_SHA384
+	  case TPM_ALG_SHA384:
+#endif
+#ifdef TPM_ALG_SHA512
+	  case TPM_ALG_SHA512:
+#endif
+#ifdef TPM_ALG_SM3_256
+	  case TPM_ALG_SM3_256:
+#endif
+	    break;
+	  case TPM_ALG_NULL:
+	    if (allowNull) {
+		break;
+	    }
+	    /* fall through */
+	  default:
+	    rc = TPM_RC_HASH;
+	}
+    }
+    return rc;
+}
+
+/* Table 60 - Definition of (TPM_ALG_ID) TPMI_ALG_SYM_OBJECT Type */
+
+TPM_RC
+TSS_TPMI_ALG_SYM_OBJECT_Unmarshal(TPMI_ALG_SYM_OBJECT *target, BYTE **buffer, INT32 *size, BOOL allowNull)
+{
+    TPM_RC rc = 0;
+    if (rc == 0) {
+	rc = TSS_TPM_ALG_ID_Unmarshal(target, buffer, size);
+    }
+    if (rc == 0) {
+	switch (*target) {
+#ifdef TPM_ALG_AES
+	  case TPM_ALG_AES:
+#endif
+#ifdef TPM_ALG_SM4
+	  case TPM_ALG_SM4:
+#endif
+#ifdef TPM_ALG_CAMELLIA
+	  case TPM_ALG_CAMELLIA:
+#endif
+	    break;
+	  case TPM_ALG_NULL:
+	    if (allowNull) {
+		break;
+	    }
+	    /* fall through */
+	  default:
+	    rc = TPM_RC_SYMMETRIC;
+	}
+    }
+    return rc;
+}
+
+/* Table 61 - Definition of (TPM_ALG_ID) TPMI_ALG_SYM_MODE Type */
+
+TPM_RC
+TSS_TPMI_ALG_SYM_MODE_Unmarshal(TPMI_ALG_SYM_MODE *target, BYTE **buffer, INT32 *size, BOOL allowNull)
+{
+    TPM_RC rc = 0;
+    if (rc == 0) {
+	rc = TSS_TPM_ALG_ID_Unmarshal(target, buffer, size);
+    }
+    if (rc == 0) {
+	switch (*target) {
+#ifdef TPM_ALG_CTR
+	  case TPM_ALG_CTR:
+#endif
+#ifdef TPM_ALG_OFB
+	  case TPM_ALG_OFB:
+#endif
+#ifdef TPM_ALG_CBC
+	  case TPM_ALG_CBC:
+#endif
+#ifdef TPM_ALG_CFB
+	  case TPM_ALG_CFB:
+#endif
+#ifdef TPM_ALG_ECB
+	  case TPM_ALG_ECB:
+#endif
+	    break;
+	  case TPM_ALG_NULL:
+	    if (allowNull) {
+		break;
+	    }
+	    /* fall through */
+	  default:
+	    rc = TPM_RC_MODE;
+	}
+    }
+    return rc;
+}
+
+/* Table 62 - Definition of (TPM_ALG_ID) TPMI_ALG_KDF Type */
+
+TPM_RC
+TSS_TPMI_ALG_KDF_Unmarshal(TPMI_ALG_KDF *target, BYTE **buffer, INT32 *size, BOOL allowNull)
+{
+    TPM_RC rc = 0;
+    if (rc == 0) {
+	rc = TSS_TPM_ALG_ID_Unmarshal(target, buffer, size);
+    }
+    if (rc == 0) {
+	switch (*target) {
+#ifdef TPM_ALG_MGF1
+	  case TPM_ALG_MGF1:
+#endif
+#ifdef TPM_ALG_KDF1_SP800_56A
+	  case TPM_ALG_KDF1_SP800_56A:
+#endif
+#ifdef TPM_ALG_KDF2
+	  case TPM_ALG_KDF2:
+#endif
+#ifdef TPM_ALG_KDF1_SP800_108
+	  case TPM_ALG_KDF1_SP800_108:
+#endif
+	    break;
+	  case TPM_ALG_NULL:
+	    if (allowNull) {
+		break;
+	    }
+	    /* fall through */
+	  default:
+	    rc = TPM_RC_KDF;
+	}
+    }
+    return rc;
+}
+
+/* Table 71 - Definition of TPM2B_DIGEST Structure */
+
+TPM_RC
+TSS_TPM2B_DIGEST_Unmarshal(TPM2B_DIGEST *target, BYTE **buffer, INT32 *size)
+{
+    TPM_RC rc = 0;
+    if (rc == 0) {
+	rc = TSS_TPM2B_Unmarshal(&target->b, sizeof(target->t.buffer), buffer, size);
+    }
+    return rc;
+}
+
+/* Table 75 - Definition of Types for TPM2B_AUTH */
+
+TPM_RC
+TSS_TPM2B_AUTH_Unmarshal(TPM2B_AUTH *target, BYTE **buffer, INT32 *size)
+{
+    TPM_RC rc = 0;
+    if (rc == 0) {
+	rc = TSS_TPM2B_Unmarshal(&target->b, sizeof(target->t.buffer), buffer, size);
+    }
+    return rc;
+}
+
+/* Table 125 - Definition of TPMU_SYM_KEY_BITS Union */
+
+TPM_RC
+TSS_TPMU_SYM_KEY_BITS_Unmarshal(TPMU_SYM_KEY_BITS *target, BYTE **buffer, INT32 *size, UINT32 selector)
+{
+    TPM_RC rc = 0;
+    switch (selector) {
+#ifdef TPM_ALG_AES
+      case TPM_ALG_AES:
+	if (rc == 0) {
+	    rc = TSS_UINT16_Unmarshal(&target->aes, buffer, size);
+	}
+	if (rc == 0) {
+	    if ((target->aes != 128) && (target->aes != 192) && (target->aes != 256)) {
+		rc = TPM_RC_KEY_SIZE;
+	    }
+	}
+	break;
+#endif
+#ifdef TPM_ALG_SM4
+      case TPM_ALG_SM4:
+	if (rc == 0) {
+	    rc = TSS_UINT16_Unmarshal(&target->sm4, buffer, size);
+	}
+	if (rc == 0) {
+	    if (target->sm4 != 128) {
+		rc = TPM_RC_KEY_SIZE;
+	    }
+	}
+	break;
+#endif
+#ifdef TPM_ALG_CAMELLIA
+      case TPM_ALG_CAMELLIA:
+	if (rc == 0) {
+	    rc = TSS_UINT16_Unmarshal(&target->camellia, buffer, size);
+	}
+	if (rc == 0) {
+	    if ((target->camellia != 128) && (target->camellia != 192) &&
+		(target->camellia != 256)) {
+		rc = TPM_RC_KEY_SIZE;
+	    }
+	}
+	break;
+#endif
+      case TPM_ALG_NULL:
+	break;
+      default:
+	rc = TPM_RC_SELECTOR;
+    }
+    return rc;
+}
+
+/* Table 126 - Definition of TPMU_SYM_MODE Union */
+
+TPM_RC
+TSS_TPMU_SYM_MODE_Unmarshal(TPMU_SYM_MODE *target, BYTE **buffer, INT32 *size, UINT32 selector)
+{
+    TPM_RC rc = 0;
+    switch (selector) {
+#ifdef TPM_ALG_AES
+      case TPM_ALG_AES:
+	if (rc == 0) {
+	    rc = TSS_TPMI_ALG_SYM_MODE_Unmarshal(&target->aes, buffer, size, YES);
+	}
+	break;
+#endif
+#ifdef TPM_ALG_SM4
+      case TPM_ALG_SM4:
+	if (rc == 0) {
+	    rc = TSS_TPMI_ALG_SYM_MODE_Unmarshal(&target->sm4, buffer, size, YES);
+	}
+	break;
+#endif
+#ifdef TPM_ALG_CAMELLIA
+      case TPM_ALG_CAMELLIA:
+	if (rc == 0) {
+	    rc = TSS_TPMI_ALG_SYM_MODE_Unmarshal(&target->camellia, buffer, size, YES);
+	}
+	break;
+#endif
+      case TPM_ALG_NULL:
+	break;
+      default:
+	rc = TPM_RC_SELECTOR;
+    }
+    return rc;
+}
+
+/* Table 129 - Definition of TPMT_SYM_DEF_OBJECT Structure */
+
+TPM_RC
+TSS_TPMT_SYM_DEF_OBJECT_Unmarshal(TPMT_SYM_DEF_OBJECT *target, BYTE **buffer, INT32 *size, BOOL allowNull)
+{
+    TPM_RC rc = 0;
+    if (rc == 0) {
+	rc = TSS_TPMI_ALG_SYM_OBJECT_Unmarshal(&target->algorithm, buffer, size, allowNull);
+    }
+    if (rc == 0) {
+	rc = TSS_TPMU_SYM_KEY_BITS_Unmarshal(&target->keyBits, buffer, size, target->algorithm);
+    }
+    if (rc == 0) {
+	rc = TSS_TPMU_SYM_MODE_Unmarshal(&target->mode, buffer, size, target->algorithm);
+    }
+    return rc;
+}
+
+/* Table 130 - Definition of TPM2B_SYM_KEY Structure */
+
+TPM_RC
+TSS_TPM2B_SYM_KEY_Unmarshal(TPM2B_SYM_KEY *target, BYTE **buffer, INT32 *size)
+{
+    TPM_RC rc = 0;
+    if (rc == 0) {
+	rc = TSS_TPM2B_Unmarshal(&target->b, sizeof(target->t.buffer), buffer, size);
+    }
+    return rc;
+}
+
+/* Table 131 - Definition of TPMS_SYMCIPHER_PARMS Structure */
+
+TPM_RC
+TSS_TPMS_SYMCIPHER_PARMS_Unmarshal(TPMS_SYMCIPHER_PARMS *target, BYTE **buffer, INT32 *size)
+{
+    TPM_RC rc = 0;
+    if (rc == 0) {
+	rc = TSS_TPMT_SYM_DEF_OBJECT_Unmarshal(&target->sym, buffer, size, NO);
+    }
+    return rc;
+}
+
+/* Table 134 - Definition of TPM2B_SENSITIVE_DATA Structure */
+
+TPM_RC
+TSS_TPM2B_SENSITIVE_DATA_Unmarshal(TPM2B_SENSITIVE_DATA *target, BYTE **buffer, INT32 *size)
+{
+    TPM_RC rc = 0;
+    if (rc == 0) {
+	rc = TSS_TPM2B_Unmarshal(&target->b, sizeof(target->t.buffer), buffer, size);
+    }
+    return rc;
+}
+
+/* Table 137 - Definition of TPMS_SCHEME_HASH Structure */
+
+TPM_RC
+TSS_TPMS_SCHEME_HASH_Unmarshal(TPMS_SCHEME_HASH *target, BYTE **buffer, INT32 *size)
+{
+    TPM_RC rc = 0;
+    if (rc == 0) {
+	rc = TSS_TPMI_ALG_HASH_Unmarshal(&target->hashAlg, buffer, size, NO);
+    }
+    return rc;
+}
+
+/* Table 138 - Definition of {ECC} TPMS_SCHEME_ECDAA Structure */
+
+TPM_RC
+TSS_TPMS_SCHEME_ECDAA_Unmarshal(TPMS_SCHEME_ECDAA *target, BYTE **buffer, INT32 *size)
+{
+    TPM_RC rc = 0;
+    if (rc == 0) {
+	rc = TSS_TPMI_ALG_HASH_Unmarshal(&target->hashAlg, buffer, size, NO);
+    }
+    if (rc == 0) {
+	rc = TSS_UINT16_Unmarshal(&target->count, buffer, size);
+    }
+    return rc;
+}
+
+/* Table 139 - Definition of (TPM_ALG_ID) TPMI_ALG_KEYEDHASH_SCHEME Type */
+
+TPM_RC
+TSS_TPMI_ALG_KEYEDHASH_SCHEME_Unmarshal(TPMI_ALG_KEYEDHASH_SCHEME *target, BYTE **buffer, INT32 *size, BOOL allowNull)
+{
+    TPM_RC rc = 0;
+    if (rc == 0) {
+	rc = TSS_TPM_ALG_ID_Unmarshal(target, buffer, size);
+    }
+    if (rc == 0) {
+	switch (*target) {
+#ifdef TPM_ALG_HMAC
+	  case TPM_ALG_HMAC:
+#endif
+#ifdef TPM_ALG_XOR
+	  case TPM_ALG_XOR:
+#endif
+	    break;
+	  case TPM_ALG_NULL:
+	    if (allowNull) {
+		break;
+	    }
+	    /* fall through */
+	  default:
+	    rc = TPM_RC_VALUE;
+	}
+    }
+    return rc;
+}
+
+/* Table 141 - Definition of TPMS_SCHEME_XOR Structure */
+
+TPM_RC
+TSS_TPMS_SCHEME_XOR_Unmarshal(TPMS_SCHEME_XOR *target, BYTE **buffer, INT32 *size)
+{
+    TPM_RC rc = 0;
+    if (rc == 0) {
+	rc = TSS_TPMI_ALG_HASH_Unmarshal(&target->hashAlg, buffer, size, NO);
+    }
+    if (rc == 0) {
+	rc = TSS_TPMI_ALG_KDF_Unmarshal(&target->kdf, buffer, size, YES);
+    }
+    return rc;
+}
+
+/* Table 142 - Definition of TPMU_SCHEME_KEYEDHASH Union <IN/OUT, S> */
+
+TPM_RC
+TSS_TPMU_SCHEME_KEYEDHASH_Unmarshal(TPMU_SCHEME_KEYEDHASH *target, BYTE **buffer, INT32 *size, UINT32 selector)
+{
+    TPM_RC rc = 0;
+    switch (selector) {
+#ifdef TPM_ALG_HMAC
+      case TPM_ALG_HMAC:
+	if (rc == 0) {
+	    rc = TSS_TPMS_SCHEME_HASH_Unmarshal(&target->hmac, buffer, size);
+	}
+	break;
+#endif
+#ifdef TPM_ALG_XOR
+      case TPM_ALG_XOR:
+	if (rc == 0) {
+	    rc = TSS_TPMS_SCHEME_XOR_Unmarshal(&target->xorr, buffer, size);
+	}
+	break;
+#endif
+      case TPM_ALG_NULL:
+	break;
+      default:
+	rc = TPM_RC_SELECTOR;
+    }
+    return rc;
+}
+
+/* Table 143 - Definition of TPMT_KEYEDHASH_SCHEME Structure */
+
+TPM_RC
+TSS_TPMT_KEYEDHASH_SCHEME_Unmarshal(TPMT_KEYEDHASH_SCHEME *target, BYTE **buffer, INT32 *size, BOOL allowNull)
+{
+    TPM_RC rc = 0;
+    if (rc == 0) {
+	rc = TSS_TPMI_ALG_KEYEDHASH_SCHEME_Unmarshal(&target->scheme, buffer, size, allowNull);
+    }
+    if (rc == 0) {
+	rc = TSS_TPMU_SCHEME_KEYEDHASH_Unmarshal(&target->details, buffer, size, target->scheme);
+    }
+    return rc;
+}
+
+/* Table 148 - Definition of TPMU_KDF_SCHEME Union <IN/OUT, S> */
+
+TPM_RC
+TSS_TPMU_KDF_SCHEME_Unmarshal(TPMU_KDF_SCHEME *target, BYTE **buffer, INT32 *size, UINT32 selector)
+{
+    TPM_RC rc = 0;
+    switch (selector) {
+#ifdef TPM_ALG_MGF1
+      case TPM_ALG_MGF1:
+	if (rc == 0) {
+	    rc = TSS_TPMS_SCHEME_HASH_Unmarshal(&target->mgf1, buffer, size);
+	}
+	break;
+#endif
+#ifdef TPM_ALG_KDF1_SP800_56A
+      case TPM_ALG_KDF1_SP800_56A:
+	if (rc == 0) {
+	    rc = TSS_TPMS_SCHEME_HASH_Unmarshal(&target->kdf1_SP800_56a, buffer, size);
+	}
+	break;
+#endif
+#ifdef TPM_ALG_KDF2
+      case TPM_ALG_KDF2:
+	if (rc == 0) {
+	    rc = TSS_TPMS_SCHEME_HASH_Unmarshal(&target->kdf2, buffer, size);
+	}
+	break;
+#endif
+#ifdef TPM_ALG_KDF1_SP800_108
+      case TPM_ALG_KDF1_SP800_108:
+	if (rc == 0) {
+	    rc = TSS_TPMS_SCHEME_HASH_Unmarshal(&target->kdf1_sp800_108, buffer, size);
+	}
+	break;
+#endif
+      case TPM_ALG_NULL:
+	break;
+      default:
+	rc = TPM_RC_SELECTOR;
+    }
+    return rc;
+}
+
+/* Table 149 - Definition of TPMT_KDF_SCHEME Structure */
+
+TPM_RC
+TSS_TPMT_KDF_SCHEME_Unmarshal(TPMT_KDF_SCHEME *target, BYTE **buffer, INT32 *size, BOOL allowNull)
+{
+    TPM_RC rc = 0;
+    if (rc == 0) {
+	rc = TSS_TPMI_ALG_KDF_Unmarshal(&target->scheme, buffer, size, allowNull);
+    }
+    if (rc == 0) {
+	rc = TSS_TPMU_KDF_SCHEME_Unmarshal(&target->details, buffer, size, target->scheme);
+    }
+    return rc;
+}
+
+/* Table 151 - Definition of TPMU_ASYM_SCHEME Union */
+
+TPM_RC
+TSS_TPMU_ASYM_SCHEME_Unmarshal(TPMU_ASYM_SCHEME *target, BYTE **buffer, INT32 *size, UINT32 selector)
+{
+    TPM_RC rc = 0;
+    switch (selector) {
+#ifdef TPM_ALG_ECDH
+      case TPM_ALG_ECDH:
+	if (rc == 0) {
+	    rc = TSS_TPMS_SCHEME_HASH_Unmarshal(&target->ecdh, buffer, size);
+	}
+	break;
+#endif
+#ifdef TPM_ALG_ECMQV
+      case TPM_ALG_ECMQV:
+	if (rc == 0) {
+	    rc = TSS_TPMS_SCHEME_HASH_Unmarshal(&target->ecmqvh, buffer, size);
+	}
+	break;
+#endif
+#ifdef TPM_ALG_RSASSA
+      case TPM_ALG_RSASSA:
+	if (rc == 0) {
+	    rc = TSS_TPMS_SCHEME_HASH_Unmarshal(&target->rsassa, buffer, size);
+	}
+	break;
+#endif
+#ifdef TPM_ALG_RSAPSS
+      case TPM_ALG_RSAPSS:
+	if (rc == 0) {
+	    rc = TSS_TPMS_SCHEME_HASH_Unmarshal(&target->rsapss, buffer, size);
+	}
+	break;
+#endif
+#ifdef TPM_ALG_ECDSA
+      case TPM_ALG_ECDSA:
+	if (rc == 0) {
+	    rc = TSS_TPMS_SCHEME_HASH_Unmarshal(&target->ecdsa, buffer, size);
+	}
+	break;
+#endif
+#ifdef TPM_ALG_ECDAA
+      case TPM_ALG_ECDAA:
+	if (rc == 0) {
+	    rc = TSS_TPMS_SCHEME_ECDAA_Unmarshal(&target->ecdaa, buffer, size);
+	}
+	break;
+#endif
+#ifdef TPM_ALG_SM2
+      case TPM_ALG_SM2:
+	if (rc == 0) {
+	    rc = TSS_TPMS_SCHEME_HASH_Unmarshal(&target->sm2, buffer, size);
+	}
+	break;
+#endif
+#ifdef TPM_ALG_ECSCHNORR
+      case TPM_ALG_ECSCHNORR:
+	if (rc == 0) {
+	    rc = TSS_TPMS_SCHEME_HASH_Unmarshal(&target->ecSchnorr, buffer, size);
+	}
+	break;
+#endif
+#ifdef TPM_ALG_RSAES
+      case TPM_ALG_RSAES:
+	break;
+#endif
+#ifdef TPM_ALG_OAEP
+      case TPM_ALG_OAEP:
+	if (rc == 0) {
+	    rc = TSS_TPMS_SCHEME_HASH_Unmarshal(&target->oaep, buffer, size);
+	}
+	break;
+#endif
+      case TPM_ALG_NULL:
+	break;
+      default:
+	rc = TPM_RC_SELECTOR;
+    }
+    return rc;
+}
+
+/* Table 154 - Definition of (TPM_ALG_ID) {RSA} TPMI_ALG_RSA_SCHEME Type */
+
+TPM_RC
+TSS_TPMI_ALG_RSA_SCHEME_Unmarshal(TPMI_ALG_RSA_SCHEME *target, BYTE **buffer, INT32 *size, BOOL allowNull)
+{
+    TPM_RC rc = 0;
+    if (rc == 0) {
+	rc = TSS_TPM_ALG_ID_Unmarshal(target, buffer, size);
+    }
+    if (rc == 0) {
+	switch (*target) {
+#ifdef TPM_ALG_RSASSA
+	  case TPM_ALG_RSASSA:
+#endif
+#ifdef TPM_ALG_RSAPSS
+	  case TPM_ALG_RSAPSS:
+#endif
+#ifdef TPM_ALG_RSAES
+	  case TPM_ALG_RSAES:
+#endif
+#ifdef TPM_ALG_OAEP
+	  case TPM_ALG_OAEP:
+#endif
+	    break;
+	  case TPM_ALG_NULL:
+	    if (allowNull) {
+		break;
+	    }
+	    /* fall through */
+	  default:
+	    rc = TPM_RC_VALUE;
+	}
+    }
+    return rc;
+}
+
+/* Table 155 - Definition of {RSA} TPMT_RSA_SCHEME Structure */
+
+TPM_RC
+TSS_TPMT_RSA_SCHEME_Unmarshal(TPMT_RSA_SCHEME *target, BYTE **buffer, INT32 *size, BOOL allowNull)
+{
+    TPM_RC rc = 0;
+    if (rc == 0) {
+	rc = TSS_TPMI_ALG_RSA_SCHEME_Unmarshal(&target->scheme, buffer, size, allowNull);
+    }
+    if (rc == 0) {
+	rc = TSS_TPMU_ASYM_SCHEME_Unmarshal(&target->details, buffer, size, target->scheme);
+    }
+    return rc;
+}
+
+/* Table 158 - Definition of {RSA} TPM2B_PUBLIC_KEY_RSA Structure */
+
+TPM_RC
+TSS_TPM2B_PUBLIC_KEY_RSA_Unmarshal(TPM2B_PUBLIC_KEY_RSA *target, BYTE **buffer, INT32 *size)
+{
+    TPM_RC rc = 0;
+    if (rc == 0) {
+	rc = TSS_TPM2B_Unmarshal(&target->b, sizeof(target->t.buffer), buffer, size);
+    }
+    return rc;
+}
+
+/* Table 159 - Definition of {RSA} (TPM_KEY_BITS) TPMI_RSA_KEY_BITS Type */
+
+TPM_RC
+TSS_TPMI_RSA_KEY_BITS_Unmarshal(TPMI_RSA_KEY_BITS *target, BYTE **buffer, INT32 *size)
+{
+    TPM_RC rc = 0;
+    if (rc == 0) {
+	rc = TSS_UINT16_Unmarshal(target, buffer, size);
+    }
+    if (rc == 0) {
+	if ((*target == 0) || (*target > (MAX_RSA_KEY_BYTES * 8)) || ((*target % 8) != 0)) {
+	    rc = TPM_RC_VALUE;
+	}
+    }
+    return rc;
+}
+
+/* Table 160 - Definition of {RSA} TPM2B_PRIVATE_KEY_RSA Structure */
+
+TPM_RC
+TSS_TPM2B_PRIVATE_KEY_RSA_Unmarshal(TPM2B_PRIVATE_KEY_RSA *target, BYTE **buffer, INT32 *size)
+{
+    TPM_RC rc = 0;
+    if (rc == 0) {
+	rc = TSS_TPM2B_Unmarshal(&target->b, sizeof(target->t.buffer), buffer, size);
+    }
+    return rc;
+}
+
+/* Table 161 - Definition of {ECC} TPM2B_ECC_PARAMETER Structure */
+
+TPM_RC
+TSS_TPM2B_ECC_PARAMETER_Unmarshal(TPM2B_ECC_PARAMETER *target, BYTE **buffer, INT32 *size)
+{
+    TPM_RC rc = 0;
+    if (rc == 0) {
+	rc = TSS_TPM2B_Unmarshal(&target->b, sizeof(target->t.buffer), buffer, size);
+    }
+    return rc;
+}
+
+/* Table 162 - Definition of {ECC} TPMS_ECC_POINT Structure */
+
+TPM_RC
+TSS_TPMS_ECC_POINT_Unmarshal(TPMS_ECC_POINT *target, BYTE **buffer, INT32 *size)
+{
+    TPM_RC rc = 0;
+    if (rc == 0) {
+	rc = TSS_TPM2B_ECC_PARAMETER_Unmarshal(&target->x, buffer, size);
+    }
+    if (rc == 0) {
+	rc = TSS_TPM2B_ECC_PARAMETER_Unmarshal(&target->y, buffer, size);
+    }
+    return rc;
+}
+
+/* Table 164 - Definition of (TPM_ALG_ID) {ECC} TPMI_ALG_ECC_SCHEME Type */
+
+TPM_RC
+TSS_TPMI_ALG_ECC_SCHEME_Unmarshal(TPMI_ALG_ECC_SCHEME *target, BYTE **buffer, INT32 *size, BOOL allowNull)
+{
+    TPM_RC rc = 0;
+    if (rc == 0) {
+	rc = TSS_TPM_ALG_ID_Unmarshal(target, buffer, size);
+    }
+    if (rc == 0) {
+	switch (*target) {
+#ifdef TPM_ALG_ECDSA
+	  case TPM_ALG_ECDSA:
+#endif
+#ifdef TPM_ALG_ECDAA
+	  case TPM_ALG_ECDAA:
+#endif
+#ifdef TPM_ALG_SM2
+	  case TPM_ALG_SM2:
+#endif
+#ifdef TPM_ALG_ECSCHNORR
+	  case TPM_ALG_ECSCHNORR:
+#endif
+#ifdef TPM_ALG_ECDH
+	  case TPM_ALG_ECDH:
+#endif
+#ifdef TPM_ALG_ECMQV
+	  case TPM_ALG_ECMQV:
+#endif
+	    break;
+	  case TPM_ALG_NULL:
+	    if (allowNull) {
+		break;
+	    }
+	    /* fall through */
+	  default:
+	    rc = TPM_RC_SCHEME;
+	}
+    }
+    return rc;
+}
+
+/* Table 165 - Definition of {ECC} (TPM_ECC_CURVE) TPMI_ECC_CURVE Type */
+
+TPM_RC
+TSS_TPMI_ECC_CURVE_Unmarshal(TPMI_ECC_CURVE *target, BYTE **buffer, INT32 *size)
+{
+    TPM_RC rc = 0;
+    if (rc == 0) {
+	rc = TSS_TPM_ECC_CURVE_Unmarshal(target, buffer, size);
+    }
+    if (rc == 0) {
+	switch (*target) {
+#if ECC_BN_P256
+	  case TPM_ECC_BN_P256:
+#endif
+#if ECC_NIST_P256
+	  case TPM_ECC_NIST_P256:
+#endif
+#if ECC_NIST_P384
+	  case TPM_ECC_NIST_P384:
+#endif
+	    break;
+	  default:
+	    rc = TPM_RC_CURVE;
+	}
+    }
+    return rc;
+}
+
+/* Table 166 - Definition of (TPMT_SIG_SCHEME) {ECC} TPMT_ECC_SCHEME Structure */
+
+TPM_RC
+TSS_TPMT_ECC_SCHEME_Unmarshal(TPMT_ECC_SCHEME *target, BYTE **buffer, INT32 *size, BOOL allowNull)
+{
+    TPM_RC rc = 0;
+    if (rc == 0) {
+	rc = TSS_TPMI_ALG_ECC_SCHEME_Unmarshal(&target->scheme, buffer, size, allowNull);
+    }
+    if (rc == 0) {
+	rc = TSS_TPMU_ASYM_SCHEME_Unmarshal(&target->details, buffer, size, target->scheme);
+    }
+    return rc;
+}
+
+/* Table 176 - Definition of (TPM_ALG_ID) TPMI_ALG_PUBLIC Type */
+
+TPM_RC
+TSS_TPMI_ALG_PUBLIC_Unmarshal(TPMI_ALG_PUBLIC *target, BYTE **buffer, INT32 *size)
+{
+    TPM_RC rc = 0;
+    if (rc == 0) {
+	rc = TSS_TPM_ALG_ID_Unmarshal(target, buffer, size);
+    }
+    if (rc == 0) {
+	switch (*target) {
+#ifdef TPM_ALG_KEYEDHASH
+	  case TPM_ALG_KEYEDHASH:
+#endif
+#ifdef TPM_ALG_RSA
+	  case TPM_ALG_RSA:
+#endif
+#ifdef TPM_ALG_ECC
+	  case TPM_ALG_ECC:
+#endif
+#ifdef TPM_ALG_SYMCIPHER
+	  case TPM_ALG_SYMCIPHER:
+#endif
+	    break;
+	  default:
+	    rc = TPM_RC_TYPE;
+	}
+    }
+    return rc;
+}
+
+/* Table 177 - Definition of TPMU_PUBLIC_ID Union <IN/OUT, S> */
+
+TPM_RC
+TSS_TPMU_PUBLIC_ID_Unmarshal(TPMU_PUBLIC_ID *target, BYTE **buffer, INT32 *size, UINT32 selector)
+{
+    TPM_RC rc = 0;
+    switch (selector) {
+#ifdef TPM_ALG_KEYEDHASH
+      case TPM_ALG_KEYEDHASH:
+	if (rc == 0) {
+	    rc = TSS_TPM2B_DIGEST_Unmarshal(&target->keyedHash, buffer, size);
+	}
+	break;
+#endif
+#ifdef TPM_ALG_SYMCIPHER
+      case TPM_ALG_SYMCIPHER:
+	if (rc == 0) {
+	    rc = TSS_TPM2B_DIGEST_Unmarshal(&target->sym, buffer, size);
+	}
+	break;
+#endif
+#ifdef TPM_ALG_RSA
+      case TPM_ALG_RSA:
+	if (rc == 0) {
+	    rc = TSS_TPM2B_PUBLIC_KEY_RSA_Unmarshal(&target->rsa, buffer, size);
+	}
+	break;
+#endif
+#ifdef TPM_ALG_ECC
+      case TPM_ALG_ECC:
+	if (rc == 0) {
+	    rc = TSS_TPMS_ECC_POINT_Unmarshal(&target->ecc, buffer, size);
+	}
+	break;
+#endif
+      default:
+	rc = TPM_RC_SELECTOR;
+    }
+    return rc;
+}
+
+/* Table 178 - Definition of TPMS_KEYEDHASH_PARMS Structure */
+
+TPM_RC
+TSS_TPMS_KEYEDHASH_PARMS_Unmarshal(TPMS_KEYEDHASH_PARMS *target, BYTE **buffer, INT32 *size)
+{
+    TPM_RC rc = 0;
+    if (rc == 0) {
+	rc = TSS_TPMT_KEYEDHASH_SCHEME_Unmarshal(&target->scheme, buffer, size, YES);
+    }
+    return rc;
+}
+
+/* Table 180 - Definition of {RSA} TPMS_RSA_PARMS Structure */
+
+TPM_RC
+TSS_TPMS_RSA_PARMS_Unmarshal(TPMS_RSA_PARMS *target, BYTE **buffer, INT32 *size)
+{
+    TPM_RC rc = 0;
+    if (rc == 0) {
+	rc = TSS_TPMT_SYM_DEF_OBJECT_Unmarshal(&target->symmetric, buffer, size, YES);
+    }
+    if (rc == 0) {
+	rc = TSS_TPMT_RSA_SCHEME_Unmarshal(&target->scheme, buffer, size, YES);
+    }
+    if (rc == 0) {
+	rc = TSS_TPMI_RSA_KEY_BITS_Unmarshal(&target->keyBits, buffer, size);
+    }
+    if (rc == 0) {
+	rc = TSS_UINT32_Unmarshal(&target->exponent, buffer, size);
+    }
+    return rc;
+}
+
+/* Table 181 - Definition of {ECC} TPMS_ECC_PARMS Structure */
+
+TPM_RC
+TSS_TPMS_ECC_PARMS_Unmarshal(TPMS_ECC_PARMS *target, BYTE **buffer, INT32 *size)
+{
+    TPM_RC rc = 0;
+    if (rc == 0) {
+	rc = TSS_TPMT_SYM_DEF_OBJECT_Unmarshal(&target->symmetric, buffer, size, YES);
+    }
+    if (rc == 0) {
+	rc = TSS_TPMT_ECC_SCHEME_Unmarshal(&target->scheme, buffer, size, YES);
+    }
+    if (rc == 0) {
+	rc = TSS_TPMI_ECC_CURVE_Unmarshal(&target->curveID, buffer, size);
+    }
+    if (rc == 0) {
+	rc = TSS_TPMT_KDF_SCHEME_Unmarshal(&target->kdf, buffer, size, YES);
+    }
+    return rc;
+}
+
+/* Table 182 - Definition of TPMU_PUBLIC_PARMS Union <IN/OUT, S> */
+
+TPM_RC
+TSS_TPMU_PUBLIC_PARMS_Unmarshal(TPMU_PUBLIC_PARMS *target, BYTE **buffer, INT32 *size, UINT32 selector)
+{
+    TPM_RC rc = 0;
+    switch (selector) {
+#ifdef TPM_ALG_KEYEDHASH
+      case TPM_ALG_KEYEDHASH:
+	if (rc == 0) {
+	    rc = TSS_TPMS_KEYEDHASH_PARMS_Unmarshal(&target->keyedHashDetail, buffer, size);
+	}
+	break;
+#endif
+#ifdef TPM_ALG_SYMCIPHER
+      case TPM_ALG_SYMCIPHER:
+	if (rc == 0) {
+	    rc = TSS_TPMS_SYMCIPHER_PARMS_Unmarshal(&target->symDetail, buffer, size);
+	}
+	break;
+#endif
+#ifdef TPM_ALG_RSA
+      case TPM_ALG_RSA:
+	if (rc == 0) {
+	    rc = TSS_TPMS_RSA_PARMS_Unmarshal(&target->rsaDetail, buffer, size);
+	}
+	break;
+#endif
+#ifdef TPM_ALG_ECC
+      case TPM_ALG_ECC:
+	if (rc == 0) {
+	    rc = TSS_TPMS_ECC_PARMS_Unmarshal(&target->eccDetail, buffer, size);
+	}
+	break;
+#endif
+      default:
+	rc = TPM_RC_SELECTOR;
+    }
+    return rc;
+}
+
+/* Table 184 - Definition of TPMT_PUBLIC Structure */
+
+TPM_RC
+TSS_TPMT_PUBLIC_Unmarshal(TPMT_PUBLIC *target, BYTE **buffer, INT32 *size, BOOL allowNull)
+{
+    TPM_RC rc = 0;
+    if (rc == 0) {
+	rc = TSS_TPMI_ALG_PUBLIC_Unmarshal(&target->type, buffer, size);
+    }
+    if (rc == 0) {
+	rc = TSS_TPMI_ALG_HASH_Unmarshal(&target->nameAlg, buffer, size, allowNull);
+    }
+    if (rc == 0) {
+	rc = TSS_TPMA_OBJECT_Unmarshal(&target->objectAttributes, buffer, size);
+    }
+    if (rc == 0) {
+	rc = TSS_TPM2B_DIGEST_Unmarshal(&target->authPolicy, buffer, size);
+    }
+    if (rc == 0) {
+	rc = TSS_TPMU_PUBLIC_PARMS_Unmarshal(&target->parameters, buffer, size, target->type);
+    }
+    if (rc == 0) {
+	rc = TSS_TPMU_PUBLIC_ID_Unmarshal(&target->unique, buffer, size, target->type);
+    }
+    return rc;
+}
+
+/* Table 185 - Definition of TPM2B_PUBLIC Structure
+
+   The size must be nonzero and must match the TPMT_PUBLIC exactly.  The name algorithm may not be
+   TPM_ALG_NULL, since the object is to be imported. */
+
+TPM_RC
+TSS_TPM2B_PUBLIC_Unmarshal(TPM2B_PUBLIC *target, BYTE **buffer, INT32 *size)
+{
+    TPM_RC rc = 0;
+    INT32 startSize;
+
+    if (rc == 0) {
+	rc = TSS_UINT16_Unmarshal(&target->size, buffer, size);
+    }
+    if (rc == 0) {
+	if (target->size == 0) {
+	    rc = TPM_RC_SIZE;
+	}
+    }
+    if (rc == 0) {
+	startSize = *size;
+	rc = TSS_TPMT_PUBLIC_Unmarshal(&target->publicArea, buffer, size, NO);
+    }
+    if (rc == 0) {
+	if (target->size != (startSize - *size)) {
+	    rc = TPM_RC_SIZE;
+	}
+    }
+    return rc;
+}
+
+/* Table 187 - Definition of TPMU_SENSITIVE_COMPOSITE Union <IN/OUT, S> */
+
+TPM_RC
+TSS_TPMU_SENSITIVE_COMPOSITE_Unmarshal(TPMU_SENSITIVE_COMPOSITE *target, BYTE **buffer, INT32 *size, UINT32 selector)
+{
+    TPM_RC rc = 0;
+    switch (selector) {
+#ifdef TPM_ALG_RSA
+      case TPM_ALG_RSA:
+	if (rc == 0) {
+	    rc = TSS_TPM2B_PRIVATE_KEY_RSA_Unmarshal(&target->rsa, buffer, size);
+	}
+	break;
+#endif
+#ifdef TPM_ALG_ECC
+      case TPM_ALG_ECC:
+	if (rc == 0) {
+	    rc = TSS_TPM2B_ECC_PARAMETER_Unmarshal(&target->ecc, buffer, size);
+	}
+	break;
+#endif
+#ifdef TPM_ALG_KEYEDHASH
+      case TPM_ALG_KEYEDHASH:
+	if (rc == 0) {
+	    rc = TSS_TPM2B_SENSITIVE_DATA_Unmarshal(&target->bits, buffer, size);
+	}
+	break;
+#endif
+#ifdef TPM_ALG_SYMCIPHER
+      case TPM_ALG_SYMCIPHER:
+	if (rc == 0) {
+	    rc = TSS_TPM2B_SYM_KEY_Unmarshal(&target->sym, buffer, size);
+	}
+	break;
+#endif
+      default:
+	rc = TPM_RC_SELECTOR;
+    }
+    return rc;
+}
+
+/* Table 188 - Definition of TPMT_SENSITIVE Structure */
+
+TPM_RC
+TSS_TPMT_SENSITIVE_Unmarshal(TPMT_SENSITIVE *target, BYTE **buffer, INT32 *size)
+{
+    TPM_RC rc = 0;
+    if (rc == 0) {
+	rc = TSS_TPMI_ALG_PUBLIC_Unmarshal(&target->sensitiveType, buffer, size);
+    }
+    if (rc == 0) {
+	rc = TSS_TPM2B_AUTH_Unmarshal(&target->authValue, buffer, size);
+    }
+    if (rc == 0) {
+	rc = TSS_TPM2B_DIGEST_Unmarshal(&target->seedValue, buffer, size);
+    }
+    if (rc == 0) {
+	rc = TSS_TPMU_SENSITIVE_COMPOSITE_Unmarshal(&target->sensitive, buffer, size, target->sensitiveType);
+    }
+    return rc;
+}
+
+/* Table 189 - Definition of TPM2B_SENSITIVE Structure <IN/OUT>
+
+   The size must match the TPMT_SENSITIVE exactly. */
+
+TPM_RC
+TSS_TPM2B_SENSITIVE_Unmarshal(TPM2B_SENSITIVE *target, BYTE **buffer, INT32 *size)
+{
+    TPM_RC rc = 0;
+    INT32 startSize;
+
+    if (rc == 0) {
+	rc = TSS_UINT16_Unmarshal(&target->t.size, buffer, size);
+    }
+    if (rc == 0) {
+	if (target->t.size == 0) {
+	    rc = TPM_RC_SIZE;
+	}
+    }
+    if (rc == 0) {
+	startSize = *size;
+	rc = TSS_TPMT_SENSITIVE_Unmarshal(&target->t.sensitiveArea, buffer, size);
+    }
+    if (rc == 0) {
+	if (target->t.size != (startSize - *size)) {
+	    rc = TPM_RC_SIZE;
+	}
+    }
+    return rc;
+}
+
+/* Table 191 - Definition of TPM2B_PRIVATE Structure <IN/OUT, S> */
+
+TPM_RC
+TSS_TPM2B_PRIVATE_Unmarshal(TPM2B_PRIVATE *target, BYTE **buffer, INT32 *size)
+{
+    TPM_RC rc = 0;
+    if (rc == 0) {
+	rc = TSS_TPM2B_Unmarshal(&target->b, sizeof(target->t.buffer), buffer, size);
+    }
+    return rc;
+}
@@ -39,6 +39,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <errno.h>
 
@@ -54,6 +55,8 @@
 #include <tss2/tsserror.h>
 #include <tss2/tssprint.h>
 
+#include "pemtpmstats.h"
+
 #define TSS_ALLOC_MAX  0x10000  /* 64k bytes */
 
 extern int tssVerbose;
@@ -98,6 +101,10 @@ TPM_RC TSS_Malloc(unsigned char **buffer, uint32_t size)
             rc = TSS_RC_OUT_OF_MEMORY;
         }
     }
+    if (rc == 0) {
+	PEMTPM_STATS_COUNT(PEMTPM_STAT_MALLOC_CALLS, 1);
+	PEMTPM_STATS_COUNT(PEMTPM_STAT_MALLOC_BYTES, size);
+    }
     return rc;
 }
 
@@ -130,6 +137,85 @@ TPM_RC TSS_Realloc(unsigned char **buffer, uint32_t size)
     }
     if (rc == 0) {
 	*buffer = tmpptr;
+	PEMTPM_STATS_COUNT(PEMTPM_STAT_REALLOC_CALLS, 1);
+	PEMTPM_STATS_COUNT(PEMTPM_STAT_REALLOC_BYTES, size);
+    }
+    return rc;
+}
+
+/* TSS_ArrayMalloc() allocates a zeroed array of 'count' elements of 'size' bytes.
+
+   TSS_ALLOC_MAX bounds a buffer sized from a TPM structure.  The pemtpm arrays, such as the batch
+   job pool, the queues, the writer groups, the stamps, the cache scan and the container index, are
+   sized by the number of keys or by -j and -sync, and can legitimately exceed it.  The array
+   functions therefore only check that count * size does not overflow.
+*/
+
+TPM_RC TSS_ArrayMalloc(unsigned char **buffer, size_t count, size_t size)
+{
+    TPM_RC          rc = 0;
+
+    if (rc == 0) {
+        if (*buffer != NULL) {
+            if (tssVerbose)
+		printf("TSS_ArrayMalloc: Error (fatal), *buffer %p should be NULL before malloc\n",
+		       *buffer);
+            rc = TSS_RC_ALLOC_INPUT;
+        }
+    }
+    if (rc == 0) {
+        if ((count == 0) || (size == 0) || (count > SIZE_MAX / size)) {
+            if (tssVerbose) printf("TSS_ArrayMalloc: Error, bad size %lu * %lu\n",
+				   (unsigned long)count, (unsigned long)size);
+            rc = TSS_RC_MALLOC_SIZE;
+        }
+    }
+    if (rc == 0) {
+        *buffer = calloc(count, size);
+        if (*buffer == NULL) {
+            if (tssVerbose) printf("TSS_ArrayMalloc: Error allocating %lu * %lu bytes\n",
+				   (unsigned long)count, (unsigned long)size);
+            rc = TSS_RC_OUT_OF_MEMORY;
+        }
+    }
+    if (rc == 0) {
+	PEMTPM_STATS_COUNT(PEMTPM_STAT_MALLOC_CALLS, 1);
+	PEMTPM_STATS_COUNT(PEMTPM_STAT_MALLOC_BYTES, count * size);
+    }
+    return rc;
+}
+
+/* TSS_ArrayGrow() doubles an array of '*allocated' elements of 'size' bytes, starting at 1024
+   elements.  On error, the array and '*allocated' are unchanged.  See TSS_ArrayMalloc() for the
+   size limit.
+*/
+
+TPM_RC TSS_ArrayGrow(unsigned char **buffer, size_t *allocated, size_t size)
+{
+    TPM_RC          	rc = 0;
+    size_t		count = (*allocated == 0) ? 1024 : 2 * *allocated;
+    unsigned char 	*tmpptr;
+
+    if (rc == 0) {
+        if ((size == 0) || (count < *allocated) || (count > SIZE_MAX / size)) {
+            if (tssVerbose) printf("TSS_ArrayGrow: Error, bad size %lu * %lu\n",
+				   (unsigned long)count, (unsigned long)size);
+            rc = TSS_RC_MALLOC_SIZE;
+        }
+    }
+    if (rc == 0) {
+	tmpptr = realloc(*buffer, count * size);
+	if (tmpptr == NULL) {
+            if (tssVerbose) printf("TSS_ArrayGrow: Error reallocating %lu * %lu bytes\n",
+				   (unsigned long)count, (unsigned long)size);
+	    rc = TSS_RC_OUT_OF_MEMORY;
+	}
+    }
+    if (rc == 0) {
+	*buffer = tmpptr;
+	*allocated = count;
+	PEMTPM_STATS_COUNT(PEMTPM_STAT_REALLOC_CALLS, 1);
+	PEMTPM_STATS_COUNT(PEMTPM_STAT_REALLOC_BYTES, count * size);
     }
     return rc;
 }
@@ -156,7 +242,6 @@ TPM_RC TSS_Structure_Marshal(uint8_t		**buffer,	/* freed by caller */
     }
     if (rc == 0) {
 	rc = TSS_Malloc(buffer, *written);
-	printf("Size=%d\n", *written);
     }
     if (rc == 0) {
 	buffer1 = *buffer;
@@ -166,6 +251,34 @@ TPM_RC TSS_Structure_Marshal(uint8_t		**buffer,	/* freed by caller */
     return rc;
 }
 
+/* TSS_Structure_MarshalBuffer() is a single pass TSS_Structure_Marshal() into the caller's 'buffer'
+   of 'bufferSize' bytes.
+
+   It does not allocate.  It is intended for structures with a known maximum size, such as a
+   TPM2B_PUBLIC or TPM2B_PRIVATE, where a buffer of sizeof(structure) is always sufficient.
+   Returns TSS_RC_INSUFFICIENT_BUFFER if the buffer is too small.
+*/
+
+TPM_RC TSS_Structure_MarshalBuffer(uint8_t		*buffer,
+				   uint16_t		*written,
+				   uint32_t		bufferSize,
+				   void 		*structure,
+				   MarshalFunction_t 	marshalFunction)
+{
+    TPM_RC 	rc = 0;
+    uint8_t	*buffer1 = buffer;	/* for marshaling, moves pointer */
+    int32_t	size = bufferSize;
+
+    if (rc == 0) {
+	if (bufferSize > INT32_MAX) {
+	    size = INT32_MAX;
+	}
+	*written = 0;
+	rc = marshalFunction(structure, written, &buffer1, &size);
+    }
+    return rc;
+}
+
 /* TSS_TPM2B_Copy() copies source to target if the source fits the target size */
 
 TPM_RC TSS_TPM2B_Copy(TPM2B *target, TPM2B *source, uint16_t targetSize)
@@ -84,6 +84,10 @@
 // Switch added to support packed lists that leave out space assocaited with unimplemented commands. Comment this out to use linear lists.
 // NOTE:	if vendor specific commands are presnet, the associated list is always in compressed form.
 #define COMPRESSED_LISTS
+#ifndef TPM_TSS_MARSHAL_ALL
+// pemtpm: remove the comment on the following line, or define it on the command line, to compile every TSS_*_Marshal() function in tssmarshal.c. Otherwise only the functions that pemtpm reaches are compiled, and the union marshalers handle only RSA and ECC objects with the schemes that pemtpm and pemtpmmarshal.c use.
+// #define TPM_TSS_MARSHAL_ALL
+#endif
 // Set the alignment size for the crypto. It would be nice to set this according to macros automatically defined by the build environment, but that doesn't seem possible because there isn't any simple set for that. So, this is just a plugged value. Your compiler should complain if this alignment isn't possible.
 // NOTE:	this value can be set at the command line or just plugged in here.
 #ifdef CRYPTO_ALIGN_16
@@ -0,0 +1,210 @@
+/********************************************************************************/
+/*										*/
+/*		      PEM Keypair to TPM Structures Library			*/
+/*										*/
+/********************************************************************************/
+
+/* This is a public header.  It is the libpemtpm API.
+
+   The library converts a PEM keypair held in memory to the TPM2_Import objectPublic and duplicate
+   parameters, and reads those back.  The duplicate can optionally be wrapped with an inner
+   symmetric key, the encryptionKey parameter, and for a parent, which also produces the inSymSeed
+   parameter.  It can also marshal the complete TPM2_Import command, and find a key in a pemtpm
+   container held in memory.  It does no file I/O.
+
+   Errors are reported as a TPM_RC, either a TSS_RC_ value from tsserror.h or EXIT_FAILURE for an
+   OpenSSL failure.  If tssVerbose is nonzero, the default, the library also prints a trace of
+   errors to stdout.
+*/
+
+#ifndef PEMTPM_H
+#define PEMTPM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef TPM_TSS
+#define TPM_TSS
+#endif
+#include <tss2/TPM_Types.h>
+#include <tss2/tsserror.h>
+
+/* keyType, a signing key.  Otherwise the key is a decryption key. */
+#define TYPE_SI            5
+
+/* caller buffer sizes that are always sufficient for PEMTPM_ConvertPem() */
+#define PEMTPM_PUBLIC_BUFFER_MAX	(sizeof(TPM2B_PUBLIC))
+#define PEMTPM_PRIVATE_BUFFER_MAX	(sizeof(TPM2B_PRIVATE))
+
+/* a caller buffer size that is always sufficient for PEMTPM_MarshalImport(): the header, the
+   parent handle, the authorizationSize, one password session, and the parameters */
+#define PEMTPM_IMPORT_COMMAND_MAX	(10 + 4 + 4 + (4 + 2 + 1 + sizeof(TPM2B_AUTH)) +	\
+					 sizeof(TPM2B_DATA) + sizeof(TPM2B_PUBLIC) +	\
+					 sizeof(TPM2B_PRIVATE) + sizeof(TPM2B_ENCRYPTED_SECRET) + 6)
+
+/* pemtpm -stream output records.  A record is a one byte tag, a four byte big endian length, and
+   the value.  Each input key produces either a PUBLIC record followed by a PRIVATE record, or one
+   ERROR record holding the four byte big endian TPM_RC.  With -ipp, a SEED record follows the
+   PRIVATE record. */
+
+#define PEMTPM_RECORD_HEADER_SIZE	5
+#define PEMTPM_RECORD_PUBLIC		0x01	/* marshaled TPM2B_PUBLIC */
+#define PEMTPM_RECORD_PRIVATE		0x02	/* marshaled TPM2B_PRIVATE */
+#define PEMTPM_RECORD_ERROR		0x03	/* TPM_RC */
+#define PEMTPM_RECORD_SEED		0x04	/* TPM2_Import inSymSeed */
+
+/* pemtpm -serve requests use the same record framing.  A request is optional PARAMS and PASSWORD
+   records followed by a PEM record, and is answered with the records above.  PARAMS holds four
+   big endian uint16_t: algPublic, keyType, nalg and halg.  Omitted values are the server command
+   line values, and an omitted password is empty. */
+
+#define PEMTPM_RECORD_REQUEST_PARAMS	0x11
+#define PEMTPM_RECORD_REQUEST_PASSWORD	0x12
+#define PEMTPM_RECORD_REQUEST_PEM	0x13
+
+/* pemtpm -ocf container file, which holds the outputs of a whole batch.  Integers are big endian.
+
+	header	 8 byte magic, uint32_t version, uint32_t flags, 32 byte parent digest
+	records	 one for each converted key, in manifest order
+	index	 one entry for each record, a 32 byte key ID and the uint64_t offset of the record,
+		 sorted by key ID and then by offset
+	trailer	 uint64_t offset of the index, uint64_t number of entries, 8 byte index magic
+
+   The parent digest is the SHA-256 of the -ipp TPM2B_PUBLIC, and is zero without a parent.  A
+   record is a uint32_t length of the rest of the record, then:
+
+	source ID	uint16_t size and the bytes, the PEM file name in the manifest
+	Name		marshaled TPM2B_NAME
+	parameters	four uint16_t, algPublic, keyType, nalg and halg
+	objectPublic	marshaled TPM2B_PUBLIC
+	duplicate	marshaled TPM2B_PRIVATE
+	inSymSeed	marshaled TPM2B_ENCRYPTED_SECRET, empty without a parent
+
+   The key ID is the SHA-256 of the marshaled TPMT_PUBLIC, which is the Name digest when nalg is
+   SHA-256.  A reader maps the file and finds a key with PEMTPM_ContainerFind(). */
+
+#define PEMTPM_CONTAINER_MAGIC		"PEMTPMKC"
+#define PEMTPM_CONTAINER_INDEX_MAGIC	"PEMTPMIX"
+#define PEMTPM_CONTAINER_MAGIC_SIZE	8
+#define PEMTPM_CONTAINER_VERSION	1
+#define PEMTPM_CONTAINER_KEY_ID_SIZE	32
+#define PEMTPM_CONTAINER_HEADER_SIZE	(PEMTPM_CONTAINER_MAGIC_SIZE + 4 + 4 + 32)
+#define PEMTPM_CONTAINER_ENTRY_SIZE	(PEMTPM_CONTAINER_KEY_ID_SIZE + 8)
+#define PEMTPM_CONTAINER_TRAILER_SIZE	(8 + 8 + PEMTPM_CONTAINER_MAGIC_SIZE)
+
+/* header flags, the wrapping of every duplicate */
+#define PEMTPM_CONTAINER_INNER		0x00000001	/* -iek or -oek */
+#define PEMTPM_CONTAINER_OUTER		0x00000002	/* -ipp */
+
+/* one container record.  The buffers point into the container.  objectPublic and duplicate
+   include their size, so they are the bytes of the -opu and -opr files. */
+
+typedef struct {
+    uint32_t		flags;		/* of the container */
+    const uint8_t	*parentDigest;
+    const uint8_t	*sourceId;	/* not NUL terminated */
+    uint16_t		sourceIdSize;
+    const uint8_t	*name;
+    uint16_t		nameSize;
+    uint16_t		algPublic;
+    uint16_t		keyType;
+    uint16_t		nalg;
+    uint16_t		halg;
+    const uint8_t	*objectPublic;
+    uint32_t		objectPublicSize;
+    const uint8_t	*duplicate;
+    uint32_t		duplicateSize;
+    const uint8_t	*inSymSeed;	/* the secret bytes */
+    uint16_t		inSymSeedSize;
+} PEMTPM_CONTAINER_RECORD;
+
+/* a parsed TPM2_Import parent, see PEMTPM_Parent_Create() */
+typedef struct PEMTPM_PARENT PEMTPM_PARENT;
+
+/* a reusable inner wrapper cipher context, see PEMTPM_Cipher_Create() */
+typedef struct PEMTPM_CIPHER PEMTPM_CIPHER;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    extern int tssVerbose;
+
+    LIB_EXPORT
+    TPM_RC PEMTPM_ConvertPemToKeyPair(TPM2B_PUBLIC 		*objectPublic,
+				      TPM2B_PRIVATE 		*objectPrivate,
+				      TPMI_ALG_PUBLIC 		algPublic,
+				      int			keyType,
+				      TPMI_ALG_HASH 		nalg,
+				      TPMI_ALG_HASH		halg,
+				      const unsigned char 	*pemData,
+				      size_t 			pemLength,
+				      const char 		*password);
+    LIB_EXPORT
+    TPM_RC PEMTPM_ConvertPem(uint8_t 			*publicBuffer,
+			     uint16_t 			*publicSize,
+			     uint32_t 			publicBufferSize,
+			     uint8_t 			*privateBuffer,
+			     uint16_t 			*privateSize,
+			     uint32_t 			privateBufferSize,
+			     TPMI_ALG_PUBLIC 		algPublic,
+			     int			keyType,
+			     TPMI_ALG_HASH 		nalg,
+			     TPMI_ALG_HASH		halg,
+			     const unsigned char 	*pemData,
+			     size_t 			pemLength,
+			     const char 		*password);
+    LIB_EXPORT
+    TPM_RC PEMTPM_MarshalPublic(uint8_t 			*publicBuffer,
+				uint16_t 			*publicSize,
+				uint32_t 			publicBufferSize,
+				TPM2B_NAME 			*name,
+				const TPM2B_PUBLIC 		*objectPublic);
+    LIB_EXPORT
+    TPM_RC PEMTPM_MarshalImport(uint8_t 			*commandBuffer,
+				uint32_t 			*commandSize,
+				uint32_t 			commandBufferSize,
+				TPMI_DH_OBJECT 			parentHandle,
+				const TPM2B_AUTH 		*parentAuth,
+				const TPM2B_PUBLIC 		*objectPublic,
+				const TPM2B_PRIVATE 		*duplicate,
+				const TPM2B_ENCRYPTED_SECRET 	*inSymSeed,
+				const TPM2B_DATA 		*encryptionKey);
+    LIB_EXPORT
+    TPM_RC PEMTPM_Parent_Create(PEMTPM_PARENT 			**parent,
+				const uint8_t 			*publicBuffer,
+				uint32_t 			publicBufferSize);
+    LIB_EXPORT
+    void PEMTPM_Parent_Delete(PEMTPM_PARENT 			*parent);
+    LIB_EXPORT
+    TPM_RC PEMTPM_WrapDuplicate(TPM2B_PRIVATE 			*duplicate,
+				TPM2B_ENCRYPTED_SECRET 		*inSymSeed,
+				const PEMTPM_PARENT 		*parent,
+				const TPM2B_NAME 		*name);
+    LIB_EXPORT
+    TPM_RC PEMTPM_Cipher_Create(PEMTPM_CIPHER 			**cipher);
+    LIB_EXPORT
+    void PEMTPM_Cipher_Delete(PEMTPM_CIPHER 			*cipher);
+    LIB_EXPORT
+    TPM_RC PEMTPM_WrapInner(TPM2B_PRIVATE 			*duplicate,
+			    const TPM2B_DATA 			*encryptionKey,
+			    const TPM2B_NAME 			*name,
+			    PEMTPM_CIPHER 			*cipher);
+    LIB_EXPORT
+    TPM_RC PEMTPM_ReadKeyPair(TPM2B_PUBLIC 		*objectPublic,
+			      TPMT_SENSITIVE 		*objectSensitive,
+			      const uint8_t 		*publicBuffer,
+			      uint32_t 			publicBufferSize,
+			      const uint8_t 		*privateBuffer,
+			      uint32_t 			privateBufferSize);
+    LIB_EXPORT
+    TPM_RC PEMTPM_ContainerFind(PEMTPM_CONTAINER_RECORD 	*record,
+				const uint8_t 			*container,
+				size_t 				containerSize,
+				const uint8_t 			*keyId);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
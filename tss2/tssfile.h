@@ -66,6 +66,18 @@ LIB_EXPORT
 TPM_RC TSS_File_ReadBinaryFile(unsigned char **data,
 			       size_t *length,
 			       const char *filename); 
+LIB_EXPORT
+TPM_RC TSS_File_ReadBinaryFileBuffer(unsigned char *data,
+				     size_t *length,
+				     size_t dataSize,
+				     const char *filename);
+LIB_EXPORT
+TPM_RC TSS_File_MapFile(const unsigned char **data,
+			size_t *length,
+			const char *filename);
+LIB_EXPORT
+void TSS_File_UnmapFile(const unsigned char *data,
+			size_t length);
 LIB_EXPORT 
 TPM_RC TSS_File_WriteBinaryFile(const unsigned char *data,
 				size_t length,
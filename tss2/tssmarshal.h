@@ -60,36 +60,45 @@ TSS_Import_In_Marshal(const Import_In *source, UINT16 *written, BYTE **buffer, I
 
 LIB_EXPORT TPM_RC
 TSS_UINT8_Marshal(const UINT8 *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#ifdef TPM_TSS_MARSHAL_ALL
 LIB_EXPORT TPM_RC
 TSS_INT8_Marshal(const INT8 *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#endif
 LIB_EXPORT TPM_RC
 TSS_UINT16_Marshal(const UINT16 *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
 TSS_UINT32_Marshal(const UINT32 *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#ifdef TPM_TSS_MARSHAL_ALL
 LIB_EXPORT TPM_RC
 TSS_INT32_Marshal(const INT32 *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
 TSS_UINT64_Marshal(const UINT64 *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#endif
 LIB_EXPORT TPM_RC
 TSS_Array_Marshal(const BYTE *source, UINT16 sourceSize, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
 TSS_TPM2B_Marshal(const TPM2B *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
 TSS_TPM_KEY_BITS_Marshal(const TPM_KEY_BITS *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#ifdef TPM_TSS_MARSHAL_ALL
 LIB_EXPORT TPM_RC
 TSS_TPM_GENERATED_Marshal(const TPM_GENERATED *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#endif
 LIB_EXPORT TPM_RC
 TSS_TPM_ALG_ID_Marshal(const TPM_ALG_ID *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
 TSS_TPM_ECC_CURVE_Marshal(const TPM_ECC_CURVE *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#ifdef TPM_TSS_MARSHAL_ALL
 LIB_EXPORT TPM_RC
 TSS_TPM_RC_Marshal(const TPM_RC *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
 TSS_TPM_CLOCK_ADJUST_Marshal(const TPM_CLOCK_ADJUST *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
 TSS_TPM_EO_Marshal(const TPM_EO *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#endif
 LIB_EXPORT TPM_RC
 TSS_TPM_ST_Marshal(const TPM_ST *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#ifdef TPM_TSS_MARSHAL_ALL
 LIB_EXPORT TPM_RC
 TSS_TPM_SU_Marshal(const TPM_ST *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
@@ -100,32 +109,42 @@ LIB_EXPORT TPM_RC
 TSS_TPM_PT_Marshal(const TPM_PT *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
 TSS_TPM_PT_PCR_Marshal(const TPM_PT_PCR *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#endif
 LIB_EXPORT TPM_RC
 TSS_TPM_HANDLE_Marshal(const TPM_HANDLE *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#ifdef TPM_TSS_MARSHAL_ALL
 LIB_EXPORT TPM_RC
 TSS_TPMA_ALGORITHM_Marshal(const TPMA_ALGORITHM *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#endif
 LIB_EXPORT TPM_RC
 TSS_TPMA_OBJECT_Marshal(const TPMA_OBJECT *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
 TSS_TPMA_SESSION_Marshal(const TPMA_SESSION *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#ifdef TPM_TSS_MARSHAL_ALL
 LIB_EXPORT TPM_RC
 TSS_TPMA_LOCALITY_Marshal(const TPMA_LOCALITY *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#endif
 LIB_EXPORT TPM_RC
 TSS_TPM_CC_Marshal(const TPM_CC *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#ifdef TPM_TSS_MARSHAL_ALL
 LIB_EXPORT TPM_RC
 TSS_TPMA_CC_Marshal(const TPMA_CC *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
 TSS_TPMI_YES_NO_Marshal(const TPMI_YES_NO *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#endif
 LIB_EXPORT TPM_RC
 TSS_TPMI_DH_OBJECT_Marshal(const TPMI_DH_OBJECT *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#ifdef TPM_TSS_MARSHAL_ALL
 LIB_EXPORT TPM_RC
 TSS_TPMI_DH_PERSISTENT_Marshal(const TPMI_DH_PERSISTENT *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
 TSS_TPMI_DH_ENTITY_Marshal(const TPMI_DH_ENTITY *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
 TSS_TPMI_DH_PCR_Marshal(const TPMI_DH_PCR  *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#endif
 LIB_EXPORT TPM_RC
 TSS_TPMI_SH_AUTH_SESSION_Marshal(const TPMI_SH_AUTH_SESSION *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#ifdef TPM_TSS_MARSHAL_ALL
 LIB_EXPORT TPM_RC
 TSS_TPMI_SH_HMAC_Marshal(const TPMI_SH_HMAC *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
@@ -152,26 +171,33 @@ LIB_EXPORT TPM_RC
 TSS_TPMI_RH_LOCKOUT_Marshal(const TPMI_RH_LOCKOUT *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
 TSS_TPMI_RH_NV_INDEX_Marshal(const TPMI_RH_NV_INDEX *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#endif
 LIB_EXPORT TPM_RC
 TSS_TPMI_ALG_HASH_Marshal(const TPMI_ALG_HASH *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#ifdef TPM_TSS_MARSHAL_ALL
 LIB_EXPORT TPM_RC
 TSS_TPMI_ALG_SYM_Marshal(const TPMI_ALG_SYM *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#endif
 LIB_EXPORT TPM_RC
 TSS_TPMI_ALG_SYM_OBJECT_Marshal(const TPMI_ALG_SYM_OBJECT *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
 TSS_TPMI_ALG_SYM_MODE_Marshal(const TPMI_ALG_SYM_MODE *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
 TSS_TPMI_ALG_KDF_Marshal(const TPMI_ALG_KDF *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#ifdef TPM_TSS_MARSHAL_ALL
 LIB_EXPORT TPM_RC
 TSS_TPMI_ALG_SIG_SCHEME_Marshal(const TPMI_ALG_SIG_SCHEME *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
 TSS_TPMI_ECC_KEY_EXCHANGE_Marshal(const TPMI_ECC_KEY_EXCHANGE *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#endif
 LIB_EXPORT TPM_RC
 TSS_TPMI_ST_COMMAND_TAG_Marshal(const TPMI_ST_COMMAND_TAG *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#ifdef TPM_TSS_MARSHAL_ALL
 LIB_EXPORT TPM_RC
 TSS_TPMU_HA_Marshal(const TPMU_HA *source, UINT16 *written, BYTE **buffer, INT32 *size, UINT32 selector);
 LIB_EXPORT TPM_RC
 TSS_TPMT_HA_Marshal(const TPMT_HA *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#endif
 LIB_EXPORT TPM_RC
 TSS_TPM2B_DIGEST_Marshal(const TPM2B_DIGEST *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
@@ -180,6 +206,7 @@ LIB_EXPORT TPM_RC
 TSS_TPM2B_NONCE_Marshal(const TPM2B_NONCE *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
 TSS_TPM2B_AUTH_Marshal(const TPM2B_AUTH *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#ifdef TPM_TSS_MARSHAL_ALL
 LIB_EXPORT TPM_RC
 TSS_TPM2B_OPERAND_Marshal(const TPM2B_OPERAND *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
@@ -262,6 +289,7 @@ LIB_EXPORT TPM_RC
 TSS_TPMS_ATTEST_Marshal(const TPMS_ATTEST  *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
 TSS_TPM2B_ATTEST_Marshal(const TPM2B_ATTEST *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#endif
 LIB_EXPORT TPM_RC
 TSS_TPMS_AUTH_COMMAND_Marshal(const TPMS_AUTH_COMMAND *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
@@ -270,10 +298,13 @@ LIB_EXPORT TPM_RC
 TSS_TPMU_SYM_KEY_BITS_Marshal(const TPMU_SYM_KEY_BITS *source, UINT16 *written, BYTE **buffer, INT32 *size, UINT32 selector);
 LIB_EXPORT TPM_RC
 TSS_TPMU_SYM_MODE_Marshal(const TPMU_SYM_MODE *source, UINT16 *written, BYTE **buffer, INT32 *size, UINT32 selector);
+#ifdef TPM_TSS_MARSHAL_ALL
 LIB_EXPORT TPM_RC
 TSS_TPMT_SYM_DEF_Marshal(const TPMT_SYM_DEF *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#endif
 LIB_EXPORT TPM_RC
 TSS_TPMT_SYM_DEF_OBJECT_Marshal(const TPMT_SYM_DEF_OBJECT *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#ifdef TPM_TSS_MARSHAL_ALL
 LIB_EXPORT TPM_RC
 TSS_TPM2B_SYM_KEY_Marshal(const TPM2B_SYM_KEY *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
@@ -286,8 +317,10 @@ LIB_EXPORT TPM_RC
 TSS_TPMS_SENSITIVE_CREATE_Marshal(const TPMS_SENSITIVE_CREATE *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
 TSS_TPM2B_SENSITIVE_CREATE_Marshal(const TPM2B_SENSITIVE_CREATE  *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#endif
 LIB_EXPORT TPM_RC
 TSS_TPMS_SCHEME_HASH_Marshal(const TPMS_SCHEME_HASH *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#ifdef TPM_TSS_MARSHAL_ALL
 LIB_EXPORT TPM_RC
 TSS_TPMS_SCHEME_ECDAA_Marshal(const TPMS_SCHEME_ECDAA *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
@@ -300,6 +333,7 @@ LIB_EXPORT TPM_RC
 TSS_TPMU_SCHEME_KEYEDHASH_Marshal(const TPMU_SCHEME_KEYEDHASH *source, UINT16 *written, BYTE **buffer, INT32 *size, UINT32 selector);
 LIB_EXPORT TPM_RC
 TSS_TPMT_KEYEDHASH_SCHEME_Marshal(const TPMT_KEYEDHASH_SCHEME *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#endif
 LIB_EXPORT TPM_RC
 TSS_TPMS_SIG_SCHEME_RSASSA_Marshal(const TPMS_SIG_SCHEME_RSASSA *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
@@ -310,18 +344,21 @@ LIB_EXPORT TPM_RC
 TSS_TPMS_SIG_SCHEME_SM2_Marshal(const TPMS_SIG_SCHEME_SM2 *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
 TSS_TPMS_SIG_SCHEME_ECSCHNORR_Marshal(const TPMS_SIG_SCHEME_ECSCHNORR *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#ifdef TPM_TSS_MARSHAL_ALL
 LIB_EXPORT TPM_RC
 TSS_TPMS_SIG_SCHEME_ECDAA_Marshal(const TPMS_SIG_SCHEME_ECDAA *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
 TSS_TPMU_SIG_SCHEME_Marshal(const TPMU_SIG_SCHEME *source, UINT16 *written, BYTE **buffer, INT32 *size, UINT32 selector);
 LIB_EXPORT TPM_RC
 TSS_TPMT_SIG_SCHEME_Marshal(const TPMT_SIG_SCHEME *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#endif
 LIB_EXPORT TPM_RC
 TSS_TPMS_ENC_SCHEME_OAEP_Marshal(const TPMS_ENC_SCHEME_OAEP *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
 TSS_TPMS_ENC_SCHEME_RSAES_Marshal(const TPMS_ENC_SCHEME_RSAES *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
 TSS_TPMS_KEY_SCHEME_ECDH_Marshal(const TPMS_KEY_SCHEME_ECDH *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#ifdef TPM_TSS_MARSHAL_ALL
 LIB_EXPORT TPM_RC
 TSS_TPMS_KEY_SCHEME_ECMQV_Marshal(const TPMS_KEY_SCHEME_ECMQV *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
@@ -332,6 +369,7 @@ LIB_EXPORT TPM_RC
 TSS_TPMS_SCHEME_KDF2_Marshal(const TPMS_SCHEME_KDF2 *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
 TSS_TPMS_SCHEME_KDF1_SP800_108_Marshal(const TPMS_SCHEME_KDF1_SP800_108 *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#endif
 LIB_EXPORT TPM_RC
 TSS_TPMU_KDF_SCHEME_Marshal(const TPMU_KDF_SCHEME *source, UINT16 *written, BYTE **buffer, INT32 *size, UINT32 selector);
 LIB_EXPORT TPM_RC
@@ -342,10 +380,12 @@ LIB_EXPORT TPM_RC
 TSS_TPMI_ALG_RSA_SCHEME_Marshal(const TPMI_ALG_RSA_SCHEME *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
 TSS_TPMT_RSA_SCHEME_Marshal(const TPMT_RSA_SCHEME *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#ifdef TPM_TSS_MARSHAL_ALL
 LIB_EXPORT TPM_RC
 TSS_TPMI_ALG_RSA_DECRYPT_Marshal(const TPMI_ALG_RSA_DECRYPT *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
 TSS_TPMT_RSA_DECRYPT_Marshal(const TPMT_RSA_DECRYPT  *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#endif
 LIB_EXPORT TPM_RC
 TSS_TPM2B_PUBLIC_KEY_RSA_Marshal(const TPM2B_PUBLIC_KEY_RSA *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
@@ -356,14 +396,17 @@ LIB_EXPORT TPM_RC
 TSS_TPM2B_ECC_PARAMETER_Marshal(const TPM2B_ECC_PARAMETER *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
 TSS_TPMS_ECC_POINT_Marshal(const TPMS_ECC_POINT *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#ifdef TPM_TSS_MARSHAL_ALL
 LIB_EXPORT TPM_RC
 TSS_TPM2B_ECC_POINT_Marshal(const TPM2B_ECC_POINT *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#endif
 LIB_EXPORT TPM_RC
 TSS_TPMI_ALG_ECC_SCHEME_Marshal(const TPMI_ALG_ECC_SCHEME *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
 TSS_TPMI_ECC_CURVE_Marshal(const TPMI_ECC_CURVE *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
 TSS_TPMT_ECC_SCHEME_Marshal(const TPMT_ECC_SCHEME *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#ifdef TPM_TSS_MARSHAL_ALL
 LIB_EXPORT TPM_RC
 TSS_TPMS_ALGORITHM_DETAIL_ECC_Marshal(const TPMS_ALGORITHM_DETAIL_ECC *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
@@ -386,38 +429,50 @@ LIB_EXPORT TPM_RC
 TSS_TPMU_SIGNATURE_Marshal(const TPMU_SIGNATURE *source, UINT16 *written, BYTE **buffer, INT32 *size, UINT32 selector);
 LIB_EXPORT TPM_RC
 TSS_TPMT_SIGNATURE_Marshal(const TPMT_SIGNATURE *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#endif
 LIB_EXPORT TPM_RC
 TSS_TPM2B_ENCRYPTED_SECRET_Marshal(const TPM2B_ENCRYPTED_SECRET *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
 TSS_TPMI_ALG_PUBLIC_Marshal(const TPMI_ALG_PUBLIC *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
 TSS_TPMU_PUBLIC_ID_Marshal(const TPMU_PUBLIC_ID *source, UINT16 *written, BYTE **buffer, INT32 *size, UINT32 selector);
+#ifdef TPM_TSS_MARSHAL_ALL
 LIB_EXPORT TPM_RC
 TSS_TPMS_KEYEDHASH_PARMS_Marshal(const TPMS_KEYEDHASH_PARMS *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#endif
 LIB_EXPORT TPM_RC
 TSS_TPMS_RSA_PARMS_Marshal(const TPMS_RSA_PARMS *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
 TSS_TPMS_ECC_PARMS_Marshal(const TPMS_ECC_PARMS *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
 TSS_TPMU_PUBLIC_PARMS_Marshal(const TPMU_PUBLIC_PARMS *source, UINT16 *written, BYTE **buffer, INT32 *size, UINT32 selector);
+#ifdef TPM_TSS_MARSHAL_ALL
 LIB_EXPORT TPM_RC
 TSS_TPMT_PUBLIC_PARMS_Marshal(const TPMT_PUBLIC_PARMS *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#endif
 LIB_EXPORT TPM_RC
 TSS_TPMT_PUBLIC_Marshal(const TPMT_PUBLIC *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#ifdef TPM_TSS_MARSHAL_ALL
 LIB_EXPORT TPM_RC
 TSS_TPMT_PUBLIC_D_Marshal(const TPMT_PUBLIC *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#endif
 LIB_EXPORT TPM_RC
 TSS_TPM2B_PUBLIC_Marshal(const TPM2B_PUBLIC *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#ifdef TPM_TSS_MARSHAL_ALL
 LIB_EXPORT TPM_RC
 TSS_TPM2B_TEMPLATE_Marshal(const TPM2B_TEMPLATE *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#endif
 LIB_EXPORT TPM_RC
 TSS_TPMU_SENSITIVE_COMPOSITE_Marshal(const TPMU_SENSITIVE_COMPOSITE *source, UINT16 *written, BYTE **buffer, INT32 *size, UINT32 selector);
 LIB_EXPORT TPM_RC
 TSS_TPMT_SENSITIVE_Marshal(const TPMT_SENSITIVE *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#ifdef TPM_TSS_MARSHAL_ALL
 LIB_EXPORT TPM_RC
 TSS_TPM2B_SENSITIVE_Marshal(const TPM2B_SENSITIVE *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#endif
 LIB_EXPORT TPM_RC
 TSS_TPM2B_PRIVATE_Marshal(const TPM2B_PRIVATE *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#ifdef TPM_TSS_MARSHAL_ALL
 LIB_EXPORT TPM_RC
 TSS_TPM2B_ID_OBJECT_Marshal(const TPM2B_ID_OBJECT *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
@@ -436,5 +491,110 @@ LIB_EXPORT TPM_RC
 TSS_TPMS_CREATION_DATA_Marshal(const TPMS_CREATION_DATA *source, UINT16 *written, BYTE **buffer, INT32 *size);
 LIB_EXPORT TPM_RC
 TSS_TPM2B_CREATION_DATA_Marshal(const TPM2B_CREATION_DATA *source, UINT16 *written, BYTE **buffer, INT32 *size);
+#endif
+
+
+/* unmarshal */
+
+LIB_EXPORT TPM_RC
+TSS_UINT8_Unmarshal(UINT8 *target, BYTE **buffer, INT32 *size);
+LIB_EXPORT TPM_RC
+TSS_UINT16_Unmarshal(UINT16 *target, BYTE **buffer, INT32 *size);
+LIB_EXPORT TPM_RC
+TSS_UINT32_Unmarshal(UINT32 *target, BYTE **buffer, INT32 *size);
+LIB_EXPORT TPM_RC
+TSS_TPM2B_Unmarshal(TPM2B *target, UINT16 targetSize, BYTE **buffer, INT32 *size);
+LIB_EXPORT TPM_RC
+TSS_TPM_ALG_ID_Unmarshal(TPM_ALG_ID *target, BYTE **buffer, INT32 *size);
+LIB_EXPORT TPM_RC
+TSS_TPM_ECC_CURVE_Unmarshal(TPM_ECC_CURVE *target, BYTE **buffer, INT32 *size);
+LIB_EXPORT TPM_RC
+TSS_TPMA_OBJECT_Unmarshal(TPMA_OBJECT *target, BYTE **buffer, INT32 *size);
+LIB_EXPORT TPM_RC
+TSS_TPMI_ALG_HASH_Unmarshal(TPMI_ALG_HASH *target, BYTE **buffer, INT32 *size, BOOL allowNull);
+LIB_EXPORT TPM_RC
+TSS_TPMI_ALG_SYM_OBJECT_Unmarshal(TPMI_ALG_SYM_OBJECT *target, BYTE **buffer, INT32 *size, BOOL allowNull);
+LIB_EXPORT TPM_RC
+TSS_TPMI_ALG_SYM_MODE_Unmarshal(TPMI_ALG_SYM_MODE *target, BYTE **buffer, INT32 *size, BOOL allowNull);
+LIB_EXPORT TPM_RC
+TSS_TPMI_ALG_KDF_Unmarshal(TPMI_ALG_KDF *target, BYTE **buffer, INT32 *size, BOOL allowNull);
+LIB_EXPORT TPM_RC
+TSS_TPM2B_DIGEST_Unmarshal(TPM2B_DIGEST *target, BYTE **buffer, INT32 *size);
+LIB_EXPORT TPM_RC
+TSS_TPM2B_AUTH_Unmarshal(TPM2B_AUTH *target, BYTE **buffer, INT32 *size);
+LIB_EXPORT TPM_RC
+TSS_TPMU_SYM_KEY_BITS_Unmarshal(TPMU_SYM_KEY_BITS *target, BYTE **buffer, INT32 *size, UINT32 selector);
+LIB_EXPORT TPM_RC
+TSS_TPMU_SYM_MODE_Unmarshal(TPMU_SYM_MODE *target, BYTE **buffer, INT32 *size, UINT32 selector);
+LIB_EXPORT TPM_RC
+TSS_TPMT_SYM_DEF_OBJECT_Unmarshal(TPMT_SYM_DEF_OBJECT *target, BYTE **buffer, INT32 *size, BOOL allowNull);
+LIB_EXPORT TPM_RC
+TSS_TPM2B_SYM_KEY_Unmarshal(TPM2B_SYM_KEY *target, BYTE **buffer, INT32 *size);
+LIB_EXPORT TPM_RC
+TSS_TPMS_SYMCIPHER_PARMS_Unmarshal(TPMS_SYMCIPHER_PARMS *target, BYTE **buffer, INT32 *size);
+LIB_EXPORT TPM_RC
+TSS_TPM2B_SENSITIVE_DATA_Unmarshal(TPM2B_SENSITIVE_DATA *target, BYTE **buffer, INT32 *size);
+LIB_EXPORT TPM_RC
+TSS_TPMS_SCHEME_HASH_Unmarshal(TPMS_SCHEME_HASH *target, BYTE **buffer, INT32 *size);
+LIB_EXPORT TPM_RC
+TSS_TPMS_SCHEME_ECDAA_Unmarshal(TPMS_SCHEME_ECDAA *target, BYTE **buffer, INT32 *size);
+LIB_EXPORT TPM_RC
+TSS_TPMI_ALG_KEYEDHASH_SCHEME_Unmarshal(TPMI_ALG_KEYEDHASH_SCHEME *target, BYTE **buffer, INT32 *size, BOOL allowNull);
+LIB_EXPORT TPM_RC
+TSS_TPMS_SCHEME_XOR_Unmarshal(TPMS_SCHEME_XOR *target, BYTE **buffer, INT32 *size);
+LIB_EXPORT TPM_RC
+TSS_TPMU_SCHEME_KEYEDHASH_Unmarshal(TPMU_SCHEME_KEYEDHASH *target, BYTE **buffer, INT32 *size, UINT32 selector);
+LIB_EXPORT TPM_RC
+TSS_TPMT_KEYEDHASH_SCHEME_Unmarshal(TPMT_KEYEDHASH_SCHEME *target, BYTE **buffer, INT32 *size, BOOL allowNull);
+LIB_EXPORT TPM_RC
+TSS_TPMU_KDF_SCHEME_Unmarshal(TPMU_KDF_SCHEME *target, BYTE **buffer, INT32 *size, UINT32 selector);
+LIB_EXPORT TPM_RC
+TSS_TPMT_KDF_SCHEME_Unmarshal(TPMT_KDF_SCHEME *target, BYTE **buffer, INT32 *size, BOOL allowNull);
+LIB_EXPORT TPM_RC
+TSS_TPMU_ASYM_SCHEME_Unmarshal(TPMU_ASYM_SCHEME *target, BYTE **buffer, INT32 *size, UINT32 selector);
+LIB_EXPORT TPM_RC
+TSS_TPMI_ALG_RSA_SCHEME_Unmarshal(TPMI_ALG_RSA_SCHEME *target, BYTE **buffer, INT32 *size, BOOL allowNull);
+LIB_EXPORT TPM_RC
+TSS_TPMT_RSA_SCHEME_Unmarshal(TPMT_RSA_SCHEME *target, BYTE **buffer, INT32 *size, BOOL allowNull);
+LIB_EXPORT TPM_RC
+TSS_TPM2B_PUBLIC_KEY_RSA_Unmarshal(TPM2B_PUBLIC_KEY_RSA *target, BYTE **buffer, INT32 *size);
+LIB_EXPORT TPM_RC
+TSS_TPMI_RSA_KEY_BITS_Unmarshal(TPMI_RSA_KEY_BITS *target, BYTE **buffer, INT32 *size);
+LIB_EXPORT TPM_RC
+TSS_TPM2B_PRIVATE_KEY_RSA_Unmarshal(TPM2B_PRIVATE_KEY_RSA *target, BYTE **buffer, INT32 *size);
+LIB_EXPORT TPM_RC
+TSS_TPM2B_ECC_PARAMETER_Unmarshal(TPM2B_ECC_PARAMETER *target, BYTE **buffer, INT32 *size);
+LIB_EXPORT TPM_RC
+TSS_TPMS_ECC_POINT_Unmarshal(TPMS_ECC_POINT *target, BYTE **buffer, INT32 *size);
+LIB_EXPORT TPM_RC
+TSS_TPMI_ALG_ECC_SCHEME_Unmarshal(TPMI_ALG_ECC_SCHEME *target, BYTE **buffer, INT32 *size, BOOL allowNull);
+LIB_EXPORT TPM_RC
+TSS_TPMI_ECC_CURVE_Unmarshal(TPMI_ECC_CURVE *target, BYTE **buffer, INT32 *size);
+LIB_EXPORT TPM_RC
+TSS_TPMT_ECC_SCHEME_Unmarshal(TPMT_ECC_SCHEME *target, BYTE **buffer, INT32 *size, BOOL allowNull);
+LIB_EXPORT TPM_RC
+TSS_TPMI_ALG_PUBLIC_Unmarshal(TPMI_ALG_PUBLIC *target, BYTE **buffer, INT32 *size);
+LIB_EXPORT TPM_RC
+TSS_TPMU_PUBLIC_ID_Unmarshal(TPMU_PUBLIC_ID *target, BYTE **buffer, INT32 *size, UINT32 selector);
+LIB_EXPORT TPM_RC
+TSS_TPMS_KEYEDHASH_PARMS_Unmarshal(TPMS_KEYEDHASH_PARMS *target, BYTE **buffer, INT32 *size);
+LIB_EXPORT TPM_RC
+TSS_TPMS_RSA_PARMS_Unmarshal(TPMS_RSA_PARMS *target, BYTE **buffer, INT32 *size);
+LIB_EXPORT TPM_RC
+TSS_TPMS_ECC_PARMS_Unmarshal(TPMS_ECC_PARMS *target, BYTE **buffer, INT32 *size);
+LIB_EXPORT TPM_RC
+TSS_TPMU_PUBLIC_PARMS_Unmarshal(TPMU_PUBLIC_PARMS *target, BYTE **buffer, INT32 *size, UINT32 selector);
+LIB_EXPORT TPM_RC
+TSS_TPMT_PUBLIC_Unmarshal(TPMT_PUBLIC *target, BYTE **buffer, INT32 *size, BOOL allowNull);
+LIB_EXPORT TPM_RC
+TSS_TPM2B_PUBLIC_Unmarshal(TPM2B_PUBLIC *target, BYTE **buffer, INT32 *size);
+LIB_EXPORT TPM_RC
+TSS_TPMU_SENSITIVE_COMPOSITE_Unmarshal(TPMU_SENSITIVE_COMPOSITE *target, BYTE **buffer, INT32 *size, UINT32 selector);
+LIB_EXPORT TPM_RC
+TSS_TPMT_SENSITIVE_Unmarshal(TPMT_SENSITIVE *target, BYTE **buffer, INT32 *size);
+LIB_EXPORT TPM_RC
+TSS_TPM2B_SENSITIVE_Unmarshal(TPM2B_SENSITIVE *target, BYTE **buffer, INT32 *size);
+LIB_EXPORT TPM_RC
+TSS_TPM2B_PRIVATE_Unmarshal(TPM2B_PRIVATE *target, BYTE **buffer, INT32 *size);
 
 #endif
@@ -47,6 +47,7 @@
 #define TSSUTILS_H
 
 #include <stdio.h>
+#include <stddef.h>
 
 #ifndef TPM_TSS
 #define TPM_TSS
@@ -65,12 +66,22 @@ extern "C" {
     TPM_RC TSS_Malloc(unsigned char **buffer, uint32_t size);
     LIB_EXPORT
     TPM_RC TSS_Realloc(unsigned char **buffer, uint32_t size);
+    LIB_EXPORT
+    TPM_RC TSS_ArrayMalloc(unsigned char **buffer, size_t count, size_t size);
+    LIB_EXPORT
+    TPM_RC TSS_ArrayGrow(unsigned char **buffer, size_t *allocated, size_t size);
 
     LIB_EXPORT
     TPM_RC TSS_Structure_Marshal(uint8_t		**buffer,
 				 uint16_t		*written,
 				 void 		*structure,
 				 MarshalFunction_t 	marshalFunction);
+    LIB_EXPORT
+    TPM_RC TSS_Structure_MarshalBuffer(uint8_t		*buffer,
+				       uint16_t		*written,
+				       uint32_t		bufferSize,
+				       void 		*structure,
+				       MarshalFunction_t 	marshalFunction);
 
     LIB_EXPORT 
     TPM_RC TSS_TPM2B_Copy(TPM2B *target, TPM2B *source, uint16_t targetSize);